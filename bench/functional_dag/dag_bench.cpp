@@ -0,0 +1,297 @@
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ *
+ * Runs synthetic graphs built from parameters: `width` chains of `depth`
+ * nodes under one source, each node copying a `payload` of bytes and then
+ * spinning `cost` loop turns on it, single or multi threaded. Prints one
+ * JSON object per run with the frames per second, the percentiles of the
+ * frame latency and of the per-hop latency and queue wait, and the threads
+ * and allocations used, so runs on the same hardware can be compared across
+ * releases.
+ *
+ * Without arguments a matrix of shapes runs. Otherwise one run with
+ * --width=N --depth=N --payload=BYTES --cost=TURNS --frames=N
+ * --mode=single|multi --workers=N (0 for one per hardware thread).
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <functional_dag/filter_sys.hpp>
+#include <functional_dag/fn_dag_interface.hpp>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+atomic<uint64_t> g_allocations = 0;  // Calls to operator new so far
+}  // namespace
+
+// Counts every allocation of the process, so a run can report how many it
+// made per frame. Not inlined, so the compiler does not pair the new
+// expressions with free.
+[[gnu::noinline]] void *operator new(const size_t _size) {
+  g_allocations.fetch_add(1, memory_order_relaxed);
+  if (void *ptr = malloc(_size == 0 ? 1 : _size)) return ptr;
+  throw bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void *_ptr) noexcept { free(_ptr); }
+[[gnu::noinline]] void operator delete(void *_ptr, size_t) noexcept {
+  free(_ptr);
+}
+
+namespace {
+using payload = vector<uint8_t>;
+
+/** What one run looks like. */
+struct bench_options {
+  int width = 4;            // Chains under the source
+  int depth = 4;            // Nodes per chain
+  size_t payload = 64;      // Bytes every node copies
+  uint32_t cost = 100;      // Loop turns every node spins
+  int frames = 2000;        // Frames to push through
+  bool multi = true;        // Whether nodes run on the pool
+  uint32_t workers = 0;     // Workers of the pool, zero for one per core
+};
+
+/** Burns roughly _iterations loop turns on the payload to stand in for
+ * node work. */
+void spin(payload &_data, const uint32_t _iterations) {
+  if (_data.empty()) return;
+  uint64_t acc = _data.front();
+  for (uint32_t i = 0; i < _iterations; i++)
+    acc = acc * 6364136223846793005UL + 1;
+  _data.front() = static_cast<uint8_t>(acc);
+}
+
+/** A node that copies its input and works on the copy. */
+fn_dag::dag_node<payload, payload> *make_stage(const uint32_t _cost) {
+  function<unique_ptr<payload>(const payload *const)> fn =
+      [_cost](const payload *const _in) {
+        auto out = make_unique<payload>(*_in);
+        spin(*out, _cost);
+        return out;
+      };
+  return fn_dag::fn_call(fn);
+}
+
+/** How many threads the process runs right now.
+ * @return The count, or zero where it can't be told
+ */
+size_t thread_count() {
+  ifstream status("/proc/self/status");
+  string line;
+  while (getline(status, line))
+    if (line.starts_with("Threads:")) return stoul(line.substr(8));
+  return 0;
+}
+
+/** Adds up the histograms of many nodes.
+ * @param _into The sum so far
+ * @param _histogram What to add
+ */
+void merge(fn_dag::latency_histogram &_into,
+           const fn_dag::latency_histogram &_histogram) {
+  if (_histogram.count == 0) return;
+  if (_into.count == 0 || _histogram.shortest < _into.shortest)
+    _into.shortest = _histogram.shortest;
+  _into.longest = max(_into.longest, _histogram.longest);
+  _into.count += _histogram.count;
+  _into.total += _histogram.total;
+  _into.buckets.resize(_histogram.buckets.size(), 0);
+  for (size_t i = 0; i < _histogram.buckets.size(); i++)
+    _into.buckets[i] += _histogram.buckets[i];
+}
+
+/** Takes an earlier snapshot of a histogram out of it, bucket by bucket,
+ * e.g. to leave out the warm up.
+ *
+ * The snapshots do not say which durations were the shortest and longest,
+ * so those are narrowed down to the buckets that are left.
+ *
+ * @param _from The histogram
+ * @param _earlier The snapshot of it to take out
+ */
+void subtract(fn_dag::latency_histogram &_from,
+              const fn_dag::latency_histogram &_earlier) {
+  _from.count -= _earlier.count;
+  _from.total -= _earlier.total;
+  for (size_t i = 0; i < min(_from.buckets.size(), _earlier.buckets.size());
+       i++)
+    _from.buckets[i] -= _earlier.buckets[i];
+  const auto used = [](const uint64_t _in_bucket) { return _in_bucket != 0; };
+  const auto first = find_if(_from.buckets.begin(), _from.buckets.end(), used);
+  if (first == _from.buckets.end()) {
+    _from = {};
+    return;
+  }
+  const auto last = find_if(_from.buckets.rbegin(), _from.buckets.rend(), used);
+  _from.shortest = max(_from.shortest,
+                       chrono::nanoseconds(fn_dag::_latency_buckets::floor(
+                           first - _from.buckets.begin())));
+  _from.longest = min(_from.longest,
+                      chrono::nanoseconds(fn_dag::_latency_buckets::ceiling(
+                          _from.buckets.rend() - last - 1)));
+}
+
+/** Writes the percentiles of a histogram as a JSON object, in ns.
+ * @param _name The key of the object
+ * @param _histogram The histogram
+ */
+void write_percentiles(const string &_name,
+                       const fn_dag::latency_histogram &_histogram) {
+  cout << "\"" << _name << "\": {\"count\": " << _histogram.count
+       << ", \"mean\": " << _histogram.mean().count();
+  for (const double p : {50.0, 90.0, 99.0, 99.9})
+    cout << ", \"p" << p << "\": " << _histogram.percentile(p).count();
+  cout << ", \"max\": " << _histogram.longest.count() << "}";
+}
+
+void run(const bench_options &_options) {
+  const size_t threads_before = thread_count();
+  fn_dag::dag_manager<int> manager;
+  manager.run_single_threaded(!_options.multi);
+  manager.set_worker_count(_options.workers);
+  const size_t bytes = _options.payload;
+  function<unique_ptr<payload>()> source = [bytes]() {
+    return make_unique<payload>(bytes, uint8_t(1));
+  };
+  auto dag = manager.add_dag(0, fn_dag::fn_source(source), false);
+  if (!dag) return;
+  int next_id = 1;
+  for (int chain = 0; chain < _options.width; chain++) {
+    int parent = 0;
+    for (int hop = 0; hop < _options.depth; hop++) {
+      if (!manager.add_node(next_id, make_stage(_options.cost), parent)) {
+        cerr << "Failed to add node " << next_id << endl;
+        return;
+      }
+      parent = next_id++;
+    }
+  }
+
+  // Warms up the pool and the allocator before measuring
+  for (int i = 0; i < _options.frames / 10; i++) dag.value()->push_once();
+  const auto metrics_before = manager.get_metrics();
+
+  fn_dag::_latency_recorder frames;
+  const uint64_t allocations_before = g_allocations.load();
+  const auto start = chrono::steady_clock::now();
+  for (int i = 0; i < _options.frames; i++) {
+    const auto frame_start = chrono::steady_clock::now();
+    dag.value()->push_once();
+    frames.record(chrono::steady_clock::now() - frame_start);
+  }
+  const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  const uint64_t allocations = g_allocations.load() - allocations_before;
+  const size_t threads = thread_count();
+
+  fn_dag::latency_histogram hop_latency{};
+  fn_dag::latency_histogram hop_wait{};
+  for (auto &[id, metrics] : manager.get_metrics()) {
+    const auto warm_up = metrics_before.find(id);
+    if (id == 0 || warm_up == metrics_before.end()) continue;
+    subtract(metrics.latency, warm_up->second.latency);
+    subtract(metrics.queue_wait, warm_up->second.queue_wait);
+    merge(hop_latency, metrics.latency);
+    merge(hop_wait, metrics.queue_wait);
+  }
+
+  cout << "{\"bench\": \"dag\", \"mode\": \""
+       << (_options.multi ? "multi" : "single")
+       << "\", \"width\": " << _options.width
+       << ", \"depth\": " << _options.depth
+       << ", \"payload\": " << _options.payload
+       << ", \"node_cost\": " << _options.cost
+       << ", \"frames\": " << _options.frames
+       << ", \"workers\": " << manager.worker_count()
+       << ", \"threads\": " << threads
+       << ", \"threads_started\": "
+       << (threads >= threads_before ? threads - threads_before : 0)
+       << ", \"allocations_per_frame\": "
+       << static_cast<double>(allocations) / _options.frames
+       << ", \"fps\": " << _options.frames / elapsed.count() << ", ";
+  write_percentiles("frame_ns", frames.snapshot());
+  if constexpr (fn_dag::metrics_enabled) {
+    cout << ", ";
+    write_percentiles("hop_ns", hop_latency);
+    cout << ", ";
+    write_percentiles("hop_wait_ns", hop_wait);
+  }
+  cout << "}" << endl;
+}
+
+/** Reads --name=value arguments into the options.
+ * @return Whether every argument was understood
+ */
+bool parse(const int _argc, char **_argv, bench_options &_options) {
+  for (int i = 1; i < _argc; i++) {
+    const string_view arg(_argv[i]);
+    const size_t equals = arg.find('=');
+    if (!arg.starts_with("--") || equals == string_view::npos) return false;
+    const string_view name = arg.substr(2, equals - 2);
+    const string value(arg.substr(equals + 1));
+    if (name == "mode" && (value == "single" || value == "multi"))
+      _options.multi = value == "multi";
+    else if (name == "width")
+      _options.width = stoi(value);
+    else if (name == "depth")
+      _options.depth = stoi(value);
+    else if (name == "payload")
+      _options.payload = stoul(value);
+    else if (name == "cost")
+      _options.cost = static_cast<uint32_t>(stoul(value));
+    else if (name == "frames")
+      _options.frames = stoi(value);
+    else if (name == "workers")
+      _options.workers = static_cast<uint32_t>(stoul(value));
+    else
+      return false;
+  }
+  return true;
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    bench_options options;
+    if (!parse(argc, argv, options)) {
+      cerr << "usage: " << argv[0]
+           << " [--width=N] [--depth=N] [--payload=BYTES] [--cost=TURNS]"
+              " [--frames=N] [--mode=single|multi] [--workers=N]"
+           << endl;
+      return 1;
+    }
+    run(options);
+    return 0;
+  }
+
+  for (const bool multi : {false, true})
+    for (const auto &[width, depth] : {pair{1, 16}, pair{16, 1}, pair{8, 8}})
+      for (const size_t bytes : {size_t(64), size_t(64 * 1024)})
+        for (const uint32_t cost : {100U, 10000U})
+          run({.width = width,
+               .depth = depth,
+               .payload = bytes,
+               .cost = cost,
+               .frames = 1000,
+               .multi = multi,
+               .workers = 0});
+  return 0;
+}
@@ -0,0 +1,107 @@
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ *
+ * Compares the central-queue pool against the work-stealing pool on wide and
+ * deep synthetic graphs. Prints one JSON object per run.
+ */
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <functional_dag/filter_sys.hpp>
+#include <functional_dag/fn_dag_interface.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+namespace {
+/** Burns roughly _iterations loop turns to stand in for node work. */
+uint64_t spin(const uint64_t _seed, const uint32_t _iterations) {
+  volatile uint64_t acc = _seed;
+  for (uint32_t i = 0; i < _iterations; i++)
+    acc = acc * 6364136223846793005UL + 1;
+  return acc;
+}
+
+function<unique_ptr<uint64_t>(const uint64_t *const)> make_stage(
+    const uint32_t _cost) {
+  return [_cost](const uint64_t *const _in) {
+    return make_unique<uint64_t>(spin(*_in, _cost));
+  };
+}
+
+/** One source with _width leaves hanging directly off of it. */
+void build_wide(fn_dag::dag_manager<int> &_manager, const int _width,
+                const uint32_t _cost) {
+  for (int i = 0; i < _width; i++)
+    if (!_manager.add_node(i + 1, fn_dag::fn_call(make_stage(_cost)), 0))
+      cerr << "Failed to add node " << i + 1 << endl;
+}
+
+/** A binary tree of the given depth under the source. */
+void build_deep(fn_dag::dag_manager<int> &_manager, const int _depth,
+                const uint32_t _cost) {
+  int next_id = 1;
+  vector<int> level({0});
+  for (int d = 0; d < _depth; d++) {
+    vector<int> next_level;
+    for (int parent : level)
+      for (int b = 0; b < 2; b++) {
+        if (!_manager.add_node(next_id, fn_dag::fn_call(make_stage(_cost)),
+                               parent))
+          cerr << "Failed to add node " << next_id << endl;
+        next_level.push_back(next_id++);
+      }
+    level = next_level;
+  }
+}
+
+void run(const string &_shape, const fn_dag::executor_type _scheduler,
+         const int _size, const uint32_t _cost, const int _frames) {
+  fn_dag::dag_manager<int> manager;
+  manager.set_executor_type(_scheduler);
+  function<unique_ptr<uint64_t>()> source = []() {
+    return make_unique<uint64_t>(1);
+  };
+  auto dag = manager.add_dag(0, fn_dag::fn_source(source), false);
+  if (!dag) return;
+  if (_shape == "wide")
+    build_wide(manager, _size, _cost);
+  else
+    build_deep(manager, _size, _cost);
+
+  const auto start = chrono::steady_clock::now();
+  for (int i = 0; i < _frames; i++) dag.value()->push_once();
+  const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  cout << "{\"bench\": \"executor\", \"shape\": \"" << _shape
+       << "\", \"scheduler\": \""
+       << (_scheduler == fn_dag::executor_type::CENTRAL_QUEUE
+               ? "central_queue"
+               : "work_stealing")
+       << "\", \"size\": " << _size << ", \"node_cost\": " << _cost
+       << ", \"workers\": " << manager.worker_count()
+       << ", \"frames\": " << _frames
+       << ", \"fps\": " << _frames / elapsed.count() << "}" << endl;
+}
+}  // namespace
+
+int main() {
+  const int frames = 2000;
+  for (auto scheduler : {fn_dag::executor_type::CENTRAL_QUEUE,
+                         fn_dag::executor_type::WORK_STEALING}) {
+    for (uint32_t cost : {100U, 10000U}) {
+      run("wide", scheduler, 64, cost, frames);
+      run("deep", scheduler, 6, cost, frames);
+    }
+  }
+  return 0;
+}
\ No newline at end of file
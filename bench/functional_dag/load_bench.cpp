@@ -0,0 +1,159 @@
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ *
+ * Times how long library::fsys_deserialize takes to load JSON specs of 10k to
+ * 100k nodes. The nodes are listed children first, so every node comes
+ * before the node it is wired to and the whole order has to be worked out.
+ * Prints one JSON object per spec, where the time per node should stay flat
+ * as the specs grow.
+ *
+ * Then it stresses loading from many threads at once, which all share the
+ * library and its parsers. Every load is checked, and one JSON object per
+ * thread count has the loads per second and how many loads failed.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <functional_dag/dag_interface.hpp>
+#include <functional_dag/filter_sys.hpp>
+#include <functional_dag/guid_impl.hpp>
+#include <functional_dag/lib_spec_generated.h>
+#include <functional_dag/libutils.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+class bench_source : public fn_dag::dag_source<int> {
+ public:
+  unique_ptr<int> update() { return make_unique<int>(0); }
+};
+
+class bench_relay : public fn_dag::dag_node<int, int> {
+ public:
+  unique_ptr<int> update(const int *const _in) {
+    return make_unique<int>(*_in);
+  }
+};
+
+bool construct_source(fn_dag::dag_manager<string> &_manager,
+                      const fn_dag::node_spec &_spec) {
+  return _manager.add_dag(_spec.name()->str(), new bench_source(), false)
+      .has_value();
+}
+
+bool construct_relay(fn_dag::dag_manager<string> &_manager,
+                     const fn_dag::node_spec &_spec) {
+  return _manager
+      .add_node(_spec.name()->str(), new bench_relay(),
+                _spec.wires()->Get(0)->value()->str())
+      .has_value();
+}
+
+/** Builds sources with the ID {1, 1} and relays with the ID {1, 2}. */
+class bench_library : public fn_dag::library {
+ public:
+  bench_library() : fn_dag::library() {
+    using guid = fn_dag::GUID<fn_dag::node_spec>;
+    m_constructors[guid(fn_dag::GUID_vals(1, 1))] =
+        function<fn_dag::construction_signature>(&construct_source);
+    m_constructors[guid(fn_dag::GUID_vals(1, 2))] =
+        function<fn_dag::construction_signature>(&construct_relay);
+  }
+};
+
+/** Writes a spec of one source, "n0", and _nodes relays, where relay i is
+ * wired to the node _parent(i) returns. The relays are listed last first.
+ */
+string make_spec(const int _nodes, const function<int(int)> &_parent) {
+  string json = "{sources: [{name: \"n0\", target_id: {bits1: 1, bits2: 1}, "
+                "wires: [], options: []}], nodes: [";
+  for (int id = _nodes; id >= 1; id--) {
+    json += "{name: \"n" + to_string(id) +
+            "\", target_id: {bits1: 1, bits2: 2}, wires: [{key: \"in\", "
+            "value: \"n" +
+            to_string(_parent(id)) + "\"}], options: []},";
+  }
+  return json + "]}";
+}
+
+void run(const string &_shape, const int _nodes,
+         const function<int(int)> &_parent) {
+  const string json = make_spec(_nodes, _parent);
+  bench_library library;
+  constexpr int repeats = 3;
+  double fastest = 0;
+  for (int i = 0; i < repeats; i++) {
+    const auto start = chrono::steady_clock::now();
+    auto manager = library.fsys_deserialize(json, true, cerr);
+    const chrono::duration<double, milli> elapsed =
+        chrono::steady_clock::now() - start;
+    if (!manager) {
+      cerr << "Failed to load the " << _shape << " spec" << endl;
+      return;
+    }
+    delete manager.value();
+    fastest = i == 0 ? elapsed.count() : min(fastest, elapsed.count());
+  }
+  cout << "{\"bench\": \"load\", \"shape\": \"" << _shape
+       << "\", \"nodes\": " << _nodes << ", \"json_bytes\": " << json.size()
+       << ", \"load_ms\": " << fastest
+       << ", \"load_us_per_node\": " << fastest * 1000 / _nodes << "}"
+       << endl;
+}
+
+/** Loads the same spec over and over from many threads at once.
+ *
+ * @param _threads How many threads load at once
+ * @param _loads How many loads every thread does
+ * @param _nodes How many nodes the spec has
+ */
+void run_threads(const int _threads, const int _loads, const int _nodes) {
+  const string json = make_spec(_nodes, [](int _id) { return (_id - 1) / 4; });
+  const string last = "n" + to_string(_nodes);
+  bench_library library;
+  atomic<int> failed = 0;
+  const auto start = chrono::steady_clock::now();
+  vector<thread> loaders;
+  for (int t = 0; t < _threads; t++) {
+    loaders.emplace_back([&]() {
+      for (int i = 0; i < _loads; i++) {
+        auto manager = library.fsys_deserialize(json, true, cerr);
+        if (!manager || !manager.value()->manager_contains_id(last)) failed++;
+        if (manager) delete manager.value();
+      }
+    });
+  }
+  for (auto &loader : loaders) loader.join();
+  const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << "{\"bench\": \"load_threads\", \"threads\": " << _threads
+       << ", \"nodes\": " << _nodes << ", \"loads\": " << _threads * _loads
+       << ", \"failed\": " << failed.load()
+       << ", \"loads_per_s\": " << _threads * _loads / elapsed.count() << "}"
+       << endl;
+}
+}  // namespace
+
+int main() {
+  for (const int nodes : {10000, 30000, 100000}) {
+    // Every node straight under the source
+    run("wide", nodes, [](int) { return 0; });
+    // Every node has 4 children
+    run("tree", nodes, [](int _id) { return (_id - 1) / 4; });
+  }
+  for (const int threads : {1, 4, 16, 64}) run_threads(threads, 20, 1000);
+  return 0;
+}
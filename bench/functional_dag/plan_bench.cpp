@@ -0,0 +1,108 @@
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ *
+ * Compares a dag walked as a tree against the same dag frozen into a flat
+ * execution plan, on graphs of 10k cheap nodes in a few shapes. Both run
+ * single threaded so only the cost of getting from node to node is
+ * measured. Prints one JSON object per shape.
+ */
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <functional_dag/filter_sys.hpp>
+#include <functional_dag/fn_dag_interface.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+namespace {
+constexpr int k_nodes = 10000;  // Nodes in every graph
+
+/** A cheap node, so the time goes to the hops between nodes. */
+fn_dag::dag_node<uint64_t, uint64_t> *make_stage() {
+  function<unique_ptr<uint64_t>(const uint64_t *const)> fn =
+      [](const uint64_t *const _in) { return make_unique<uint64_t>(*_in + 1); };
+  return fn_dag::fn_call(fn);
+}
+
+/** Builds a graph of k_nodes nodes under the source, node i under the node
+ * _parent(i) returns, where 0 is the source.
+ *
+ * @return Whether every node was added
+ */
+bool build(fn_dag::dag_manager<int> &_manager,
+           const function<int(int)> &_parent) {
+  for (int id = 1; id <= k_nodes; id++)
+    if (!_manager.add_node(id, make_stage(), _parent(id))) return false;
+  return true;
+}
+
+/** Times frames through one graph.
+ *
+ * @param _parent Where each node goes, see build
+ * @param _frozen Whether to freeze the dag first
+ * @param _frames How many frames to time
+ * @param _stats Set to what the plan looks like when frozen
+ * @return How long a frame took, on average, in ns
+ */
+double time_frames(const function<int(int)> &_parent, const bool _frozen,
+                   const int _frames, fn_dag::plan_stats &_stats) {
+  fn_dag::dag_manager<int> manager;
+  manager.run_single_threaded(true);
+  uint64_t next = 0;
+  function<unique_ptr<uint64_t>()> source = [&next]() {
+    return make_unique<uint64_t>(next++);
+  };
+  auto dag = manager.add_dag(0, fn_dag::fn_source(source), false);
+  if (!dag || !build(manager, _parent)) {
+    cerr << "Failed to build the dag" << endl;
+    return 0;
+  }
+  if (_frozen) _stats = manager.freeze(0).value();
+
+  // Warms up the allocator before measuring
+  for (int i = 0; i < _frames / 10 + 1; i++) dag.value()->push_once();
+  const auto start = chrono::steady_clock::now();
+  for (int i = 0; i < _frames; i++) dag.value()->push_once();
+  const chrono::duration<double, nano> elapsed =
+      chrono::steady_clock::now() - start;
+  return elapsed.count() / _frames;
+}
+
+void run(const string &_shape, const function<int(int)> &_parent,
+         const int _frames) {
+  fn_dag::plan_stats stats{};
+  const double walked = time_frames(_parent, false, _frames, stats);
+  const double frozen = time_frames(_parent, true, _frames, stats);
+  cout << "{\"bench\": \"plan\", \"shape\": \"" << _shape
+       << "\", \"nodes\": " << stats.nodes << ", \"levels\": " << stats.levels
+       << ", \"widest\": " << stats.widest << ", \"frames\": " << _frames
+       << ", \"walked_ns_per_frame\": " << walked
+       << ", \"frozen_ns_per_frame\": " << frozen
+       << ", \"walked_ns_per_node\": " << walked / k_nodes
+       << ", \"frozen_ns_per_node\": " << frozen / k_nodes
+       << ", \"speedup\": " << walked / frozen << "}" << endl;
+}
+}  // namespace
+
+int main() {
+  const int frames = 200;
+  // Every node straight under the source
+  run("wide", [](int) { return 0; }, frames);
+  // 100 chains of 100 nodes
+  run("grid", [](int _id) { return _id <= 100 ? 0 : _id - 100; }, frames);
+  // Every node has 4 children
+  run("tree", [](int _id) { return (_id - 1) / 4; }, frames);
+  // One chain of all the nodes, where the walk recurses the deepest
+  run("chain", [](int _id) { return _id - 1; }, frames);
+  return 0;
+}
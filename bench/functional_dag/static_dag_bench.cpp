@@ -0,0 +1,118 @@
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ *
+ * Compares a static_dag against the same chain of cheap stages built as a
+ * dynamic dag. Both run single threaded so only the cost of the hops is
+ * measured. Prints one JSON object per run.
+ */
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <functional_dag/filter_sys.hpp>
+#include <functional_dag/fn_dag_interface.hpp>
+#include <functional_dag/static_dag.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+namespace {
+uint64_t g_next = 0;            // What the source outputs next
+volatile double g_celsius = 0;  // Where one branch ends
+volatile double g_kelvin = 0;   // Where the other branch ends
+
+// A unit conversion chain: raw ADC counts to millivolts to degrees
+constexpr auto raw_source = []() { return g_next++; };
+constexpr auto to_millivolts = [](const uint64_t &_raw) {
+  return static_cast<double>(_raw & 0xfff) * 0.805664;
+};
+constexpr auto to_fahrenheit = [](const double &_mv) { return _mv * 0.1; };
+constexpr auto to_celsius = [](const double &_f) {
+  g_celsius = (_f - 32.0) * 5.0 / 9.0;
+};
+constexpr auto to_kelvin = [](const double &_f) {
+  g_kelvin = (_f - 32.0) * 5.0 / 9.0 + 273.15;
+};
+
+using static_chain =
+    fn_dag::static_dag<raw_source, fn_dag::then<to_millivolts>,
+                       fn_dag::then<to_fahrenheit>,
+                       fn_dag::fanout<to_celsius, to_kelvin>>;
+
+/** Wraps a stage of the static chain for the dynamic dag. */
+template <typename In, typename Out, typename F>
+fn_dag::dag_node<In, Out> *dynamic_stage(const F _stage) {
+  function<unique_ptr<Out>(const In *const)> fn =
+      [_stage](const In *const _in) { return make_unique<Out>(_stage(*_in)); };
+  return fn_dag::fn_call(fn);
+}
+
+/** Wraps a branch end of the static chain for the dynamic dag. */
+template <typename F>
+fn_dag::dag_node<double, double> *dynamic_sink(const F _sink) {
+  function<unique_ptr<double>(const double *const)> fn =
+      [_sink](const double *const _in) {
+        _sink(*_in);
+        return unique_ptr<double>();
+      };
+  return fn_dag::fn_call(fn);
+}
+
+void report(const string &_kind, const uint64_t _frames,
+            const chrono::duration<double> _elapsed) {
+  cout << "{\"bench\": \"static_dag\", \"kind\": \"" << _kind
+       << "\", \"frames\": " << _frames
+       << ", \"ns_per_frame\": " << _elapsed.count() * 1e9 / _frames
+       << ", \"fps\": " << _frames / _elapsed.count() << "}" << endl;
+}
+
+void run_static(const uint64_t _frames) {
+  fn_dag::dag_manager<int> manager;
+  manager.run_single_threaded(true);
+  auto dag = manager.add_static_dag<static_chain>(0, false);
+  if (!dag) {
+    cerr << "Failed to add the static dag" << endl;
+    return;
+  }
+
+  const auto start = chrono::steady_clock::now();
+  for (uint64_t i = 0; i < _frames; i++) dag.value()->push_once();
+  report("static", _frames, chrono::steady_clock::now() - start);
+}
+
+void run_dynamic(const uint64_t _frames) {
+  fn_dag::dag_manager<int> manager;
+  manager.run_single_threaded(true);
+  function<unique_ptr<uint64_t>()> source = []() {
+    return make_unique<uint64_t>(raw_source());
+  };
+  auto dag = manager.add_dag(0, fn_dag::fn_source(source), false);
+  if (!dag ||
+      !manager.add_node(1, dynamic_stage<uint64_t, double>(to_millivolts), 0) ||
+      !manager.add_node(2, dynamic_stage<double, double>(to_fahrenheit), 1) ||
+      !manager.add_node(3, dynamic_sink(to_celsius), 2) ||
+      !manager.add_node(4, dynamic_sink(to_kelvin), 2)) {
+    cerr << "Failed to build the dynamic dag" << endl;
+    return;
+  }
+
+  const auto start = chrono::steady_clock::now();
+  for (uint64_t i = 0; i < _frames; i++) dag.value()->push_once();
+  report("dynamic", _frames, chrono::steady_clock::now() - start);
+}
+}  // namespace
+
+int main() {
+  const uint64_t frames = 1000000;
+  run_static(frames);
+  run_dynamic(frames);
+  return 0;
+}
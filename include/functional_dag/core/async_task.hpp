@@ -0,0 +1,238 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "functional_dag/core/executor.hpp"
+
+namespace fn_dag {
+using namespace std;
+
+template <typename T>
+class task;
+
+/** What the coroutine of a task keeps besides its result: who to resume
+ * when it is done, and what it threw. */
+class _task_promise_base {
+ private:
+  coroutine_handle<> m_continuation;  // The awaiting coroutine, if any
+  function<void()> m_on_done;  // Called when done if nobody awaits the task
+  exception_ptr m_error;       // What the coroutine threw, if anything
+
+ public:
+  /** Hands control back to the awaiting coroutine once the task is done. */
+  struct _final_awaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    coroutine_handle<> await_suspend(
+        coroutine_handle<Promise> _done) const noexcept {
+      _task_promise_base &promise = _done.promise();
+      if (promise.m_continuation) return promise.m_continuation;
+      // Moved out first, since it may destroy the coroutine
+      if (function<void()> on_done = std::move(promise.m_on_done)) on_done();
+      return noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  /** Tasks are lazy: they start when awaited. */
+  suspend_always initial_suspend() const noexcept { return {}; }
+
+  /** Resumes the awaiting coroutine without growing the stack. */
+  _final_awaiter final_suspend() const noexcept { return {}; }
+
+  /** Keeps the exception for the awaiting coroutine. */
+  void unhandled_exception() noexcept { m_error = current_exception(); }
+
+  /** Sets who to resume when the task is done.
+   * @param _continuation The awaiting coroutine
+   */
+  void set_continuation(const coroutine_handle<> _continuation) {
+    m_continuation = _continuation;
+  }
+
+  /** Sets what to call when the task is done and nobody awaits it.
+   * @param _on_done Called once. It may destroy the coroutine.
+   */
+  void set_on_done(function<void()> _on_done) {
+    m_on_done = std::move(_on_done);
+  }
+
+  /** Passes on what the coroutine threw, if anything. */
+  void rethrow_if_failed() const {
+    if (m_error) rethrow_exception(m_error);
+  }
+};
+
+/** The promise of a task with a result. */
+template <typename T>
+class _task_promise : public _task_promise_base {
+ private:
+  optional<T> m_value;  // The result once the coroutine returned
+
+ public:
+  task<T> get_return_object() {
+    return task<T>(coroutine_handle<_task_promise>::from_promise(*this));
+  }
+
+  void return_value(T _value) { m_value.emplace(std::move(_value)); }
+
+  /** Moves the result out.
+   * @return What the coroutine returned. Throws what it threw instead.
+   */
+  T take() {
+    rethrow_if_failed();
+    return std::move(*m_value);
+  }
+};
+
+/** The promise of a task without a result. */
+template <>
+class _task_promise<void> : public _task_promise_base {
+ public:
+  task<void> get_return_object();
+
+  void return_void() const noexcept {}
+
+  /** Throws what the coroutine threw, if anything. */
+  void take() const { rethrow_if_failed(); }
+};
+
+/** A coroutine that produces a T, e.g. the update of a dag_async_node.
+ *
+ * The coroutine starts when the task is awaited and resumes the awaiting
+ * coroutine once it returns, which then gets the result or the exception it
+ * threw. A task can be awaited once.
+ */
+template <typename T>
+class task {
+ public:
+  using promise_type = _task_promise<T>;
+
+ private:
+  coroutine_handle<promise_type> m_handle;  // The coroutine, if any
+
+ public:
+  /** Takes over a coroutine. Used by its promise.
+   * @param _handle The coroutine
+   */
+  explicit task(const coroutine_handle<promise_type> _handle)
+      : m_handle(_handle) {}
+
+  task(task &&_other) noexcept : m_handle(exchange(_other.m_handle, {})) {}
+
+  task &operator=(task &&_other) noexcept {
+    if (this != &_other) {
+      if (m_handle) m_handle.destroy();
+      m_handle = exchange(_other.m_handle, {});
+    }
+    return *this;
+  }
+
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+
+  /** Frees the coroutine. */
+  ~task() {
+    if (m_handle) m_handle.destroy();
+  }
+
+  /** A task always has to run first. */
+  bool await_ready() const noexcept { return false; }
+
+  /** Starts the coroutine, which resumes the awaiting one when done.
+   * @param _awaiting The coroutine awaiting the task
+   * @return The coroutine to run now
+   */
+  coroutine_handle<> await_suspend(const coroutine_handle<> _awaiting) {
+    m_handle.promise().set_continuation(_awaiting);
+    return m_handle;
+  }
+
+  /** The result of the coroutine.
+   * @return What it returned. Throws what it threw instead.
+   */
+  T await_resume() { return m_handle.promise().take(); }
+
+  /** Gives up the coroutine, e.g. to run it without awaiting it.
+   * @return The coroutine. The caller has to destroy it.
+   */
+  coroutine_handle<promise_type> release() { return exchange(m_handle, {}); }
+};
+
+inline task<void> _task_promise<void>::get_return_object() {
+  return task<void>(coroutine_handle<_task_promise>::from_promise(*this));
+}
+
+/** Runs a task without waiting for it.
+ *
+ * The task runs on the calling thread until it first suspends, then on
+ * whichever thread resumes it. The task is freed before the callback is
+ * called, so the callback may free what the task used. What the task throws
+ * ends the process, like an exception thrown by the update of a node on a
+ * worker.
+ *
+ * @param _task The task to run
+ * @param _done Called with the result once the task returned
+ */
+template <typename T, typename Done>
+void _spawn(task<T> _task, Done _done) {
+  const auto handle = _task.release();
+  handle.promise().set_on_done(
+      [handle, done = std::move(_done)]() mutable noexcept {
+        T result = handle.promise().take();
+        handle.destroy();
+        done(std::move(result));
+      });
+  handle.resume();
+}
+
+/** Runs a task to completion on the calling thread.
+ *
+ * The calling thread blocks while the task waits on I/O or timers, so only
+ * call it where blocking is fine. Waits in the task resume on the reactor's
+ * thread rather than on a pool, which may be the very pool blocked here.
+ *
+ * @param _task The task to run
+ * @return What the task returned. Throws what it threw instead.
+ */
+template <typename T>
+T sync_wait(task<T> _task) {
+  mutex done_mutex;
+  condition_variable done;
+  bool finished = false;
+  const auto handle = _task.release();
+  handle.promise().set_on_done([&done_mutex, &done, &finished]() {
+    lock_guard<mutex> lock(done_mutex);
+    finished = true;
+    done.notify_all();
+  });
+  {
+    _executor_scope on_reactor(nullptr);
+    handle.resume();
+  }
+  {
+    unique_lock<mutex> lock(done_mutex);
+    done.wait(lock, [&finished]() { return finished; });
+  }
+  // Freed here, once the task has let go of the lock
+  task<T> owner(handle);
+  return owner.await_resume();
+}
+}  // namespace fn_dag
@@ -0,0 +1,139 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace fn_dag {
+using namespace std;
+
+/** A bounded, lock-free, multi-producer multi-consumer queue.
+ *
+ * This is the classic ring of sequenced cells: every cell carries a sequence
+ * number that tells producers and consumers whose turn it is, so no locks are
+ * taken and the positions are only ever advanced with a CAS. It is used for
+ * the edges between nodes, which usually have a single producer and a single
+ * consumer, but fan-in edges may have several producers.
+ *
+ * The capacity is rounded up to the next power of two, and to at least two
+ * since a single cell cannot tell a full ring from an empty one.
+ */
+template <typename T>
+class _bounded_queue {
+ private:
+  /** A slot of the ring and the turn it is on. */
+  struct _cell {
+    atomic<size_t> m_sequence;  // Whose turn it is to use the cell
+    T m_value;                  // The stored element
+  };
+
+  const size_t m_mask;                   // Capacity - 1
+  unique_ptr<_cell[]> m_cells;           // The ring itself
+  alignas(64) atomic<size_t> m_enqueue;  // The next position to write
+  alignas(64) atomic<size_t> m_dequeue;  // The next position to read
+
+  /** Rounds up to the next power of two (and to at least two). */
+  static size_t round_up(size_t _capacity) {
+    size_t rounded = 2;
+    while (rounded < _capacity) rounded <<= 1;
+    return rounded;
+  }
+
+ public:
+  /** Creates an empty queue.
+   *
+   * @param _capacity The least number of elements the queue can hold.
+   */
+  explicit _bounded_queue(const size_t _capacity)
+      : m_mask(round_up(_capacity) - 1),
+        m_cells(new _cell[m_mask + 1]),
+        m_enqueue(0),
+        m_dequeue(0) {
+    for (size_t i = 0; i <= m_mask; i++)
+      m_cells[i].m_sequence.store(i, memory_order_relaxed);
+  }
+
+  _bounded_queue(const _bounded_queue &) = delete;
+  _bounded_queue &operator=(const _bounded_queue &) = delete;
+
+  /** Tries to add an element to the back of the queue.
+   *
+   * @param _value The element to add. It is only moved from on success.
+   * @return Whether the element was added; false when the queue is full.
+   */
+  bool try_push(T &_value) {
+    size_t pos = m_enqueue.load(memory_order_relaxed);
+    while (true) {
+      _cell &cell = m_cells[pos & m_mask];
+      const size_t sequence = cell.m_sequence.load(memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (m_enqueue.compare_exchange_weak(pos, pos + 1)) {
+          cell.m_value = std::move(_value);
+          cell.m_sequence.store(pos + 1, memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_enqueue.load(memory_order_relaxed);
+      }
+    }
+  }
+
+  /** Tries to take the element at the front of the queue.
+   *
+   * @param _value Where to move the element to.
+   * @return Whether an element was taken; false when the queue is empty.
+   */
+  bool try_pop(T &_value) {
+    size_t pos = m_dequeue.load(memory_order_relaxed);
+    while (true) {
+      _cell &cell = m_cells[pos & m_mask];
+      const size_t sequence = cell.m_sequence.load(memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (m_dequeue.compare_exchange_weak(pos, pos + 1)) {
+          _value = std::move(cell.m_value);
+          cell.m_value = T();
+          cell.m_sequence.store(pos + m_mask + 1, memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_dequeue.load(memory_order_relaxed);
+      }
+    }
+  }
+
+  /** An estimate of how many elements are queued. Exact when no other thread
+   * is using the queue.
+   *
+   * @return The number of queued elements.
+   */
+  size_t size_approx() const {
+    const size_t enqueued = m_enqueue.load();
+    const size_t dequeued = m_dequeue.load();
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+  }
+
+  /** Getter for the capacity
+   * @return How many elements fit in the queue.
+   */
+  size_t capacity() const { return m_mask + 1; }
+};
+}  // namespace fn_dag
\ No newline at end of file
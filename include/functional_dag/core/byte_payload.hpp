@@ -0,0 +1,117 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+#if __has_include(<flatbuffers/flatbuffers.h>)
+#include <flatbuffers/flatbuffers.h>
+#endif
+
+namespace fn_dag {
+using namespace std;
+
+/** A payload that is its bytes, e.g. a flatbuffer, so it can be sent to
+ * another process as is.
+ *
+ * It gives its bytes with bytes(). The receiving end checks them with
+ * verify() before anything reads them, since they may come from a process
+ * that crashed or misbehaved. view() then wraps bytes that outlive the
+ * payload without copying them, and copy() makes a payload that owns a copy.
+ */
+template <typename T>
+concept byte_payload = requires(const T &_payload, span<const byte> _bytes) {
+  { _payload.bytes() } -> convertible_to<span<const byte>>;
+  { T::verify(_bytes) } -> same_as<bool>;
+  { T::view(_bytes) } -> same_as<T>;
+  { T::copy(_bytes) } -> same_as<unique_ptr<T>>;
+};
+
+#if __has_include(<flatbuffers/flatbuffers.h>)
+/** A finished flatbuffer with a root table of a known type.
+ *
+ * Nodes that run in a child process (see node_residence::FORK) can take and
+ * give these, since they cross as bytes and are verified on the way in.
+ *
+ * @tparam Root The type of the root table
+ */
+template <typename Root>
+class flatbuffer_payload {
+ private:
+  flatbuffers::DetachedBuffer m_detached;  // The buffer, if built here
+  vector<uint8_t> m_copied;                // The buffer, if copied here
+  span<const byte> m_bytes;                // Whichever buffer it is
+
+  flatbuffer_payload() : m_detached(), m_copied(), m_bytes() {}
+
+ public:
+  /** Takes over a finished buffer without copying it.
+   * @param _buffer The buffer, e.g. from FlatBufferBuilder::Release()
+   */
+  explicit flatbuffer_payload(flatbuffers::DetachedBuffer _buffer)
+      : m_detached(std::move(_buffer)),
+        m_copied(),
+        m_bytes(as_bytes(span(m_detached.data(), m_detached.size()))) {}
+
+  flatbuffer_payload(flatbuffer_payload &&) = default;
+  flatbuffer_payload &operator=(flatbuffer_payload &&) = default;
+
+  /** Checks that bytes hold a well formed buffer with a Root at its root.
+   * @param _bytes The bytes
+   * @return Whether they are safe to read
+   */
+  static bool verify(const span<const byte> _bytes) {
+    flatbuffers::Verifier verifier(
+        reinterpret_cast<const uint8_t *>(_bytes.data()), _bytes.size());
+    return verifier.template VerifyBuffer<Root>(nullptr);
+  }
+
+  /** Wraps bytes that outlive the payload, without copying them.
+   * @param _bytes A verified buffer
+   * @return The payload
+   */
+  static flatbuffer_payload view(const span<const byte> _bytes) {
+    flatbuffer_payload payload;
+    payload.m_bytes = _bytes;
+    return payload;
+  }
+
+  /** Copies bytes into a payload of its own.
+   * @param _bytes A verified buffer
+   * @return The payload
+   */
+  static unique_ptr<flatbuffer_payload> copy(const span<const byte> _bytes) {
+    auto payload = unique_ptr<flatbuffer_payload>(new flatbuffer_payload());
+    const auto begin = reinterpret_cast<const uint8_t *>(_bytes.data());
+    payload->m_copied.assign(begin, begin + _bytes.size());
+    payload->m_bytes = as_bytes(span(payload->m_copied));
+    return payload;
+  }
+
+  /** Getter for the buffer
+   * @return Its bytes
+   */
+  span<const byte> bytes() const { return m_bytes; }
+
+  /** Getter for the root table
+   * @return The root
+   */
+  const Root *root() const {
+    return flatbuffers::GetRoot<Root>(m_bytes.data());
+  }
+};
+#endif
+}  // namespace fn_dag
@@ -0,0 +1,80 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <stop_token>
+#include <utility>
+#include <vector>
+
+namespace fn_dag {
+using namespace std;
+
+/** Makes a stop token visible to the user code running on this thread.
+ *
+ * The dag sets one up around every call to a source or a node, so the user
+ * code can find out it should give up without changing the update
+ * signatures. Scopes nest, e.g. when a thread helps the pool while it waits.
+ */
+class _stop_scope {
+ private:
+  static inline thread_local const stop_token *t_current =
+      nullptr;                   // The token of the innermost scope
+  const stop_token *m_previous;  // The token to restore when leaving
+
+ public:
+  /** Makes the token current until the scope ends.
+   * @param _token The token to expose. Must outlive the scope.
+   */
+  explicit _stop_scope(const stop_token &_token) : m_previous(t_current) {
+    t_current = &_token;
+  }
+
+  /** Restores the token of the enclosing scope. */
+  ~_stop_scope() { t_current = m_previous; }
+
+  _stop_scope(const _stop_scope &) = delete;
+  _stop_scope &operator=(const _stop_scope &) = delete;
+
+  /** Getter for the innermost token
+   * @return The current token or nullptr outside of any scope.
+   */
+  static const stop_token *current() { return t_current; }
+};
+
+/** The stop token of the dag the calling source or node runs in.
+ *
+ * Long running user code should poll it, or register a std::stop_callback on
+ * it to abort blocking work, so the dag can shut down promptly.
+ *
+ * @return The token, or a token that never stops when called outside a dag.
+ */
+inline stop_token current_stop_token() {
+  const stop_token *token = _stop_scope::current();
+  return token != nullptr ? *token : stop_token();
+}
+
+/** What happened while the manager drained its dags. */
+template <typename IDType>
+struct drain_report {
+  /// Whether every in-flight frame finished before the timeout
+  bool flushed;
+  /// How many frames were still in flight at the timeout
+  size_t abandoned_frames;
+  /// How many messages were dropped on any edge while draining
+  uint64_t dropped;
+  /// The nodes that dropped messages while draining and how many
+  vector<pair<IDType, uint64_t>> dropped_by_node;
+  /// How long the drain took
+  chrono::nanoseconds elapsed;
+};
+}  // namespace fn_dag
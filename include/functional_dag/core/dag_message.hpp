@@ -0,0 +1,107 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional_dag/core/executor.hpp>
+#include <functional_dag/core/frame_arena.hpp>
+#include <functional_dag/core/node_metrics.hpp>
+#include <memory>
+#include <memory_resource>
+
+namespace fn_dag {
+using namespace std;
+
+/** A reference counted, immutable handle to data moving through the dag.
+ *
+ * Every child of a node shares the same handle to the node's output. The data
+ * is deleted when the last child lets go of it, so no child has to wait on its
+ * siblings and the parent does not have to wait on any of them.
+ */
+template <typename T>
+using dag_payload = shared_ptr<const T>;
+
+/** The state of one message from a source as it spreads through a dag.
+ *
+ * Every message derived from the source's output holds on to the frame. When
+ * the last of them is gone the frame is destroyed, which is how the dag knows
+ * the source's output has fully propagated. The frame's arena, which the
+ * nodes allocate their temporaries from, is freed along with it.
+ */
+class _dag_frame {
+ private:
+  _task_group *m_on_done;       // Told when the frame is done, if anyone waits
+  atomic<size_t> &m_in_flight;  // How many frames are alive
+  const uint64_t m_sequence;    // Which output of the source this is
+  const chrono::steady_clock::time_point
+      m_stamp;            // When the source produced the output
+  _frame_memory m_arena;  // Temporary memory of the nodes working on the frame
+
+ public:
+  /** Starts a frame.
+   *
+   * @param _on_done A group to mark done when the frame has fully propagated
+   * or nullptr if nobody waits on the frame.
+   * @param _in_flight The count of live frames to add this one to.
+   * @param _sequence Which output of the source this is, counting from zero.
+   * @param _stamp When the source produced the output.
+   */
+  _dag_frame(_task_group *_on_done, atomic<size_t> &_in_flight,
+             const uint64_t _sequence,
+             const chrono::steady_clock::time_point _stamp)
+      : m_on_done(_on_done),
+        m_in_flight(_in_flight),
+        m_sequence(_sequence),
+        m_stamp(_stamp),
+        m_arena() {
+    m_in_flight++;
+  }
+
+  /** The frame is done once the last message holding it is gone. */
+  ~_dag_frame() {
+    m_in_flight--;
+    if (m_on_done != nullptr) m_on_done->done();
+  }
+
+  _dag_frame(const _dag_frame &) = delete;
+  _dag_frame &operator=(const _dag_frame &) = delete;
+
+  /** Getter for the sequence number
+   * @return Which output of the source this is, counting from zero.
+   */
+  uint64_t sequence() const { return m_sequence; }
+
+  /** Getter for the timestamp
+   * @return When the source produced the output.
+   */
+  chrono::steady_clock::time_point stamp() const { return m_stamp; }
+
+  /** Getter for the arena
+   * @return Where the nodes working on the frame allocate their temporaries.
+   */
+  _frame_memory &arena() { return m_arena; }
+};
+
+/** What moves along an edge: the data and the frame it belongs to.
+ *
+ * The frame is declared first so the data is released before the frame when
+ * a message goes away.
+ */
+template <typename T>
+struct _dag_message {
+  shared_ptr<_dag_frame> frame;  //! The frame the data was derived in
+  dag_payload<T> data;           //! The shared, immutable data
+  [[no_unique_address]] _sent_stamp<>
+      sent;  //! When the parent passed the data on, to tell how long it
+             //! waited. Empty when the metrics are compiled out.
+};
+}  // namespace fn_dag
\ No newline at end of file
@@ -9,7 +9,15 @@
  * ---------------------------------------------
  * @author ndepalma@alum.mit.edu
  */
+#include <atomic>
+#include <cstdint>
+#include <functional_dag/core/executor.hpp>
+#include <functional_dag/core/object_pool.hpp>
+#include <functional_dag/core/priority.hpp>
+#include <functional_dag/core/thread_placement.hpp>
+#include <functional_dag/core/tracer.hpp>
 #include <iostream>
+#include <stop_token>
 
 namespace fn_dag {
 using namespace std;
@@ -19,16 +27,48 @@ using namespace std;
  * this shared state to stop themselves.
  */
 struct _dag_context {
-  bool filter_off;           //! Whether the dag is running
+  stop_source stopper;       //! Asked to stop when the dags should stop.
+                             //! Safe to read from any thread.
   bool run_single_threaded;  //! Whether the dag is running in threads or single
                              //! threaded
 
+  uint32_t num_workers;      //! How many workers the shared pool runs. Zero
+                             //! means one per hardware thread.
+  thread_placement worker_placement;  //! Where the workers of the shared
+                                      //! pool run
+  bool pipelined;            //! Whether nodes queue their input and run as
+                             //! soon as it is available instead of the
+                             //! parent waiting on them
+  size_t edge_capacity;      //! How many messages an edge queues in
+                             //! pipelined mode
+  executor_type scheduler;   //! Which kind of pool the manager starts
+  bool fuse_chains;          //! Whether a node's only child runs in the
+                             //! node's task instead of a task of its own
+  _dag_executor *executor;   //! The shared pool to run children on. Null
+                             //! means children run on the calling thread.
+  mutable atomic<size_t>
+      frames_in_flight;  //! Source outputs that have not fully propagated
+  _object_pools pools;   //! Where outputs go once the last child is done
+  mutable _load_monitor load;  //! Whether background nodes should be shed
+  mutable _tracer tracer;      //! Records spans while a trace is on
+
   ostream *log;  //! Which output stream to log to. Useful to override.
   string_view indent_str;  //! How far to indent when printing the dag info
 
   _dag_context()
-      : filter_off(false),
+      : stopper(),
         run_single_threaded(false),
+        num_workers(0),
+        worker_placement(),
+        pipelined(false),
+        edge_capacity(4),
+        scheduler(executor_type::WORK_STEALING),
+        fuse_chains(true),
+        executor(nullptr),
+        frames_in_flight(0),
+        pools(),
+        load(frames_in_flight),
+        tracer(),
         log(&cout),
         indent_str("  ") {}
 };
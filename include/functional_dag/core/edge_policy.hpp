@@ -0,0 +1,73 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace fn_dag {
+using namespace std;
+
+/** What a pipelined edge does when the node it feeds has fallen behind and
+ * its queue is full. */
+enum class overflow_policy : uint8_t {
+  BLOCK = 0,    ///< The producer waits until there is room.
+  DROP_NEWEST,  ///< The incoming message is dropped.
+  DROP_OLDEST,  ///< The oldest queued message is dropped to make room.
+  KEEP_LATEST,  ///< Everything queued is dropped; only the latest is kept.
+};
+
+/** The options of the edge that feeds a node. */
+struct edge_options {
+  /// What to do when the queue is full
+  overflow_policy policy = overflow_policy::BLOCK;
+  /// How many messages the edge queues. Zero uses the manager's default.
+  size_t capacity = 0;
+  /// How many queued messages the node may run on at once with update_batch
+  /// in pipelined mode. One runs every message on its own with update.
+  size_t max_batch = 1;
+  /// How long the last message of a batch may wait on the ones before it.
+  /// Batches are cut short to fit, based on how long the node took per
+  /// message so far. Zero means no limit.
+  chrono::nanoseconds max_latency = chrono::nanoseconds(0);
+  /// How many queued messages the node may run on at once in pipelined mode,
+  /// each on its own worker. The outputs are passed on in the order the
+  /// messages were queued. Only for stateless nodes, since update is called
+  /// from several threads at once. Edges that batch run one batch at a time.
+  size_t replicas = 1;
+};
+
+/** A snapshot of the counters of the edge that feeds a node. */
+struct edge_stats {
+  /// What the edge does when its queue is full
+  overflow_policy policy;
+  /// How many messages the edge can queue
+  size_t capacity;
+  /// How many messages the node may run on at once
+  size_t replicas;
+  /// How many messages are queued right now
+  size_t queued;
+  /// How many messages were accepted onto the edge
+  uint64_t delivered;
+  /// How many messages were shed by the overflow policy
+  uint64_t dropped;
+  /// How many batches the node ran on. Zero when the edge does not batch.
+  uint64_t batches;
+  /// How many messages a background node skipped while the dags were
+  /// overloaded. Its whole subtree skips them too.
+  uint64_t shed;
+  /// How many messages the node finished after its deadline
+  uint64_t deadline_misses;
+  /// How many outputs of a replicated node waited on an earlier message to
+  /// finish before they were passed on
+  uint64_t reordered;
+};
+}  // namespace fn_dag
\ No newline at end of file
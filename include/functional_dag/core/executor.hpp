@@ -0,0 +1,205 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+namespace fn_dag {
+using namespace std;
+
+/** Which scheduler the dag manager runs the nodes on */
+enum class executor_type {
+  CENTRAL_QUEUE,  ///< All workers share one queue of tasks.
+  WORK_STEALING,  ///< Every worker has its own deque and steals when idle.
+};
+
+/** Abstract interface of the worker pools that run the nodes.
+ *
+ * The dag manager owns one executor and shares it through the context. Threads
+ * that wait on submitted tasks are expected to help run queued work (see
+ * try_run_one) so nested fan-outs never starve the pool.
+ */
+class _dag_executor {
+ public:
+  /** Default deconstructor */
+  virtual ~_dag_executor() = default;
+
+  /** Queues a task to be run by one of the workers.
+   *
+   * @param _task The task to run.
+   */
+  virtual void submit(function<void()> _task) = 0;
+
+  /** Queues a task that should be done by a deadline.
+   *
+   * Such tasks run before the ones without a deadline, earliest deadline
+   * first. Pools that can't order their tasks just queue it.
+   *
+   * @param _task The task to run.
+   * @param _deadline When the task should be done.
+   */
+  virtual void submit_by(function<void()> _task,
+                         [[maybe_unused]] const chrono::steady_clock::time_point
+                             _deadline) {
+    submit(std::move(_task));
+  }
+
+  /** Runs one queued task on the calling thread if there is one.
+   *
+   * This lets a thread that is waiting on other tasks do useful work instead
+   * of blocking a worker.
+   *
+   * @return Whether a task was run.
+   */
+  virtual bool try_run_one() = 0;
+
+  /** Getter for the number of workers
+   * @return How many worker threads the pool runs.
+   */
+  virtual size_t size() const = 0;
+};
+
+/** Makes the pool a node runs on visible to the coroutines it starts, so one
+ * that waits on I/O resumes on that pool rather than the reactor's thread.
+ * Scopes nest like _stop_scope.
+ */
+class _executor_scope {
+ private:
+  static inline thread_local _dag_executor *t_current =
+      nullptr;                  // The pool of the innermost scope
+  _dag_executor *m_previous;  // The pool to restore when leaving
+
+ public:
+  /** Makes the pool current until the scope ends.
+   * @param _executor The pool or nullptr for none. Must outlive the scope.
+   */
+  explicit _executor_scope(_dag_executor *const _executor)
+      : m_previous(t_current) {
+    t_current = _executor;
+  }
+
+  /** Restores the pool of the enclosing scope. */
+  ~_executor_scope() { t_current = m_previous; }
+
+  _executor_scope(const _executor_scope &) = delete;
+  _executor_scope &operator=(const _executor_scope &) = delete;
+
+  /** Getter for the innermost pool
+   * @return The current pool or nullptr outside of any scope.
+   */
+  static _dag_executor *current() { return t_current; }
+};
+
+/** Tasks with deadlines, earliest deadline first. Tasks with the same
+ * deadline keep the order they were pushed in. Not thread safe. */
+class _deadline_queue {
+ private:
+  /** A task and when it should be done. */
+  struct _entry {
+    chrono::steady_clock::time_point deadline;  // When to be done
+    uint64_t order;                             // Breaks ties in push order
+    function<void()> task;                      // What to run
+
+    /** Orders the heap so the earliest deadline is on top.
+     * @param _other The entry to compare with
+     * @return Whether this entry runs after the other one
+     */
+    bool operator>(const _entry &_other) const {
+      return deadline != _other.deadline ? deadline > _other.deadline
+                                         : order > _other.order;
+    }
+  };
+
+  priority_queue<_entry, vector<_entry>, greater<_entry>>
+      m_heap;        // The tasks
+  uint64_t m_next;  // The order of the next task pushed
+
+ public:
+  /** Default constructor. Starts empty. */
+  _deadline_queue() : m_heap(), m_next(0) {}
+
+  /** Adds a task.
+   * @param _task The task
+   * @param _deadline When it should be done
+   */
+  void push(function<void()> _task,
+            const chrono::steady_clock::time_point _deadline) {
+    m_heap.push({_deadline, m_next++, std::move(_task)});
+  }
+
+  /** Takes the task with the earliest deadline.
+   * @param _task Where to put the task
+   * @return Whether there was one
+   */
+  bool pop(function<void()> &_task) {
+    if (m_heap.empty()) return false;
+    // The top is const, but it is popped right away
+    _task = std::move(const_cast<_entry &>(m_heap.top()).task);
+    m_heap.pop();
+    return true;
+  }
+
+  /** Whether there are no tasks
+   * @return True if empty
+   */
+  bool empty() const { return m_heap.empty(); }
+};
+
+/** A counter of outstanding tasks that a thread can wait on.
+ *
+ * The waiting thread helps the pool run tasks while the group is not done.
+ * The counter is only touched under the mutex so the group can live on the
+ * waiter's stack.
+ */
+class _task_group {
+ private:
+  mutex m_mutex;            // Guards the counter
+  condition_variable m_cv;  // Signaled when the counter hits zero
+  size_t m_pending;         // Tasks that have not finished yet
+
+ public:
+  /** Default constructor. Starts with nothing pending. */
+  _task_group() : m_pending(0) {}
+
+  /** Records that a task was added to the group. */
+  void add() {
+    lock_guard<mutex> lock(m_mutex);
+    m_pending++;
+  }
+
+  /** Records that a task of the group finished. */
+  void done() {
+    lock_guard<mutex> lock(m_mutex);
+    if (--m_pending == 0) m_cv.notify_all();
+  }
+
+  /** Blocks until all tasks in the group finished, running queued tasks from
+   * the pool in the meantime.
+   *
+   * @param _pool The executor the tasks were submitted to.
+   */
+  void wait(_dag_executor &_pool) {
+    unique_lock<mutex> lock(m_mutex);
+    while (m_pending != 0) {
+      lock.unlock();
+      const bool ran = _pool.try_run_one();
+      lock.lock();
+      if (!ran && m_pending != 0) m_cv.wait(lock);
+    }
+  }
+};
+}  // namespace fn_dag
\ No newline at end of file
@@ -0,0 +1,246 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+
+namespace fn_dag {
+using namespace std;
+
+/** A bump allocator for the temporary allocations of one frame.
+ *
+ * Every node working on the frame allocates from the same arena, from any
+ * thread, without locking in the common case: an allocation just moves the
+ * cursor of the current chunk. Deallocating does nothing. All of the memory
+ * is freed at once when the arena is destroyed, which is when the frame has
+ * fully propagated. No memory is taken until the first allocation.
+ */
+class _frame_arena : public pmr::memory_resource {
+ private:
+  /** A block of memory to bump-allocate from. The bytes follow the header. */
+  struct _chunk {
+    _chunk *next;         // The chunk allocated before this one
+    size_t capacity;      // How many bytes follow the header
+    atomic<size_t> used;  // How many of them were handed out
+  };
+
+  static constexpr size_t first_chunk = 4096;   // Bytes of the first chunk
+  static constexpr size_t max_chunk = 1 << 20;  // Most bytes a chunk grows to
+
+  atomic<_chunk *> m_current;  // The chunk allocations bump, if any
+  mutex m_grow_mutex;          // Serializes allocating chunks
+  _chunk *m_chunks;            // Every chunk, newest first
+  size_t m_next_capacity;      // How many bytes the next chunk gets
+
+  /** Where the bytes of a chunk start.
+   * @param _chunk The chunk
+   * @return Its first byte
+   */
+  static byte *bytes_of(_chunk *const _chunk) {
+    return reinterpret_cast<byte *>(_chunk + 1);
+  }
+
+  /** Hands out bytes from a chunk unless it is full.
+   *
+   * @param _chunk The chunk to bump
+   * @param _bytes How many bytes
+   * @param _alignment What to align them to
+   * @return The bytes or nullptr if the chunk is full
+   */
+  static void *bump(_chunk *const _chunk, const size_t _bytes,
+                    const size_t _alignment) {
+    // Reserve enough to align within the reservation, whatever the cursor is
+    const size_t reserved = _bytes + _alignment - 1;
+    const size_t offset = _chunk->used.fetch_add(reserved);
+    if (offset + reserved > _chunk->capacity) return nullptr;
+    const uintptr_t start = reinterpret_cast<uintptr_t>(bytes_of(_chunk));
+    const uintptr_t aligned =
+        (start + offset + _alignment - 1) & ~uintptr_t(_alignment - 1);
+    return reinterpret_cast<void *>(aligned);
+  }
+
+  /** Allocates a chunk and links it into the list. Needs m_grow_mutex.
+   * @param _capacity How many bytes it holds
+   * @return The chunk
+   */
+  _chunk *add_chunk(const size_t _capacity) {
+    void *memory = ::operator new(sizeof(_chunk) + _capacity);
+    _chunk *chunk = new (memory) _chunk{m_chunks, _capacity, 0};
+    m_chunks = chunk;
+    return chunk;
+  }
+
+ protected:
+  /** Allocates from the current chunk, or from a new one if it is full.
+   *
+   * Allocations too big for a chunk get one of their own, so they do not
+   * waste the rest of the current chunk.
+   *
+   * @param _bytes How many bytes
+   * @param _alignment What to align them to
+   * @return The memory. Valid until the arena is destroyed.
+   */
+  void *do_allocate(const size_t _bytes, const size_t _alignment) override {
+    const size_t needed = _bytes + _alignment - 1;
+    while (true) {
+      _chunk *current = m_current.load(memory_order_acquire);
+      if (current != nullptr)
+        if (void *memory = bump(current, _bytes, _alignment)) return memory;
+
+      lock_guard<mutex> lock(m_grow_mutex);
+      if (needed > m_next_capacity / 2)
+        return bump(add_chunk(needed), _bytes, _alignment);
+      // Another thread may have added a chunk while this one waited
+      if (m_current.load(memory_order_acquire) == current) {
+        m_current.store(add_chunk(m_next_capacity), memory_order_release);
+        m_next_capacity = min(m_next_capacity * 2, max_chunk);
+      }
+    }
+  }
+
+  /** Does nothing. The memory is freed with the arena. */
+  void do_deallocate(void *, size_t, size_t) override {}
+
+  /** Arenas only free what they allocated themselves.
+   * @param _other The resource to compare with
+   * @return Whether it is this arena
+   */
+  bool do_is_equal(const pmr::memory_resource &_other) const noexcept override {
+    return this == &_other;
+  }
+
+ public:
+  /** Default constructor. Takes no memory until the first allocation. */
+  _frame_arena()
+      : m_current(nullptr),
+        m_grow_mutex(),
+        m_chunks(nullptr),
+        m_next_capacity(first_chunk) {}
+
+  /** Frees every chunk at once. */
+  ~_frame_arena() {
+    while (m_chunks != nullptr) {
+      _chunk *next = m_chunks->next;
+      m_chunks->~_chunk();
+      ::operator delete(m_chunks);
+      m_chunks = next;
+    }
+  }
+
+  _frame_arena(const _frame_arena &) = delete;
+  _frame_arena &operator=(const _frame_arena &) = delete;
+
+  /** How many bytes the arena took from the system so far.
+   * @return The total capacity of the chunks
+   */
+  size_t reserved() {
+    lock_guard<mutex> lock(m_grow_mutex);
+    size_t total = 0;
+    for (_chunk *chunk = m_chunks; chunk != nullptr; chunk = chunk->next)
+      total += chunk->capacity;
+    return total;
+  }
+};
+
+/** The arena of one frame, only made once a node of the frame first asks
+ * for memory.
+ *
+ * The arena lives on the heap rather than in the frame, so outputs allocated
+ * from it can keep it alive for as long as they are held, even after the
+ * frame is done, e.g. while a join holds on to them.
+ */
+class _frame_memory {
+ private:
+  once_flag m_made;                 // Makes the arena once
+  shared_ptr<_frame_arena> m_arena;  // The arena, once made
+  atomic<bool> m_in_use;            // Whether m_arena was made
+
+ public:
+  /** Default constructor. Takes no memory until the arena is asked for. */
+  _frame_memory() : m_made(), m_arena(), m_in_use(false) {}
+
+  _frame_memory(const _frame_memory &) = delete;
+  _frame_memory &operator=(const _frame_memory &) = delete;
+
+  /** Getter for the arena, which is made on the first call.
+   * @return The arena of the frame
+   */
+  _frame_arena &arena() {
+    call_once(m_made, [this]() {
+      m_arena = make_shared<_frame_arena>();
+      m_in_use.store(true, memory_order_release);
+    });
+    return *m_arena;
+  }
+
+  /** Keeps the arena alive for as long as the handle is held.
+   * @return The arena or nullptr if no node of the frame asked for it yet
+   */
+  shared_ptr<const _frame_arena> keep_alive() const {
+    if (!m_in_use.load(memory_order_acquire)) return nullptr;
+    return m_arena;
+  }
+};
+
+/** Makes the arena of a frame visible to the user code running on this
+ * thread, like _stop_scope does for the stop token. */
+class _arena_scope {
+ private:
+  static inline thread_local _frame_memory *t_current =
+      nullptr;                 // The arena of the innermost scope
+  _frame_memory *m_previous;  // The arena to restore when leaving
+
+ public:
+  /** Makes the arena current until the scope ends.
+   * @param _arena The arena to expose or nullptr for none. Must outlive the
+   * scope.
+   */
+  explicit _arena_scope(_frame_memory *const _arena) : m_previous(t_current) {
+    t_current = _arena;
+  }
+
+  /** Restores the arena of the enclosing scope. */
+  ~_arena_scope() { t_current = m_previous; }
+
+  _arena_scope(const _arena_scope &) = delete;
+  _arena_scope &operator=(const _arena_scope &) = delete;
+
+  /** Getter for the innermost arena
+   * @return The current arena or nullptr outside of any frame.
+   */
+  static _frame_memory *current() { return t_current; }
+};
+
+/** Memory for the temporary allocations of the frame the calling node works
+ * on, e.g. `pmr::vector<detection> found(frame_memory());`.
+ *
+ * Allocating is a pointer bump shared by every node of the frame, so worker
+ * threads do not contend on the global allocator, and everything is freed at
+ * once when the frame has fully propagated. Outputs may use it too: every
+ * output passed on keeps the arena alive until the last child, or a join
+ * holding on to it, lets go. Do not keep the arena in node state, and do not
+ * use it for outputs that go to a pool, which outlive any one frame. Pooled
+ * containers with a pmr allocator on the arena are deleted instead of being
+ * recycled, but the pool can't tell for anything else.
+ *
+ * @return The frame's arena, or the default resource outside of a node or in
+ * a batched update, whose inputs belong to different frames.
+ */
+inline pmr::memory_resource *frame_memory() {
+  _frame_memory *memory = _arena_scope::current();
+  return memory != nullptr ? &memory->arena() : pmr::get_default_resource();
+}
+}  // namespace fn_dag
@@ -0,0 +1,39 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace fn_dag {
+using namespace std;
+
+/** How a join node decides which inputs belong together */
+enum class join_policy : uint8_t {
+  EXACT_SEQUENCE = 0,  ///< Inputs from the same sequence number of their
+                       ///< sources, e.g. two branches of one source.
+  APPROXIMATE_TIME,    ///< Inputs whose sources produced them within a
+                       ///< window of each other.
+  SAMPLE_AND_HOLD,     ///< Every input on the first parent, together with
+                       ///< the latest input of the other parents.
+};
+
+/** How a join node buffers and matches its inputs. */
+struct join_options {
+  /// How inputs are matched
+  join_policy policy = join_policy::EXACT_SEQUENCE;
+  /// How far apart the timestamps of approximately matched inputs may be
+  chrono::nanoseconds window = chrono::milliseconds(5);
+  /// How many unmatched inputs are kept per parent. Zero means the
+  /// manager's edge capacity. The oldest unmatched input is dropped first.
+  size_t capacity = 0;
+};
+}  // namespace fn_dag
@@ -0,0 +1,338 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+// Whether the nodes keep metrics. Build with -DFN_DAG_METRICS=0 (meson
+// -Dmetrics=false) to compile the instrumentation out entirely.
+#ifndef FN_DAG_METRICS
+#define FN_DAG_METRICS 1
+#endif
+
+namespace fn_dag {
+using namespace std;
+
+/** Whether the nodes keep metrics, see FN_DAG_METRICS */
+inline constexpr bool metrics_enabled = FN_DAG_METRICS != 0;
+
+/** The buckets of a latency histogram.
+ *
+ * Below 16ns every nanosecond has its own bucket. Above that every power of
+ * two is split into 8 buckets, so a bucket is never wider than an eighth of
+ * the durations it holds. Durations of 2^38ns (about 4.6 minutes) and more
+ * all land in the last bucket.
+ */
+struct _latency_buckets {
+  static constexpr unsigned k_sub_bits = 4;  // Bits kept exact per duration
+  static constexpr uint64_t k_linear = 1 << k_sub_bits;  // Exact buckets
+  static constexpr uint64_t k_half = k_linear / 2;  // Buckets per power of 2
+  static constexpr unsigned k_max_bits = 38;        // Widest duration kept
+  static constexpr size_t k_count =
+      (k_max_bits - k_sub_bits + 1) * k_half + k_half;  // Number of buckets
+
+  /** Which bucket a duration lands in.
+   * @param _ns The duration in nanoseconds
+   * @return The index of its bucket
+   */
+  static constexpr size_t index(const uint64_t _ns) {
+    const uint64_t ns = min<uint64_t>(_ns, (uint64_t(1) << k_max_bits) - 1);
+    if (ns < k_linear) return ns;
+    const unsigned shift = bit_width(ns) - k_sub_bits;
+    return shift * k_half + (ns >> shift);
+  }
+
+  /** The shortest duration of a bucket.
+   * @param _index The index of the bucket
+   * @return Its lower bound in nanoseconds
+   */
+  static constexpr uint64_t floor(const size_t _index) {
+    if (_index < k_linear) return _index;
+    const uint64_t shift = _index / k_half - 1;
+    return (_index - shift * k_half) << shift;
+  }
+
+  /** The longest duration of a bucket.
+   * @param _index The index of the bucket
+   * @return Its upper bound in nanoseconds
+   */
+  static constexpr uint64_t ceiling(const size_t _index) {
+    if (_index < k_linear) return _index;
+    return floor(_index) + (uint64_t(1) << (_index / k_half - 1)) - 1;
+  }
+};
+
+/** A snapshot of a latency histogram. */
+struct latency_histogram {
+  /// How many durations were recorded
+  uint64_t count;
+  /// The shortest duration. Zero when nothing was recorded.
+  chrono::nanoseconds shortest;
+  /// The longest duration
+  chrono::nanoseconds longest;
+  /// All of the durations added up
+  chrono::nanoseconds total;
+  /// How many durations landed in each bucket, shortest first. Empty when
+  /// nothing was recorded.
+  vector<uint64_t> buckets;
+
+  /** The average duration
+   * @return The mean, or zero when nothing was recorded
+   */
+  chrono::nanoseconds mean() const {
+    return count == 0 ? chrono::nanoseconds(0)
+                      : total / static_cast<int64_t>(count);
+  }
+
+  /** The duration a share of the recorded ones did not exceed.
+   *
+   * The answer is the upper bound of the bucket the percentile falls in, so
+   * it is at most an eighth too high, and never beyond the longest duration.
+   *
+   * @param _percent The share, from 0 to 100. 50 is the median.
+   * @return The duration, or zero when nothing was recorded
+   */
+  chrono::nanoseconds percentile(const double _percent) const {
+    if (count == 0) return chrono::nanoseconds(0);
+    const double share = clamp(_percent, 0.0, 100.0) / 100.0;
+    const uint64_t rank = max<uint64_t>(
+        1, static_cast<uint64_t>(ceil(share * static_cast<double>(count))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+      seen += buckets[i];
+      if (seen >= rank)
+        return clamp(
+            chrono::nanoseconds(_latency_buckets::ceiling(i)), shortest,
+            longest);
+    }
+    return longest;
+  }
+};
+
+/** A snapshot of what a node did since it was added. */
+struct node_metrics {
+  /// How many messages the node ran on. A batch counts every message.
+  uint64_t invocations;
+  /// How many of those gave no output, so the node's subtree skipped them
+  uint64_t null_outputs;
+  /// CPU time the threads running the node spent in its update, summed
+  /// over the threads. Coroutine nodes and platforms without a per-thread
+  /// CPU clock leave it at zero.
+  chrono::nanoseconds cpu_time;
+  /// How long each run took, from the first line of update to its output
+  latency_histogram latency;
+  /// How long each message waited between its parent passing it on and the
+  /// node starting on it, e.g. in the inbox or the pool's queue
+  latency_histogram queue_wait;
+};
+
+/** A lock-free latency histogram that many threads record into at once. */
+class _latency_recorder {
+ private:
+  array<atomic<uint64_t>, _latency_buckets::k_count>
+      m_buckets;                // Durations per bucket
+  atomic<uint64_t> m_count;     // Durations recorded
+  atomic<int64_t> m_total_ns;   // Durations added up
+  atomic<int64_t> m_shortest;   // Shortest duration in ns
+  atomic<int64_t> m_longest;    // Longest duration in ns
+
+ public:
+  /** Default constructor. Starts empty. */
+  _latency_recorder()
+      : m_buckets(),
+        m_count(0),
+        m_total_ns(0),
+        m_shortest(numeric_limits<int64_t>::max()),
+        m_longest(0) {}
+
+  /** Records durations.
+   * @param _duration How long it took. Negative counts as zero.
+   * @param _times How many times it took that long
+   */
+  void record(const chrono::nanoseconds _duration, const uint64_t _times = 1) {
+    const int64_t ns = max<int64_t>(_duration.count(), 0);
+    int64_t shortest = m_shortest.load(memory_order_relaxed);
+    while (ns < shortest && !m_shortest.compare_exchange_weak(shortest, ns)) {
+    }
+    int64_t longest = m_longest.load(memory_order_relaxed);
+    while (ns > longest && !m_longest.compare_exchange_weak(longest, ns)) {
+    }
+    m_buckets[_latency_buckets::index(static_cast<uint64_t>(ns))].fetch_add(
+        _times, memory_order_relaxed);
+    m_total_ns.fetch_add(ns * static_cast<int64_t>(_times),
+                         memory_order_relaxed);
+    // Last, so a snapshot that sees the count sees the bounds too
+    m_count.fetch_add(_times, memory_order_release);
+  }
+
+  /** Takes a snapshot of the histogram.
+   * @return The histogram at about this point in time
+   */
+  latency_histogram snapshot() const {
+    latency_histogram out{.count = m_count.load(memory_order_acquire),
+                          .shortest = {},
+                          .longest = {},
+                          .total = {},
+                          .buckets = {}};
+    if (out.count == 0) return out;
+    out.shortest = chrono::nanoseconds(m_shortest.load(memory_order_relaxed));
+    out.longest = chrono::nanoseconds(m_longest.load(memory_order_relaxed));
+    out.total = chrono::nanoseconds(m_total_ns.load(memory_order_relaxed));
+    out.buckets.reserve(m_buckets.size());
+    for (const auto &bucket : m_buckets)
+      out.buckets.push_back(bucket.load(memory_order_relaxed));
+    return out;
+  }
+};
+
+/** When a message was passed on, to tell how long it waited. Empty when the
+ * metrics are compiled out. */
+template <bool Enabled = metrics_enabled>
+struct _sent_stamp {
+  chrono::steady_clock::time_point at;  //! When the parent passed it on
+
+  /** Stamps a message that is passed on now
+   * @return The stamp
+   */
+  static _sent_stamp now() { return {chrono::steady_clock::now()}; }
+};
+
+/** Keeps no time when the metrics are compiled out. */
+template <>
+struct _sent_stamp<false> {
+  /** Keeps no time
+   * @return An empty stamp
+   */
+  static _sent_stamp now() { return {}; }
+};
+
+/** The lock-free counters a node keeps about its runs. Threads running the
+ * node record into it, readers on other threads take snapshots. */
+template <bool Enabled = metrics_enabled>
+class _node_meter {
+ private:
+  atomic<uint64_t> m_invocations;   // Messages the node ran on
+  atomic<uint64_t> m_null_outputs;  // Runs that gave no output
+  atomic<int64_t> m_cpu_ns;         // CPU time of the runs
+  _latency_recorder m_latency;      // How long the runs took
+  _latency_recorder m_queue_wait;   // How long the messages waited
+
+  /** The CPU time of the calling thread.
+   * @return The time, or nothing without a per-thread CPU clock
+   */
+  static optional<chrono::nanoseconds> thread_cpu_time() {
+#if defined(__linux__)
+    timespec now{};
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0)
+      return chrono::seconds(now.tv_sec) + chrono::nanoseconds(now.tv_nsec);
+#endif
+    return nullopt;
+  }
+
+ public:
+  /** When a run started. */
+  struct _span {
+    chrono::steady_clock::time_point wall;  //! The time it started
+    optional<chrono::nanoseconds> cpu;  //! The CPU time of its thread then
+  };
+
+  /** Default constructor. Everything starts at zero. */
+  _node_meter()
+      : m_invocations(0),
+        m_null_outputs(0),
+        m_cpu_ns(0),
+        m_latency(),
+        m_queue_wait() {}
+
+  /** Starts timing a run on the calling thread.
+   * @param _on_thread Whether the run ends on this thread too, so its CPU
+   * time can be told. Coroutines may end on another one.
+   * @return What finish needs
+   */
+  _span start(const bool _on_thread = true) const {
+    return {chrono::steady_clock::now(),
+            _on_thread ? thread_cpu_time() : nullopt};
+  }
+
+  /** Records how long a message waited before the node started on it.
+   * @param _sent When the parent passed the message on
+   */
+  void waited(const _sent_stamp<Enabled> &_sent) {
+    m_queue_wait.record(chrono::steady_clock::now() - _sent.at);
+  }
+
+  /** Records a run that started at start.
+   *
+   * @param _started What start returned
+   * @param _runs How many messages it ran on, e.g. a whole batch
+   * @param _outputs How many of them gave an output
+   */
+  void finish(const _span &_started, const uint64_t _runs = 1,
+              const uint64_t _outputs = 1) {
+    if (_runs == 0) return;
+    const auto elapsed = chrono::steady_clock::now() - _started.wall;
+    if (_started.cpu) {
+      if (const auto cpu = thread_cpu_time())
+        m_cpu_ns.fetch_add((*cpu - *_started.cpu).count(),
+                           memory_order_relaxed);
+    }
+    m_invocations.fetch_add(_runs, memory_order_relaxed);
+    m_null_outputs.fetch_add(_runs - min(_outputs, _runs),
+                             memory_order_relaxed);
+    m_latency.record(
+        chrono::duration_cast<chrono::nanoseconds>(elapsed) /
+            static_cast<int64_t>(_runs),
+        _runs);
+  }
+
+  /** Takes a snapshot of the counters.
+   * @return The counters at about this point in time
+   */
+  node_metrics snapshot() const {
+    return {.invocations = m_invocations.load(memory_order_relaxed),
+            .null_outputs = m_null_outputs.load(memory_order_relaxed),
+            .cpu_time = chrono::nanoseconds(
+                m_cpu_ns.load(memory_order_relaxed)),
+            .latency = m_latency.snapshot(),
+            .queue_wait = m_queue_wait.snapshot()};
+  }
+};
+
+/** Keeps nothing and costs nothing when the metrics are compiled out. */
+template <>
+class _node_meter<false> {
+ public:
+  /** An empty span. */
+  struct _span {};
+
+  _span start(const bool = true) const { return {}; }
+  void waited(const _sent_stamp<false> &) {}
+  void finish(const _span &, const uint64_t = 1, const uint64_t = 1) {}
+
+  /** There is nothing to take a snapshot of.
+   * @return All zeroes
+   */
+  node_metrics snapshot() const { return {}; }
+};
+}  // namespace fn_dag
@@ -0,0 +1,293 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace fn_dag {
+using namespace std;
+
+/** How a pool of node outputs is sized and backed. */
+struct pool_options {
+  /// How many objects to construct up front
+  size_t preallocate = 0;
+  /// How many released objects to keep for reuse. The rest are deleted.
+  size_t max_free = 16;
+  /// Whether to ask the kernel to back large objects with huge pages. Only
+  /// has an effect on Linux. Objects of at least one huge page are advised
+  /// themselves. Containers, and structs that expose their buffer through
+  /// data() and capacity(), have the buffer advised once it holds at least
+  /// one huge page, when constructed and each time they are kept for reuse.
+  /// Anything else is counted as skipped, see pool_stats.
+  bool huge_pages = false;
+};
+
+/** A snapshot of the counters of a pool. */
+struct pool_stats {
+  /// How many acquires got a recycled object
+  uint64_t hits;
+  /// How many acquires had to construct a new object
+  uint64_t misses;
+  /// How many released objects were kept for reuse
+  uint64_t recycled;
+  /// How many released objects were deleted because the pool was full
+  uint64_t discarded;
+  /// How many objects wait to be reused right now
+  size_t free;
+  /// How many times an object or its buffer was advised to use huge pages
+  uint64_t huge_page_objects;
+  /// How many times an object had no whole huge page to advise, e.g. a
+  /// struct whose buffer is not exposed through data() and capacity()
+  uint64_t huge_page_skipped;
+};
+
+/** An internal interface so pools of every type can be kept together. */
+class _object_pool_base {
+ public:
+  /** Pure, default deconstructor */
+  virtual ~_object_pool_base() = default;
+};
+
+/** Recycles node outputs of one type instead of deleting them.
+ *
+ * Sources and nodes acquire their output from the pool instead of allocating
+ * it. Once the last child is done with the output, the dag hands it back to
+ * the pool rather than deleting it, so the next acquire skips the allocation,
+ * the page faults and whatever buffers the object already grew. Outputs that
+ * were not acquired from the pool are adopted by it the same way.
+ *
+ * Every object is allocated with new, so an acquired object that is never
+ * passed on can still be dropped like any unique_ptr; release is only needed
+ * to reuse it.
+ *
+ * @tparam T The type of the outputs. Recycled objects keep their old
+ * contents, so nodes must overwrite what they use.
+ */
+template <typename T>
+class object_pool : public _object_pool_base {
+ private:
+  const pool_options m_options;  // How the pool is sized and backed
+  mutex m_mutex;                 // Guards m_free
+  vector<T *> m_free;            // Objects waiting to be reused
+  atomic<uint64_t> m_hits;       // Acquires that got a recycled object
+  atomic<uint64_t> m_misses;     // Acquires that constructed an object
+  atomic<uint64_t> m_recycled;   // Releases kept for reuse
+  atomic<uint64_t> m_discarded;  // Releases deleted because the pool was full
+  atomic<uint64_t> m_huge;       // Objects advised to use huge pages
+  atomic<uint64_t> m_skipped;    // Objects with nothing to advise
+
+  static constexpr size_t huge_page_size = size_t(2) << 20;  // 2MiB on x86-64
+
+  /** Asks the kernel to back memory with huge pages.
+   *
+   * Only the huge pages that lie entirely inside the memory are advised, so
+   * the memory around it is left alone.
+   *
+   * @param _begin Where the memory starts
+   * @param _bytes How long it is
+   * @return Whether a huge page was advised
+   */
+  static bool advise_range([[maybe_unused]] const void *const _begin,
+                           [[maybe_unused]] const size_t _bytes) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    constexpr uintptr_t mask = ~uintptr_t(huge_page_size - 1);
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(_begin);
+    const uintptr_t first = (begin + huge_page_size - 1) & mask;
+    const uintptr_t last = (begin + _bytes) & mask;
+    return last > first && madvise(reinterpret_cast<void *>(first),
+                                   last - first, MADV_HUGEPAGE) == 0;
+#else
+    return false;
+#endif
+  }
+
+  /** Asks the kernel to back an object with huge pages, or the buffer of a
+   * container since that is where its data is.
+   *
+   * @param _object The object to advise
+   */
+  void advise_huge_pages(const T *const _object) {
+    if (!m_options.huge_pages) return;
+    bool advised = false;
+    if constexpr (sizeof(T) >= huge_page_size) {
+      advised = advise_range(_object, sizeof(T));
+    } else if constexpr (requires {
+                           _object->data();
+                           _object->capacity();
+                         }) {
+      using element_t = remove_pointer_t<decltype(_object->data())>;
+      advised = advise_range(_object->data(),
+                             _object->capacity() * sizeof(element_t));
+    }
+    if (advised)
+      m_huge++;
+    else
+      m_skipped++;
+  }
+
+  /** Constructs a new object for the pool.
+   * @param _args What to construct it with
+   * @return The object
+   */
+  template <typename... Args>
+  unique_ptr<T> construct(Args &&..._args) {
+    auto object = make_unique<T>(std::forward<Args>(_args)...);
+    advise_huge_pages(object.get());
+    return object;
+  }
+
+ public:
+  /** Creates the pool and constructs the objects to preallocate.
+   * @param _options How the pool is sized and backed
+   */
+  explicit object_pool(const pool_options &_options = {})
+      : m_options(_options),
+        m_mutex(),
+        m_free(),
+        m_hits(0),
+        m_misses(0),
+        m_recycled(0),
+        m_discarded(0),
+        m_huge(0),
+        m_skipped(0) {
+    if constexpr (is_default_constructible_v<T>) {
+      m_free.reserve(max(m_options.max_free, m_options.preallocate));
+      for (size_t i = 0; i < m_options.preallocate; i++)
+        m_free.push_back(construct().release());
+    }
+  }
+
+  /** Deletes the objects waiting to be reused. */
+  ~object_pool() {
+    for (auto object : m_free) delete object;
+  }
+
+  object_pool(const object_pool &) = delete;
+  object_pool &operator=(const object_pool &) = delete;
+
+  /** Gets an object to output.
+   *
+   * @param _args What to construct a new object with if none can be reused.
+   * They are ignored for a recycled object.
+   * @return A recycled object, or a new one if the pool is empty.
+   */
+  template <typename... Args>
+  unique_ptr<T> acquire(Args &&..._args) {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      if (!m_free.empty()) {
+        T *const object = m_free.back();
+        m_free.pop_back();
+        m_hits++;
+        return unique_ptr<T>(object);
+      }
+    }
+    m_misses++;
+    return construct(std::forward<Args>(_args)...);
+  }
+
+  /** Gives an object back to be reused, or deletes it if the pool is full.
+   * @param _object The object. It may come from anywhere as long as it was
+   * allocated with new.
+   */
+  void release(unique_ptr<T> _object) {
+    if (_object == nullptr) return;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_free.size() < m_options.max_free) {
+        // Its buffer may have grown since it was last advised
+        advise_huge_pages(_object.get());
+        m_free.push_back(_object.release());
+        m_recycled++;
+        return;
+      }
+    }
+    m_discarded++;
+  }
+
+  /** Reads the counters of the pool
+   * @return A snapshot of the counters
+   */
+  pool_stats stats() {
+    lock_guard<mutex> lock(m_mutex);
+    return {.hits = m_hits.load(),
+            .misses = m_misses.load(),
+            .recycled = m_recycled.load(),
+            .discarded = m_discarded.load(),
+            .free = m_free.size(),
+            .huge_page_objects = m_huge.load(),
+            .huge_page_skipped = m_skipped.load()};
+  }
+};
+
+/** The pools of a dag_manager, one per output type.
+ *
+ * Pools are only ever added, never removed, while the manager lives, so a
+ * pool found once can be used without holding the lock.
+ */
+class _object_pools {
+ private:
+  mutable mutex m_mutex;  // Guards m_pools
+  unordered_map<type_index, unique_ptr<_object_pool_base>>
+      m_pools;                   // The pool of each type
+  atomic<uint64_t> m_version;  // Bumped every time a pool is added
+
+ public:
+  /** Default constructor. There are no pools until one is asked for. */
+  _object_pools() : m_mutex(), m_pools(), m_version(0) {}
+
+  /** Gets the pool of a type, creating it on first use.
+   * @param _options How to size and back the pool if it is created
+   * @return The pool
+   */
+  template <typename T>
+  object_pool<T> &get(const pool_options &_options) {
+    lock_guard<mutex> lock(m_mutex);
+    auto &pool = m_pools[type_index(typeid(T))];
+    if (pool == nullptr) {
+      pool = make_unique<object_pool<T>>(_options);
+      m_version++;
+    }
+    return static_cast<object_pool<T> &>(*pool);
+  }
+
+  /** Finds the pool of a type.
+   * @return The pool or nullptr if nobody asked for one yet
+   */
+  template <typename T>
+  object_pool<T> *find() const {
+    lock_guard<mutex> lock(m_mutex);
+    auto pool = m_pools.find(type_index(typeid(T)));
+    return pool == m_pools.end() ? nullptr
+                                 : static_cast<object_pool<T> *>(
+                                       pool->second.get());
+  }
+
+  /** Changes every time a pool is added. Cheap to poll.
+   * @return The number of pools
+   */
+  uint64_t version() const { return m_version.load(memory_order_acquire); }
+};
+}  // namespace fn_dag
@@ -0,0 +1,89 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace fn_dag {
+using namespace std;
+
+/** How much a node matters when the dags can't keep up. */
+enum class priority_class : uint8_t {
+  CRITICAL = 0,  ///< Dispatched ahead of everything without a deadline.
+  NORMAL,        ///< Dispatched in order. The default.
+  BACKGROUND,    ///< Shed, with its whole subtree, while the dags are
+                 ///< overloaded.
+};
+
+/** When the dags count as overloaded, so background nodes are shed. */
+struct shed_options {
+  /// How many frames may be in flight before the dags are overloaded. Zero
+  /// never counts as overloaded because of the frames in flight.
+  size_t max_frames_in_flight = 0;
+  /// How long the dags stay overloaded after a node missed its deadline.
+  chrono::nanoseconds after_miss = chrono::milliseconds(100);
+};
+
+/** Tracks whether the dags are overloaded. Shared by all of the nodes. */
+class _load_monitor {
+ private:
+  atomic<size_t> m_max_frames;     // See max_frames_in_flight
+  atomic<int64_t> m_after_miss;    // See after_miss, in ns
+  atomic<int64_t> m_last_miss;     // When a deadline was last missed, in ns
+                                   // since the clock's epoch
+  const atomic<size_t> &m_frames;  // The frames in flight
+
+  /** The time now, as the monitor keeps it.
+   * @return Nanoseconds since the steady clock's epoch
+   */
+  static int64_t now() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+ public:
+  /** Starts out not overloaded.
+   * @param _frames The counter of frames in flight to watch
+   */
+  explicit _load_monitor(const atomic<size_t> &_frames)
+      : m_max_frames(0),
+        m_after_miss(chrono::nanoseconds(shed_options{}.after_miss).count()),
+        m_last_miss(numeric_limits<int64_t>::min() / 2),
+        m_frames(_frames) {}
+
+  /** Changes when the dags count as overloaded.
+   * @param _options The new thresholds
+   */
+  void configure(const shed_options &_options) {
+    m_max_frames.store(_options.max_frames_in_flight);
+    m_after_miss.store(_options.after_miss.count());
+  }
+
+  /** Records that a node finished a message after its deadline. */
+  void missed_deadline() { m_last_miss.store(now(), memory_order_relaxed); }
+
+  /** Whether background nodes should be shed right now.
+   * @return True while too many frames are in flight or shortly after a
+   * deadline was missed
+   */
+  bool overloaded() const {
+    const size_t max_frames = m_max_frames.load(memory_order_relaxed);
+    if (max_frames != 0 && m_frames.load(memory_order_relaxed) > max_frames)
+      return true;
+    return now() - m_last_miss.load(memory_order_relaxed) <
+           m_after_miss.load(memory_order_relaxed);
+  }
+};
+}  // namespace fn_dag
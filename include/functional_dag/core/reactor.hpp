@@ -0,0 +1,453 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "functional_dag/core/cancellation.hpp"
+#include "functional_dag/core/executor.hpp"
+#include "functional_dag/core/frame_arena.hpp"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+namespace fn_dag {
+using namespace std;
+
+#if defined(__linux__)
+/** Where a suspended coroutine picks up again: the pool it ran on, and what
+ * its thread exposed to it through the scopes. */
+struct _resume_context {
+  _dag_executor *executor;     //! The pool or nullptr for the reactor thread
+  const stop_token *stop;      //! The stop token of the dag, if any
+  _frame_memory *arena;        //! The arena of the frame, if any
+
+  /** What the calling thread exposes right now.
+   * @return The context to resume in
+   */
+  static _resume_context capture() {
+    return {_executor_scope::current(), _stop_scope::current(),
+            _arena_scope::current()};
+  }
+
+  /** Resumes a coroutine on this thread with the scopes it was suspended in.
+   * @param _handle The coroutine
+   */
+  void resume(const coroutine_handle<> _handle) const {
+    static const stop_token never;
+    _executor_scope executor_scope(executor);
+    _stop_scope stop_scope(stop != nullptr ? *stop : never);
+    _arena_scope arena_scope(arena);
+    _handle.resume();
+  }
+
+  /** Resumes a coroutine on its pool, or on this thread if it has none.
+   * @param _handle The coroutine
+   */
+  void post(const coroutine_handle<> _handle) const {
+    if (executor == nullptr) {
+      resume(_handle);
+      return;
+    }
+    executor->submit([context = *this, _handle]() { context.resume(_handle); });
+  }
+};
+
+class _reactor;
+
+/** What a coroutine awaits to wait on a file descriptor, a time or both.
+ *
+ * Awaiting it suspends the coroutine without holding its thread, and gives
+ * true once the fd is ready or the time came. It gives false when a wait on
+ * an fd timed out, or when the dag was asked to stop, which ends the wait
+ * right away. File descriptors epoll can't watch, like regular files, count
+ * as ready, so the read or write that follows reports what is wrong.
+ */
+class _io_wait {
+ private:
+  friend class _reactor;
+
+  /** Ends the wait when the dag is asked to stop. */
+  struct _cancel {
+    _io_wait *wait;  // The wait to end
+    void operator()() const noexcept;
+  };
+
+  const int m_fd;          // What to watch or -1 for a plain timer
+  const uint32_t m_events;  // The epoll events to wait for
+  const optional<chrono::steady_clock::time_point>
+      m_deadline;  // When to give up or, for a timer, to wake up
+  int m_watched;   // The fd epoll watches, a dup if m_fd was busy, or -1
+  uint64_t m_key;  // Identifies the wait to epoll
+  multimap<chrono::steady_clock::time_point, _io_wait *>::iterator
+      m_timer;                  // The wait's timer, if it has one
+  bool m_timed;                 // Whether m_timer is set
+  bool m_finished;              // Whether the wait is over
+  bool m_ready;                 // Whether it ended because it was ready
+  coroutine_handle<> m_handle;  // The suspended coroutine
+  _resume_context m_context;    // Where to resume it
+  optional<stop_callback<_cancel>> m_on_stop;  // Ends the wait on a stop
+
+ public:
+  /** Sets up a wait. Nothing happens until it is awaited.
+   * @param _fd What to watch or -1 for a plain timer
+   * @param _events The epoll events to wait for
+   * @param _deadline When to give up, or for a timer when to wake up
+   */
+  _io_wait(const int _fd, const uint32_t _events,
+           const optional<chrono::steady_clock::time_point> _deadline)
+      : m_fd(_fd),
+        m_events(_events),
+        m_deadline(_deadline),
+        m_watched(-1),
+        m_key(0),
+        m_timer(),
+        m_timed(false),
+        m_finished(false),
+        m_ready(false),
+        m_handle(),
+        m_context(),
+        m_on_stop() {}
+
+  _io_wait(const _io_wait &) = delete;
+  _io_wait &operator=(const _io_wait &) = delete;
+
+  /** Skips suspending when the dag is already stopping.
+   * @return Whether the wait is already over
+   */
+  bool await_ready() {
+    const stop_token *stop = _stop_scope::current();
+    return stop != nullptr && stop->stop_requested();
+  }
+
+  /** Hands the wait to the reactor.
+   * @param _handle The awaiting coroutine
+   * @return False if the wait is already over and the coroutine goes on
+   */
+  bool await_suspend(const coroutine_handle<> _handle);
+
+  /** The outcome of the wait.
+   * @return True if the fd is ready or the time came
+   */
+  bool await_resume() const noexcept { return m_ready; }
+};
+
+/** The thread that resumes coroutines once what they wait on is ready.
+ *
+ * One epoll instance watches the file descriptors of every wait, a timerfd
+ * fires at the earliest deadline, and an eventfd wakes the thread when a
+ * wait is cancelled from elsewhere. The coroutines are resumed on the pools
+ * they were suspended on. Those suspended outside a pool, e.g. in sync_wait,
+ * resume on the reactor's thread, so they must not block.
+ */
+class _reactor {
+ private:
+  static constexpr uint64_t wake_key = 0;   // Identifies the eventfd
+  static constexpr uint64_t timer_key = 1;  // Identifies the timerfd
+
+  const int m_epoll;  // Watches everything or -1 if it could not be made
+  const int m_timer;  // Fires at the earliest deadline
+  const int m_wake;   // Wakes the thread
+  mutex m_mutex;      // Guards the waits
+  unordered_map<uint64_t, _io_wait *> m_watching;  // Waits on fds by key
+  multimap<chrono::steady_clock::time_point, _io_wait *>
+      m_timers;                // Waits with a deadline, earliest first
+  vector<_io_wait *> m_done;   // Waits that are over but not resumed yet
+  uint64_t m_next_key;         // The key of the next wait on an fd
+  chrono::steady_clock::time_point m_armed;  // When the timerfd fires
+  jthread m_thread;                          // Runs the loop
+
+  /** Makes the timerfd fire at the earliest deadline. Needs m_mutex. */
+  void arm() {
+    const auto earliest = m_timers.empty()
+                              ? chrono::steady_clock::time_point::max()
+                              : m_timers.begin()->first;
+    if (earliest == m_armed) return;
+    m_armed = earliest;
+    itimerspec spec{};
+    if (!m_timers.empty()) {
+      // steady_clock is CLOCK_MONOTONIC. Zero would disarm the timer.
+      const auto since = max<chrono::nanoseconds>(
+          earliest.time_since_epoch(), chrono::nanoseconds(1));
+      spec.it_value.tv_sec = chrono::duration_cast<chrono::seconds>(since)
+                                 .count();
+      spec.it_value.tv_nsec = (since % chrono::seconds(1)).count();
+    }
+    timerfd_settime(m_timer, TFD_TIMER_ABSTIME, &spec, nullptr);
+  }
+
+  /** Ends a wait and queues its coroutine to be resumed. Needs m_mutex.
+   * @param _wait The wait
+   * @param _ready Whether it ended because it was ready
+   */
+  void finish(_io_wait &_wait, const bool _ready) {
+    if (_wait.m_finished) return;
+    _wait.m_finished = true;
+    _wait.m_ready = _ready;
+    if (_wait.m_watched >= 0) {
+      epoll_ctl(m_epoll, EPOLL_CTL_DEL, _wait.m_watched, nullptr);
+      if (_wait.m_watched != _wait.m_fd) close(_wait.m_watched);
+      m_watching.erase(_wait.m_key);
+      _wait.m_watched = -1;
+    }
+    if (_wait.m_timed) {
+      m_timers.erase(_wait.m_timer);
+      _wait.m_timed = false;
+    }
+    m_done.push_back(&_wait);
+  }
+
+  /** Wakes the reactor's thread. */
+  void wake() const {
+    const uint64_t one = 1;
+    [[maybe_unused]] const ssize_t written = write(m_wake, &one, sizeof(one));
+  }
+
+  /** Waits without the reactor, blocking the calling thread. Only used if
+   * the reactor could not be set up.
+   * @param _wait The wait
+   * @return Whether the fd is ready or the time came
+   */
+  static bool wait_in_place(const _io_wait &_wait) {
+    if (_wait.m_fd < 0) {
+      if (_wait.m_deadline) this_thread::sleep_until(*_wait.m_deadline);
+      return true;
+    }
+    int timeout = -1;
+    if (_wait.m_deadline)
+      timeout = static_cast<int>(max<int64_t>(
+          0, chrono::ceil<chrono::milliseconds>(*_wait.m_deadline -
+                                                chrono::steady_clock::now())
+                 .count()));
+    pollfd watched{_wait.m_fd, static_cast<short>(_wait.m_events), 0};
+    return poll(&watched, 1, timeout) != 0;
+  }
+
+  /** The thread: ends the waits whose fd is ready or whose time came and
+   * resumes their coroutines.
+   * @param _stop Set when the reactor is destroyed
+   */
+  void run(const stop_token _stop) {
+    epoll_event events[64];
+    vector<_io_wait *> done;
+    while (!_stop.stop_requested()) {
+      const int count = epoll_wait(m_epoll, events, 64, -1);
+      {
+        lock_guard<mutex> lock(m_mutex);
+        for (int i = 0; i < count; i++) {
+          uint64_t drained;
+          const uint64_t key = events[i].data.u64;
+          if (key == wake_key || key == timer_key) {
+            [[maybe_unused]] const ssize_t read_bytes =
+                read(key == wake_key ? m_wake : m_timer, &drained,
+                     sizeof(drained));
+            if (key == timer_key) m_armed = chrono::steady_clock::time_point();
+          } else if (auto it = m_watching.find(key); it != m_watching.end()) {
+            // The wait may have been cancelled since epoll_wait returned
+            finish(*it->second, true);
+          }
+        }
+        const auto now = chrono::steady_clock::now();
+        while (!m_timers.empty() && m_timers.begin()->first <= now) {
+          _io_wait &expired = *m_timers.begin()->second;
+          finish(expired, expired.m_fd < 0);
+        }
+        arm();
+        done.swap(m_done);
+      }
+      // Nothing touches a wait once its coroutine is resumed
+      for (_io_wait *wait : done) {
+        const coroutine_handle<> handle = wait->m_handle;
+        const _resume_context context = wait->m_context;
+        context.post(handle);
+      }
+      done.clear();
+    }
+  }
+
+ public:
+  /** Sets up epoll and starts the thread. */
+  _reactor()
+      : m_epoll(epoll_create1(EPOLL_CLOEXEC)),
+        m_timer(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+        m_wake(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+        m_mutex(),
+        m_watching(),
+        m_timers(),
+        m_done(),
+        m_next_key(timer_key + 1),
+        m_armed(chrono::steady_clock::time_point::max()),
+        m_thread() {
+    if (m_epoll < 0 || m_timer < 0 || m_wake < 0) return;
+    epoll_event wake_event{EPOLLIN, {.u64 = wake_key}};
+    epoll_event timer_event{EPOLLIN, {.u64 = timer_key}};
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &wake_event) != 0 ||
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_timer, &timer_event) != 0)
+      return;
+    m_thread = jthread([this](const stop_token _stop) { run(_stop); });
+  }
+
+  /** Stops the thread. Coroutines still waiting are never resumed. */
+  ~_reactor() {
+    if (m_thread.joinable()) {
+      m_thread.request_stop();
+      wake();
+      m_thread.join();
+    }
+    for (const int fd : {m_epoll, m_timer, m_wake})
+      if (fd >= 0) close(fd);
+  }
+
+  _reactor(const _reactor &) = delete;
+  _reactor &operator=(const _reactor &) = delete;
+
+  /** The reactor every coroutine waits on. Started on first use.
+   * @return The reactor
+   */
+  static _reactor &instance() {
+    static _reactor reactor;
+    return reactor;
+  }
+
+  /** Starts watching for the end of a wait.
+   *
+   * @param _wait The wait. Its coroutine is resumed once it is over.
+   * @return False if the wait is already over, e.g. because it was
+   * cancelled or the fd can't be watched, and the coroutine goes on.
+   */
+  bool watch(_io_wait &_wait) {
+    if (!m_thread.joinable()) {
+      _wait.m_ready = wait_in_place(_wait);
+      return false;
+    }
+    lock_guard<mutex> lock(m_mutex);
+    if (_wait.m_finished) return false;
+    if (_wait.m_fd >= 0) {
+      const uint64_t key = m_next_key++;
+      epoll_event event{_wait.m_events | EPOLLONESHOT, {.u64 = key}};
+      int watched = _wait.m_fd;
+      int added = epoll_ctl(m_epoll, EPOLL_CTL_ADD, watched, &event);
+      if (added != 0 && errno == EEXIST) {
+        // Another coroutine waits on the fd. epoll tells dups apart.
+        watched = dup(_wait.m_fd);
+        added = watched < 0
+                    ? -1
+                    : epoll_ctl(m_epoll, EPOLL_CTL_ADD, watched, &event);
+        if (added != 0 && watched >= 0) close(watched);
+      }
+      if (added != 0) {
+        _wait.m_finished = true;
+        _wait.m_ready = true;
+        return false;
+      }
+      _wait.m_watched = watched;
+      _wait.m_key = key;
+      m_watching.emplace(key, &_wait);
+    }
+    if (_wait.m_deadline) {
+      _wait.m_timer = m_timers.emplace(*_wait.m_deadline, &_wait);
+      _wait.m_timed = true;
+      arm();
+    }
+    return true;
+  }
+
+  /** Ends a wait early. Its coroutine is resumed with false.
+   * @param _wait The wait
+   */
+  void cancel(_io_wait &_wait) {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      // A wait not watched yet is not queued: watch sees it is over
+      if (_wait.m_finished) return;
+      if (_wait.m_watched < 0 && !_wait.m_timed) {
+        _wait.m_finished = true;
+        return;
+      }
+      finish(_wait, false);
+    }
+    wake();
+  }
+};
+
+inline void _io_wait::_cancel::operator()() const noexcept {
+  _reactor::instance().cancel(*wait);
+}
+
+inline bool _io_wait::await_suspend(const coroutine_handle<> _handle) {
+  m_handle = _handle;
+  m_context = _resume_context::capture();
+  // Before watching: once watched, the coroutine may resume at any time
+  if (m_context.stop != nullptr)
+    m_on_stop.emplace(*m_context.stop, _cancel{this});
+  return _reactor::instance().watch(*this);
+}
+
+/** When a wait on an fd gives up.
+ * @param _timeout How long to wait at most. Zero waits as long as it takes.
+ * @return The deadline, if there is one
+ */
+inline optional<chrono::steady_clock::time_point> _wait_deadline(
+    const chrono::nanoseconds _timeout) {
+  if (_timeout.count() <= 0) return nullopt;
+  return chrono::steady_clock::now() + _timeout;
+}
+
+/** Waits until an fd can be read from, without holding the thread.
+ *
+ * @param _fd The fd
+ * @param _timeout How long to wait at most. Zero waits as long as it takes.
+ * @return What to co_await. Gives true once the fd is readable, false if it
+ * timed out or the dag is stopping.
+ */
+inline _io_wait async_readable(
+    const int _fd, const chrono::nanoseconds _timeout = {}) {
+  return _io_wait(_fd, EPOLLIN | EPOLLRDHUP, _wait_deadline(_timeout));
+}
+
+/** Waits until an fd can be written to, without holding the thread.
+ *
+ * @param _fd The fd
+ * @param _timeout How long to wait at most. Zero waits as long as it takes.
+ * @return What to co_await. Gives true once the fd is writable, false if it
+ * timed out or the dag is stopping.
+ */
+inline _io_wait async_writable(
+    const int _fd, const chrono::nanoseconds _timeout = {}) {
+  return _io_wait(_fd, EPOLLOUT, _wait_deadline(_timeout));
+}
+
+/** Waits for a while, without holding the thread.
+ *
+ * @param _duration How long
+ * @return What to co_await. Gives true once the time passed, false if the
+ * dag is stopping.
+ */
+inline _io_wait async_sleep(const chrono::nanoseconds _duration) {
+  return _io_wait(-1, 0, chrono::steady_clock::now() + _duration);
+}
+#endif
+}  // namespace fn_dag
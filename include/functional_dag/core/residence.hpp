@@ -0,0 +1,22 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <cstdint>
+
+namespace fn_dag {
+using namespace std;
+
+/** Where a node runs. Mirrors PS_TYPE of the node specs. */
+enum class node_residence : uint8_t {
+  THREAD = 0,  ///< On the dag's threads, in this process.
+  FORK,        ///< In a child process, fed through shared memory.
+};
+}  // namespace fn_dag
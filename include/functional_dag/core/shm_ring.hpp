@@ -0,0 +1,334 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <span>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <ctime>
+#endif
+
+namespace fn_dag {
+using namespace std;
+
+#if defined(__linux__)
+/** A region of memory shared with the child processes forked after it was
+ * mapped. It is backed by a memfd, so it could also be passed to a process
+ * that was not forked from this one. */
+class _shared_memory {
+ private:
+  byte *m_data;   // The mapping or nullptr if it failed
+  size_t m_size;  // How many bytes are mapped
+
+ public:
+  /** Maps a zeroed region.
+   * @param _size How many bytes
+   */
+  explicit _shared_memory(const size_t _size) : m_data(nullptr), m_size(0) {
+    const int fd = memfd_create("fn_dag_shm", MFD_CLOEXEC);
+    if (fd < 0) return;
+    if (ftruncate(fd, static_cast<off_t>(_size)) == 0) {
+      void *data =
+          mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (data != MAP_FAILED) {
+        m_data = static_cast<byte *>(data);
+        m_size = _size;
+      }
+    }
+    close(fd);
+  }
+
+  /** Unmaps the region in this process. */
+  ~_shared_memory() {
+    if (m_data != nullptr) munmap(m_data, m_size);
+  }
+
+  _shared_memory(const _shared_memory &) = delete;
+  _shared_memory &operator=(const _shared_memory &) = delete;
+
+  /** Getter for the region
+   * @return The first byte or nullptr if mapping failed
+   */
+  byte *data() const { return m_data; }
+};
+
+/** A counter in shared memory that processes can sleep on with a futex. */
+struct alignas(64) _shm_counter {
+  atomic<uint32_t> value;     // The counter itself
+  atomic<uint32_t> sleepers;  // How many threads sleep until it changes
+
+  static_assert(atomic<uint32_t>::is_always_lock_free,
+                "Futexes need lock-free 32 bit atomics");
+
+  /** Sleeps until the counter is no longer the given value or the timeout
+   * passed. May return early.
+   *
+   * @param _seen The value the caller saw
+   * @param _timeout How long to sleep at most
+   */
+  void wait(const uint32_t _seen, const chrono::nanoseconds _timeout) {
+    const auto seconds = chrono::duration_cast<chrono::seconds>(_timeout);
+    const timespec relative{
+        .tv_sec = static_cast<time_t>(seconds.count()),
+        .tv_nsec = static_cast<long>((_timeout - seconds).count())};
+    sleepers.fetch_add(1);
+    // The kernel rechecks the value, so a change after the load isn't lost
+    if (value.load() == _seen)
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&value), FUTEX_WAIT,
+              _seen, &relative, nullptr, 0);
+    sleepers.fetch_sub(1);
+  }
+
+  /** Publishes a new value and wakes whoever sleeps on the counter.
+   * @param _value The new value
+   */
+  void publish(const uint32_t _value) {
+    value.store(_value);
+    if (sleepers.load() > 0)
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&value), FUTEX_WAKE,
+              INT32_MAX, nullptr, nullptr, 0);
+  }
+};
+
+/** A single producer, single consumer ring of variable size records in
+ * shared memory.
+ *
+ * The ring is cut into blocks of one cache line. Every record starts on a
+ * block of its own with a header that holds its length, followed by its
+ * bytes, so records of any size up to the ring's capacity fit. A record
+ * that would run past the end of the ring is put at its start instead, and
+ * the blocks it skipped are handed over as padding that the consumer steps
+ * over.
+ *
+ * The producer and the consumer may live in different processes. Both spin
+ * briefly and then sleep on a futex, so an idle ring costs nothing and a
+ * busy one makes no system calls except to wake a sleeper.
+ */
+class _shm_ring {
+ private:
+  /** The state shared by both ends, at the start of the ring's memory. */
+  struct _control {
+    _shm_counter head;        // How many blocks the consumer released
+    _shm_counter tail;        // How many blocks the producer committed
+    atomic<uint32_t> closed;  // Set when the producer gives up for good
+  };
+
+  /** What comes before the bytes of every record. */
+  struct alignas(64) _record {
+    uint32_t blocks;  // How many blocks the record takes, header and all
+    uint32_t bytes;   // How long the record is or padding if it is skipped
+  };
+
+  static constexpr uint32_t padding = UINT32_MAX;  // Marks skipped blocks
+  static constexpr int spins = 256;                // Polls before sleeping
+
+  _control *m_control;    // The shared state
+  byte *m_blocks;         // The first block
+  const uint32_t m_size;  // How many blocks there are
+  uint32_t m_reserved;    // Blocks the producer is filling
+  uint32_t m_taken;       // Blocks the consumer is reading
+
+  /** Waits until a counter is no longer the given value. Gives up early
+   * once the ring is closed.
+   *
+   * @param _counter The counter to watch
+   * @param _seen The value it had
+   * @param _timeout How long to wait at most
+   * @return Whether it changed before the timeout
+   */
+  bool await_change(_shm_counter &_counter, const uint32_t _seen,
+                    const chrono::nanoseconds _timeout) {
+    for (int i = 0; i < spins; i++)
+      if (_counter.value.load(memory_order_acquire) != _seen) return true;
+    const auto deadline = chrono::steady_clock::now() + _timeout;
+    while (_counter.value.load(memory_order_acquire) == _seen) {
+      if (closed()) return false;
+      const auto left = deadline - chrono::steady_clock::now();
+      if (left <= chrono::nanoseconds(0)) return false;
+      _counter.wait(_seen, left);
+    }
+    return true;
+  }
+
+  /** Producer: waits until the consumer freed enough blocks.
+   * @param _blocks How many blocks have to be free
+   * @param _timeout How long to wait at most
+   * @return Whether they were freed before the timeout
+   */
+  bool await_free(const uint32_t _blocks, const chrono::nanoseconds _timeout) {
+    const uint32_t tail = m_control->tail.value.load(memory_order_relaxed);
+    uint32_t head = m_control->head.value.load(memory_order_acquire);
+    while (m_size - (tail - head) < _blocks) {
+      if (!await_change(m_control->head, head, _timeout)) return false;
+      head = m_control->head.value.load(memory_order_acquire);
+    }
+    return true;
+  }
+
+  /** Finds the header of a block.
+   * @param _counter A head or tail
+   * @return The header of the block the counter points at
+   */
+  _record *record_at(const uint32_t _counter) const {
+    return reinterpret_cast<_record *>(m_blocks +
+                                       (_counter % m_size) * block_bytes);
+  }
+
+ public:
+  static constexpr size_t block_bytes = sizeof(_record);  // One cache line
+
+  /** How many blocks a record takes.
+   * @param _bytes How long the record is
+   * @return The blocks for its header and its bytes
+   */
+  static constexpr uint32_t blocks_for(const size_t _bytes) {
+    return static_cast<uint32_t>(1 + (_bytes + block_bytes - 1) / block_bytes);
+  }
+
+  /** How many blocks a ring needs to hold records at once.
+   * @param _records How many records
+   * @param _bytes How long each of them is at most
+   * @return The blocks, rounded up to a power of two
+   */
+  static constexpr uint32_t blocks_to_hold(const uint32_t _records,
+                                           const size_t _bytes) {
+    return bit_ceil(_records * blocks_for(_bytes));
+  }
+
+  /** How much memory a ring takes.
+   * @param _size How many blocks. A power of two.
+   * @return The bytes to reserve for the ring, a multiple of 64
+   */
+  static constexpr size_t bytes_needed(const uint32_t _size) {
+    return sizeof(_control) + _size * block_bytes;
+  }
+
+  /** Lays a new, empty ring out in shared memory.
+   *
+   * @param _memory Where the ring lives. bytes_needed() bytes aligned to 64.
+   * @param _size How many blocks. A power of two, so the counters wrap
+   * around on a block boundary.
+   */
+  _shm_ring(byte *const _memory, const uint32_t _size)
+      : m_control(new (_memory) _control{}),
+        m_blocks(_memory + sizeof(_control)),
+        m_size(_size),
+        m_reserved(0),
+        m_taken(0) {}
+
+  /** Whether a record fits into the ring at all.
+   * @param _bytes How long the record is
+   * @return False if it is longer than the ring
+   */
+  bool fits(const size_t _bytes) const {
+    return _bytes < padding && blocks_for(_bytes) <= m_size;
+  }
+
+  /** Producer: waits for room for a record.
+   * @param _bytes How long the record is. It has to fit.
+   * @param _timeout How long to wait at most, for each end of the ring
+   * @return Where to write the record, aligned to 64, or nullptr if the ring
+   * stayed full
+   */
+  byte *wait_writable(const size_t _bytes,
+                      const chrono::nanoseconds _timeout) {
+    if (!fits(_bytes)) return nullptr;
+    const uint32_t blocks = blocks_for(_bytes);
+    uint32_t tail = m_control->tail.value.load(memory_order_relaxed);
+    if (const uint32_t left = m_size - tail % m_size; left < blocks) {
+      // Skip to the start, where the record is in one piece
+      if (!await_free(left, _timeout)) return nullptr;
+      *record_at(tail) = {.blocks = left, .bytes = padding};
+      tail += left;
+      m_control->tail.publish(tail);
+    }
+    if (!await_free(blocks, _timeout)) return nullptr;
+    _record *record = record_at(tail);
+    *record = {.blocks = blocks, .bytes = static_cast<uint32_t>(_bytes)};
+    m_reserved = blocks;
+    return reinterpret_cast<byte *>(record + 1);
+  }
+
+  /** Producer: hands the record from wait_writable to the consumer. */
+  void commit() {
+    m_control->tail.publish(m_control->tail.value.load(memory_order_relaxed) +
+                            m_reserved);
+    m_reserved = 0;
+  }
+
+  /** Consumer: waits for a committed record.
+   * @param _timeout How long to wait at most
+   * @return The bytes of the oldest committed record, or nothing if the ring
+   * stayed empty
+   */
+  optional<span<byte>> wait_readable(const chrono::nanoseconds _timeout) {
+    while (true) {
+      const uint32_t head = m_control->head.value.load(memory_order_relaxed);
+      if (m_control->tail.value.load(memory_order_acquire) == head &&
+          !await_change(m_control->tail, head, _timeout))
+        return nullopt;
+      _record *record = record_at(head);
+      if (record->bytes == padding) {
+        m_control->head.publish(head + record->blocks);
+        continue;
+      }
+      m_taken = record->blocks;
+      return span<byte>(reinterpret_cast<byte *>(record + 1), record->bytes);
+    }
+  }
+
+  /** Consumer: gives the record from wait_readable back to the producer. */
+  void release() {
+    m_control->head.publish(m_control->head.value.load(memory_order_relaxed) +
+                            m_taken);
+    m_taken = 0;
+  }
+
+  /** Tells the consumer nothing more will come and wakes it up. */
+  void close() {
+    m_control->closed.store(1);
+    m_control->tail.publish(m_control->tail.value.load());
+  }
+
+  /** Whether the producer closed the ring.
+   * @return True once close() was called
+   */
+  bool closed() const { return m_control->closed.load() != 0; }
+
+  /** Empties and reopens the ring. Only safe when neither end uses it, e.g.
+   * once the process at the other end died.
+   */
+  void reset() {
+    m_control->head.value.store(0);
+    m_control->tail.value.store(0);
+    m_control->closed.store(0);
+    m_reserved = 0;
+    m_taken = 0;
+  }
+
+  /** Getter for the number of blocks
+   * @return How many blocks of 64 bytes there are
+   */
+  uint32_t size() const { return m_size; }
+};
+#endif
+}  // namespace fn_dag
@@ -0,0 +1,252 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <functional_dag/core/cancellation.hpp>
+#include <functional_dag/core/source_pacing.hpp>
+#include <functional_dag/core/thread_placement.hpp>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+
+namespace fn_dag {
+using namespace std;
+
+/** The thread that calls a dag's source, paced the way the source asked.
+ *
+ * The thread stops when it is asked to directly or when the dags stop. Its
+ * sleeps wake up as soon as either happens.
+ */
+class _source_loop {
+ private:
+  _pacing_meter m_pacing;  // How well the source keeps its pace
+  mutex m_sleep_mutex;     // Guards m_generating and m_placement, used to
+                           // sleep the source
+  condition_variable_any
+      m_sleep_cv;     // Wakes the source thread early, or a stop waiter
+  bool m_generating;  // Whether the source thread is still running
+  thread_placement m_placement;   // Where the source thread runs
+  atomic<bool> m_placement_dirty;  // Whether the thread has to apply it again
+  function<bool()> m_tick;  // Calls the source once and propagates its output
+  function<bool(chrono::nanoseconds)>
+      m_wait_for_data;  // Blocks until the source has data ready
+  jthread m_thread;     // The thread calling the source
+  optional<stop_callback<function<void()>>>
+      m_forward_stop;  // Stops the source thread when the dags stop
+
+  static constexpr auto min_idle_backoff =
+      chrono::microseconds(50);  // First sleep after the source had no data
+  static constexpr auto max_idle_backoff =
+      chrono::milliseconds(10);  // Longest sleep while the source has no data
+
+  /** Applies the placement to the source thread if it changed. */
+  void place() {
+    if (!m_placement_dirty.exchange(false)) return;
+    thread_placement placement;
+    {
+      lock_guard<mutex> lock(m_sleep_mutex);
+      placement = m_placement;
+    }
+    apply_placement(placement);
+  }
+
+  /** Calls the source once and counts it.
+   * @return Whether the source had data
+   */
+  bool tick() {
+    place();
+    const bool had_data = m_tick();
+    m_pacing.tick(had_data);
+    return had_data;
+  }
+
+  /** Sleeps until the deadline unless the source thread is asked to stop.
+   *
+   * @param _stop The source thread's stop token
+   * @param _deadline When to wake up
+   * @return Whether the thread should keep going
+   */
+  bool sleep_until(const stop_token &_stop,
+                   const chrono::steady_clock::time_point _deadline) {
+    unique_lock<mutex> lock(m_sleep_mutex);
+    m_sleep_cv.wait_until(lock, _stop, _deadline, []() { return false; });
+    return !_stop.stop_requested();
+  }
+
+  /** The thread function. Loops until asked to stop.
+   *
+   * The stop token is current for the source so it can abort blocking reads.
+   *
+   * @param _stop Set when the source thread should stop
+   * @param _pacing How the source wants to be called
+   */
+  void run(const stop_token _stop, const source_pacing _pacing) {
+    {
+      place();
+      _stop_scope scope(_stop);
+      if (_pacing.mode == pacing_mode::FIXED_RATE &&
+          _pacing.period > chrono::nanoseconds(0))
+        run_fixed_rate(_stop, _pacing.period);
+      else if (_pacing.mode == pacing_mode::WAIT_FOR_DATA)
+        run_when_ready(_stop, _pacing.period);
+      else
+        run_max_rate(_stop);
+    }
+    lock_guard<mutex> lock(m_sleep_mutex);
+    m_generating = false;
+    m_sleep_cv.notify_all();
+  }
+
+  /** Calls the source back to back. While it has no data, the thread sleeps
+   * for exponentially longer up to max_idle_backoff.
+   *
+   * @param _stop Set when the source thread should stop
+   */
+  void run_max_rate(const stop_token &_stop) {
+    chrono::microseconds backoff(0);
+    while (!_stop.stop_requested()) {
+      if (tick()) {
+        backoff = chrono::microseconds(0);
+      } else {
+        backoff = clamp<chrono::microseconds>(backoff * 2, min_idle_backoff,
+                                              max_idle_backoff);
+        sleep_until(_stop, chrono::steady_clock::now() + backoff);
+      }
+    }
+  }
+
+  /** Calls the source once per period.
+   *
+   * Deadlines are multiples of the period from the start so they do not drift
+   * with how long each tick takes. If a tick overruns whole periods, those
+   * deadlines are skipped and counted as missed instead of bursting to catch
+   * up.
+   *
+   * @param _stop Set when the source thread should stop
+   * @param _period Time between two calls
+   */
+  void run_fixed_rate(const stop_token &_stop,
+                      const chrono::nanoseconds _period) {
+    auto deadline = chrono::steady_clock::now();
+    while (!_stop.stop_requested()) {
+      tick();
+      deadline += _period;
+      if (const auto behind = chrono::steady_clock::now() - deadline;
+          behind >= _period) {
+        const auto skipped = behind / _period;
+        m_pacing.missed(static_cast<uint64_t>(skipped));
+        deadline += skipped * _period;
+      }
+      if (!sleep_until(_stop, deadline)) break;
+      m_pacing.wake_up(chrono::steady_clock::now() - deadline);
+    }
+  }
+
+  /** Calls the source whenever it says it has data ready.
+   *
+   * @param _stop Set when the source thread should stop
+   * @param _timeout How long the source may block before the thread checks
+   * whether it was asked to stop.
+   */
+  void run_when_ready(const stop_token &_stop,
+                      const chrono::nanoseconds _timeout) {
+    while (!_stop.stop_requested())
+      if (m_wait_for_data(_timeout) && !_stop.stop_requested()) tick();
+  }
+
+ public:
+  /** Default constructor. Nothing runs until start is called. */
+  _source_loop()
+      : m_pacing(),
+        m_generating(false),
+        m_placement(),
+        m_placement_dirty(false) {}
+
+  /** Stops the thread and waits for it. */
+  ~_source_loop() { join(); }
+
+  _source_loop(const _source_loop &) = delete;
+  _source_loop &operator=(const _source_loop &) = delete;
+
+  /** Starts the thread.
+   *
+   * @param _dags_stop Set when all of the dags stop
+   * @param _pacing How the source wants to be called
+   * @param _tick Calls the source once and propagates its output. Returns
+   * whether the source had data.
+   * @param _wait_for_data Blocks until the source has data ready or the
+   * timeout passed. Only used with WAIT_FOR_DATA.
+   */
+  void start(const stop_token &_dags_stop, const source_pacing _pacing,
+             function<bool()> _tick,
+             function<bool(chrono::nanoseconds)> _wait_for_data) {
+    m_tick = std::move(_tick);
+    m_wait_for_data = std::move(_wait_for_data);
+    m_generating = true;
+    m_thread =
+        jthread([this, _pacing](stop_token _stop) { run(_stop, _pacing); });
+    m_forward_stop.emplace(_dags_stop, [this]() { m_thread.request_stop(); });
+  }
+
+  /** Changes where the thread runs. A running thread moves before it calls
+   * the source again.
+   *
+   * @param _placement Where the thread should run
+   */
+  void set_placement(const thread_placement &_placement) {
+    {
+      lock_guard<mutex> lock(m_sleep_mutex);
+      m_placement = _placement;
+    }
+    m_placement_dirty.store(true);
+  }
+
+  /** Counts a call to the source made outside of the thread.
+   * @param _had_data Whether the source had data
+   */
+  void count(const bool _had_data) { m_pacing.tick(_had_data); }
+
+  /** Stops the thread and waits for it, however long that takes. */
+  void join() {
+    m_forward_stop.reset();
+    if (m_thread.joinable()) {
+      m_thread.request_stop();
+      m_thread.join();
+    }
+  }
+
+  /** Stops calling the source and waits for the thread to finish
+   *
+   * A thread that is sleeping wakes up right away. One blocked in the source
+   * only returns once the source notices current_stop_token() was stopped.
+   *
+   * @param _deadline When to give up waiting
+   * @return Whether the thread finished in time
+   */
+  bool stop(const chrono::steady_clock::time_point _deadline) {
+    m_thread.request_stop();
+    unique_lock<mutex> lock(m_sleep_mutex);
+    return m_sleep_cv.wait_until(lock, _deadline,
+                                 [this]() { return !m_generating; });
+  }
+
+  /** Reads how well the source kept its pace
+   * @return A snapshot of the pacing counters
+   */
+  pacing_stats stats() const { return m_pacing.snapshot(); }
+};
+}  // namespace fn_dag
@@ -0,0 +1,112 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace fn_dag {
+using namespace std;
+
+/** How a dag's thread decides when to call its source again */
+enum class pacing_mode : uint8_t {
+  MAX_RATE = 0,   ///< As fast as possible, backing off while there is no data.
+  FIXED_RATE,     ///< Once per period, on drift-compensated deadlines.
+  WAIT_FOR_DATA,  ///< Whenever the source says its data is ready.
+};
+
+/** What a source declares about how it should be called. */
+struct source_pacing {
+  /// How the source is paced
+  pacing_mode mode = pacing_mode::MAX_RATE;
+  /// The period of a fixed rate source, or how long a waiting source waits
+  /// at most before the dag checks whether it was asked to stop.
+  chrono::nanoseconds period = chrono::milliseconds(100);
+};
+
+/** A snapshot of how well a source kept its pace. */
+struct pacing_stats {
+  /// How many times the source was called
+  uint64_t ticks;
+  /// How many times the source had no data
+  uint64_t idle_ticks;
+  /// How many fixed rate deadlines were skipped because a tick ran too long
+  uint64_t missed_deadlines;
+  /// The mean of how late the thread woke up for a deadline
+  chrono::nanoseconds mean_jitter;
+  /// The worst of how late the thread woke up for a deadline
+  chrono::nanoseconds max_jitter;
+};
+
+/** Lock-free counters a dag's thread keeps about its source's pace. Readers
+ * on other threads take snapshots. */
+class _pacing_meter {
+ private:
+  atomic<uint64_t> m_ticks;           // Times the source was called
+  atomic<uint64_t> m_idle_ticks;      // Times the source had no data
+  atomic<uint64_t> m_missed;          // Skipped fixed rate deadlines
+  atomic<uint64_t> m_jitter_samples;  // Deadlines measured
+  atomic<int64_t> m_jitter_sum_ns;    // Total lateness
+  atomic<int64_t> m_jitter_max_ns;    // Worst lateness
+
+ public:
+  /** Default constructor. Everything starts at zero. */
+  _pacing_meter()
+      : m_ticks(0),
+        m_idle_ticks(0),
+        m_missed(0),
+        m_jitter_samples(0),
+        m_jitter_sum_ns(0),
+        m_jitter_max_ns(0) {}
+
+  /** Records a call to the source.
+   * @param _had_data Whether the source returned data
+   */
+  void tick(const bool _had_data) {
+    m_ticks.fetch_add(1, memory_order_relaxed);
+    if (!_had_data) m_idle_ticks.fetch_add(1, memory_order_relaxed);
+  }
+
+  /** Records how late the thread woke up for a deadline.
+   * @param _lateness Time between the deadline and the wake up
+   */
+  void wake_up(const chrono::nanoseconds _lateness) {
+    const int64_t ns = _lateness.count() < 0 ? 0 : _lateness.count();
+    m_jitter_samples.fetch_add(1, memory_order_relaxed);
+    m_jitter_sum_ns.fetch_add(ns, memory_order_relaxed);
+    int64_t worst = m_jitter_max_ns.load(memory_order_relaxed);
+    while (ns > worst && !m_jitter_max_ns.compare_exchange_weak(worst, ns)) {
+    }
+  }
+
+  /** Records deadlines that were skipped.
+   * @param _count How many were skipped
+   */
+  void missed(const uint64_t _count) {
+    m_missed.fetch_add(_count, memory_order_relaxed);
+  }
+
+  /** Takes a snapshot of the counters.
+   * @return The counters at about this point in time
+   */
+  pacing_stats snapshot() const {
+    const uint64_t samples = m_jitter_samples.load(memory_order_relaxed);
+    const int64_t sum = m_jitter_sum_ns.load(memory_order_relaxed);
+    const int64_t worst = m_jitter_max_ns.load(memory_order_relaxed);
+    return {.ticks = m_ticks.load(memory_order_relaxed),
+            .idle_ticks = m_idle_ticks.load(memory_order_relaxed),
+            .missed_deadlines = m_missed.load(memory_order_relaxed),
+            .mean_jitter = chrono::nanoseconds(
+                samples == 0 ? 0 : sum / static_cast<int64_t>(samples)),
+            .max_jitter = chrono::nanoseconds(worst)};
+  }
+};
+}  // namespace fn_dag
\ No newline at end of file
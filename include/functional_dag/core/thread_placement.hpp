@@ -0,0 +1,154 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fn_dag {
+using namespace std;
+
+/** Where a thread of the dag runs and how urgently. */
+struct thread_placement {
+  /// The cores the thread may run on. Empty leaves it to numa_node or the OS.
+  vector<uint32_t> cores;
+  /// The NUMA node to run on and allocate from, or -1 for any. The cores of
+  /// the node are used when no cores are given.
+  int numa_node = -1;
+  /// The SCHED_FIFO priority, from 1 to 99, or 0 for the default scheduler.
+  int fifo_priority = 0;
+
+  /** Whether there is nothing to apply
+   * @return True if the thread may run anywhere with the default scheduler
+   */
+  bool empty() const {
+    return cores.empty() && numa_node < 0 && fifo_priority <= 0;
+  }
+};
+
+/** What of its placement a thread actually got. The parts that need
+ * privileges the process does not have are skipped. */
+struct placement_result {
+  /// Whether the thread is pinned to the cores asked for
+  bool pinned;
+  /// Whether the thread prefers memory from the NUMA node asked for
+  bool numa_bound;
+  /// Whether the thread runs with the SCHED_FIFO priority asked for
+  bool realtime;
+};
+
+/** Reads which cores belong to a NUMA node.
+ *
+ * @param _node The NUMA node
+ * @return Its cores, or none if the node or sysfs are missing.
+ */
+inline vector<uint32_t> numa_node_cores(const int _node) {
+  vector<uint32_t> cores;
+  ifstream file("/sys/devices/system/node/node" + to_string(_node) +
+                "/cpulist");
+  string range;
+  // The list looks like 0-3,8-11
+  while (getline(file, range, ',')) {
+    uint32_t first = 0, last = 0;
+    char dash = 0;
+    istringstream parse(range);
+    if (!(parse >> first)) break;
+    if (!(parse >> dash >> last)) last = first;
+    for (uint32_t core = first; core <= last; core++) cores.push_back(core);
+  }
+  return cores;
+}
+
+/** Places the calling thread.
+ *
+ * Every part of the placement is tried on its own, so e.g. a process that
+ * may not use real-time priorities still gets its threads pinned.
+ *
+ * @param _placement Where and how urgently the thread should run
+ * @return What the thread got. Nothing outside of Linux.
+ */
+inline placement_result apply_placement(const thread_placement &_placement) {
+  placement_result result{.pinned = false,
+                          .numa_bound = false,
+                          .realtime = false};
+#if defined(__linux__)
+  const vector<uint32_t> cores =
+      _placement.cores.empty() && _placement.numa_node >= 0
+          ? numa_node_cores(_placement.numa_node)
+          : _placement.cores;
+  if (!cores.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const uint32_t core : cores)
+      if (core < CPU_SETSIZE) CPU_SET(core, &set);
+    result.pinned =
+        CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+  }
+
+  if (_placement.numa_node >= 0) {
+    constexpr size_t word_bits = 8 * sizeof(unsigned long);
+    const size_t node = static_cast<size_t>(_placement.numa_node);
+    vector<unsigned long> mask(node / word_bits + 1, 0);
+    mask[node / word_bits] = 1UL << (node % word_bits);
+    result.numa_bound = syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(),
+                                mask.size() * word_bits + 1) == 0;
+  }
+
+  if (_placement.fifo_priority > 0) {
+    sched_param param{};
+    param.sched_priority = _placement.fifo_priority;
+    result.realtime =
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+  }
+#endif
+  return result;
+}
+
+/** The placement of one worker of a pool. Workers are spread over the cores,
+ * one core each, so every worker keeps its own cache warm.
+ *
+ * @param _placement The placement of the pool
+ * @param _index Which worker
+ * @return The placement of the worker
+ */
+inline thread_placement _worker_placement(const thread_placement &_placement,
+                                          const size_t _index) {
+  thread_placement worker = _placement;
+  if (!_placement.cores.empty())
+    worker.cores = {_placement.cores[_index % _placement.cores.size()]};
+  return worker;
+}
+
+/** How many workers a pool with a placement should run.
+ * @param _placement The placement of the pool
+ * @return One per core it is placed on, or one if it may run anywhere
+ */
+inline uint32_t _placement_width(const thread_placement &_placement) {
+  if (!_placement.cores.empty())
+    return static_cast<uint32_t>(_placement.cores.size());
+  if (_placement.numa_node >= 0)
+    if (const auto cores = numa_node_cores(_placement.numa_node);
+        !cores.empty())
+      return static_cast<uint32_t>(cores.size());
+  return 1;
+}
+}  // namespace fn_dag
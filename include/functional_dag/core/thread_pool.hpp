@@ -0,0 +1,150 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <functional_dag/core/executor.hpp>
+#include <functional_dag/core/thread_placement.hpp>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fn_dag {
+using namespace std;
+
+/** A fixed set of long-lived worker threads that share one task queue.
+ *
+ * Instead of creating a thread per child per message, fan-out nodes submit
+ * their children as tasks here. Every submit and every pop goes through the
+ * same lock, which is simple but becomes a contention point on wide fan-outs.
+ */
+class dag_thread_pool : public _dag_executor {
+ private:
+  mutex m_mutex;                    // Guards the task queue
+  condition_variable m_cv;          // Wakes idle workers
+  deque<function<void()>> m_tasks;  // Tasks waiting for a worker
+  _deadline_queue m_urgent;         // Tasks with deadlines, run first
+  vector<thread> m_workers;         // The long-lived workers
+  bool m_stopping;                  // Set when the pool is shutting down
+
+  /** Takes the next task, the one with the earliest deadline if any has
+   * one. Needs m_mutex.
+   *
+   * @param _task Where to put the task
+   * @return Whether there was a task
+   */
+  bool pop(function<void()> &_task) {
+    if (m_urgent.pop(_task)) return true;
+    if (m_tasks.empty()) return false;
+    _task = std::move(m_tasks.front());
+    m_tasks.pop_front();
+    return true;
+  }
+
+  /** The loop every worker runs until the pool is destroyed.
+   * @param _placement Where the worker runs
+   */
+  void worker_loop(const thread_placement _placement) {
+    if (!_placement.empty()) apply_placement(_placement);
+    while (true) {
+      function<void()> task;
+      {
+        unique_lock<mutex> lock(m_mutex);
+        m_cv.wait(lock, [this] {
+          return m_stopping || !m_tasks.empty() || !m_urgent.empty();
+        });
+        if (!pop(task)) return;
+      }
+      task();
+    }
+  }
+
+ public:
+  /** Starts the workers.
+   *
+   * @param _num_workers How many workers to start. Zero means one worker per
+   * hardware thread.
+   * @param _placement Where the workers run. Each worker gets its own core of
+   * the ones listed.
+   */
+  explicit dag_thread_pool(uint32_t _num_workers,
+                           const thread_placement &_placement = {})
+      : m_stopping(false) {
+    if (_num_workers == 0) _num_workers = thread::hardware_concurrency();
+    if (_num_workers == 0) _num_workers = 1;
+    m_workers.reserve(_num_workers);
+    for (uint32_t i = 0; i < _num_workers; i++)
+      m_workers.emplace_back(&dag_thread_pool::worker_loop, this,
+                             _worker_placement(_placement, i));
+  }
+
+  /** Finishes the queued tasks and joins the workers. */
+  ~dag_thread_pool() {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_cv.notify_all();
+    for (auto &worker : m_workers) worker.join();
+  }
+
+  dag_thread_pool(const dag_thread_pool &) = delete;
+  dag_thread_pool &operator=(const dag_thread_pool &) = delete;
+
+  /** Queues a task at the back of the shared queue.
+   *
+   * @param _task The task to run.
+   */
+  void submit(function<void()> _task) override {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_tasks.push_back(std::move(_task));
+    }
+    m_cv.notify_one();
+  }
+
+  /** Queues a task ahead of the ones without a deadline, earliest deadline
+   * first.
+   *
+   * @param _task The task to run.
+   * @param _deadline When the task should be done.
+   */
+  void submit_by(function<void()> _task,
+                 const chrono::steady_clock::time_point _deadline) override {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_urgent.push(std::move(_task), _deadline);
+    }
+    m_cv.notify_one();
+  }
+
+  /** Runs the most urgent queued task on the calling thread if there is one.
+   *
+   * @return Whether a task was run.
+   */
+  bool try_run_one() override {
+    function<void()> task;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      if (!pop(task)) return false;
+    }
+    task();
+    return true;
+  }
+
+  /** Getter for the number of workers
+   * @return How many worker threads the pool runs.
+   */
+  size_t size() const override { return m_workers.size(); }
+};
+}  // namespace fn_dag
\ No newline at end of file
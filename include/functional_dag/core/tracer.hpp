@@ -0,0 +1,347 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace fn_dag {
+using namespace std;
+
+/** One span in a ring. The fields are atomics so a dump can read a ring
+ * while its thread keeps writing; a span overwritten in the meantime is
+ * skipped. */
+struct _trace_event {
+  atomic<const char *> name;  //! What ran, e.g. "update"
+  atomic<uint32_t> track;     //! Which node, see _tracer::track
+  atomic<uint64_t> frame;     //! The sequence number of the frame
+  atomic<int64_t> start_ns;   //! When it began, on the steady clock
+  atomic<int64_t> duration_ns;  //! How long it ran
+};
+
+/** The spans of one thread, newest overwriting oldest. Only its thread
+ * writes to it. */
+class _trace_ring {
+ private:
+  const thread::id m_owner;          // The thread writing to the ring
+  const uint32_t m_thread;           // The thread's number in the trace
+  const size_t m_mask;               // Capacity minus one
+  unique_ptr<_trace_event[]> m_events;  // The spans
+  atomic<uint64_t> m_head;           // How many spans were ever written
+  atomic<uint64_t> m_base;           // The first span of the current trace
+
+ public:
+  /** Creates the ring of a thread.
+   * @param _owner The thread
+   * @param _thread The thread's number in the trace
+   * @param _capacity How many spans it keeps at least. One more slot is
+   * kept for the span being written, and the total rounded up to a power of
+   * two.
+   */
+  _trace_ring(const thread::id _owner, const uint32_t _thread,
+              const size_t _capacity)
+      : m_owner(_owner),
+        m_thread(_thread),
+        m_mask(bit_ceil(max<size_t>(_capacity, 1) + 1) - 1),
+        m_events(new _trace_event[m_mask + 1]),
+        m_head(0),
+        m_base(0) {}
+
+  /** Getter for the thread writing to the ring
+   * @return Its ID
+   */
+  thread::id owner() const { return m_owner; }
+
+  /** Getter for the thread's number
+   * @return The number the trace shows the thread as
+   */
+  uint32_t thread_number() const { return m_thread; }
+
+  /** Forgets the spans of an earlier trace. */
+  void restart() { m_base.store(m_head.load()); }
+
+  /** Adds a span. Only called by the owner.
+   *
+   * @param _name What ran
+   * @param _track Which node
+   * @param _frame The sequence number of the frame
+   * @param _start_ns When it began
+   * @param _duration_ns How long it ran
+   */
+  void push(const char *const _name, const uint32_t _track,
+            const uint64_t _frame, const int64_t _start_ns,
+            const int64_t _duration_ns) {
+    const uint64_t head = m_head.load(memory_order_relaxed);
+    _trace_event &event = m_events[head & m_mask];
+    event.name.store(_name, memory_order_relaxed);
+    event.track.store(_track, memory_order_relaxed);
+    event.frame.store(_frame, memory_order_relaxed);
+    event.start_ns.store(_start_ns, memory_order_relaxed);
+    event.duration_ns.store(_duration_ns, memory_order_relaxed);
+    m_head.store(head + 1, memory_order_release);
+  }
+
+  /** Visits the spans of the current trace that were not overwritten.
+   * @param _fn Called with the name, track, frame, start and duration
+   */
+  template <typename Fn>
+  void for_each(Fn &&_fn) const {
+    const size_t capacity = m_mask + 1;
+    const uint64_t head = m_head.load(memory_order_acquire);
+    const uint64_t first =
+        max<uint64_t>(m_base.load(), head > capacity ? head - capacity : 0);
+    for (uint64_t i = first; i < head; i++) {
+      const _trace_event &event = m_events[i & m_mask];
+      const char *const name = event.name.load(memory_order_acquire);
+      const uint32_t track = event.track.load(memory_order_acquire);
+      const uint64_t frame = event.frame.load(memory_order_acquire);
+      const int64_t start = event.start_ns.load(memory_order_acquire);
+      const int64_t duration = event.duration_ns.load(memory_order_acquire);
+      // Acquired, so the head is read after the span. The owner may have
+      // lapped the reader, or be writing over this span.
+      const uint64_t now = m_head.load(memory_order_relaxed);
+      if (now >= capacity && i <= now - capacity) continue;
+      _fn(name, track, frame, start, duration);
+    }
+  }
+};
+
+/** Records which threads ran which nodes, and when, into per-thread rings,
+ * and writes them out as a Chrome trace that Perfetto and chrome://tracing
+ * open.
+ *
+ * Recording is off until start is called. While it is off a span costs a
+ * relaxed load. While it is on a span costs two reads of the clock and a
+ * few relaxed stores into the ring of the calling thread, without locks.
+ * Every thread keeps the newest spans only, so a trace left on covers the
+ * last moments before it is written out.
+ */
+class _tracer {
+ private:
+  /** The ring the calling thread last used, and whose it is. */
+  struct _cached_ring {
+    uint64_t tracer;    // The ID of the tracer the ring belongs to
+    _trace_ring *ring;  // The ring
+  };
+
+  static inline atomic<uint64_t> s_next_id = 1;  // Tells tracers apart
+  static inline thread_local _cached_ring t_ring = {0, nullptr};
+
+  const uint64_t m_id;             // Which tracer this is
+  atomic<bool> m_recording;        // Whether spans are recorded
+  atomic<size_t> m_capacity;       // Spans per thread of rings made next
+  atomic<int64_t> m_started_ns;    // When recording started
+  mutable mutex m_mutex;           // Guards the rings and the tracks
+  vector<unique_ptr<_trace_ring>> m_rings;  // Every thread's ring
+  vector<string> m_tracks;         // The ID of every node, as text
+
+  /** The time the spans are stamped with.
+   * @return Nanoseconds since the steady clock's epoch
+   */
+  static int64_t now() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  /** Finds or makes the ring of the calling thread.
+   * @return The ring
+   */
+  _trace_ring &ring() {
+    if (t_ring.tracer == m_id) return *t_ring.ring;
+    lock_guard<mutex> lock(m_mutex);
+    const thread::id self = this_thread::get_id();
+    _trace_ring *found = nullptr;
+    for (const auto &ring : m_rings)
+      if (ring->owner() == self) found = ring.get();
+    if (found == nullptr) {
+      m_rings.push_back(make_unique<_trace_ring>(
+          self, static_cast<uint32_t>(m_rings.size() + 1), m_capacity.load()));
+      found = m_rings.back().get();
+    }
+    t_ring = {m_id, found};
+    return *found;
+  }
+
+  /** Writes text as a JSON string.
+   * @param _out Where to write it
+   * @param _text The text
+   */
+  static void write_string(ostream &_out, const string_view _text) {
+    _out << '"';
+    for (const char c : _text) {
+      if (c == '"' || c == '\\') {
+        _out << '\\' << c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        _out << escaped;
+      } else {
+        _out << c;
+      }
+    }
+    _out << '"';
+  }
+
+  /** Writes nanoseconds as the microseconds Chrome traces count in.
+   * @param _out Where to write it
+   * @param _ns The nanoseconds
+   */
+  static void write_micros(ostream &_out, const int64_t _ns) {
+    char micros[32];
+    snprintf(micros, sizeof(micros), "%lld.%03lld",
+             static_cast<long long>(_ns / 1000),
+             static_cast<long long>(_ns % 1000));
+    _out << micros;
+  }
+
+ public:
+  /** A span that is recorded when it goes out of scope, if the tracer was
+   * recording when it began. */
+  class _span {
+   private:
+    _tracer *m_tracer;        // Where to record it, or nullptr
+    const char *const m_name;  // What runs
+    const uint32_t m_track;   // Which node
+    const uint64_t m_frame;   // The sequence number of the frame
+    const int64_t m_start;    // When it began
+
+   public:
+    /** Begins a span.
+     * @param _owner The tracer
+     * @param _name What runs. Must outlive the tracer, e.g. a literal.
+     * @param _track Which node, see track
+     * @param _frame The sequence number of the frame
+     */
+    _span(_tracer &_owner, const char *const _name, const uint32_t _track,
+          const uint64_t _frame)
+        : m_tracer(_owner.recording() ? &_owner : nullptr),
+          m_name(_name),
+          m_track(_track),
+          m_frame(_frame),
+          m_start(m_tracer != nullptr ? now() : 0) {}
+
+    /** Leaves the span out of the trace, e.g. when it did nothing. */
+    void discard() { m_tracer = nullptr; }
+
+    /** Ends the span. */
+    ~_span() {
+      if (m_tracer != nullptr)
+        m_tracer->ring().push(m_name, m_track, m_frame, m_start,
+                              now() - m_start);
+    }
+
+    _span(const _span &) = delete;
+    _span &operator=(const _span &) = delete;
+  };
+
+  /** Default constructor. Not recording. */
+  _tracer()
+      : m_id(s_next_id++),
+        m_recording(false),
+        m_capacity(size_t(1) << 16),
+        m_started_ns(0),
+        m_mutex(),
+        m_rings(),
+        m_tracks() {}
+
+  _tracer(const _tracer &) = delete;
+  _tracer &operator=(const _tracer &) = delete;
+
+  /** Whether spans are recorded right now
+   * @return True between start and stop
+   */
+  bool recording() const { return m_recording.load(memory_order_relaxed); }
+
+  /** Starts a new trace, dropping the spans of the last one.
+   * @param _events_per_thread How many spans every thread keeps at least.
+   * Only threads that record their first span from now on get the new
+   * size.
+   */
+  void start(const size_t _events_per_thread) {
+    lock_guard<mutex> lock(m_mutex);
+    m_capacity.store(_events_per_thread);
+    for (const auto &ring : m_rings) ring->restart();
+    m_started_ns.store(now());
+    m_recording.store(true);
+  }
+
+  /** Stops recording. The spans are kept until the next start. */
+  void stop() { m_recording.store(false); }
+
+  /** Names a node in the trace.
+   * @param _id The ID of the node. Must print to an ostream.
+   * @return What the node's spans refer to it by
+   */
+  template <typename IDType>
+  uint32_t track(const IDType &_id) {
+    ostringstream name;
+    name << _id;
+    lock_guard<mutex> lock(m_mutex);
+    m_tracks.push_back(name.str());
+    return static_cast<uint32_t>(m_tracks.size() - 1);
+  }
+
+  /** Writes the spans of the current trace as Chrome trace event JSON.
+   *
+   * Every span is a complete event named after what ran, on the track of
+   * the thread that ran it, with the node's ID and the frame's sequence
+   * number as arguments. Times count from when the trace started. Threads
+   * may keep recording meanwhile.
+   *
+   * @param _out Where to write the JSON
+   * @return How many spans were written
+   */
+  size_t write(ostream &_out) const {
+    lock_guard<mutex> lock(m_mutex);
+    const int64_t started = m_started_ns.load();
+    size_t written = 0;
+    _out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"args\":{\"name\":\"functional_dag\"}}";
+    for (const auto &ring : m_rings) {
+      const uint32_t thread = ring->thread_number();
+      _out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+           << thread << ",\"args\":{\"name\":\"thread " << thread << "\"}}";
+      ring->for_each([&](const char *const _name, const uint32_t _track,
+                         const uint64_t _frame, const int64_t _start,
+                         const int64_t _duration) {
+        if (_start < started || _track >= m_tracks.size()) return;
+        _out << ",\n{\"name\":";
+        write_string(_out, _name);
+        _out << ",\"cat\":\"fn_dag\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread
+             << ",\"ts\":";
+        write_micros(_out, _start - started);
+        _out << ",\"dur\":";
+        write_micros(_out, _duration);
+        _out << ",\"args\":{\"node\":";
+        write_string(_out, m_tracks[_track]);
+        _out << ",\"frame\":" << _frame << "}}";
+        written++;
+      });
+    }
+    _out << "\n]}\n";
+    return written;
+  }
+};
+}  // namespace fn_dag
@@ -0,0 +1,239 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <functional_dag/core/executor.hpp>
+#include <functional_dag/core/thread_placement.hpp>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fn_dag {
+using namespace std;
+
+/** A fixed set of long-lived workers that each own a deque of tasks.
+ *
+ * Tasks submitted from a worker (e.g. the children of a node that worker just
+ * ran) go to the back of that worker's own deque and are popped from the back
+ * again, so they run hot in the cache that produced their input. Idle workers
+ * steal the oldest task from the front of the other deques. Threads outside of
+ * the pool, like the dag source threads, spread their tasks over the deques
+ * round-robin and steal while they wait.
+ */
+class work_stealing_pool : public _dag_executor {
+ private:
+  /** The per-worker deque. Only the lock of one deque is taken at a time. */
+  struct _worker_deque {
+    mutex m_mutex;                    // Guards the tasks
+    deque<function<void()>> m_tasks;  // The owner works the back, thieves the
+                                      // front
+  };
+
+  vector<unique_ptr<_worker_deque>> m_deques;  // One deque per worker
+  vector<thread> m_workers;                    // The long-lived workers
+  mutex m_urgent_mutex;                        // Guards m_urgent
+  _deadline_queue m_urgent;                    // Tasks with deadlines
+  atomic<size_t> m_urgent_queued;              // How many m_urgent holds
+
+  atomic<size_t> m_queued;       // Tasks sitting in m_urgent or any deque
+  atomic<size_t> m_next_deque;   // Round-robin target for outside threads
+  atomic<uint32_t> m_sleeping;   // Workers parked on the idle condition
+  mutex m_idle_mutex;            // Guards parking and stopping
+  condition_variable m_idle_cv;  // Wakes parked workers
+  bool m_stopping;               // Set when the pool is shutting down
+
+  static inline thread_local work_stealing_pool *t_pool =
+      nullptr;  // The pool the current thread works for, if any
+  static inline thread_local size_t t_index =
+      0;  // The deque the current thread owns in t_pool
+
+  /** Takes a task out of a deque.
+   *
+   * @param _index Which deque to take from
+   * @param _from_back Whether to take the newest (owner) or oldest (thief)
+   * task
+   * @param _task Where to put the task
+   * @return Whether a task was taken
+   */
+  bool take(const size_t _index, const bool _from_back,
+            function<void()> &_task) {
+    _worker_deque &worker_deque = *m_deques[_index];
+    lock_guard<mutex> lock(worker_deque.m_mutex);
+    if (worker_deque.m_tasks.empty()) return false;
+    if (_from_back) {
+      _task = std::move(worker_deque.m_tasks.back());
+      worker_deque.m_tasks.pop_back();
+    } else {
+      _task = std::move(worker_deque.m_tasks.front());
+      worker_deque.m_tasks.pop_front();
+    }
+    m_queued.fetch_sub(1);
+    return true;
+  }
+
+  /** Finds the next task for a thread.
+   *
+   * Tasks with deadlines come first, earliest deadline first. Then workers
+   * look at their own deque, and every other deque is tried once, starting
+   * after the thread's own.
+   *
+   * @param _start The deque to start looking at
+   * @param _is_owner Whether the calling thread owns the _start deque
+   * @param _task Where to put the task
+   * @return Whether a task was found
+   */
+  bool find_task(const size_t _start, const bool _is_owner,
+                 function<void()> &_task) {
+    if (m_queued.load() == 0) return false;
+    if (m_urgent_queued.load() > 0) {
+      lock_guard<mutex> lock(m_urgent_mutex);
+      if (m_urgent.pop(_task)) {
+        m_urgent_queued.fetch_sub(1);
+        m_queued.fetch_sub(1);
+        return true;
+      }
+    }
+    if (_is_owner && take(_start, true, _task)) return true;
+    const size_t num_deques = m_deques.size();
+    for (size_t i = _is_owner ? 1 : 0; i < num_deques; i++)
+      if (take((_start + i) % num_deques, false, _task)) return true;
+    return false;
+  }
+
+  /** The loop every worker runs until the pool is destroyed.
+   *
+   * @param _index The deque this worker owns
+   * @param _placement Where the worker runs
+   */
+  void worker_loop(const size_t _index, const thread_placement _placement) {
+    if (!_placement.empty()) apply_placement(_placement);
+    t_pool = this;
+    t_index = _index;
+    while (true) {
+      function<void()> task;
+      if (find_task(_index, true, task)) {
+        task();
+        continue;
+      }
+
+      unique_lock<mutex> lock(m_idle_mutex);
+      m_sleeping++;
+      m_idle_cv.wait(lock,
+                     [this] { return m_stopping || m_queued.load() > 0; });
+      m_sleeping--;
+      if (m_stopping && m_queued.load() == 0) return;
+    }
+  }
+
+ public:
+  /** Starts the workers.
+   *
+   * @param _num_workers How many workers to start. Zero means one worker per
+   * hardware thread.
+   * @param _placement Where the workers run. Each worker gets its own core of
+   * the ones listed.
+   */
+  explicit work_stealing_pool(uint32_t _num_workers,
+                              const thread_placement &_placement = {})
+      : m_urgent_queued(0),
+        m_queued(0),
+        m_next_deque(0),
+        m_sleeping(0),
+        m_stopping(false) {
+    if (_num_workers == 0) _num_workers = thread::hardware_concurrency();
+    if (_num_workers == 0) _num_workers = 1;
+    for (uint32_t i = 0; i < _num_workers; i++)
+      m_deques.push_back(make_unique<_worker_deque>());
+    m_workers.reserve(_num_workers);
+    for (uint32_t i = 0; i < _num_workers; i++)
+      m_workers.emplace_back(&work_stealing_pool::worker_loop, this, i,
+                             _worker_placement(_placement, i));
+  }
+
+  /** Finishes the queued tasks and joins the workers. */
+  ~work_stealing_pool() {
+    {
+      lock_guard<mutex> lock(m_idle_mutex);
+      m_stopping = true;
+    }
+    m_idle_cv.notify_all();
+    for (auto &worker : m_workers) worker.join();
+  }
+
+  work_stealing_pool(const work_stealing_pool &) = delete;
+  work_stealing_pool &operator=(const work_stealing_pool &) = delete;
+
+  /** Queues a task on the calling worker's own deque, or round-robin when
+   * called from outside of the pool.
+   *
+   * @param _task The task to run.
+   */
+  void submit(function<void()> _task) override {
+    const size_t target = t_pool == this
+                              ? t_index
+                              : m_next_deque.fetch_add(1) % m_deques.size();
+    m_queued.fetch_add(1);
+    {
+      lock_guard<mutex> lock(m_deques[target]->m_mutex);
+      m_deques[target]->m_tasks.push_back(std::move(_task));
+    }
+    if (m_sleeping.load() > 0) {
+      lock_guard<mutex> lock(m_idle_mutex);
+      m_idle_cv.notify_one();
+    }
+  }
+
+  /** Queues a task that should be done by a deadline. Every worker looks for
+   * these before its own deque, so they skip ahead of everything else.
+   *
+   * @param _task The task to run.
+   * @param _deadline When the task should be done.
+   */
+  void submit_by(function<void()> _task,
+                 const chrono::steady_clock::time_point _deadline) override {
+    m_queued.fetch_add(1);
+    {
+      lock_guard<mutex> lock(m_urgent_mutex);
+      m_urgent.push(std::move(_task), _deadline);
+      m_urgent_queued.fetch_add(1);
+    }
+    if (m_sleeping.load() > 0) {
+      lock_guard<mutex> lock(m_idle_mutex);
+      m_idle_cv.notify_one();
+    }
+  }
+
+  /** Runs one queued task on the calling thread if there is one.
+   *
+   * Workers prefer their own newest task; other threads steal the oldest.
+   *
+   * @return Whether a task was run.
+   */
+  bool try_run_one() override {
+    function<void()> task;
+    const bool is_worker = t_pool == this;
+    const size_t start = is_worker ? t_index : m_next_deque.load();
+    if (!find_task(start % m_deques.size(), is_worker, task)) return false;
+    task();
+    return true;
+  }
+
+  /** Getter for the number of workers
+   * @return How many worker threads the pool runs.
+   */
+  size_t size() const override { return m_workers.size(); }
+};
+}  // namespace fn_dag
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <functional_dag/core/async_task.hpp>
+#include <functional_dag/core/reactor.hpp>
+#include <functional_dag/dag_interface.hpp>
+#include <memory>
+
+namespace fn_dag {
+using namespace std;
+/** Interface for nodes that wait on I/O
+ *
+ * The update is a coroutine. It can co_await a file descriptor or a timer
+ * (see async_readable, async_writable and async_sleep) without holding a
+ * worker: the worker moves on to other nodes while the reactor watches the
+ * wait, and the node resumes on the pool once the wait is over. Waits end
+ * early, giving false, when the dags are asked to stop. The output is passed
+ * on to the children like the output of any other node.
+ *
+ * Since the node does not hold a worker while it waits, it may work on
+ * several messages at once, in pipelined mode too. The input stays valid
+ * until the coroutine returns. When the dag runs single threaded or the edge
+ * batches, update runs the coroutine to completion in place instead.
+ */
+template <typename In, typename Out>
+class dag_async_node : public dag_node<In, Out> {
+ public:
+  /** Translator coroutine
+   *
+   * @param _data The data to use to generate the output data
+   * @return A task giving the data out, or nullptr to pass nothing on.
+   */
+  virtual task<unique_ptr<Out>> update_async(const In* const _data) = 0;
+
+  /** Runs the coroutine to completion, blocking the calling thread while it
+   * waits.
+   *
+   * @param _data The data to use to generate the output data
+   * @return Data out, or nullptr to pass nothing on.
+   */
+  unique_ptr<Out> update(const In* const _data) {
+    return sync_wait(update_async(_data));
+  }
+};
+}  // namespace fn_dag
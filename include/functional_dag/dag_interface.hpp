@@ -9,7 +9,13 @@
  * ---------------------------------------------
  * @author ndepalma@alum.mit.edu
  */
+#include <chrono>
+#include <functional_dag/core/source_pacing.hpp>
 #include <memory>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace fn_dag {
 using namespace std;
@@ -29,6 +35,28 @@ class dag_source {
    * @return New data that was just generated
    */
   virtual unique_ptr<Out> update() = 0;
+
+  /** How the dag's thread should pace calls to update.
+   *
+   * By default the source is called as fast as possible, and the thread backs
+   * off while update returns nullptr so an idle source does not burn a core.
+   *
+   * @return The pacing the source wants.
+   */
+  virtual source_pacing pacing() { return {}; }
+
+  /** Blocks until the source has data ready or the timeout passed.
+   *
+   * Only used by sources paced with WAIT_FOR_DATA. Override this to wait on
+   * a device or a socket instead of polling it in update.
+   *
+   * @param _timeout How long to wait at most.
+   * @return Whether data is ready and update should be called.
+   */
+  virtual bool wait_for_data(
+      [[maybe_unused]] const chrono::nanoseconds _timeout) {
+    return true;
+  }
 };
 
 /** Interface for all external "mapping" lambdas
@@ -54,5 +82,47 @@ class dag_node {
    * @return Data out, just allocated on the heap with *new*.
    */
   virtual unique_ptr<Out> update(const In* const _data) = 0;
+
+  /** Batched translator function
+   *
+   * Called instead of update when the edge feeding the node batches its
+   * messages (see edge_options::max_batch). Override this to amortize setup
+   * costs or vectorize across inputs. By default it calls update on each
+   * input in turn.
+   *
+   * @param _batch The inputs, oldest first. Each belongs to its own frame.
+   * @return One output per input in the same order, null where there is
+   * nothing to pass on.
+   */
+  virtual vector<unique_ptr<Out>> update_batch(span<const In* const> _batch) {
+    vector<unique_ptr<Out>> outputs;
+    outputs.reserve(_batch.size());
+    for (const In* const data : _batch) outputs.push_back(update(data));
+    return outputs;
+  }
+
+  /** In place translator function
+   *
+   * Called instead of update where the output already has a place to go,
+   * e.g. a slot in shared memory when the node runs in a child process (see
+   * node_residence::FORK). Override this to build the output right there
+   * instead of on the heap. By default it calls update and moves the output
+   * over.
+   *
+   * @param _data The data to use to generate the output data
+   * @param _out Where to put the output. Default constructed.
+   * @return Whether there is an output to pass on
+   */
+  virtual bool update_into(const In* const _data, Out& _out) {
+    unique_ptr<Out> out = update(_data);
+    if (out == nullptr) return false;
+    if constexpr (is_move_assignable_v<Out>) {
+      _out = std::move(*out);
+      return true;
+    } else {
+      // It has no way to get there
+      return false;
+    }
+  }
 };
 }  // namespace fn_dag
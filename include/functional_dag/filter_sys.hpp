@@ -12,8 +12,32 @@
 
 #include <functional_dag/error_codes.h>
 
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <functional_dag/core/cancellation.hpp>
+#include <functional_dag/core/edge_policy.hpp>
+#include <functional_dag/core/node_metrics.hpp>
+#include <functional_dag/core/object_pool.hpp>
+#include <functional_dag/core/priority.hpp>
+#include <functional_dag/core/residence.hpp>
+#include <functional_dag/core/thread_placement.hpp>
+#include <functional_dag/core/thread_pool.hpp>
+#include <functional_dag/core/tracer.hpp>
+#include <functional_dag/core/work_stealing_pool.hpp>
 #include <functional_dag/dag_interface.hpp>
 #include <functional_dag/impl/dag_impl.hpp>
+#include <functional_dag/impl/dag_join_impl.hpp>
+#include <functional_dag/impl/static_dag_impl.hpp>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 namespace fn_dag {
 using namespace std;
@@ -29,6 +53,57 @@ template <typename IDType>
 class dag_manager {
  private:
   _dag_context m_context;  // This is the "global" context used by all dags
+  unique_ptr<_dag_executor>
+      m_executor;  // The workers shared by all multi-threaded dags
+  map<tuple<executor_type, vector<uint32_t>, int, int>,
+      unique_ptr<_dag_executor>>
+      m_placed_executors;  // The workers of placed nodes, one pool for each
+                           // kind of pool, cores, NUMA node and priority
+  unordered_map<IDType, _dag_base<IDType> *>
+      m_owners;  // The DAG every node and DAG ID belongs to, so IDs are found
+                 // in O(1) rather than by asking every DAG
+
+  /** Starts a pool of the kind the manager is set up for
+   *
+   * @param _num_workers How many workers. Zero means one per hardware thread.
+   * @param _placement Where the workers run
+   * @return The pool
+   */
+  unique_ptr<_dag_executor> start_executor(
+      const uint32_t _num_workers, const thread_placement &_placement) {
+    if (m_context.scheduler == executor_type::CENTRAL_QUEUE)
+      return make_unique<dag_thread_pool>(_num_workers, _placement);
+    return make_unique<work_stealing_pool>(_num_workers, _placement);
+  }
+
+  /** Finds the pool of the nodes placed a certain way, starting it when the
+   * first of them is placed
+   *
+   * A pool stays once started, even after no node is placed on it any more,
+   * since a task may still be on its way to it. The next node placed the
+   * same way reuses it.
+   *
+   * @param _placement Where the workers run
+   * @return The pool
+   */
+  _dag_executor *placed_executor(const thread_placement &_placement) {
+    auto &pool = m_placed_executors[{m_context.scheduler, _placement.cores,
+                                     _placement.numa_node,
+                                     _placement.fifo_priority}];
+    if (pool == nullptr)
+      pool = start_executor(_placement_width(_placement), _placement);
+    return pool.get();
+  }
+
+  /** Finds the DAG a node or a DAG ID belongs to
+   *
+   * @param _id The ID to look for
+   * @return The DAG or nullptr if no DAG contains the ID
+   */
+  _dag_base<IDType> *find_dag_of(const IDType &_id) {
+    auto owner = m_owners.find(_id);
+    return owner == m_owners.end() ? nullptr : owner->second;
+  }
 
  public:
   /** All of the DAGs the manager maintains */
@@ -36,42 +111,104 @@ class dag_manager {
 
   /** Default constructor. Begins in the "on" state and in multi-threaded mode.
    */
-  dag_manager() {
-    m_context.filter_off = false;
-    m_context.run_single_threaded = false;
-  }
+  dag_manager() { m_context.run_single_threaded = false; }
 
   /** Default deconstructor
    */
   ~dag_manager() {
-    m_context.filter_off = true;
+    stahp();
     clear();
   }
 
   /** This function adds a node to the graph.
    *
-   * Use this function to add a lambda function onto the graph.
+   * Use this function to add a lambda function onto the graph. Every ID may
+   * only be taken once across all of the DAGs.
    *
    * @param _id The node's name for later referencing
    * @param _new_filter The lambda function to run fromt he parent
    * @param _onto The node ID of the parent to attach the lambda function on to.
+   * @param _edge The options of the edge from the parent, e.g. what to do
+   * when the node falls behind in pipelined mode or how to batch messages.
+   * @return The ID of the parent if the node was added. Otherwise an error
+   * code, GUID_COLLISION if the ID is taken.
    */
   template <typename In, typename Out>
   [[nodiscard]] expected<IDType, error_codes> add_node(
-      IDType _id, dag_node<In, Out> *_new_filter, const IDType &_onto) {
-    if (_new_filter != nullptr) {
-      for (auto t = m_all_dags.cbegin(); t != m_all_dags.cend(); t++) {
-        if ((*t)->dag_contains(_onto) || (*t)->get_id() == _onto) {
-          dag<In, IDType> *tptr = static_cast<dag<In, IDType> *>(*t);
-          return tptr->add_filter(_id, _new_filter, _onto);
-        }
-      }
-    } else {
+      IDType _id, dag_node<In, Out> *_new_filter, const IDType &_onto,
+      const edge_options &_edge = {}) {
+    if (_new_filter == nullptr) return unexpected(error_codes::NULL_PTR_ERROR);
+    if (manager_contains_id(_id)) {
       delete _new_filter;
-      return unexpected(error_codes::NULL_PTR_ERROR);
+      return unexpected(error_codes::GUID_COLLISION);
     }
-    delete _new_filter;
-    return unexpected(error_codes::PARENT_NOT_FOUND);
+    auto parent_dag = find_dag_of(_onto);
+    if (parent_dag == nullptr) {
+      delete _new_filter;
+      return unexpected(error_codes::PARENT_NOT_FOUND);
+    }
+    // Only a node that was attached takes its ID
+    auto added = parent_dag->add_filter(_id, _new_filter, _onto, _edge);
+    if (added) m_owners.emplace(_id, parent_dag);
+    return added;
+  }
+
+  /** This function adds a node that joins the outputs of several parents.
+   *
+   * The node takes a tuple with one input of each parent, in the order of
+   * the parents. The parents may belong to different DAGs. The join policy
+   * decides which of their outputs belong together: the same sequence number,
+   * timestamps within a window, or the latest output of every parent each
+   * time the first parent outputs something. Inputs are copied into the
+   * tuple.
+   *
+   * The node belongs to the DAG of the first parent, so that is where nodes
+   * attached to it run.
+   *
+   * @param _id The node's name for later referencing
+   * @param _new_filter The lambda function to run on every match
+   * @param _onto The node IDs of the parents, one per element of the tuple
+   * @param _join How inputs are matched and buffered
+   * @return The ID of the first parent if the node was added. Otherwise an
+   * error code if the ID is taken, like add_node, or if a parent is missing
+   * or outputs another type.
+   */
+  template <typename Out, typename... Ins>
+  [[nodiscard]] expected<IDType, error_codes> add_join(
+      IDType _id, dag_node<tuple<Ins...>, Out> *_new_filter,
+      const array<IDType, sizeof...(Ins)> &_onto,
+      const join_options &_join = {}) {
+    if (_new_filter == nullptr) return unexpected(error_codes::NULL_PTR_ERROR);
+    if (manager_contains_id(_id)) {
+      delete _new_filter;
+      return unexpected(error_codes::GUID_COLLISION);
+    }
+
+    // Every parent has to exist and output the right type before attaching
+    array<void *, sizeof...(Ins)> fanouts;
+    error_codes error = error_codes::PARENT_NOT_FOUND;
+    const bool resolved = [&]<size_t... I>(index_sequence<I...>) {
+      return ([&]() {
+        auto fanout = attach_point<tuple_element_t<I, tuple<Ins...>>>(_onto[I]);
+        if (fanout)
+          fanouts[I] = fanout.value();
+        else
+          error = fanout.error();
+        return fanout.has_value();
+      }() && ...);
+    }(index_sequence_for<Ins...>{});
+    if (!resolved) {
+      delete _new_filter;
+      return unexpected(error);
+    }
+
+    auto join = make_shared<_join_node<Out, IDType, Ins...>>(
+        _id, _new_filter, m_context, _join);
+    _join_node<Out, IDType, Ins...>::attach(join, fanouts);
+    auto parent_dag = find_dag_of(_onto[0]);
+    parent_dag->register_node(_id, join.get());
+    m_owners.emplace(_id, parent_dag);
+    return _onto[0];
   }
 
   /** Containment function for checking presence
@@ -82,11 +219,226 @@ class dag_manager {
    *
    * @return Whether or not any of the dags contain the ID provided.
    */
-  bool manager_contains_id(IDType _id) {
-    for (auto t = m_all_dags.cbegin(); t != m_all_dags.cend(); t++) {
-      if ((*t)->dag_contains(_id) || (*t)->get_id() == _id) return true;
+  bool manager_contains_id(IDType _id) { return m_owners.count(_id) > 0; }
+
+  /** Changes what the edge feeding a node does when it is full
+   *
+   * @param _id The ID of the node the edge feeds
+   * @param _policy The new overflow policy
+   * @return True if the node was found. Otherwise an error code.
+   */
+  expected<bool, error_codes> set_overflow_policy(
+      const IDType &_id, const overflow_policy _policy) {
+    if (auto node = find_node(_id); node != nullptr) {
+      node->set_overflow_policy(_policy);
+      return true;
+    }
+    return unexpected(error_codes::NODE_NOT_FOUND);
+  }
+
+  /** Moves a node into a child process, or back into this one
+   *
+   * A forked node runs in a worker process fed through shared memory, so a
+   * crash in the node only drops the message it crashed on, after which a
+   * new worker takes over. It only works on Linux, for nodes whose input and
+   * output are trivially copyable or payloads of bytes, e.g. a
+   * flatbuffer_payload, and not for sources or joins. Payloads of bytes are
+   * verified before the other process reads them. The worker starts as a
+   * copy of the node, and what it changes in its own state is not seen by
+   * this process.
+   *
+   * @param _id The ID of the node
+   * @param _residence Where the node should run
+   * @return True if the node moved. Otherwise an error code.
+   */
+  expected<bool, error_codes> set_residence(const IDType &_id,
+                                            const node_residence _residence) {
+    if (auto node = find_node(_id); node != nullptr) {
+      if (node->set_residence(_residence)) return true;
+      return unexpected(error_codes::RESIDENCE_UNSUPPORTED);
+    }
+    if (manager_contains_id(_id))
+      return _residence == node_residence::THREAD
+                 ? expected<bool, error_codes>(true)
+                 : unexpected(error_codes::RESIDENCE_UNSUPPORTED);
+    return unexpected(error_codes::NODE_NOT_FOUND);
+  }
+
+  /** Pins a node or the thread of a source to cores
+   *
+   * A node runs on a pool with one worker per core of the placement, shared
+   * with the other nodes placed the same way, and is no longer fused into
+   * its parent's task. A pool is reused by whatever node is placed that way
+   * next, so placing nodes over and over does not start more workers. The
+   * thread of a source moves before it calls the source again. Threads
+   * prefer memory from the placement's NUMA node. Parts of the placement the
+   * process lacks the privileges for, like real-time priorities, are
+   * skipped, and the rest still applies. Single threaded dags run everything
+   * on the caller's thread, wherever that is.
+   *
+   * @param _id The ID of the node or of the DAG of the source
+   * @param _placement Where to run. Empty moves a node back to the shared
+   * pool.
+   * @return True if the node or source was placed. Otherwise an error code.
+   */
+  expected<bool, error_codes> set_placement(
+      const IDType &_id, const thread_placement &_placement) {
+    if (auto node = find_node(_id); node != nullptr) {
+      if (_placement.empty()) {
+        if (node->set_executor(nullptr)) return true;
+        return unexpected(error_codes::RESIDENCE_UNSUPPORTED);
+      }
+      if (node->set_executor(placed_executor(_placement))) return true;
+      return unexpected(error_codes::RESIDENCE_UNSUPPORTED);
+    }
+    if (auto t = find_dag_of(_id); t != nullptr && t->get_id() == _id) {
+      t->set_placement(_placement);
+      return true;
+    }
+    return unexpected(error_codes::NODE_NOT_FOUND);
+  }
+
+  /** Sets how urgent a node is
+   *
+   * Nodes with a deadline, and critical nodes, are dispatched earliest
+   * deadline first, ahead of the rest. A node that finishes a message after
+   * its deadline counts a miss and puts the dags in overload for a while
+   * (see set_shedding). While overloaded, background nodes skip their
+   * messages, and so does their whole subtree, to free the workers for the
+   * rest. The skipped messages are counted in the edge stats.
+   *
+   * @param _id The ID of the node
+   * @param _priority The node's priority class
+   * @param _deadline How long after the source produced a frame the node
+   * should be done with it. Zero for no deadline.
+   * @return True if the node was found. Otherwise an error code.
+   */
+  expected<bool, error_codes> set_priority(
+      const IDType &_id, const priority_class _priority,
+      const chrono::nanoseconds _deadline = chrono::nanoseconds(0)) {
+    if (auto node = find_node(_id); node != nullptr) {
+      if (node->set_priority(_priority, _deadline)) return true;
+      return unexpected(error_codes::SCHEDULING_UNSUPPORTED);
     }
-    return false;
+    if (manager_contains_id(_id))
+      return unexpected(error_codes::SCHEDULING_UNSUPPORTED);
+    return unexpected(error_codes::NODE_NOT_FOUND);
+  }
+
+  /** Lets a stateless node run on several messages at once
+   *
+   * In pipelined mode a node runs on one queued message at a time, so a slow
+   * node caps the whole dag. A replicated node runs on up to _replicas
+   * queued messages at once, each on its own worker, and its outputs are put
+   * back in the order the messages were queued before they reach its
+   * children. The node's update is called from several threads at once, so
+   * it must not keep state between calls. The same can be set when adding
+   * the node, with edge_options::replicas.
+   *
+   * @param _id The ID of the node
+   * @param _replicas How many messages the node may run on at once. One
+   * turns replication off.
+   * @return True if the node was found and can be replicated. Otherwise an
+   * error code. Joins, sources, coroutine nodes and nodes whose edge batches
+   * can't be replicated.
+   */
+  expected<bool, error_codes> set_replicas(const IDType &_id,
+                                           const size_t _replicas) {
+    if (auto node = find_node(_id); node != nullptr) {
+      if (node->set_replicas(_replicas)) return true;
+      return unexpected(error_codes::SCHEDULING_UNSUPPORTED);
+    }
+    if (manager_contains_id(_id))
+      return unexpected(error_codes::SCHEDULING_UNSUPPORTED);
+    return unexpected(error_codes::NODE_NOT_FOUND);
+  }
+
+  /** Sets when the dags count as overloaded, so background nodes are shed
+   *
+   * By default that is for 100ms after any node missed its deadline.
+   *
+   * @param _options The thresholds
+   */
+  void set_shedding(const shed_options &_options) {
+    m_context.load.configure(_options);
+  }
+
+  /** Reads the counters of the edge feeding a node
+   *
+   * This is how to tell how many messages a slow node shed.
+   *
+   * @param _id The ID of the node the edge feeds
+   * @return A snapshot of the edge counters if the node was found. Otherwise
+   * an error code.
+   */
+  expected<edge_stats, error_codes> get_edge_stats(const IDType &_id) {
+    if (auto node = find_node(_id); node != nullptr)
+      return node->get_edge_stats();
+    return unexpected(error_codes::NODE_NOT_FOUND);
+  }
+
+  /** Takes a snapshot of what every node and source did so far
+   *
+   * This is how to find the node that holds the dags back: its latency,
+   * how long messages waited for it, and the CPU time it used. The sources
+   * are keyed by the ID of their DAG. Nothing is kept when the metrics are
+   * compiled out (see FN_DAG_METRICS), and the map is empty.
+   *
+   * @return The metrics of every node, keyed by node ID
+   */
+  unordered_map<IDType, node_metrics> get_metrics() {
+    unordered_map<IDType, node_metrics> metrics;
+    if constexpr (metrics_enabled) {
+      for (auto t = m_all_dags.cbegin(); t != m_all_dags.cend(); t++)
+        metrics.emplace((*t)->get_id(), (*t)->get_source_metrics());
+      for_each_node([&metrics](_dag_node_base<IDType> &_node) {
+        metrics.emplace(_node.get_id(), _node.get_metrics());
+      });
+    }
+    return metrics;
+  }
+
+  /** Starts recording which threads run which nodes, and when
+   *
+   * Every run_filter, update and fan_out of a node, and every update of a
+   * source, is recorded as a span with the node's ID, the thread and the
+   * frame's sequence number. Each thread keeps its newest spans in a ring
+   * of its own, so recording takes no locks and can stay on in production
+   * for a while. Starting again drops the spans recorded so far.
+   *
+   * @param _events_per_thread How many spans each thread keeps at least
+   */
+  void start_trace(const size_t _events_per_thread = size_t(1) << 16) {
+    m_context.tracer.start(_events_per_thread);
+  }
+
+  /** Stops recording spans. They are kept until the next start_trace. */
+  void stop_trace() { m_context.tracer.stop(); }
+
+  /** Writes the spans as Chrome trace event JSON, which Perfetto opens
+   *
+   * Recording may go on meanwhile.
+   *
+   * @param _out Where to write the JSON
+   * @return How many spans were written
+   */
+  size_t write_trace(ostream &_out) const {
+    return m_context.tracer.write(_out);
+  }
+
+  /** Writes the spans to a Chrome trace event JSON file
+   *
+   * @param _path The file to write. It is replaced if it exists.
+   * @return How many spans were written. Otherwise an error code if the
+   * file can't be written.
+   */
+  expected<size_t, error_codes> write_trace(const string &_path) const {
+    ofstream out(_path, ios::trunc);
+    if (!out) return unexpected(error_codes::PATH_DOES_NOT_EXIST);
+    const size_t written = write_trace(out);
+    out.close();
+    if (!out) return unexpected(error_codes::PATH_DOES_NOT_EXIST);
+    return written;
   }
 
   /** Indentation delimiter
@@ -125,30 +477,210 @@ class dag_manager {
     m_context.run_single_threaded = _is_single_threaded;
   }
 
+  /** Sets whether the dags run pipelined
+   *
+   * In pipelined mode every edge is a bounded queue. A node runs as soon as
+   * its input is available and its parent does not wait on it, so a source
+   * can produce its next message while the previous ones are still moving
+   * through the dag. Each node still handles one message at a time and in
+   * order. This has no effect on single threaded dags.
+   *
+   * Like run_single_threaded, this is unsafe to change while a dag is being
+   * built.
+   *
+   * @param _is_pipelined Whether new dags run pipelined.
+   */
+  void run_pipelined(const bool _is_pipelined) {
+    m_context.pipelined = _is_pipelined;
+  }
+
+  /** Sets whether chains of nodes are fused
+   *
+   * A chain is a run of nodes that each have exactly one child, e.g. decode,
+   * undistort, resize and normalize. When fused, the head of a chain is
+   * scheduled like any other node and every following link runs right away
+   * in the same task, on the same thread, instead of going through the pool
+   * or an edge queue. The nodes keep their own IDs for printing, lookup and
+   * stats, but the overflow policy of a fused edge has no effect because
+   * nothing queues on it. A node whose input edge batches is never fused
+   * into its parent. Chains are fused by default.
+   *
+   * Like run_pipelined, this is unsafe to change while the dags are running.
+   *
+   * @param _fuse Whether to fuse chains.
+   */
+  void fuse_chains(const bool _fuse) { m_context.fuse_chains = _fuse; }
+
+  /** Sets how many messages each edge can queue in pipelined mode
+   *
+   * Only nodes added after this call use the new capacity. A parent that
+   * finds the queue of a child full waits until there is room again.
+   *
+   * @param _capacity The number of messages. Rounded up to a power of two
+   * and to at least two.
+   */
+  void set_edge_capacity(const size_t _capacity) {
+    m_context.edge_capacity = _capacity;
+  }
+
+  /** Sets how many workers the shared pool runs
+   *
+   * The pool is started when the first multi-threaded dag is added, so this
+   * only has an effect before that. By default there is one worker per
+   * hardware thread.
+   *
+   * @param _num_workers The number of workers. Zero means one per hardware
+   * thread.
+   */
+  void set_worker_count(const uint32_t _num_workers) {
+    m_context.num_workers = _num_workers;
+  }
+
+  /** Sets where the workers of the shared pool run
+   *
+   * Like the worker count, this only has an effect before the first
+   * multi-threaded dag is added. Each worker is pinned to its own core of
+   * the ones listed, and prefers memory from the NUMA node, so what it
+   * allocates is local. Parts of the placement the process lacks the
+   * privileges for, like real-time priorities, are skipped.
+   *
+   * @param _placement Where the workers run
+   */
+  void set_worker_placement(const thread_placement &_placement) {
+    m_context.worker_placement = _placement;
+  }
+
+  /** Sets which scheduler the shared pool uses
+   *
+   * Like the worker count, this only has an effect before the first
+   * multi-threaded dag is added. Defaults to work stealing.
+   *
+   * @param _scheduler The kind of pool to start.
+   */
+  void set_executor_type(const executor_type _scheduler) {
+    m_context.scheduler = _scheduler;
+  }
+
+  /** Gets the pool that recycles outputs of a type, creating it on first use
+   *
+   * Once a type has a pool, every output of that type goes back to the pool
+   * when the last child is done with it instead of being deleted. Sources
+   * and nodes call acquire on the pool to reuse those objects rather than
+   * allocating new ones, e.g. by capturing the pool in their lambda. The
+   * pool lives as long as the manager.
+   *
+   * @param _options How to size and back the pool. Ignored if the pool
+   * already exists.
+   * @return The pool, to acquire objects from and read its counters
+   */
+  template <typename T>
+  object_pool<T> &get_pool(const pool_options &_options = {}) {
+    return m_context.pools.template get<T>(_options);
+  }
+
+  /** Getter for the number of workers in the shared pool
+   *
+   * @return How many workers the pool runs or zero if it was not started.
+   */
+  size_t worker_count() const { return m_executor ? m_executor->size() : 0; }
+
   /** Starts a new DAG with a given source of data out
    *
    * This begins a new dag (tree) that must generate output data sequentially.
+   * The ID may not be taken by another DAG or node yet.
    *
    * @param _id The DAGs name
    * @param _new_filter The generator function.
    * @param _startImmediately Whether or not to begin generating data on a loop
    * immediately.
    *
-   * @return Returns the created DAG if the user wants it. Otherwise, NULL if
-   * something fails.
+   * @return Returns the created DAG if the user wants it. Otherwise, an error
+   * code if something fails.
    */
   template <typename Out>
   expected<dag<Out, IDType> *, error_codes> add_dag(
       IDType _id, dag_source<Out> *_new_filter, bool _startImmediately) {
+    if (manager_contains_id(_id)) {
+      delete _new_filter;
+      return unexpected(error_codes::GUID_COLLISION);
+    }
     if (_new_filter != nullptr) {
+      if (!m_context.run_single_threaded && !m_executor) {
+        m_executor =
+            start_executor(m_context.num_workers, m_context.worker_placement);
+        m_context.executor = m_executor.get();
+      }
       dag<Out, IDType> *t =
           new dag<Out, IDType>(_id, _new_filter, m_context, _startImmediately);
       m_all_dags.push_back(t);
+      m_owners.emplace(_id, t);
       return t;
     }
     return unexpected(error_codes::NULL_PTR_ERROR);
   }
 
+  /** Adds a DAG whose topology is a type
+   *
+   * The whole static_dag runs on one thread with no virtual calls between its
+   * stages. The manager starts, paces, stops and drains it like any other
+   * DAG, but nodes can not be attached to it. The ID may not be taken by
+   * another DAG or node yet.
+   *
+   * @param _id The DAGs name
+   * @param _startImmediately Whether or not to begin calling the source on a
+   * loop immediately.
+   * @param _pacing How to pace calls to the source. Defaults to as fast as
+   * possible.
+   * @return The created DAG, e.g. to push_once on it. Otherwise, an error
+   * code if something fails.
+   */
+  template <typename Pipeline>
+  expected<_dag_base<IDType> *, error_codes> add_static_dag(
+      IDType _id, bool _startImmediately, const source_pacing _pacing = {}) {
+    if (manager_contains_id(_id))
+      return unexpected(error_codes::GUID_COLLISION);
+    auto t = new _static_dag<Pipeline, IDType>(_id, m_context,
+                                                _startImmediately, _pacing);
+    m_all_dags.push_back(t);
+    m_owners.emplace(_id, t);
+    return t;
+  }
+
+  /** Compiles a DAG into an immutable execution plan
+   *
+   * The nodes of a frozen DAG sit in flat arrays, level by level, with the
+   * children of every node next to each other. When the DAG runs single
+   * threaded, every frame is one loop over those arrays instead of a
+   * recursive walk of the tree, which is kinder to the cache and does not
+   * grow the stack with the depth of the DAG. Joins and their subtrees run
+   * as before. The plan runs its steps one after the other on one thread,
+   * so multi-threaded and pipelined DAGs do not use it: their frames still
+   * fan out through the nodes on the pool. Nothing can be attached to a
+   * frozen DAG either way; add_node and add_join fail with DAG_FROZEN.
+   * Freeze before the DAG starts running.
+   *
+   * @param _id The ID of the DAG
+   * @return What the plan looks like if the DAG was found. Otherwise an error
+   * code.
+   */
+  expected<plan_stats, error_codes> freeze(const IDType &_id) {
+    if (auto t = find_dag_of(_id); t != nullptr && t->get_id() == _id)
+      return t->freeze();
+    return unexpected(error_codes::DAG_NOT_FOUND);
+  }
+
+  /** Reads how well the source of a DAG kept its pace
+   *
+   * @param _id The ID of the DAG
+   * @return A snapshot of the pacing counters, including the jitter of fixed
+   * rate sources, if the DAG was found. Otherwise an error code.
+   */
+  expected<pacing_stats, error_codes> get_pacing_stats(const IDType &_id) {
+    if (auto t = find_dag_of(_id); t != nullptr && t->get_id() == _id)
+      return t->get_pacing_stats();
+    return unexpected(error_codes::DAG_NOT_FOUND);
+  }
+
   /** Print all of the trees for verification purposes
    *
    * Simply prints all of the dags and their nodes to the given output stream.
@@ -164,20 +696,104 @@ class dag_manager {
 
   /** Stops all of the DAGs from generating data out
    *
-   * Stops all of the DAGs from generating data out. Fair warning, sometimes
-   * it takes a second for the nodes to complete.
+   * Stops all of the DAGs from generating data out. Sleeping sources wake up
+   * right away and nodes stop taking new input, but a node that is already
+   * running only stops early if it checks current_stop_token(). Queued input
+   * is dropped. Use drain() to let the in-flight data finish first.
    */
-  void stahp() { m_context.filter_off = true; }
+  void stahp() { m_context.stopper.request_stop(); }
+
+  /** Stops all of the DAGs, letting the data already produced finish
+   *
+   * First every source is stopped. Then the nodes keep running until every
+   * frame in flight has fully propagated. Whatever is not done by the
+   * timeout is dropped, and the manager is stopped like with stahp().
+   *
+   * @param _timeout How long to wait at most for the sources and the frames
+   * @return What was flushed and what was dropped
+   */
+  drain_report<IDType> drain(const chrono::nanoseconds _timeout) {
+    const auto start = chrono::steady_clock::now();
+    const auto deadline = start + _timeout;
+    unordered_map<IDType, uint64_t> dropped_before;
+    for_each_node([&dropped_before](_dag_node_base<IDType> &_node) {
+      dropped_before[_node.get_id()] = _node.get_edge_stats().dropped;
+    });
+
+    bool flushed = true;
+    for (auto t = m_all_dags.cbegin(); t != m_all_dags.cend(); t++)
+      flushed = (*t)->stop_generating(deadline) && flushed;
+    while (flushed && m_context.frames_in_flight.load() > 0) {
+      if (chrono::steady_clock::now() >= deadline)
+        flushed = false;
+      else if (!m_executor || !m_executor->try_run_one())
+        this_thread::yield();
+    }
+
+    drain_report<IDType> report{.flushed = flushed,
+                                .abandoned_frames =
+                                    m_context.frames_in_flight.load(),
+                                .dropped = 0,
+                                .dropped_by_node = {},
+                                .elapsed = {}};
+    stahp();
+    for_each_node([&report, &dropped_before](_dag_node_base<IDType> &_node) {
+      _node.discard_queued();
+      const uint64_t dropped =
+          _node.get_edge_stats().dropped - dropped_before[_node.get_id()];
+      if (dropped == 0) return;
+      report.dropped += dropped;
+      report.dropped_by_node.emplace_back(_node.get_id(), dropped);
+    });
+    report.elapsed = chrono::steady_clock::now() - start;
+    return report;
+  }
+
+  /** Visits every node of every DAG
+   *
+   * @param _fn What to call on each node
+   */
+  void for_each_node(const function<void(_dag_node_base<IDType> &)> &_fn) {
+    for (auto t = m_all_dags.cbegin(); t != m_all_dags.cend(); t++)
+      (*t)->for_each_node(_fn);
+  }
+
+  /** Finds where a child taking a given type attaches to a parent
+   *
+   * @param _onto The ID of the parent, a node or a DAG
+   * @return The parent's dag_fanout_node<In, IDType>. Otherwise an error
+   * code if the parent is missing or outputs another type.
+   */
+  template <typename In>
+  expected<void *, error_codes> attach_point(const IDType &_onto) {
+    if (auto parent_dag = find_dag_of(_onto); parent_dag != nullptr)
+      return parent_dag->attach_point(_onto, typeid(In));
+    return unexpected(error_codes::PARENT_NOT_FOUND);
+  }
+
+  /** Finds a node by ID in any of the DAGs
+   *
+   * @param _id The ID to look for
+   * @return The node or nullptr if none of the DAGs contain it
+   */
+  _dag_node_base<IDType> *find_node(const IDType &_id) {
+    if (auto owner = find_dag_of(_id); owner != nullptr)
+      return owner->find_node(_id);
+    return nullptr;
+  }
 
   /** Clears all of the DAGs out of the "forest" of DAGs.
    *
    * This doesn't stop the nodes, this simply clears out the tracked DAGs so if
    * you need to stop the DAGs and maintain the pointers manually, feel free to
-   * do so.
+   * do so. The pools of placed nodes go with them, once the nodes are gone.
    */
   void clear() {
     for (auto t = m_all_dags.begin(); t != m_all_dags.end(); t++) delete *t;
     m_all_dags.clear();
+    m_owners.clear();
+    // Joins the workers, which have nothing left to run
+    m_placed_executors.clear();
   }
 };
 }  // namespace fn_dag
@@ -11,7 +11,10 @@
  */
 
 #include <functional>
+#include <functional_dag/dag_async_interface.hpp>
 #include <functional_dag/dag_interface.hpp>
+#include <span>
+#include <vector>
 
 namespace fn_dag {
 using namespace std;
@@ -21,12 +24,15 @@ template <typename Out>
 class __dag_source : public dag_source<Out> {
  public:
   function<unique_ptr<Out>()> m_generator;  // Generator lambda function
+  source_pacing m_pacing;                   // How to pace the generator
 
   /** Default constructor
    * @param _generator A lambda function to call repeatedly.
+   * @param _pacing How the dag should pace calls to the generator.
    */
-  __dag_source(function<unique_ptr<Out>()> _generator)
-      : m_generator(_generator) {}
+  __dag_source(function<unique_ptr<Out>()> _generator,
+               source_pacing _pacing = {})
+      : m_generator(_generator), m_pacing(_pacing) {}
 
   /** Default deconstructor */
   ~__dag_source() {}
@@ -35,6 +41,11 @@ class __dag_source : public dag_source<Out> {
    * @return Output data from the lambda function
    */
   unique_ptr<Out> update() { return m_generator(); };
+
+  /** Overloaded function to report the pacing given at construction.
+   * @return How the dag should pace calls to the generator
+   */
+  source_pacing pacing() { return m_pacing; }
 };
 
 /** Internal structure to support a mapping function
@@ -61,6 +72,106 @@ class __dag_node : public dag_node<In, Out> {
   unique_ptr<Out> update(const In *const _data) { return m_update(_data); };
 };
 
+/** Internal structure to support a mapping function that fills in its output
+ */
+template <typename In, typename Out>
+class __dag_into_node : public dag_node<In, Out> {
+ public:
+  function<bool(const In *const, Out &)>
+      m_update_into;  // Mapping lambda function
+
+  /** Default constructor
+   * @param _update_into A lambda function to call repeatedly on input data
+   */
+  __dag_into_node(function<bool(const In *const, Out &)> _update_into)
+      : m_update_into(_update_into) {}
+
+  /** Default deconstructor */
+  ~__dag_into_node() {}
+
+  /** Overloaded function to call the mapping function on a new output.
+   * @param _data Input data to the lambda function
+   * @return Output data from the lambda function
+   */
+  unique_ptr<Out> update(const In *const _data) {
+    auto out = make_unique<Out>();
+    if (!m_update_into(_data, *out)) return nullptr;
+    return out;
+  };
+
+  /** Overloaded function to call the mapping function on a given output.
+   * @param _data Input data to the lambda function
+   * @param _out Where the lambda function puts the output data
+   * @return Whether the lambda function had output data
+   */
+  bool update_into(const In *const _data, Out &_out) {
+    return m_update_into(_data, _out);
+  };
+};
+
+/** Internal structure to support a batched mapping function
+ */
+template <typename In, typename Out>
+class __dag_batch_node : public dag_node<In, Out> {
+ public:
+  function<vector<unique_ptr<Out>>(span<const In *const>)>
+      m_update_batch;  // Batched mapping lambda function
+
+  /** Default constructor
+   * @param _update_batch A lambda function to call on batches of input data
+   */
+  __dag_batch_node(
+      function<vector<unique_ptr<Out>>(span<const In *const>)> _update_batch)
+      : m_update_batch(_update_batch) {}
+
+  /** Default deconstructor */
+  ~__dag_batch_node() {}
+
+  /** Overloaded function to call the mapping function on a batch of one.
+   * @param _data Input data to the lambda function
+   * @return Output data from the lambda function
+   */
+  unique_ptr<Out> update(const In *const _data) {
+    auto outputs = m_update_batch(span<const In *const>(&_data, 1));
+    return outputs.empty() ? nullptr : std::move(outputs.front());
+  };
+
+  /** Overloaded function to call the mapping function.
+   * @param _batch Input data to the lambda function
+   * @return Output data from the lambda function, one per input
+   */
+  vector<unique_ptr<Out>> update_batch(span<const In *const> _batch) {
+    return m_update_batch(_batch);
+  };
+};
+
+/** Internal structure to support a mapping coroutine
+ */
+template <typename In, typename Out>
+class __dag_async_node : public dag_async_node<In, Out> {
+ public:
+  function<task<unique_ptr<Out>>(const In *const)>
+      m_update_async;  // Mapping coroutine
+
+  /** Default constructor
+   * @param _update_async A coroutine to call on input data
+   */
+  __dag_async_node(
+      function<task<unique_ptr<Out>>(const In *const)> _update_async)
+      : m_update_async(_update_async) {}
+
+  /** Default deconstructor */
+  ~__dag_async_node() {}
+
+  /** Overloaded function to call the mapping coroutine.
+   * @param _data Input data to the coroutine
+   * @return The task giving the output data
+   */
+  task<unique_ptr<Out>> update_async(const In *const _data) {
+    return m_update_async(_data);
+  };
+};
+
 /** A wrapper function that constructs a generator wrapper for your generator
  * function
  *
@@ -69,11 +180,14 @@ class __dag_node : public dag_node<In, Out> {
  * and wrap your lambda around.
  *
  * @param _run_fn A lambda function that outputs *Out* typed data when called
+ * @param _pacing How the dag should pace calls to the lambda. Defaults to as
+ * fast as possible.
  * @return A wrapped, compatible, source node for the dag tree.
  */
 template <typename Out>
-dag_source<Out> *fn_source(function<unique_ptr<Out>()> _run_fn) {
-  return new __dag_source(_run_fn);
+dag_source<Out> *fn_source(function<unique_ptr<Out>()> _run_fn,
+                           source_pacing _pacing = {}) {
+  return new __dag_source(_run_fn, _pacing);
 }
 
 /** A wrapper function that constructs a mapping wrapper for your mapping
@@ -92,4 +206,58 @@ dag_node<In, Out> *fn_call(function<unique_ptr<Out>(const In *const)> _run_fn) {
   return new __dag_node(_run_fn);
 }
 
+/** A wrapper function that constructs a mapping wrapper for your mapping
+ * function that fills in its output
+ *
+ * Like fn_call, but the lambda writes into an output it is given and says
+ * whether there is one. That way a node running in a child process builds
+ * its output straight in shared memory. Otherwise the output is default
+ * constructed on the heap first.
+ *
+ * @param _run_fn A lambda function that fills in *Out* typed data when
+ * called with *In* type data, and returns false if there is nothing to pass
+ * on.
+ * @return A wrapped, compatible, dag node for the dag tree.
+ */
+template <typename In, typename Out>
+dag_node<In, Out> *fn_call_into(
+    function<bool(const In *const, Out &)> _run_fn) {
+  return new __dag_into_node(_run_fn);
+}
+
+/** A wrapper function that constructs a mapping wrapper for your batched
+ * mapping function
+ *
+ * Like fn_call, but the lambda gets every input of a batch at once, e.g. to
+ * run inference on all of them together. Messages that do not come in a
+ * batch are handed over as a batch of one.
+ *
+ * @param _run_fn A lambda function that outputs one *Out* typed data per
+ * *In* typed data it is called with, in order. Null where there is nothing to
+ * pass on.
+ * @return A wrapped, compatible, dag node for the dag tree.
+ */
+template <typename In, typename Out>
+dag_node<In, Out> *fn_batch_call(
+    function<vector<unique_ptr<Out>>(span<const In *const>)> _run_fn) {
+  return new __dag_batch_node(_run_fn);
+}
+
+/** A wrapper function that constructs a mapping wrapper for your mapping
+ * coroutine
+ *
+ * Like fn_call, but the lambda is a coroutine that can co_await I/O and
+ * timers without holding a worker (see dag_async_node). The lambda is kept
+ * in the node, so its captures live as long as the node.
+ *
+ * @param _run_fn A lambda coroutine that gives *Out* typed data when called
+ * with *In* type data.
+ * @return A wrapped, compatible, dag node for the dag tree.
+ */
+template <typename In, typename Out>
+dag_node<In, Out> *fn_async_call(
+    function<task<unique_ptr<Out>>(const In *const)> _run_fn) {
+  return new __dag_async_node(_run_fn);
+}
+
 }  // namespace fn_dag
@@ -13,14 +13,48 @@
 #include <functional_dag/error_codes.h>
 
 #include <expected>
+#include <functional>
 #include <functional_dag/core/dag_utils.hpp>
+#include <functional_dag/core/object_pool.hpp>
 #include <functional_dag/impl/dag_node_impl.hpp>
-#include <thread>
+#include <functional_dag/impl/dag_plan_impl.hpp>
+#include <memory>
 #include <vector>
 
 namespace fn_dag {
 using namespace std;
 
+/** Counts the fused links the calling thread runs inside each other. Every
+ * fused link runs in the stack frame of the one before it, so a chain is
+ * cut into tasks of at most max_links links before it runs out of stack.
+ */
+class _fused_scope {
+ private:
+  static inline thread_local size_t t_depth = 0;  // Links the thread is in
+  const bool m_entered;  // Whether there was room for one more link
+
+ public:
+  static constexpr size_t max_links = 256;  // Fused links per task at most
+
+  /** Enters a fused link if the thread is not max_links deep yet. */
+  _fused_scope() : m_entered(t_depth < max_links) {
+    if (m_entered) t_depth++;
+  }
+
+  /** Leaves the fused link, if it was entered. */
+  ~_fused_scope() {
+    if (m_entered) t_depth--;
+  }
+
+  _fused_scope(const _fused_scope &) = delete;
+  _fused_scope &operator=(const _fused_scope &) = delete;
+
+  /** Whether the link may run in the current task.
+   * @return False if the chain has to go on in a new task
+   */
+  bool entered() const { return m_entered; }
+};
+
 /** Internal node to take data from parent and run children.
  *
  * Every node when generating output will send it's output to the nodes
@@ -31,17 +65,71 @@ class dag_fanout_node {
  private:
   const fn_dag::_dag_context &g_context;  // Shared state
   vector<_abstract_internal_dag_node<Type, IDType> *>
-      m_children;  // Children to fan-out to
+      m_children;        // Children to fan-out to
+  const bool m_chained;  // Whether a node, not a source, owns the fan-out
+  bool m_lone_link;      // Whether the only child continues a chain
+  atomic<object_pool<Type> *>
+      m_pool;  // Where the data goes when the children are done, if anywhere
+  atomic<uint64_t> m_pools_seen;  // The version of the pools m_pool is from
 
-  /**
-   * This is an internal function for adding subsequent nodes
-   * @param _new_node The node to add to the children
+  /** Whether the only child runs in the task of the parent.
+   * @return True if the chain is fused
    */
-  void _add_node(_abstract_internal_dag_node<Type, IDType> *_new_node) {
-    m_children.push_back(_new_node);
+  bool fused() const {
+    return m_lone_link && g_context.fuse_chains &&
+           m_children.front()->fusable();
   }
 
  public:
+  /** Whether the data is a container that allocates from an arena, as far
+   * as can be told: containers with a pmr allocator say what they use.
+   *
+   * @param _data The data
+   * @param _arena The arena
+   * @return True if the data allocates from the arena
+   */
+  static bool allocates_from(const Type &_data, const _frame_arena *_arena) {
+    if constexpr (requires { _data.get_allocator().resource(); })
+      return _data.get_allocator().resource() == _arena;
+    else
+      return false;
+  }
+
+  /** Shares the data with the children. Once the last of them is done, the
+   * data goes back to the pool of its type if the manager has one.
+   *
+   * If a node of the frame used the frame's arena, the data keeps the arena
+   * alive until it is let go of, since it may have been allocated from it
+   * and can outlive the frame, e.g. in a join. Such data only goes back to
+   * the pool if it does not allocate from the arena itself.
+   *
+   * @param _data Data from the parent node
+   * @param _frame The frame the data belongs to
+   * @return The payload to hand to the children
+   */
+  dag_payload<Type> share(unique_ptr<Type> _data, _dag_frame &_frame) {
+    const shared_ptr<const _frame_arena> arena = _frame.arena().keep_alive();
+    object_pool<Type> *pool = m_pool.load(memory_order_acquire);
+    if (pool == nullptr) {
+      // Only look the pool up again when one was added since
+      const uint64_t version = g_context.pools.version();
+      if (m_pools_seen.exchange(version) != version) {
+        pool = g_context.pools.template find<Type>();
+        m_pool.store(pool, memory_order_release);
+      }
+    }
+    if (arena != nullptr && allocates_from(*_data, arena.get()))
+      pool = nullptr;
+    if (pool == nullptr && arena == nullptr)
+      return dag_payload<Type>(std::move(_data));
+    // The data is let go of before the arena it may use
+    return dag_payload<Type>(
+        _data.release(), [pool, arena](const Type *_released) {
+          unique_ptr<Type> released(const_cast<Type *>(_released));
+          if (pool != nullptr) pool->release(std::move(released));
+        });
+  }
+
   /** This node uses data computed from the previous node to fan-out to it's
    children
    *
@@ -50,9 +138,30 @@ class dag_fanout_node {
    * data as well as cleaning up the data on the heap when finished
 
    * @param _context The shared state between the nodes
+   * @param _chained Whether a node owns the fan-out. The children of a source
+   * always start a new task so the source never waits on them.
   */
-  dag_fanout_node(const _dag_context &_context)
-      : g_context(_context), m_children() {}
+  dag_fanout_node(const _dag_context &_context, const bool _chained = false)
+      : g_context(_context),
+        m_children(),
+        m_chained(_chained),
+        m_lone_link(false),
+        m_pool(nullptr),
+        m_pools_seen(0) {}
+
+  /**
+   * This is an internal function for adding subsequent nodes. The fan-out
+   * owns the node from then on.
+   *
+   * This is also where chains are found: a node with exactly one child, that
+   * has no other parent, is a link of a chain.
+   *
+   * @param _new_node The node to add to the children
+   */
+  void _add_node(_abstract_internal_dag_node<Type, IDType> *_new_node) {
+    m_children.push_back(_new_node);
+    m_lone_link = m_chained && m_children.size() == 1;
+  }
 
   /** Standard deconstructor */
   ~dag_fanout_node() {
@@ -63,83 +172,98 @@ class dag_fanout_node {
   /** Function to move data through the graph.
    *
    * This function will take data from the parent node and execute
-   * the subsequent functions with the data. After the subsequent
-   * nodes have been run, it deletes the data. The nodes will run
-   * on their own threads in the event that run_single_threaded is
-   * off. Otherwise, this function will block until the children are
-   * finished in a depth-first way.
+   * the subsequent functions with the data. The data is handed to the
+   * children as a shared, immutable payload and is deleted, or given back to
+   * the pool of its type, by whichever child finishes last.
+   *
+   * If run_single_threaded is on (or there is no pool), this function will
+   * block until the children are finished in a depth-first way. Otherwise
+   * each child is submitted to the shared pool and this returns right away,
+   * so the parent is never held up by its slowest child. Children with a
+   * deadline are dispatched earliest deadline first, ahead of the others. In
+   * pipelined mode the payload is queued on the children's inboxes instead.
+   *
+   * When chains are fused, a node's only child runs right away in the
+   * parent's task instead, so a chain runs as one task on one thread without
+   * paying for scheduling between its links. Every _fused_scope::max_links
+   * links the rest of the chain goes on in a new task, so a long chain does
+   * not overflow the worker's stack.
    *
    * @param _data Data from the parent node
+   * @param _frame The frame the data belongs to
    */
-  void fan_out(unique_ptr<Type> _data) {
+  void fan_out(unique_ptr<Type> _data, const shared_ptr<_dag_frame> &_frame) {
     if (_data.get() == nullptr) return;
-    if (!g_context.run_single_threaded) {
-      vector<thread> child_threads;
-
-      for (auto it : m_children)
-        child_threads.push_back(thread(
-            &fn_dag::_abstract_internal_dag_node<Type, IDType>::run_filter, it,
-            _data.get()));
-
-      for (uint32_t i = 0; i < child_threads.size(); i++)
-        child_threads[i].join();
-    } else
-      for (auto it : m_children) it->run_filter(_data.get());
+    const _dag_message<Type> msg{_frame, share(std::move(_data), *_frame),
+                                 _sent_stamp<>::now()};
+    if (g_context.run_single_threaded || g_context.executor == nullptr) {
+      for (auto it : m_children) it->run_filter(msg);
+      return;
+    }
+    if (fused()) {
+      if (_fused_scope link; link.entered()) {
+        m_children.front()->run_filter(msg);
+        return;
+      }
+    }
+    if (g_context.pipelined) {
+      for (auto it : m_children) it->enqueue(msg);
+    } else {
+      for (auto it : m_children) {
+        _dag_executor *placed = it->executor();
+        _dag_executor *pool = placed != nullptr ? placed : g_context.executor;
+        auto task = [it, msg]() { it->run_filter(msg); };
+        if (const auto deadline = it->deadline_of(*_frame))
+          pool->submit_by(std::move(task), *deadline);
+        else
+          pool->submit(std::move(task));
+      }
+    }
   }
 
   /** Printing function
    *
    * This will print recursively to the logging stream the identity
-   * of the nodes. This can help ensure the dag was constructed correctly
+   * of the nodes. This can help ensure the dag was constructed correctly.
+   * A fused link of a chain is printed as => instead of ->.
    *
    * @param _indent The parents indent context
    */
   void print(const string &_indent) {
     const string next_indent = _indent + string(g_context.indent_str);
+    const char *const link = fused() ? "=>" : "->";
 
     for (const auto child : m_children) {
-      *g_context.log << _indent << "->";
+      *g_context.log << _indent << link;
       child->print(next_indent);
     }
   }
 
-  /** Recursively adds a node to children.
+  /** Recursively finds a node by ID in the children.
    *
-   * This function will check whether the node attaches to the parent
-   * of this fan-out. If so, then it becomes a child of the parent function.
-   * If it did not attach to parent node, then it will recursively check its
-   * children until it finds it. If the parent isn't found, it will return
-   * false.
+   * @param _id The ID to look for.
+   * @return The node or nullptr if none of the children has the ID.
+   */
+  _dag_node_base<IDType> *find_node(const IDType &_id) {
+    for (auto child : m_children)
+      if (auto found = child->find_node(_id); found != nullptr) return found;
+    return nullptr;
+  }
+
+  /** Adds the children to the plan of a frozen DAG, in the order they run.
    *
-   * @param _node_to_add The node to add
-   * @param _onto The ID of the parent the node wants to attach to
-   * @param _parent_id The current ID of this nodes parent
-   * @return The parent ID if successfully added. Otherwise it returns an error
-   * code.
+   * @param _plan The plan being compiled
    */
-  template <typename In, typename Out>
-  [[nodiscard]] expected<IDType, error_codes> add_node_to_subdag(
-      _internal_dag_node<In, Out, IDType> *_node_to_add, const IDType _onto,
-      const IDType _parent_id) {
-    if (_onto == _parent_id) {
-      _add_node((_abstract_internal_dag_node<In, IDType> *)_node_to_add);
-      return _parent_id;
-    } else {
-      for (auto child = m_children.cbegin(); child != m_children.cend();
-           child++) {
-        auto *internal_child =
-            static_cast<_internal_dag_node<In, Type, IDType> *>(*child);
-        fn_dag::dag_fanout_node<Type, IDType> *fanout_node =
-            internal_child->m_child;
-        if (auto p = fanout_node->add_node_to_subdag(_node_to_add, _onto,
-                                                     (*child)->get_id());
-            p.has_value())
-          return p.value();
-      }
-    }
+  void add_to_plan(_dag_plan &_plan) {
+    for (auto child : m_children) child->add_to_plan(_plan);
+  }
 
-    return unexpected(error_codes::PARENT_NOT_FOUND);
-    ;
+  /** Recursively visits every node in the children's subtrees.
+   *
+   * @param _fn What to call on each node.
+   */
+  void for_each_node(const function<void(_dag_node_base<IDType> &)> &_fn) {
+    for (auto child : m_children) child->for_each_node(_fn);
   }
 };
 }  // namespace fn_dag
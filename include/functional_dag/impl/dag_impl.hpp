@@ -11,12 +11,21 @@
  */
 #include <functional_dag/error_codes.h>
 
+#include <chrono>
 #include <expected>
+#include <functional>
 #include <iostream>
-#include <unordered_set>
+#include <memory>
+#include <typeinfo>
+#include <unordered_map>
 
+#include "functional_dag/core/node_metrics.hpp"
+#include "functional_dag/core/source_loop.hpp"
+#include "functional_dag/core/thread_placement.hpp"
+#include "functional_dag/core/tracer.hpp"
 #include "functional_dag/dag_interface.hpp"
 #include "functional_dag/impl/dag_fanout_impl.hpp"
+#include "functional_dag/impl/dag_plan_impl.hpp"
 
 namespace fn_dag {
 using namespace std;
@@ -47,6 +56,94 @@ class _dag_base {
 
   /** Calls the source generator data and propagates it across the DAG once. */
   virtual void push_once() = 0;
+
+  /** Finds one of the DAG's nodes by ID
+   * @return The node or nullptr if the DAG does not contain the ID
+   */
+  virtual _dag_node_base<IDType> *find_node(const IDType &_id) = 0;
+
+  /** Reads how well the source kept its pace
+   * @return A snapshot of the pacing counters
+   */
+  virtual pacing_stats get_pacing_stats() = 0;
+
+  /** Reads what the source did so far
+   * @return A snapshot of the source's metrics
+   */
+  virtual node_metrics get_source_metrics() = 0;
+
+  /** Changes where the source thread runs
+   * @param _placement Where the thread should run
+   */
+  virtual void set_placement(const thread_placement &_placement) = 0;
+
+  /** Compiles the DAG into an execution plan, and stops taking new nodes
+   * @return What the plan looks like
+   */
+  virtual plan_stats freeze() = 0;
+
+  /** Visits every node of the DAG
+   * @param _fn What to call on each node
+   */
+  virtual void for_each_node(
+      const function<void(_dag_node_base<IDType> &)> &_fn) = 0;
+
+  /** Stops calling the source and waits for the source thread to finish
+   * @param _deadline When to give up waiting
+   * @return Whether the source thread finished in time
+   */
+  virtual bool stop_generating(chrono::steady_clock::time_point _deadline) = 0;
+
+  /** Finds the fan-out a child attaches to
+   * @param _onto The ID of the parent, either a node or the DAG itself
+   * @param _type The input type of the child
+   * @return The parent's dag_fanout_node of that type. Otherwise an error
+   * code if the parent is not in the DAG or outputs another type.
+   */
+  virtual expected<void *, error_codes> attach_point(
+      const IDType &_onto, const type_info &_type) = 0;
+
+  /** Records that a node now belongs to the DAG
+   * @param _id The ID of the node
+   * @param _node The node, to find it again without walking the DAG
+   */
+  virtual void register_node(const IDType &_id,
+                             _dag_node_base<IDType> *_node) = 0;
+
+  /** Getter for the state shared by the DAG's nodes
+   * @return The shared context
+   */
+  virtual const _dag_context &get_context() = 0;
+
+  /** Adds a new function to the DAG.
+   *
+   * Looks the parent up by ID and, after checking that it outputs the type
+   * the function takes, attaches the function to the parent to process the
+   * data output by the parent node.
+   *
+   * @param _newID The ID of the new function
+   * @param _new_filter The mapping function itself to pass along
+   * @param _on_node The ID of the parent to attach the function to.
+   * @param _edge The options of the edge from the parent to the function.
+   * @return A parent ID if successfully added to the dag. Otherwise an error
+   * code.
+   */
+  template <typename In, typename Out>
+  [[nodiscard]] expected<IDType, error_codes> add_filter(
+      IDType _newID, dag_node<In, Out> *_new_filter, IDType _on_node,
+      const edge_options &_edge = {}) {
+    auto fanout = attach_point(_on_node, typeid(In));
+    if (!fanout) {
+      delete _new_filter;
+      return unexpected(fanout.error());
+    }
+    auto node = new _internal_dag_node<In, Out, IDType>(
+        _newID, _new_filter, get_context(), _edge);
+    static_cast<dag_fanout_node<In, IDType> *>(fanout.value())
+        ->_add_node(node);
+    register_node(_newID, node);
+    return _on_node;
+  }
 };
 
 /** The main DAG function that encapulates generation and mapping of the data
@@ -66,11 +163,16 @@ class dag : public _dag_base<IDType> {
   dag_source<OriginType> *m_source;  // The source generator that creates data
   dag_fanout_node<OriginType, IDType>
       m_children;  // The children of the source to propagate data across
-  unordered_set<IDType> m_children_ids;  // An optimization: a quick O(1) set
-                                         // lookup of the children IDs
+  unordered_map<IDType, _dag_node_base<IDType> *>
+      m_children_ids;  // An optimization: a quick O(1) lookup of the
+                       // children by ID
   const _dag_context
-      &g_context;   // The shared state across all of the children of this node.
-  thread m_thread;  // Thread to run on if this DAG runs multi-threaded.
+      &g_context;  // The shared state across all of the children of this node.
+  atomic<uint64_t> m_next_sequence;  // The sequence number of the next frame
+  _node_meter<> m_meter;  // What the source did, see get_source_metrics
+  const uint32_t m_track;  // What the source's spans refer to it by
+  unique_ptr<_dag_plan> m_plan;  // What runs the nodes once the DAG is frozen
+  _source_loop m_loop;  // Thread to run on if this DAG runs multi-threaded.
 
  public:
   /** Constructor of the DAG. Ideally this is created in the manager but you can
@@ -89,13 +191,25 @@ class dag : public _dag_base<IDType> {
         m_source(_lsource),
         m_children(_context),
         m_children_ids(),
-        g_context(_context) {
-    if (_startThread) m_thread = thread(&dag::start_source, this);
+        g_context(_context),
+        m_next_sequence(0),
+        m_meter(),
+        m_track(_context.tracer.track(_id)),
+        m_plan(),
+        m_loop() {
+    if (_startThread)
+      m_loop.start(
+          g_context.stopper.get_token(), m_source->pacing(),
+          [this]() { return tick(); },
+          [this](const chrono::nanoseconds _timeout) {
+            return m_source->wait_for_data(_timeout);
+          });
   }
 
-  /** Default deconstructor. Waits for children to stop before cleaning up. */
+  /** Default deconstructor. Stops the source thread and waits for it before
+   * cleaning up. */
   ~dag() {
-    if (m_thread.joinable()) m_thread.join();
+    m_loop.join();
     delete m_source;
   }
 
@@ -114,13 +228,13 @@ class dag : public _dag_base<IDType> {
    *
    * @param _raw_dat The raw data that the user provides.
    */
-  void manual_pump(const unique_ptr<OriginType> _raw_dat) {
-    m_children.fan_out(_raw_dat);
+  void manual_pump(unique_ptr<OriginType> _raw_dat) {
+    propagate(std::move(_raw_dat));
   }
 
   /** Checks whether this DAG contains a specific ID
    *
-   * Given an ID, it will check the optimized hash set to see if the child
+   * Given an ID, it will check the optimized hash map to see if the child
    * exists.
    *
    * @param _id The ID to lookup
@@ -128,30 +242,55 @@ class dag : public _dag_base<IDType> {
    */
   bool dag_contains(const IDType &_id) { return m_children_ids.count(_id) > 0; }
 
-  /** Adds a new function to the DAG.
-   *
-   * Since the generator already exists, this function recursively calls itself
-   * with the parents nodes type and, in a strongly typed way, attaches a child
-   * to the parent to process the data output by the parent node.
+  /** Finds the fan-out a child attaches to
    *
-   * @param _newID The ID of the new function
-   * @param _new_filter The mapping function itself to pass along
-   * @param _on_node The ID of the parent to attach the function to.
-   * @return A parent ID if successfully added to the dag. Otherwise an error
-   * code.
+   * @param _onto The ID of the parent, either a node or the DAG itself
+   * @param _type The input type of the child
+   * @return The parent's dag_fanout_node of that type. Otherwise an error
+   * code if the parent is not in the DAG or outputs another type.
    */
-  template <typename In, typename Out>
-  [[nodiscard]] expected<IDType, error_codes> add_filter(
-      IDType _newID, dag_node<In, Out> *_new_filter, IDType _on_node) {
-    _internal_dag_node<In, Out, IDType> *new_node;
-    new_node =
-        new _internal_dag_node<In, Out, IDType>(_newID, _new_filter, g_context);
-    m_children_ids.insert(_newID);
-    auto res = m_children.add_node_to_subdag(new_node, _on_node, m_id);
-    if (!res) {
-      delete new_node;
+  expected<void *, error_codes> attach_point(const IDType &_onto,
+                                             const type_info &_type) {
+    void *fanout = nullptr;
+    if (m_plan != nullptr && (_onto == m_id || dag_contains(_onto))) {
+      return unexpected(error_codes::DAG_FROZEN);
+    } else if (_onto == m_id) {
+      if (_type == typeid(OriginType)) fanout = &m_children;
+    } else if (auto parent = find_node(_onto); parent != nullptr) {
+      fanout = parent->attach_point(_type);
+    } else {
+      return unexpected(error_codes::PARENT_NOT_FOUND);
     }
-    return res;
+    if (fanout == nullptr) return unexpected(error_codes::INPUT_TYPE_MISMATCH);
+    return fanout;
+  }
+
+  /** Records that a node now belongs to the DAG
+   *
+   * The first node registered under an ID keeps it.
+   *
+   * @param _id The ID of the node
+   * @param _node The node, to find it again without walking the DAG
+   */
+  void register_node(const IDType &_id, _dag_node_base<IDType> *_node) {
+    m_children_ids.emplace(_id, _node);
+  }
+
+  /** Getter for the state shared by the DAG's nodes
+   * @return The shared context
+   */
+  const _dag_context &get_context() { return g_context; }
+
+  /** Finds one of the DAG's nodes by ID
+   *
+   * Looks the node up in the hash map rather than walking the DAG.
+   *
+   * @param _id The ID to look for
+   * @return The node or nullptr if the DAG does not contain the ID
+   */
+  _dag_node_base<IDType> *find_node(const IDType &_id) {
+    auto found = m_children_ids.find(_id);
+    return found == m_children_ids.end() ? nullptr : found->second;
   }
 
   /** Simple print function to print the ID of this DAG and it's children. */
@@ -165,18 +304,136 @@ class dag : public _dag_base<IDType> {
    * This function can be called from the thread on a loop or called on a single
    * thread. This encapsulates a single pass across the DAG.
    */
-  void push_once() {
-    unique_ptr<OriginType> dat = m_source->update();
-    if (dat.get() != nullptr) m_children.fan_out(std::move(dat));
+  void push_once() { m_loop.count(tick()); }
+
+  /** Reads how well the source kept its pace
+   *
+   * For fixed rate sources this includes the jitter: how late the thread
+   * woke up compared to each deadline.
+   *
+   * @return A snapshot of the pacing counters
+   */
+  pacing_stats get_pacing_stats() { return m_loop.stats(); }
+
+  /** Reads what the source did so far
+   *
+   * The latency is how long the source's update took, and a null output is
+   * a call that had no data. Sources have no queue to wait in.
+   *
+   * @return A snapshot of the source's metrics
+   */
+  node_metrics get_source_metrics() { return m_meter.snapshot(); }
+
+  /** Changes where the source thread runs. Pushes from other threads are
+   * not moved.
+   *
+   * @param _placement Where the thread should run
+   */
+  void set_placement(const thread_placement &_placement) {
+    m_loop.set_placement(_placement);
+  }
+
+  /** Visits every node of the DAG
+   * @param _fn What to call on each node
+   */
+  void for_each_node(const function<void(_dag_node_base<IDType> &)> &_fn) {
+    m_children.for_each_node(_fn);
+  }
+
+  /** Compiles the DAG into an execution plan, and stops taking new nodes
+   *
+   * Nodes are laid out in flat arrays, level by level, and when the DAG runs
+   * single threaded a frame is a loop over them rather than a recursive walk
+   * of the tree, so deep chains don't grow the stack. Joins, and what is
+   * attached to them, still run the way they do in a DAG that is not frozen.
+   * Multi-threaded and pipelined DAGs run as before, on the pool, and only
+   * stop taking new nodes. Like adding nodes, only freeze while the DAG is
+   * not running. Freezing twice does nothing.
+   *
+   * @return What the plan looks like
+   */
+  plan_stats freeze() {
+    if (m_plan == nullptr)
+      m_plan = make_unique<_dag_plan>(
+          &m_children, [](void *_children, _dag_plan &_plan) {
+            static_cast<dag_fanout_node<OriginType, IDType> *>(_children)
+                ->add_to_plan(_plan);
+          });
+    return m_plan->stats();
+  }
+
+  /** Stops calling the source and waits for the source thread to finish
+   *
+   * The nodes keep running so the frames already produced can finish. A
+   * source thread that is sleeping wakes up right away. One blocked in the
+   * source's update or wait_for_data only returns once the source notices
+   * current_stop_token() was stopped.
+   *
+   * @param _deadline When to give up waiting
+   * @return Whether the source thread finished in time
+   */
+  bool stop_generating(chrono::steady_clock::time_point _deadline) {
+    return m_loop.stop(_deadline);
   }
 
  private:
-  /** Private function to run on a thread. Loops until asked to stop.
+  /** Spreads data from the source across the DAG as a new frame.
+   *
+   * In multi-threaded mode the children run on the pool and this waits,
+   * helping the pool, until the last message of the frame is gone. That keeps
+   * every node on one frame at a time without any node waiting on its
+   * children. Pipelined and single threaded DAGs return as soon as the
+   * children have the data (queued or already processed).
    *
-   * This is the thread function. Runs until the DAG is asked to stop.
+   * @param _data The data to propagate. Nothing happens if it is null.
    */
-  void start_source() {
-    while (!g_context.filter_off) push_once();
+  void propagate(unique_ptr<OriginType> _data) {
+    if (_data.get() == nullptr) return;
+    const bool waits = !g_context.run_single_threaded &&
+                       g_context.executor != nullptr && !g_context.pipelined;
+    _task_group frame_running;
+    if (waits) frame_running.add();
+    {
+      // Let go of the frame before waiting on it
+      const auto frame = new_frame(waits ? &frame_running : nullptr);
+      _tracer::_span traced(g_context.tracer, "fan_out", m_track,
+                            frame->sequence());
+      if (m_plan != nullptr &&
+          (g_context.run_single_threaded || g_context.executor == nullptr))
+        m_plan->run(m_children.share(std::move(_data), *frame), frame);
+      else
+        m_children.fan_out(std::move(_data), frame);
+    }
+    if (waits) frame_running.wait(*g_context.executor);
+  }
+
+  /** Starts the frame of the source's next output.
+   * @param _on_done A group to mark done when the frame has propagated, if any
+   * @return The frame, stamped with the next sequence number and the time
+   */
+  shared_ptr<_dag_frame> new_frame(_task_group *_on_done) {
+    return make_shared<_dag_frame>(_on_done, g_context.frames_in_flight,
+                                   m_next_sequence++,
+                                   chrono::steady_clock::now());
+  }
+
+  /** Calls the source once and propagates what it returned.
+   * @return Whether the source returned data
+   */
+  bool tick() {
+    const auto started = m_meter.start();
+    unique_ptr<OriginType> dat;
+    {
+      _tracer::_span traced(g_context.tracer, "update", m_track,
+                            m_next_sequence.load());
+      dat = m_source->update();
+      // Polls without data would push the useful spans out of the ring
+      if (dat == nullptr) traced.discard();
+    }
+    const bool had_data = dat != nullptr;
+    m_meter.finish(started, 1, had_data);
+    propagate(std::move(dat));
+    return had_data;
   }
 };
 };  // namespace fn_dag
@@ -0,0 +1,663 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <typeinfo>
+#include <utility>
+
+#include "functional_dag/core/bounded_queue.hpp"
+#include "functional_dag/core/cancellation.hpp"
+#include "functional_dag/core/dag_message.hpp"
+#include "functional_dag/core/dag_utils.hpp"
+#include "functional_dag/core/edge_policy.hpp"
+#include "functional_dag/core/frame_arena.hpp"
+#include "functional_dag/core/join_policy.hpp"
+#include "functional_dag/core/node_metrics.hpp"
+#include "functional_dag/core/residence.hpp"
+#include "functional_dag/core/tracer.hpp"
+#include "functional_dag/dag_interface.hpp"
+#include "functional_dag/impl/dag_fanout_impl.hpp"
+#include "functional_dag/impl/dag_node_impl.hpp"
+
+namespace fn_dag {
+using namespace std;
+
+/** An input of a join node waiting to be matched. It does not hold on to its
+ * frame so an unmatched input never keeps its source waiting. */
+template <typename T>
+struct _join_sample {
+  dag_payload<T> data;                     //! The shared, immutable data
+  uint64_t sequence;                       //! The frame's sequence number
+  chrono::steady_clock::time_point stamp;  //! The frame's timestamp
+};
+
+/** The buffers of one parent of a join node. */
+template <typename T>
+struct _join_input {
+  _bounded_queue<_dag_message<T>>
+      queue;  //! Lock-free hand-off from the parent to the matcher
+  deque<_join_sample<T>> staged;  //! Unmatched inputs. Only the matcher
+                                  //! touches it and it never grows past the
+                                  //! join's capacity.
+
+  /** Creates empty buffers.
+   * @param _capacity How many inputs each buffer holds
+   */
+  explicit _join_input(const size_t _capacity) : queue(_capacity), staged() {}
+};
+
+/** An internal class to encapsulate a function that takes one input from each
+ * of several parents, possibly from different dags.
+ *
+ * Each parent hands its output to the join through a lock-free bounded queue.
+ * Whichever thread wins the turn (the same way a pipelined node drains its
+ * inbox) moves the queued inputs to the staging buffers, matches them by the
+ * join policy and runs the function on every match, one at a time. The output
+ * belongs to the frame of the input that completed the match.
+ */
+template <typename Out, typename IDType, typename... Ins>
+class _join_node : public _dag_node_base<IDType> {
+ private:
+  static constexpr size_t num_inputs = sizeof...(Ins);  // How many parents
+  using _picks = array<size_t, num_inputs>;  // A staged input per parent
+
+  template <size_t I>
+  using _input_type = tuple_element_t<I, tuple<Ins...>>;
+
+  dag_node<tuple<Ins...>, Out> *m_node_hook;  // The function to run
+  const IDType m_node_id;                     // The ID of the node
+  dag_fanout_node<Out, IDType>
+      *m_child;  // All of the children to provide our output data to.
+  const fn_dag::_dag_context
+      &g_context;               // A hook to the global context of this DAG.
+  const uint32_t m_track;       // What the join's spans refer to it by
+  const join_options m_options;  // How inputs are matched
+  const size_t m_capacity;       // How many inputs each buffer holds
+  tuple<_join_input<Ins>...> m_inputs;  // The buffers of every parent
+  atomic<uint64_t> m_delivered;         // Inputs handed to the join
+  atomic<uint64_t> m_dropped;           // Inputs that were never matched
+  atomic<bool> m_scheduled;  // Whether the matcher is queued or running
+  atomic<bool> m_draining;   // Whether the matcher is still touching the node
+  _node_meter<> m_meter;     // What the join did, see get_metrics
+  const stop_token m_stop;   // Set when the dags are asked to stop
+
+  /** Hands the matcher's turn to the pool, or takes it right here.
+   * @param _inline Whether to match on the calling thread
+   */
+  void schedule(const bool _inline) {
+    if (m_scheduled.exchange(true)) return;
+    if (_inline || g_context.executor == nullptr)
+      drain();
+    else
+      g_context.executor->submit([this]() { drain(); });
+  }
+
+  /** Matches everything that is queued, one input of each parent at a time
+   * so they are roughly handled in the order they arrived. */
+  void drain() {
+    m_draining.store(true);
+    while (true) {
+      while (pull(index_sequence_for<Ins...>{})) {
+      }
+      m_scheduled.store(false);
+      if (!any_queued(index_sequence_for<Ins...>{}) ||
+          m_scheduled.exchange(true))
+        break;
+    }
+    m_draining.store(false);
+  }
+
+  /** Takes at most one queued input of every parent.
+   * @return Whether any input was taken
+   */
+  template <size_t... I>
+  bool pull(index_sequence<I...>) {
+    return (pull_one<I>() | ...);
+  }
+
+  /** Checks the hand-off queues
+   * @return Whether any parent has queued input
+   */
+  template <size_t... I>
+  bool any_queued(index_sequence<I...>) const {
+    return ((get<I>(m_inputs).queue.size_approx() > 0) || ...);
+  }
+
+  /** Takes one queued input of a parent, stages it and tries to match it.
+   * @return Whether there was an input
+   */
+  template <size_t I>
+  bool pull_one() {
+    _dag_message<_input_type<I>> msg;
+    if (!get<I>(m_inputs).queue.try_pop(msg)) return false;
+    if (m_stop.stop_requested()) {
+      m_dropped++;
+      return true;
+    }
+
+    auto &staged = get<I>(m_inputs).staged;
+    if (m_options.policy == join_policy::SAMPLE_AND_HOLD) {
+      staged.clear();
+    } else if (staged.size() >= m_capacity) {
+      staged.pop_front();
+      m_dropped++;
+    }
+    const uint64_t sequence = msg.frame->sequence();
+    const auto stamp = msg.frame->stamp();
+    staged.push_back({std::move(msg.data), sequence, stamp});
+
+    // Sample and hold only fires on the first parent
+    if (m_options.policy == join_policy::SAMPLE_AND_HOLD && I != 0)
+      return true;
+    _picks picks;
+    if (match_all(picks, sequence, stamp, index_sequence_for<Ins...>{})) {
+      emit(picks, msg.frame, index_sequence_for<Ins...>{});
+      consume(picks, index_sequence_for<Ins...>{});
+    }
+    return true;
+  }
+
+  /** Picks a staged input of every parent that matches an input.
+   * @return Whether every parent had a match
+   */
+  template <size_t... I>
+  bool match_all(_picks &_out, const uint64_t _sequence,
+                 const chrono::steady_clock::time_point _stamp,
+                 index_sequence<I...>) const {
+    return (match<I>(_out[I], _sequence, _stamp) && ...);
+  }
+
+  /** Picks the staged input of a parent that matches an input.
+   *
+   * @param _out Where to write the index of the staged input
+   * @param _sequence The sequence number of the input to match
+   * @param _stamp The timestamp of the input to match
+   * @return Whether the parent had a match
+   */
+  template <size_t I>
+  bool match(size_t &_out, const uint64_t _sequence,
+             const chrono::steady_clock::time_point _stamp) const {
+    const auto &staged = get<I>(m_inputs).staged;
+    if (staged.empty()) return false;
+    switch (m_options.policy) {
+      case join_policy::EXACT_SEQUENCE:
+        for (size_t i = 0; i < staged.size(); i++) {
+          if (staged[i].sequence == _sequence) {
+            _out = i;
+            return true;
+          }
+        }
+        return false;
+      case join_policy::APPROXIMATE_TIME: {
+        bool found = false;
+        auto best_gap = m_options.window;
+        for (size_t i = 0; i < staged.size(); i++) {
+          const auto gap = chrono::abs(staged[i].stamp - _stamp);
+          if (gap <= best_gap) {
+            _out = i;
+            best_gap = gap;
+            found = true;
+          }
+        }
+        return found;
+      }
+      case join_policy::SAMPLE_AND_HOLD:
+        _out = staged.size() - 1;
+        return true;
+    }
+    return false;
+  }
+
+  /** Runs the function on a match and passes its output to the children.
+   *
+   * @param _matched The staged input of every parent
+   * @param _frame The frame the output belongs to
+   */
+  template <size_t... I>
+  void emit(const _picks &_matched, const shared_ptr<_dag_frame> &_frame,
+            index_sequence<I...>) {
+    const tuple<Ins...> joined(*get<I>(m_inputs).staged[_matched[I]].data...);
+    unique_ptr<Out> data_out;
+    {
+      _stop_scope scope(m_stop);
+      _arena_scope arena(&_frame->arena());
+      _tracer::_span traced(g_context.tracer, "update", m_track,
+                            _frame->sequence());
+      const auto started = m_meter.start();
+      data_out = m_node_hook->update(&joined);
+      m_meter.finish(started, 1, data_out != nullptr);
+    }
+    if (!m_stop.stop_requested() && data_out != nullptr) {
+      _tracer::_span traced(g_context.tracer, "fan_out", m_track,
+                            _frame->sequence());
+      m_child->fan_out(std::move(data_out), _frame);
+    }
+  }
+
+  /** Removes a match from the staging buffers. Older inputs can not match
+   * anymore and are dropped, except that sample and hold keeps holding the
+   * inputs of every parent but the first. */
+  template <size_t... I>
+  void consume(const _picks &_matched, index_sequence<I...>) {
+    (consume_one<I>(_matched[I]), ...);
+  }
+
+  /** Removes a match from the staging buffer of one parent.
+   * @param _pick The index of the matched input
+   */
+  template <size_t I>
+  void consume_one(const size_t _pick) {
+    auto &staged = get<I>(m_inputs).staged;
+    if (m_options.policy == join_policy::SAMPLE_AND_HOLD) {
+      if (I == 0) staged.clear();
+      return;
+    }
+    m_dropped += _pick;
+    staged.erase(staged.begin(), staged.begin() + _pick + 1);
+  }
+
+  /** Drops the queued input of every parent.
+   * @return How many inputs were dropped
+   */
+  template <size_t... I>
+  uint64_t discard_all(index_sequence<I...>) {
+    return (discard_one<I>() + ...);
+  }
+
+  /** Drops the queued input of one parent.
+   * @return How many inputs were dropped
+   */
+  template <size_t I>
+  uint64_t discard_one() {
+    _dag_message<_input_type<I>> msg;
+    uint64_t discarded = 0;
+    while (get<I>(m_inputs).queue.try_pop(msg)) {
+      msg = {};
+      discarded++;
+    }
+    return discarded;
+  }
+
+  /** Adds up the queued input of every parent. */
+  template <size_t... I>
+  size_t queued(index_sequence<I...>) const {
+    return (get<I>(m_inputs).queue.size_approx() + ...);
+  }
+
+ public:
+  /** Internal constructor for the encapsulated lambda function.
+   *
+   * @param _node_id The new ID of the node.
+   * @param _node The function to call on every match.
+   * @param _context The state variables for the DAG. All nodes share this
+   * information.
+   * @param _options How inputs are matched and buffered.
+   */
+  _join_node(IDType _node_id, dag_node<tuple<Ins...>, Out> *_node,
+             const fn_dag::_dag_context &_context, const join_options &_options)
+      : m_node_hook(_node),
+        m_node_id(_node_id),
+        m_child(new dag_fanout_node<Out, IDType>(_context, true)),
+        g_context(_context),
+        m_track(_context.tracer.track(_node_id)),
+        m_options(_options),
+        m_capacity(_options.capacity == 0 ? _context.edge_capacity
+                                          : _options.capacity),
+        // One buffer per parent, all of the same capacity
+        m_inputs(((void)sizeof(Ins), m_capacity)...),
+        m_delivered(0),
+        m_dropped(0),
+        m_scheduled(false),
+        m_draining(false),
+        m_meter(),
+        m_stop(_context.stopper.get_token()) {}
+
+  /** Default deconstructor. Waits for the matcher to finish first. */
+  ~_join_node() {
+    while (m_scheduled.load() || m_draining.load())
+      if (g_context.executor == nullptr || !g_context.executor->try_run_one())
+        this_thread::yield();
+    delete m_child;
+    delete m_node_hook;
+  }
+
+  /** Hands the input of a parent to the join.
+   *
+   * When the queue of the parent is full, the caller takes the matcher's turn
+   * to make room or helps the pool until the matcher did.
+   *
+   * @param _msg The parent's output
+   * @param _inline Whether to match on the calling thread or on the pool
+   */
+  template <size_t I>
+  void offer(_dag_message<_input_type<I>> _msg, const bool _inline) {
+    auto &queue = get<I>(m_inputs).queue;
+    while (!queue.try_push(_msg)) {
+      if (m_stop.stop_requested()) {
+        m_dropped++;
+        return;
+      }
+      if (!m_scheduled.exchange(true))
+        drain();
+      else if (g_context.executor == nullptr ||
+               !g_context.executor->try_run_one())
+        this_thread::yield();
+    }
+    m_delivered++;
+    schedule(_inline);
+  }
+
+  /** Hands the input of a parent to the join and matches it right away.
+   * @param _msg The parent's output
+   */
+  template <size_t I>
+  void run_filter(const _dag_message<_input_type<I>> &_msg) {
+    _tracer::_span traced(g_context.tracer, "run_filter", m_track,
+                          _msg.frame->sequence());
+    offer<I>(_msg, true);
+  }
+
+  /** Attaches the join to every parent.
+   *
+   * @param _join The join. Every parent shares it.
+   * @param _fanouts The dag_fanout_node of every parent, in the order of the
+   * inputs.
+   */
+  static void attach(const shared_ptr<_join_node> &_join,
+                     const array<void *, num_inputs> &_fanouts);
+
+  /** Joins always drop the oldest unmatched input; the policy can't change.
+   */
+  void set_overflow_policy(const overflow_policy) {}
+
+  /** Joins run in the task of whichever parent completes a match, so they
+   * can't be scheduled on their own.
+   * @return False, always.
+   */
+  bool set_priority(const priority_class, const chrono::nanoseconds) {
+    return false;
+  }
+
+  /** Joins run in the task of whichever parent completes a match, so they
+   * can't have a pool of their own.
+   * @return False, always.
+   */
+  bool set_executor(_dag_executor *const) { return false; }
+
+  /** Joins match their inputs in order, so they can't be replicated.
+   * @return False, always.
+   */
+  bool set_replicas(const size_t) { return false; }
+
+  /** Joins wait on several parents and can't move to another process.
+   * @param _residence Where the join should run.
+   * @return Whether that is in this process.
+   */
+  bool set_residence(const node_residence _residence) {
+    return _residence == node_residence::THREAD;
+  }
+
+  /** Reads the counters of the join's inputs, summed over the parents.
+   *
+   * @return A snapshot of the counters.
+   */
+  edge_stats get_edge_stats() {
+    return {.policy = overflow_policy::DROP_OLDEST,
+            .capacity = m_capacity,
+            .replicas = 1,
+            .queued = queued(index_sequence_for<Ins...>{}),
+            .delivered = m_delivered.load(),
+            .dropped = m_dropped.load(),
+            .batches = 0,
+            .shed = 0,
+            .deadline_misses = 0,
+            .reordered = 0};
+  }
+
+  /** Reads what the join did so far. Inputs wait on their match rather
+   * than in a queue, so the queue wait is left empty.
+   *
+   * @return A snapshot of the join's metrics.
+   */
+  node_metrics get_metrics() { return m_meter.snapshot(); }
+
+  /** Drops everything queued by the parents.
+   *
+   * @return How many inputs were dropped.
+   */
+  uint64_t discard_queued() {
+    const uint64_t discarded = discard_all(index_sequence_for<Ins...>{});
+    m_dropped += discarded;
+    return discarded;
+  }
+
+  /** Visits this node and then every node in its subtree.
+   *
+   * @param _fn What to call on each node.
+   */
+  void for_each_node(const function<void(_dag_node_base<IDType> &)> &_fn) {
+    _fn(*this);
+    m_child->for_each_node(_fn);
+  }
+
+  /** Gives the fan-out of the node to children that take its output.
+   *
+   * @param _type The input type of the child.
+   * @return The dag_fanout_node<Out, IDType> or nullptr if the child takes
+   * another type.
+   */
+  void *attach_point(const type_info &_type) {
+    return _type == typeid(Out) ? m_child : nullptr;
+  }
+
+  /** Finds a node by ID in this node's subtree.
+   *
+   * @param _id The ID to look for.
+   * @return The node or nullptr if it is not in the subtree.
+   */
+  _dag_node_base<IDType> *find_node(const IDType &_id) {
+    if (_id == m_node_id) return this;
+    return m_child->find_node(_id);
+  }
+
+  /** Print function
+   *
+   * Simply prints the node's ID and asks the children to do the same.
+   *
+   * @param _indent_str How to indent the children
+   */
+  void print(const string &_indent_str) {
+    *g_context.log << m_node_id << endl;
+    m_child->print(_indent_str);
+  }
+
+  /** Prints where the join appears under one of its other parents.
+   *
+   * @param _input Which input of the join the parent feeds
+   */
+  void print_input(const size_t _input) {
+    *g_context.log << m_node_id << " [input " << _input << "]" << endl;
+  }
+
+  /** Getter for the ID
+   *
+   * @return ID of the node
+   */
+  const IDType &get_id() { return m_node_id; }
+};
+
+/** Where a join node is attached under one of its parents.
+ *
+ * The parent owns the port and the ports share the join, so the join lives as
+ * long as any of its parents. Only the port of the first parent exposes the
+ * join's subtree; children of the join belong to the first parent's dag.
+ */
+template <size_t I, typename Out, typename IDType, typename... Ins>
+class _join_port
+    : public _abstract_internal_dag_node<tuple_element_t<I, tuple<Ins...>>,
+                                         IDType> {
+ private:
+  using _input_type = tuple_element_t<I, tuple<Ins...>>;
+  shared_ptr<_join_node<Out, IDType, Ins...>> m_join;  // The shared join
+
+ public:
+  /** Creates the port of one input.
+   * @param _join The join the input goes to
+   */
+  explicit _join_port(shared_ptr<_join_node<Out, IDType, Ins...>> _join)
+      : m_join(std::move(_join)) {}
+
+  /** Hands the parent's output to the join and matches it right away.
+   * @param _msg The parent's output
+   */
+  void run_filter(const _dag_message<_input_type> &_msg) {
+    m_join->template run_filter<I>(_msg);
+  }
+
+  /** Hands the parent's output to the join to be matched on the pool.
+   * @param _msg The parent's output
+   */
+  void enqueue(_dag_message<_input_type> _msg) {
+    m_join->template offer<I>(std::move(_msg), false);
+  }
+
+  /** A join has several parents so it never continues a chain.
+   * @return false
+   */
+  bool fusable() const { return false; }
+
+  /** Getter for the ID
+   * @return The ID of the join
+   */
+  const IDType &get_id() { return m_join->get_id(); }
+
+  /** Prints the join, and its subtree under its first parent only.
+   * @param _indent_str How to indent the children
+   */
+  void print(const string &_indent_str) {
+    if constexpr (I == 0)
+      m_join->print(_indent_str);
+    else
+      m_join->print_input(I);
+  }
+
+  /** Finds a node by ID in the join's subtree, under its first parent only.
+   * @param _id The ID to look for.
+   * @return The node or nullptr if it is not in the subtree.
+   */
+  _dag_node_base<IDType> *find_node(const IDType &_id) {
+    if constexpr (I == 0)
+      return m_join->find_node(_id);
+    else
+      return nullptr;
+  }
+
+  /** Gives the join's fan-out, under its first parent only.
+   * @param _type The input type of the child.
+   * @return The fan-out or nullptr.
+   */
+  void *attach_point(const type_info &_type) {
+    if constexpr (I == 0)
+      return m_join->attach_point(_type);
+    else
+      return nullptr;
+  }
+
+  /** Visits the join's subtree, under its first parent only.
+   * @param _fn What to call on each node.
+   */
+  void for_each_node(const function<void(_dag_node_base<IDType> &)> &_fn) {
+    if constexpr (I == 0) m_join->for_each_node(_fn);
+  }
+
+  /** Joins always drop the oldest unmatched input; the policy can't change.
+   */
+  void set_overflow_policy(const overflow_policy) {}
+
+  /** Joins can't move to another process.
+   * @param _residence Where the join should run.
+   * @return Whether that is in this process.
+   */
+  bool set_residence(const node_residence _residence) {
+    return m_join->set_residence(_residence);
+  }
+
+  /** Joins can't be scheduled on their own.
+   * @param _priority The priority class
+   * @param _deadline The deadline
+   * @return False, always.
+   */
+  bool set_priority(const priority_class _priority,
+                    const chrono::nanoseconds _deadline) {
+    return m_join->set_priority(_priority, _deadline);
+  }
+
+  /** Joins can't have a pool of their own.
+   * @param _executor The pool
+   * @return False, always.
+   */
+  bool set_executor(_dag_executor *const _executor) {
+    return m_join->set_executor(_executor);
+  }
+
+  /** Joins can't be replicated.
+   * @param _replicas How many messages to run on at once
+   * @return False, always.
+   */
+  bool set_replicas(const size_t _replicas) {
+    return m_join->set_replicas(_replicas);
+  }
+
+  /** Reads the counters of the join.
+   * @return A snapshot of the counters.
+   */
+  edge_stats get_edge_stats() { return m_join->get_edge_stats(); }
+
+  /** Reads what the join did so far.
+   * @return A snapshot of the join's metrics.
+   */
+  node_metrics get_metrics() { return m_join->get_metrics(); }
+
+  /** Drops what is queued on the join. Only the first parent does so.
+   * @return How many inputs were dropped.
+   */
+  uint64_t discard_queued() {
+    if constexpr (I == 0)
+      return m_join->discard_queued();
+    else
+      return 0;
+  }
+};
+
+/** Attaches the join to every parent. */
+template <typename Out, typename IDType, typename... Ins>
+void _join_node<Out, IDType, Ins...>::attach(
+    const shared_ptr<_join_node> &_join,
+    const array<void *, num_inputs> &_fanouts) {
+  [&]<size_t... I>(index_sequence<I...>) {
+    (static_cast<dag_fanout_node<_input_type<I>, IDType> *>(_fanouts[I])
+         ->_add_node(new _join_port<I, Out, IDType, Ins...>(_join)),
+     ...);
+  }(index_sequence_for<Ins...>{});
+}
+}  // namespace fn_dag
@@ -10,12 +10,37 @@
  * @author ndepalma@alum.mit.edu
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
 #include <string>
+#include <thread>
+#include <typeinfo>
+#include <vector>
 
+#include "functional_dag/core/bounded_queue.hpp"
+#include "functional_dag/core/cancellation.hpp"
+#include "functional_dag/core/dag_message.hpp"
 #include "functional_dag/core/dag_utils.hpp"
+#include "functional_dag/core/edge_policy.hpp"
+#include "functional_dag/core/frame_arena.hpp"
+#include "functional_dag/core/node_metrics.hpp"
+#include "functional_dag/core/priority.hpp"
+#include "functional_dag/core/residence.hpp"
+#include "functional_dag/core/tracer.hpp"
+#include "functional_dag/dag_async_interface.hpp"
 #include "functional_dag/dag_interface.hpp"
 #include "functional_dag/impl/dag_fanout_impl.hpp"
+#include "functional_dag/impl/dag_plan_impl.hpp"
+#include "functional_dag/impl/forked_node_impl.hpp"
 
 namespace fn_dag {
 using namespace std;
@@ -24,39 +49,530 @@ using namespace std;
 template <typename Out, typename IDType>
 class dag_fanout_node;
 
-/** An internal pure virtual interface for internal nodes
+/** An internal pure virtual interface for all internal nodes regardless of
+ * the data they take.
  *
- * This should not be used by users. It is simply a pure virtual class for
- * internal nodes
+ * This lets the dag and the manager look nodes up by ID and configure them
+ * without knowing their types.
  */
-template <class Type, class IDType>
-class _abstract_internal_dag_node {
+template <class IDType>
+class _dag_node_base {
  public:
   /** Pure, default deconstructor */
-  virtual ~_abstract_internal_dag_node() = default;
+  virtual ~_dag_node_base() = default;
   /** Must provide a way to get an ID. Could be string or int or something
    * efficient. */
   virtual const IDType &get_id() = 0;
-  /** Must provide a way to call the function */
-  virtual void run_filter(const Type *const _data) = 0;
   /** Must provide a way to print some diagnostics to screen. */
   virtual void print(const string &_plus) = 0;
+  /** Must provide a way to find a node in the subtree, including itself. */
+  virtual _dag_node_base *find_node(const IDType &_id) = 0;
+  /** Must provide the fan-out children attach to if they take the type the
+   * node outputs, or nullptr otherwise. */
+  virtual void *attach_point(const type_info &_type) = 0;
+  /** Must provide a way to change what the input edge does when it is full. */
+  virtual void set_overflow_policy(const overflow_policy _policy) = 0;
+  /** Must provide a way to read the counters of the input edge. */
+  virtual edge_stats get_edge_stats() = 0;
+  /** Must provide a way to drop what waits on the input edge. */
+  virtual uint64_t discard_queued() = 0;
+  /** Must provide a way to move the node to another process, or to say it
+   * can't be moved. */
+  virtual bool set_residence(const node_residence _residence) = 0;
+  /** Must provide a way to run the node on its own pool, or to say it can't.
+   */
+  virtual bool set_executor(_dag_executor *const _executor) = 0;
+  /** Must provide a way to set how urgent the node is, or to say it can't. */
+  virtual bool set_priority(const priority_class _priority,
+                            const chrono::nanoseconds _deadline) = 0;
+  /** Must provide a way to run the node on several messages at once, or to
+   * say it can't. */
+  virtual bool set_replicas(const size_t _replicas) = 0;
+  /** Must provide a way to read what the node did so far. */
+  virtual node_metrics get_metrics() = 0;
+  /** Must provide a way to visit every node in the subtree, including itself.
+   */
+  virtual void for_each_node(const function<void(_dag_node_base &)> &_fn) = 0;
+};
+
+/** An internal pure virtual interface for internal nodes
+ *
+ * This should not be used by users. It is simply a pure virtual class for
+ * internal nodes
+ */
+template <class Type, class IDType>
+class _abstract_internal_dag_node : public _dag_node_base<IDType> {
+ public:
+  /** Must provide a way to call the function */
+  virtual void run_filter(const _dag_message<Type> &_msg) = 0;
+  /** Must provide a way to queue data to be run later (pipelined mode). */
+  virtual void enqueue(_dag_message<Type> _msg) = 0;
+  /** Adds the node to the plan of a frozen DAG. By default the node runs
+   * like in a DAG that is not frozen, passing its output on to its subtree
+   * itself, so the subtree is not part of the plan. */
+  virtual void add_to_plan(_dag_plan &_plan) {
+    _plan.add(this, &run_opaque, nullptr);
+  }
+  /** Whether the node may run in the task of its parent when it is the only
+   * child. Nodes with several parents are not part of a chain. */
+  virtual bool fusable() const { return true; }
+  /** The pool the node runs on when it has its own, or nullptr for the shared
+   * one. */
+  virtual _dag_executor *executor() const { return nullptr; }
+  /** When the node should be done with a message of a frame, if it has a
+   * deadline. */
+  virtual optional<chrono::steady_clock::time_point> deadline_of(
+      const _dag_frame &) const {
+    return nullopt;
+  }
+
+ private:
+  /** The step of a node that runs its own subtree.
+   * @return Nothing, since the node passed its output on itself
+   */
+  static dag_payload<void> run_opaque(void *_node,
+                                      const _dag_message<void> &_in) {
+    static_cast<_abstract_internal_dag_node *>(_node)->run_filter(
+        {_in.frame, static_pointer_cast<const Type>(_in.data), _in.sent});
+    return nullptr;
+  }
 };
 
 /** An internal class to encapsulate a function that transmutes input data to
  * output data. */
 template <typename In, typename Out, typename IDType>
 class _internal_dag_node : public _abstract_internal_dag_node<In, IDType> {
-  friend class dag_fanout_node<In, IDType>;  // Friend classing fanout for the
-                                             // add_node search
-
  private:
-  dag_node<In, Out> *m_node_hook;  // The function to run
+  /** A message a replica is done with, waiting to be passed on in order. */
+  struct _reordered {
+    _dag_message<In> msg;  // The input
+    unique_ptr<Out> out;   // The output or nullptr if there is none
+    bool ran;              // Whether the node ran, i.e. was not stopped or shed
+  };
+
+  atomic<dag_node<In, Out> *> m_node_hook;  // The function to run
+  dag_async_node<In, Out> *const
+      m_async;  // The hook as a coroutine, if it is one
+  _forked_dag_node<In, Out>
+      *m_forked;  // The hook once it was wrapped to run in a child process
   const IDType m_node_id;          // The ID of the node
   dag_fanout_node<Out, IDType>
       *m_child;  // All of the children to provide our output data to.
   const fn_dag::_dag_context
       &g_context;  // A hook to the global context of this DAG.
+  const uint32_t m_track;  // What the node's spans refer to it by
+  _bounded_queue<_dag_message<In>>
+      m_inbox;  // Input waiting to be run when pipelined
+  atomic<overflow_policy> m_policy;  // What to do when the inbox is full
+  atomic<uint64_t> m_delivered;      // Messages accepted onto the inbox
+  atomic<uint64_t> m_dropped;        // Messages shed by the policy
+  atomic<uint64_t> m_batches;        // Batches the node ran on
+  const size_t m_max_batch;          // Most messages to run on at once
+  const chrono::nanoseconds
+      m_max_latency;  // How long a message may wait on the rest of its batch
+  chrono::nanoseconds
+      m_item_cost;  // Average time per message of the recent batches
+  atomic<_dag_executor *>
+      m_executor;  // The pool the node is placed on, if it has its own
+  atomic<priority_class> m_priority;  // How urgent the node is
+  atomic<chrono::nanoseconds>
+      m_deadline;  // How long after its frame started a message should be
+                   // done. Zero for no deadline.
+  atomic<uint64_t> m_shed;    // Messages skipped while overloaded
+  atomic<uint64_t> m_misses;  // Messages finished after the deadline
+  atomic<size_t> m_replicas;  // Messages the node may run on at once
+  atomic<bool> m_reordering;  // Whether the outputs go through the reorder
+                              // buffer. Stays set once the node replicated.
+  mutex m_reorder_mutex;      // Guards the tickets and the reorder buffer
+  uint64_t m_next_ticket;     // The ticket of the next message taken
+  uint64_t m_next_release;    // The ticket whose output goes out next
+  map<uint64_t, _reordered>
+      m_reorder;               // Outputs waiting on an earlier message
+  bool m_releasing;            // Whether a replica is passing outputs on
+  atomic<bool> m_parked;       // Whether the replicas wait for room in the
+                               // reorder buffer, see release
+  atomic<uint64_t> m_reordered;  // Outputs that waited on an earlier one
+  atomic<size_t> m_scheduled;  // Drains of the inbox queued or running
+  atomic<size_t> m_draining;   // Drains still touching the node
+  atomic<size_t> m_running;    // Threads running the inbox
+  atomic<size_t> m_in_flight;  // Coroutines started and not returned yet
+  _node_meter<> m_meter;       // What the node did, see get_metrics
+  const stop_token m_stop;     // Set when the dags are asked to stop
+
+  /** The pool the node runs on.
+   * @return Its own pool if it was placed on one, otherwise the shared pool
+   */
+  _dag_executor *pool() const {
+    _dag_executor *placed = m_executor.load();
+    return placed != nullptr ? placed : g_context.executor;
+  }
+
+  /** Takes one of the node's replicas, e.g. to drain the inbox with.
+   *
+   * @param _taken Counts the replicas taken for the purpose
+   * @return False if all of them are taken
+   */
+  bool claim(atomic<size_t> &_taken) const {
+    size_t taken = _taken.load();
+    do {
+      if (taken >= m_replicas.load(memory_order_relaxed)) return false;
+    } while (!_taken.compare_exchange_weak(taken, taken + 1));
+    return true;
+  }
+
+  /** Submits a drain of the inbox unless one per replica is already queued
+   * or running. This makes sure the node never runs on more messages at once
+   * than it has replicas, though a coroutine node may have several waiting
+   * on I/O. A node with a deadline is dispatched earliest deadline first,
+   * ahead of the others.
+   *
+   * @param _frame The frame of the message that was just queued
+   */
+  void schedule(const _dag_frame &_frame) {
+    if (!claim(m_scheduled)) return;
+    if (const auto deadline = deadline_of(_frame))
+      pool()->submit_by([this]() { drain(); }, *deadline);
+    else
+      pool()->submit([this]() { drain(); });
+  }
+
+  /** Skips a message if the node is in the background and the dags are
+   * overloaded. The node's subtree never sees the message either.
+   *
+   * @return Whether the message was shed
+   */
+  bool shed() {
+    if (m_priority.load(memory_order_relaxed) != priority_class::BACKGROUND ||
+        !g_context.load.overloaded())
+      return false;
+    m_shed++;
+    return true;
+  }
+
+  /** Counts a message that was finished after its deadline, and tells the
+   * dags they are overloaded.
+   *
+   * @param _frame The frame of the message
+   */
+  void check_deadline(const _dag_frame &_frame) {
+    const auto deadline = m_deadline.load(memory_order_relaxed);
+    if (deadline.count() > 0 &&
+        chrono::steady_clock::now() > _frame.stamp() + deadline) {
+      m_misses++;
+      g_context.load.missed_deadline();
+    }
+  }
+
+  /** Runs the hook on a message, in the scopes of the message's frame.
+   *
+   * @param _data The input
+   * @param _frame The frame the input belongs to
+   * @param _sent When the parent passed the input on
+   * @return The output or nullptr if there is none
+   */
+  unique_ptr<Out> run_update(const In *const _data, _dag_frame &_frame,
+                             const _sent_stamp<> &_sent) {
+    m_meter.waited(_sent);
+    _stop_scope scope(m_stop);
+    _arena_scope arena(&_frame.arena());
+    _tracer::_span traced(g_context.tracer, "update", m_track,
+                          _frame.sequence());
+    const auto started = m_meter.start();
+    unique_ptr<Out> out = m_node_hook.load(memory_order_acquire)->update(_data);
+    m_meter.finish(started, 1, out != nullptr);
+    return out;
+  }
+
+  /** Runs the hook on a message, in the scopes of the message's frame.
+   *
+   * @param _msg The input
+   * @return The output or nullptr if there is none
+   */
+  unique_ptr<Out> run_update(const _dag_message<In> &_msg) {
+    return run_update(_msg.data.get(), *_msg.frame, _msg.sent);
+  }
+
+  /** Passes on the output of a coroutine or of update.
+   *
+   * @param _out The output or nullptr if there is none
+   * @param _msg The input it was made from
+   */
+  void finish(unique_ptr<Out> _out, const _dag_message<In> &_msg) {
+    check_deadline(*_msg.frame);
+    if (!m_stop.stop_requested() && _out != nullptr) {
+      _tracer::_span traced(g_context.tracer, "fan_out", m_track,
+                            _msg.frame->sequence());
+      m_child->fan_out(std::move(_out), _msg.frame);
+    }
+  }
+
+  /** Starts the coroutine of the node on a message and returns once it
+   * first waits. It resumes on the node's pool, and passes its output on
+   * from there.
+   *
+   * @param _msg Input data to process by the node.
+   */
+  void start_async(const _dag_message<In> &_msg) {
+    m_in_flight++;
+    m_meter.waited(_msg.sent);
+    _stop_scope scope(m_stop);
+    _arena_scope arena(&_msg.frame->arena());
+    _executor_scope executor(pool());
+    // It may end on another thread, so its CPU time can't be told
+    const auto started = m_meter.start(false);
+    // Only until the coroutine first waits
+    _tracer::_span traced(g_context.tracer, "update", m_track,
+                          _msg.frame->sequence());
+    _spawn(m_async->update_async(_msg.data.get()),
+           [this, msg = _msg, started](unique_ptr<Out> _out) mutable {
+             m_meter.finish(started, 1, _out != nullptr);
+             finish(std::move(_out), msg);
+             // The frame goes before the node may
+             msg = {};
+             m_in_flight--;
+           });
+  }
+
+  /** Runs the node as a step of the plan of a frozen DAG.
+   *
+   * Does what run_filter does, except that the output is handed back to the
+   * plan rather than passed on to the children. The parent's message is
+   * read in place, without copying its handles.
+   *
+   * @param _node The node
+   * @param _in The output of the parent
+   * @return The output or nullptr if there is none
+   */
+  static dag_payload<void> run_planned(void *_node,
+                                       const _dag_message<void> &_in) {
+    auto self = static_cast<_internal_dag_node *>(_node);
+    _tracer::_span traced(self->g_context.tracer, "run_filter", self->m_track,
+                          _in.frame->sequence());
+    if (self->m_stop.stop_requested() || self->shed()) return nullptr;
+    if (self->m_async != nullptr && !self->g_context.run_single_threaded &&
+        self->pool() != nullptr) {
+      self->start_async(
+          {_in.frame, static_pointer_cast<const In>(_in.data), _in.sent});
+      return nullptr;
+    }
+    unique_ptr<Out> out = self->run_update(
+        static_cast<const In *>(_in.data.get()), *_in.frame, _in.sent);
+    self->check_deadline(*_in.frame);
+    if (self->m_stop.stop_requested() || out == nullptr) return nullptr;
+    return self->m_child->share(std::move(out), *_in.frame);
+  }
+
+  /** Adds the children of a node to the plan of a frozen DAG.
+   *
+   * @param _node The node
+   * @param _plan The plan being compiled
+   */
+  static void add_children_to_plan(void *_node, _dag_plan &_plan) {
+    static_cast<_internal_dag_node *>(_node)->m_child->add_to_plan(_plan);
+  }
+
+  /** Runs the node on everything in the inbox, unless as many threads as
+   * the node has replicas already do. Either way the node runs on at most
+   * one message per replica at a time.
+   *
+   * @return Whether this thread ran the inbox. False too when the replicas
+   * are parked until an earlier output is passed on.
+   */
+  bool run_inbox() {
+    if (!claim(m_running)) return false;
+    bool ran = true;
+    if (m_max_batch > 1) {
+      run_inbox_batched();
+    } else if (m_reordering.load()) {
+      ran = run_inbox_reordered();
+    } else {
+      _dag_message<In> msg;
+      while (m_inbox.try_pop(msg)) {
+        if (m_stop.stop_requested())
+          m_dropped++;
+        else
+          run_filter(msg);
+        msg = {};
+      }
+    }
+    m_running--;
+    return ran;
+  }
+
+  /** Runs the node on everything in the inbox alongside the other replicas.
+   *
+   * Every message gets a ticket as it is taken off the inbox, and the
+   * outputs are passed on in the order of their tickets. When too many
+   * outputs wait on an earlier message, the replica parks rather than take
+   * more, and the drains start again once the earlier output is passed on.
+   *
+   * @return False if the replica parked.
+   */
+  bool run_inbox_reordered() {
+    while (true) {
+      _reordered done{{}, nullptr, false};
+      uint64_t ticket = 0;
+      {
+        lock_guard<mutex> lock(m_reorder_mutex);
+        if (m_next_ticket - m_next_release >= 2 * m_replicas.load()) {
+          m_parked = true;
+          return false;
+        }
+        if (!m_inbox.try_pop(done.msg)) return true;
+        ticket = m_next_ticket++;
+      }
+      if (m_stop.stop_requested()) {
+        m_dropped++;
+      } else if (!shed()) {
+        done.out = run_update(done.msg);
+        done.ran = true;
+      }
+      release(ticket, std::move(done));
+    }
+  }
+
+  /** Hands a replica's message over to be passed on in order, and passes on
+   * every output whose turn it is unless another replica already does. Once
+   * outputs went out, parked replicas get their drains back.
+   *
+   * @param _ticket The ticket of the message
+   * @param _done The message and its output
+   */
+  void release(const uint64_t _ticket, _reordered _done) {
+    const shared_ptr<_dag_frame> frame = _done.msg.frame;
+    unique_lock<mutex> lock(m_reorder_mutex);
+    if (_ticket != m_next_release) m_reordered++;
+    m_reorder.emplace(_ticket, std::move(_done));
+    if (m_releasing) return;
+    m_releasing = true;
+    const uint64_t first = m_next_release;
+    for (auto it = m_reorder.find(m_next_release); it != m_reorder.end();
+         it = m_reorder.find(m_next_release)) {
+      {
+        _reordered ready = std::move(it->second);
+        m_reorder.erase(it);
+        m_next_release++;
+        lock.unlock();
+        if (ready.ran) finish(std::move(ready.out), ready.msg);
+      }
+      lock.lock();
+    }
+    m_releasing = false;
+    if (m_next_release == first || !m_parked.exchange(false)) return;
+    lock.unlock();
+    for (size_t i = m_replicas.load(); i > 0; i--) schedule(*frame);
+  }
+
+  /** How many messages the next batch may take.
+   *
+   * The batch takes what has queued up while the node was busy, so it grows
+   * with the queue depth when the node falls behind and shrinks back to one
+   * when it keeps up. It is capped so the last message does not wait on the
+   * others longer than the latency budget.
+   *
+   * @return At least one and at most the edge's max_batch.
+   */
+  size_t batch_limit() const {
+    size_t limit = clamp<size_t>(m_inbox.size_approx(), 1, m_max_batch);
+    if (m_max_latency.count() > 0 && m_item_cost.count() > 0)
+      limit = min(limit, static_cast<size_t>(max<int64_t>(
+                             1, m_max_latency / m_item_cost)));
+    return limit;
+  }
+
+  /** Runs the node on everything in the inbox, a batch at a time. Only
+   * called by the thread running the inbox.
+   */
+  void run_inbox_batched() {
+    vector<_dag_message<In>> batch;
+    batch.reserve(m_max_batch);
+    _dag_message<In> msg;
+    while (true) {
+      const size_t limit = batch_limit();
+      while (batch.size() < limit && m_inbox.try_pop(msg)) {
+        if (m_stop.stop_requested())
+          m_dropped++;
+        else
+          batch.push_back(std::move(msg));
+        msg = {};
+      }
+      if (batch.empty()) break;
+      run_batch(batch);
+      batch.clear();
+    }
+  }
+
+  /** Runs the node on a batch of messages and passes each output on in the
+   * frame of its input. Once the dags are asked to stop, the whole batch is
+   * counted as dropped instead.
+   *
+   * @param _batch The messages, oldest first.
+   */
+  void run_batch(const vector<_dag_message<In>> &_batch) {
+    if (m_stop.stop_requested()) {
+      m_dropped += _batch.size();
+      return;
+    }
+    vector<const In *> inputs;
+    inputs.reserve(_batch.size());
+    for (const auto &msg : _batch) {
+      m_meter.waited(msg.sent);
+      inputs.push_back(msg.data.get());
+    }
+
+    vector<unique_ptr<Out>> outputs;
+    const auto start = chrono::steady_clock::now();
+    {
+      // The inputs belong to different frames, so there is no one arena
+      _stop_scope scope(m_stop);
+      _arena_scope arena(nullptr);
+      _tracer::_span traced(g_context.tracer, "update", m_track,
+                            _batch.front().frame->sequence());
+      const auto started = m_meter.start();
+      outputs = m_node_hook.load(memory_order_acquire)
+                    ->update_batch(span<const In *const>(inputs));
+      m_meter.finish(started, inputs.size(),
+                     count_if(outputs.begin(), outputs.end(),
+                              [](const unique_ptr<Out> &_out) {
+                                return _out != nullptr;
+                              }));
+    }
+    const auto per_item = chrono::duration_cast<chrono::nanoseconds>(
+        (chrono::steady_clock::now() - start) / inputs.size());
+    // Smoothed so one slow batch does not shrink the next ones to a single
+    // message
+    m_item_cost = m_item_cost.count() == 0 ? per_item
+                                           : (m_item_cost * 3 + per_item) / 4;
+    m_batches++;
+
+    for (const auto &msg : _batch) check_deadline(*msg.frame);
+    const size_t count = min(outputs.size(), _batch.size());
+    for (size_t i = 0; i < count && !m_stop.stop_requested(); i++) {
+      if (outputs[i] == nullptr) continue;
+      _tracer::_span traced(g_context.tracer, "fan_out", m_track,
+                            _batch[i].frame->sequence());
+      m_child->fan_out(std::move(outputs[i]), _batch[i].frame);
+    }
+  }
+
+  /** The scheduled task: runs the node on everything in the inbox.
+   *
+   * Once the inbox looks empty the node gives up its turn, then checks the
+   * inbox again in case a parent queued something in between and did not
+   * schedule a drain because this one was still running.
+   */
+  void drain() {
+    m_draining++;
+    while (true) {
+      if (!run_inbox() && !m_parked.load()) this_thread::yield();
+      m_scheduled--;
+      // A parked node is scheduled again by release
+      if (m_inbox.size_approx() == 0 || m_parked.load() ||
+          !claim(m_scheduled))
+        break;
+    }
+    m_draining--;
+  }
 
  public:
   /** Internal constructor for the encapsulated lambda function.
@@ -68,32 +584,321 @@ class _internal_dag_node : public _abstract_internal_dag_node<In, IDType> {
    * @param _node The function to call when data comes in.
    * @param _context The state variables for the DAG. All nodes share this
    * information.
+   * @param _edge The options of the edge that feeds this node.
    */
   _internal_dag_node(IDType _node_id, dag_node<In, Out> *_node,
-                     const fn_dag::_dag_context &_context)
+                     const fn_dag::_dag_context &_context,
+                     const edge_options &_edge = {})
       : m_node_hook(_node),
+        m_async(dynamic_cast<dag_async_node<In, Out> *>(_node)),
+        m_forked(nullptr),
         m_node_id(_node_id),
-        m_child(new dag_fanout_node<Out, IDType>(_context)),
-        g_context(_context) {}
+        m_child(new dag_fanout_node<Out, IDType>(_context, true)),
+        g_context(_context),
+        m_track(_context.tracer.track(_node_id)),
+        m_inbox(_edge.capacity == 0 ? _context.edge_capacity : _edge.capacity),
+        m_policy(_edge.policy),
+        m_delivered(0),
+        m_dropped(0),
+        m_batches(0),
+        m_max_batch(max<size_t>(_edge.max_batch, 1)),
+        m_max_latency(_edge.max_latency),
+        m_item_cost(0),
+        m_executor(nullptr),
+        m_priority(priority_class::NORMAL),
+        m_deadline(chrono::nanoseconds(0)),
+        m_shed(0),
+        m_misses(0),
+        m_replicas(1),
+        m_reordering(false),
+        m_reorder_mutex(),
+        m_next_ticket(0),
+        m_next_release(0),
+        m_reorder(),
+        m_releasing(false),
+        m_parked(false),
+        m_reordered(0),
+        m_scheduled(0),
+        m_draining(0),
+        m_running(0),
+        m_in_flight(0),
+        m_meter(),
+        m_stop(_context.stopper.get_token()) {
+    set_replicas(_edge.replicas);
+  }
 
-  /** Default constructor */
+  /** Destructor. Waits for a pipelined drain and the coroutines in flight to
+   * finish before the node and its children are deleted. */
   ~_internal_dag_node() {
+    while (m_scheduled.load() != 0 || m_draining.load() != 0 ||
+           m_running.load() != 0 || m_in_flight.load() != 0)
+      if (pool() == nullptr || !pool()->try_run_one()) this_thread::yield();
     delete m_child;
-    delete m_node_hook;
+    delete m_node_hook.load();
   }
 
   /** Runs the lambda function and passes it to this nodes children.
    *
    * This function simply encapsulates the process of calling update on the
    * input data, collecting the output data and propagating it to all of the
-   * children to be processed.
+   * children to be processed. The output belongs to the same frame as the
+   * input, and the node can allocate its temporaries from the frame's arena
+   * through frame_memory(). Once the dags are asked to stop, the node neither
+   * runs nor passes anything on.
+   *
+   * A coroutine node only runs until it first waits when there is a pool,
+   * and passes its output on when it returns.
+   *
+   * @param _msg Input data to process by the node.
+   */
+  void run_filter(const _dag_message<In> &_msg) {
+    _tracer::_span traced(g_context.tracer, "run_filter", m_track,
+                          _msg.frame->sequence());
+    if (m_stop.stop_requested() || shed()) return;
+    if (m_async != nullptr && !g_context.run_single_threaded &&
+        pool() != nullptr) {
+      start_async(_msg);
+      return;
+    }
+    finish(run_update(_msg), _msg);
+  }
+
+  /** Adds the node to the plan of a frozen DAG, with its children under it.
+   *
+   * @param _plan The plan being compiled
+   */
+  void add_to_plan(_dag_plan &_plan) {
+    _plan.add(this, &run_planned, &add_children_to_plan);
+  }
+
+  /** Queues input data for the node to run on as soon as it can.
+   *
+   * This is the pipelined path. The caller returns as soon as the data is in
+   * the inbox. What happens when the inbox is full depends on the overflow
+   * policy of the edge. When blocking, the caller runs the node itself until
+   * there is room again, which bounds how many messages are in flight. It
+   * does not help the pool with other tasks: one of those could be an
+   * ancestor that waits for this very thread, which deadlocks dags deeper
+   * than the pool is wide. A node placed on its own pool is never run by the
+   * caller, which makes sure a drain is queued there and waits for it. The
+   * other policies shed a message instead so a slow node never stalls its
+   * siblings or the source.
+   *
+   * @param _msg Input data shared with the node's siblings.
+   */
+  void enqueue(_dag_message<In> _msg) {
+    if (shed()) return;
+    _dag_message<In> stale;
+    switch (m_policy.load()) {
+      case overflow_policy::BLOCK:
+        while (!m_inbox.try_push(_msg)) {
+          if (m_stop.stop_requested()) {
+            m_dropped++;
+            return;
+          }
+          if (m_executor.load() != nullptr)
+            schedule(*_msg.frame);
+          else if (run_inbox())
+            continue;
+          this_thread::yield();
+        }
+        break;
+      case overflow_policy::DROP_NEWEST:
+        if (!m_inbox.try_push(_msg)) {
+          m_dropped++;
+          return;
+        }
+        break;
+      case overflow_policy::KEEP_LATEST:
+        while (m_inbox.try_pop(stale)) m_dropped++;
+        [[fallthrough]];
+      case overflow_policy::DROP_OLDEST:
+        while (!m_inbox.try_push(_msg))
+          if (m_inbox.try_pop(stale)) m_dropped++;
+        break;
+    }
+    m_delivered++;
+    schedule(*_msg.frame);
+  }
+
+  /** Whether the node may run in the task of its only parent. A node that
+   * batches or is replicated needs its edge to queue, and a placed node runs
+   * on its own pool.
+   *
+   * @return True unless the edge batches, the node is replicated or it has
+   * its own pool.
+   */
+  bool fusable() const {
+    return m_max_batch == 1 && m_replicas.load() == 1 &&
+           m_executor.load() == nullptr;
+  }
+
+  /** The pool the node is placed on, if any.
+   * @return The pool or nullptr for the shared one
+   */
+  _dag_executor *executor() const { return m_executor.load(); }
+
+  /** Runs the node on its own pool from now on. A node with its own pool is
+   * never fused into its parent's task.
+   *
+   * @param _executor The pool. Must outlive the node.
+   * @return Always true.
+   */
+  bool set_executor(_dag_executor *const _executor) {
+    m_executor.store(_executor);
+    return true;
+  }
+
+  /** Changes what the input edge does when it is full.
+   *
+   * @param _policy The new policy.
+   */
+  void set_overflow_policy(const overflow_policy _policy) {
+    m_policy.store(_policy);
+  }
+
+  /** Moves the node into a child process or back into this one.
+   *
+   * The first move wraps the hook, which then stays wrapped so a thread
+   * running the node never sees it deleted. Only nodes whose input and output
+   * are trivially copyable or payloads of bytes can move, see _forkable_v.
+   * Coroutine nodes stay, since the reactor that resumes them does not
+   * survive a fork.
+   *
+   * @param _residence Where the node should run.
+   * @return False if the node can't run there.
+   */
+  bool set_residence(const node_residence _residence) {
+    if (m_async != nullptr) return _residence == node_residence::THREAD;
+    if constexpr (_forkable_v<In, Out>) {
+      if (m_forked == nullptr) {
+        if (_residence == node_residence::THREAD) return true;
+        m_forked = new _forked_dag_node<In, Out>(m_node_hook.load());
+        m_node_hook.store(m_forked, memory_order_release);
+      }
+      return m_forked->set_forked(_residence == node_residence::FORK);
+    } else {
+      return _residence == node_residence::THREAD;
+    }
+  }
+
+  /** Sets how urgent the node is.
+   *
+   * @param _priority The node's priority class
+   * @param _deadline How long after the source produced a frame the node
+   * should be done with it. Zero for no deadline.
+   * @return Always true.
+   */
+  bool set_priority(const priority_class _priority,
+                    const chrono::nanoseconds _deadline) {
+    m_priority.store(_priority);
+    m_deadline.store(_deadline);
+    return true;
+  }
+
+  /** Lets the node run on several queued messages at once in pipelined
+   * mode, each on its own worker. The outputs are still passed on in the
+   * order the messages were queued.
+   *
+   * Best set before the dags start, since outputs finished while it changes
+   * may be passed on out of order.
+   *
+   * @param _replicas How many messages at once. Zero counts as one.
+   * @return False if the edge batches, or if the node is a coroutine, which
+   * already waits on several messages at once.
+   */
+  bool set_replicas(const size_t _replicas) {
+    const size_t replicas = max<size_t>(_replicas, 1);
+    if (replicas > 1 && (m_max_batch > 1 || m_async != nullptr)) return false;
+    if (replicas > 1) m_reordering.store(true);
+    m_replicas.store(replicas);
+    return true;
+  }
+
+  /** When the node should be done with a message of a frame.
+   *
+   * @param _frame The frame of the message
+   * @return The frame's start plus the node's deadline. Critical nodes
+   * without a deadline are due when the frame started, so they go first.
+   * Nothing for other nodes without a deadline.
+   */
+  optional<chrono::steady_clock::time_point> deadline_of(
+      const _dag_frame &_frame) const {
+    const auto deadline = m_deadline.load(memory_order_relaxed);
+    if (deadline.count() > 0) return _frame.stamp() + deadline;
+    if (m_priority.load(memory_order_relaxed) == priority_class::CRITICAL)
+      return _frame.stamp();
+    return nullopt;
+  }
+
+  /** Reads the counters of the input edge.
+   *
+   * @return A snapshot of the counters.
+   */
+  edge_stats get_edge_stats() {
+    return {.policy = m_policy.load(),
+            .capacity = m_inbox.capacity(),
+            .replicas = m_replicas.load(),
+            .queued = m_inbox.size_approx(),
+            .delivered = m_delivered.load(),
+            .dropped = m_dropped.load(),
+            .batches = m_batches.load(),
+            .shed = m_shed.load(),
+            .deadline_misses = m_misses.load(),
+            .reordered = m_reordered.load()};
+  }
+
+  /** Reads what the node did so far.
+   *
+   * @return A snapshot of the node's metrics. All zeroes when they are
+   * compiled out.
+   */
+  node_metrics get_metrics() { return m_meter.snapshot(); }
+
+  /** Drops everything waiting on the input edge.
+   *
+   * The dropped messages are counted like the ones shed by the policy.
+   *
+   * @return How many messages were dropped.
+   */
+  uint64_t discard_queued() {
+    _dag_message<In> msg;
+    uint64_t discarded = 0;
+    while (m_inbox.try_pop(msg)) {
+      msg = {};
+      discarded++;
+    }
+    m_dropped += discarded;
+    return discarded;
+  }
+
+  /** Visits this node and then every node in its subtree.
+   *
+   * @param _fn What to call on each node.
+   */
+  void for_each_node(const function<void(_dag_node_base<IDType> &)> &_fn) {
+    _fn(*this);
+    m_child->for_each_node(_fn);
+  }
+
+  /** Gives the fan-out of the node to children that take its output.
+   *
+   * @param _type The input type of the child.
+   * @return The dag_fanout_node<Out, IDType> or nullptr if the child takes
+   * another type.
+   */
+  void *attach_point(const type_info &_type) {
+    return _type == typeid(Out) ? m_child : nullptr;
+  }
+
+  /** Finds a node by ID in this node's subtree.
    *
-   * @param _data Input data to process by the node.
+   * @param _id The ID to look for.
+   * @return The node or nullptr if it is not in the subtree.
    */
-  void run_filter(const In *const _data) {
-    unique_ptr<Out> data_out = m_node_hook->update(_data);
-    if (!g_context.filter_off && data_out != nullptr)
-      m_child->fan_out(std::move(data_out));
+  _dag_node_base<IDType> *find_node(const IDType &_id) {
+    if (_id == m_node_id) return this;
+    return m_child->find_node(_id);
   }
 
   /** Print function
@@ -0,0 +1,170 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional_dag/core/dag_message.hpp>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace fn_dag {
+using namespace std;
+
+/** What the compiled plan of a frozen DAG looks like. */
+struct plan_stats {
+  /// How many nodes the plan runs, not counting the source
+  size_t nodes;
+  /// How many levels the nodes are on, i.e. the longest path from the source
+  size_t levels;
+  /// The most nodes on any one level
+  size_t widest;
+  /// How many nodes run their own subtree the way an unfrozen DAG does, like
+  /// joins. Their subtrees are not part of the plan.
+  size_t opaque;
+};
+
+/** The immutable execution plan a frozen DAG runs on a single thread.
+ *
+ * The steps are numbered breadth first from the source, step 0, so every
+ * level is a contiguous range of steps and the children of a step are
+ * numbered one after the other. The child adjacency is then CSR with an
+ * implicit column array: the children of step i are the steps from
+ * m_child_offsets[i] up to m_child_offsets[i + 1]. Each step is a node and a
+ * plain function pointer that runs it and hands back its output instead of
+ * passing it on, so a frame is one loop over flat arrays, with no recursion
+ * and no virtual calls between the nodes.
+ */
+class _dag_plan {
+ public:
+  /** Runs the node of a step on the output of its parent.
+   * @return The node's output or nullptr if it has none for its children
+   */
+  using run_step = dag_payload<void> (*)(void *_node,
+                                         const _dag_message<void> &_in);
+  /** Adds the children of the node of a step to the plan. */
+  using add_children = void (*)(void *_node, _dag_plan &_plan);
+
+ private:
+  vector<void *> m_nodes;            // The node of every step
+  vector<run_step> m_runs;           // How to run every step
+  vector<uint32_t> m_child_offsets;  // Where the children of every step start
+  vector<uint32_t> m_level_offsets;  // Where every level starts
+  vector<dag_payload<void>>
+      m_outputs;    // What every step output for the frame that is running
+  size_t m_opaque;  // Steps whose subtrees are not part of the plan
+  mutex m_running;  // Taken while a frame runs, since m_outputs is shared
+
+  vector<add_children> m_expand;  // How to add the children of every step.
+                                  // Only used while compiling.
+
+ public:
+  /** Compiles the plan breadth first from the source.
+   *
+   * @param _source The children of the source, i.e. the fan-out of the DAG
+   * @param _add_source_children Adds them
+   */
+  _dag_plan(void *_source, const add_children _add_source_children)
+      : m_nodes{nullptr},
+        m_runs{nullptr},
+        m_child_offsets(),
+        m_level_offsets{0},
+        m_outputs(),
+        m_opaque(0),
+        m_running(),
+        m_expand{nullptr} {
+    uint32_t level_end = 1;
+    for (uint32_t i = 0; i < m_nodes.size(); i++) {
+      if (i == level_end) {
+        m_level_offsets.push_back(i);
+        level_end = static_cast<uint32_t>(m_nodes.size());
+      }
+      m_child_offsets.push_back(static_cast<uint32_t>(m_nodes.size()));
+      if (i == 0)
+        _add_source_children(_source, *this);
+      else if (m_expand[i] != nullptr)
+        m_expand[i](m_nodes[i], *this);
+    }
+    m_child_offsets.push_back(static_cast<uint32_t>(m_nodes.size()));
+    m_level_offsets.push_back(static_cast<uint32_t>(m_nodes.size()));
+    m_expand = {};
+    m_outputs.resize(m_nodes.size());
+  }
+
+  _dag_plan(const _dag_plan &) = delete;
+  _dag_plan &operator=(const _dag_plan &) = delete;
+
+  /** Adds a step. Only called while compiling, by the parent's add_children.
+   *
+   * @param _node The node
+   * @param _run How to run it
+   * @param _add_children How to add its children to the plan, or nullptr if
+   * the node runs its own subtree.
+   */
+  void add(void *_node, const run_step _run,
+           const add_children _add_children) {
+    m_nodes.push_back(_node);
+    m_runs.push_back(_run);
+    m_expand.push_back(_add_children);
+    if (_add_children == nullptr) m_opaque++;
+  }
+
+  /** Runs every step on one output of the source.
+   *
+   * The steps run level by level. A step only runs if its parent had an
+   * output, and the parent's output is let go of right after its last child
+   * ran. The output of a step without children is let go of right away. Once
+   * a whole level has no output for the next one the frame is done.
+   *
+   * @param _data The output of the source
+   * @param _frame The frame it belongs to
+   */
+  void run(dag_payload<void> _data, const shared_ptr<_dag_frame> &_frame) {
+    lock_guard<mutex> lock(m_running);
+    m_outputs[0] = std::move(_data);
+    bool any = true;
+    for (size_t level = 0; any && level + 1 < m_level_offsets.size();
+         level++) {
+      any = false;
+      for (uint32_t i = m_level_offsets[level];
+           i < m_level_offsets[level + 1]; i++) {
+        if (m_outputs[i] == nullptr) continue;
+        const _dag_message<void> msg{_frame, std::move(m_outputs[i]),
+                                     _sent_stamp<>::now()};
+        for (uint32_t child = m_child_offsets[i];
+             child < m_child_offsets[i + 1]; child++) {
+          dag_payload<void> out = m_runs[child](m_nodes[child], msg);
+          if (out == nullptr ||
+              m_child_offsets[child] == m_child_offsets[child + 1])
+            continue;
+          m_outputs[child] = std::move(out);
+          any = true;
+        }
+      }
+    }
+  }
+
+  /** Describes the plan
+   * @return How many nodes are on how many levels
+   */
+  plan_stats stats() const {
+    size_t widest = 0;
+    for (size_t level = 1; level + 1 < m_level_offsets.size(); level++)
+      widest = max<size_t>(widest,
+                           m_level_offsets[level + 1] - m_level_offsets[level]);
+    return plan_stats{.nodes = m_nodes.size() - 1,
+                      .levels = m_level_offsets.size() - 2,
+                      .widest = widest,
+                      .opaque = m_opaque};
+  }
+};
+}  // namespace fn_dag
@@ -26,6 +26,6 @@ class dag_fake_source : public dag_source<Out> {
   /** Update generator function that returns NULL
    * @return NULL pointer.
    */
-  unique_ptr<Out> update() { return make_unique<Out>(nullptr); }
+  unique_ptr<Out> update() { return nullptr; }
 };
 }  // namespace fn_dag
\ No newline at end of file
@@ -0,0 +1,454 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <type_traits>
+#include <vector>
+
+#include "functional_dag/core/byte_payload.hpp"
+#include "functional_dag/core/cancellation.hpp"
+#include "functional_dag/core/frame_arena.hpp"
+#include "functional_dag/core/shm_ring.hpp"
+#include "functional_dag/dag_interface.hpp"
+
+#if defined(__linux__)
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace fn_dag {
+using namespace std;
+
+/** Whether a type crosses shared memory byte for byte, as it is. Payloads of
+ * bytes cross as their bytes instead.
+ */
+template <typename T>
+inline constexpr bool _plain_v = !byte_payload<T> &&
+                                 is_trivially_copyable_v<T> &&
+                                 alignof(T) <= 64;
+
+/** Whether a node can run in a child process. Its input and output have to
+ * cross shared memory: either they are trivially copyable, and a plain
+ * output is built by the worker in place, so it has to be default
+ * constructible and assignable, or they are payloads of bytes such as
+ * flatbuffers.
+ */
+template <typename In, typename Out>
+inline constexpr bool _forkable_v =
+#if defined(__linux__)
+    (_plain_v<In> || byte_payload<In>) &&
+    ((_plain_v<Out> && is_default_constructible_v<Out> &&
+      is_move_assignable_v<Out>) ||
+     byte_payload<Out>);
+#else
+    false;
+#endif
+
+template <typename In, typename Out>
+class _forked_dag_node;
+
+#if defined(__linux__)
+/** Runs a node in a child process, so a crash in the node only costs the
+ * message it crashed on.
+ *
+ * The node is forked, state and all, into a worker process, and talks to it
+ * through two rings of variable size records in shared memory. An input is
+ * written into the request ring once, and the worker reads it where it is.
+ * A plain output is built by the worker right in its slot of the response
+ * ring with update_into, and copied out of it once. Payloads of bytes, such
+ * as flatbuffer_payload, cross as their bytes, and are verified before they
+ * are read on either side, since the other process may be the broken one.
+ * Payloads that are empty or longer than max_payload_bytes can't cross and
+ * are dropped. When the worker dies, the message it was working on is
+ * dropped, and a new worker is forked from the node as it was in this
+ * process for the rest. State the node builds up in the worker is lost with
+ * it, so the node should be stateless.
+ *
+ * The worker is forked from a process whose pools already run threads, and
+ * only the forking thread carries over. A lock one of the others held stays
+ * locked in the worker for good. Other than allocating its output, which
+ * glibc keeps safe across fork, the node's update must only do what is
+ * async-signal-safe: no locks, no stdio and no waiting on other threads.
+ *
+ * While not forked, the node runs in this process as usual, without taking
+ * the lock the forked path uses.
+ */
+template <typename In, typename Out>
+class _forked_dag_node : public dag_node<In, Out> {
+ public:
+  static constexpr size_t max_payload_bytes =
+      (size_t(8) << 20) - _shm_ring::block_bytes;  // Longest payload of bytes
+
+ private:
+  /** What the worker sends back for a plain output. */
+  struct _response {
+    Out data;      // The output, if there is one
+    bool present;  // Whether the node had an output
+  };
+
+  static constexpr uint32_t ring_records = 16;  // Messages in flight at most
+  static constexpr chrono::milliseconds poll =
+      chrono::milliseconds(20);  // How often waits check on the other end
+
+  const unique_ptr<dag_node<In, Out>> m_inner;  // The node to run
+  _shared_memory m_memory;                      // Where the rings live
+  optional<_shm_ring> m_requests;   // Inputs for the worker, if mapped
+  optional<_shm_ring> m_responses;  // Outputs of the worker, if mapped
+  mutex m_mutex;                    // Serializes talking to the worker
+  atomic<bool> m_forked;            // Whether to run in the worker
+  pid_t m_worker;                   // The worker or -1 if there is none
+
+  /** How many blocks the request ring takes.
+   * @return The blocks for ring_records plain inputs, or for one payload of
+   * bytes as long as it gets
+   */
+  static constexpr uint32_t request_blocks() {
+    if constexpr (byte_payload<In>)
+      return _shm_ring::blocks_to_hold(1, max_payload_bytes);
+    else
+      return _shm_ring::blocks_to_hold(ring_records, sizeof(In));
+  }
+
+  /** How many blocks the response ring takes.
+   * @return The blocks for ring_records plain outputs, or for one payload of
+   * bytes as long as it gets
+   */
+  static constexpr uint32_t response_blocks() {
+    if constexpr (byte_payload<Out>)
+      return _shm_ring::blocks_to_hold(1, max_payload_bytes);
+    else
+      return _shm_ring::blocks_to_hold(ring_records, sizeof(_response));
+  }
+
+  /** How much shared memory both rings take.
+   * @return The bytes to map
+   */
+  static constexpr size_t memory_needed() {
+    return _shm_ring::bytes_needed(request_blocks()) +
+           _shm_ring::bytes_needed(response_blocks());
+  }
+
+  /** How long the record for an input is.
+   * @param _data The input
+   * @return The bytes to write into the request ring
+   */
+  static size_t request_bytes(const In *const _data) {
+    if constexpr (byte_payload<In>)
+      return _data->bytes().size();
+    else
+      return sizeof(In);
+  }
+
+  /** Waits for room for a response. Worker only.
+   *
+   * @param _bytes How long the response is
+   * @param _parent The process that forked the worker
+   * @return Where to write it or nullptr if the parent is gone
+   */
+  byte *reserve_response(const size_t _bytes, const pid_t _parent) {
+    byte *slot = nullptr;
+    while (slot == nullptr) {
+      if (m_requests->closed() || getppid() != _parent) return nullptr;
+      slot = m_responses->wait_writable(_bytes, poll);
+    }
+    return slot;
+  }
+
+  /** Runs the node on an input and sends the output back. Worker only.
+   *
+   * @param _data The input or nullptr if it did not verify
+   * @param _parent The process that forked the worker
+   * @return False if the parent is gone
+   */
+  bool respond(const In *const _data, const pid_t _parent) {
+    if constexpr (byte_payload<Out>) {
+      const unique_ptr<Out> out =
+          _data != nullptr ? m_inner->update(_data) : nullptr;
+      span<const byte> bytes;
+      if (out != nullptr) bytes = out->bytes();
+      // Dropped if it can't cross
+      if (!m_responses->fits(bytes.size())) bytes = {};
+      byte *slot = reserve_response(bytes.size(), _parent);
+      if (slot == nullptr) return false;
+      if (!bytes.empty()) memcpy(slot, bytes.data(), bytes.size());
+    } else {
+      byte *slot = reserve_response(sizeof(_response), _parent);
+      if (slot == nullptr) return false;
+      auto *response = new (slot) _response{};
+      response->present =
+          _data != nullptr && m_inner->update_into(_data, response->data);
+    }
+    // Free the input first, so the parent finds room for the next chunk
+    m_requests->release();
+    m_responses->commit();
+    return true;
+  }
+
+  /** The worker's loop. Runs the node on every input until the ring is
+   * closed or this process is gone. Payloads of bytes are verified first,
+   * and read right where they are in the ring.
+   *
+   * @param _parent The process that forked the worker
+   */
+  void serve(const pid_t _parent) {
+    const stop_token never;
+    _stop_scope scope(never);
+    _arena_scope arena(nullptr);
+    while (!m_requests->closed() && getppid() == _parent) {
+      const optional<span<byte>> request = m_requests->wait_readable(poll);
+      if (!request) continue;
+      bool served;
+      if constexpr (byte_payload<In>) {
+        if (In::verify(*request)) {
+          const In data = In::view(*request);
+          served = respond(&data, _parent);
+        } else {
+          served = respond(nullptr, _parent);
+        }
+      } else {
+        served = respond(reinterpret_cast<const In *>(request->data()),
+                         _parent);
+      }
+      if (!served) return;
+    }
+  }
+
+  /** Forks a worker unless one is running. Needs m_mutex.
+   * @return Whether a worker is running
+   */
+  bool spawn() {
+    if (m_worker > 0) return true;
+    if (!m_requests) return false;
+    m_requests->reset();
+    m_responses->reset();
+    const pid_t parent = getpid();
+    const pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+      serve(parent);
+      _exit(0);
+    }
+    m_worker = pid;
+    return true;
+  }
+
+  /** Asks the worker to exit, and kills it if it does not. Needs m_mutex. */
+  void stop_worker() {
+    if (m_worker <= 0) return;
+    m_requests->close();
+    int status;
+    const auto deadline = chrono::steady_clock::now() + 10 * poll;
+    while (waitpid(m_worker, &status, WNOHANG) == 0) {
+      if (chrono::steady_clock::now() > deadline) {
+        kill(m_worker, SIGKILL);
+        waitpid(m_worker, &status, 0);
+        break;
+      }
+      this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    m_worker = -1;
+  }
+
+  /** Reaps the worker if it died. Needs m_mutex.
+   * @return Whether it died
+   */
+  bool reap() {
+    int status;
+    if (waitpid(m_worker, &status, WNOHANG) == 0) return false;
+    m_worker = -1;
+    return true;
+  }
+
+  /** Writes an input into the request ring. Needs m_mutex.
+   *
+   * @param _data The input. It has to fit into the ring.
+   * @param _timeout How long to wait for room at most
+   * @return False if there was no room
+   */
+  bool send(const In *const _data, const chrono::nanoseconds _timeout) {
+    const size_t bytes = request_bytes(_data);
+    byte *slot = m_requests->wait_writable(bytes, _timeout);
+    if (slot == nullptr) return false;
+    if constexpr (byte_payload<In>) {
+      if (bytes > 0) memcpy(slot, _data->bytes().data(), bytes);
+    } else {
+      memcpy(slot, _data, bytes);
+    }
+    m_requests->commit();
+    return true;
+  }
+
+  /** Reads one response off the ring. A payload of bytes is verified, and
+   * dropped if it is broken.
+   *
+   * @param _record The record the response is in
+   * @return The output or nullptr if there is none
+   */
+  unique_ptr<Out> take_response(const span<const byte> _record) {
+    unique_ptr<Out> out;
+    if constexpr (byte_payload<Out>) {
+      if (!_record.empty() && Out::verify(_record)) out = Out::copy(_record);
+    } else {
+      const auto *response =
+          reinterpret_cast<const _response *>(_record.data());
+      if (response->present) {
+        out = make_unique<Out>();
+        memcpy(static_cast<void *>(out.get()), &response->data, sizeof(Out));
+      }
+    }
+    m_responses->release();
+    return out;
+  }
+
+  /** Waits for the worker to answer the oldest input it has. Needs m_mutex.
+   *
+   * Kills the worker when the dag is asked to stop, since the answer would
+   * not be passed on anyway.
+   *
+   * @param _out Where to put the output
+   * @return False if the worker died before answering. It is reaped.
+   */
+  bool await_response(unique_ptr<Out> &_out) {
+    while (true) {
+      if (const auto record = m_responses->wait_readable(poll)) {
+        _out = take_response(*record);
+        return true;
+      }
+      if (current_stop_token().stop_requested()) kill(m_worker, SIGKILL);
+      if (reap()) {
+        // It may have answered right before dying
+        const auto record = m_responses->wait_readable(chrono::nanoseconds(0));
+        if (record) {
+          _out = take_response(*record);
+          return true;
+        }
+        return false;
+      }
+    }
+  }
+
+  /** Runs the node in the worker on a batch of inputs. Needs m_mutex.
+   *
+   * The inputs are sent as many at a time as fit into the request ring, up
+   * to ring_records. When the worker dies, the input it was working on is
+   * dropped and the ones after it go to a new worker. Inputs too long for
+   * the ring are dropped too.
+   *
+   * @param _batch The inputs
+   * @return One output per input, null where there is none or it was dropped
+   */
+  vector<unique_ptr<Out>> run_forked(span<const In *const> _batch) {
+    vector<unique_ptr<Out>> outputs(_batch.size());
+    size_t next = 0;
+    while (next < _batch.size()) {
+      if (current_stop_token().stop_requested() || !spawn()) break;
+      if (!m_requests->fits(request_bytes(_batch[next]))) {
+        next++;
+        continue;
+      }
+      // The ring is empty once the last chunk was answered, but the worker
+      // may still have to step over padding
+      if (!send(_batch[next], poll)) {
+        reap();
+        continue;
+      }
+      size_t sent = 1;
+      while (next + sent < _batch.size() && sent < ring_records &&
+             m_requests->fits(request_bytes(_batch[next + sent])) &&
+             send(_batch[next + sent], chrono::nanoseconds(0)))
+        sent++;
+      size_t answered = 0;
+      while (answered < sent && await_response(outputs[next + answered]))
+        answered++;
+      // Skip the input the worker died on, if it did
+      next += answered < sent ? answered + 1 : sent;
+    }
+    return outputs;
+  }
+
+ public:
+  /** Wraps a node. It keeps running in this process until forked.
+   * @param _inner The node to run. The wrapper owns it.
+   */
+  explicit _forked_dag_node(dag_node<In, Out> *const _inner)
+      : m_inner(_inner),
+        m_memory(memory_needed()),
+        m_requests(),
+        m_responses(),
+        m_mutex(),
+        m_forked(false),
+        m_worker(-1) {
+    if (byte *memory = m_memory.data(); memory != nullptr) {
+      m_requests.emplace(memory, request_blocks());
+      m_responses.emplace(
+          memory + _shm_ring::bytes_needed(request_blocks()),
+          response_blocks());
+    }
+  }
+
+  /** Stops the worker, if any. */
+  ~_forked_dag_node() {
+    lock_guard<mutex> lock(m_mutex);
+    stop_worker();
+  }
+
+  /** Moves the node into a worker process or back into this one.
+   *
+   * @param _forked Whether to run in a worker
+   * @return False if the worker could not be forked
+   */
+  bool set_forked(const bool _forked) {
+    lock_guard<mutex> lock(m_mutex);
+    m_forked.store(_forked, memory_order_release);
+    if (_forked) return spawn();
+    stop_worker();
+    return true;
+  }
+
+  /** Runs the node, in the worker if forked.
+   * @param _data The input
+   * @return The output or nullptr if there is none or the worker crashed
+   */
+  unique_ptr<Out> update(const In *const _data) {
+    const In *const batch[] = {_data};
+    return std::move(update_batch(batch).front());
+  }
+
+  /** Runs the node on a batch of inputs, in the worker if forked. The whole
+   * batch goes through the rings without waiting on each output.
+   *
+   * @param _batch The inputs
+   * @return One output per input in the same order
+   */
+  vector<unique_ptr<Out>> update_batch(span<const In *const> _batch) {
+    if (!m_forked.load(memory_order_acquire))
+      return m_inner->update_batch(_batch);
+    lock_guard<mutex> lock(m_mutex);
+    // It may have been moved back while this waited on the lock
+    if (!m_forked.load(memory_order_relaxed))
+      return m_inner->update_batch(_batch);
+    return run_forked(_batch);
+  }
+};
+#endif
+}  // namespace fn_dag
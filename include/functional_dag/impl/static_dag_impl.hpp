@@ -0,0 +1,166 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <functional_dag/error_codes.h>
+
+#include <atomic>
+#include <chrono>
+#include <expected>
+#include <functional>
+#include <iostream>
+#include <stop_token>
+#include <typeinfo>
+
+#include "functional_dag/core/cancellation.hpp"
+#include "functional_dag/core/node_metrics.hpp"
+#include "functional_dag/core/source_loop.hpp"
+#include "functional_dag/core/thread_placement.hpp"
+#include "functional_dag/core/tracer.hpp"
+#include "functional_dag/impl/dag_impl.hpp"
+#include "functional_dag/static_dag.hpp"
+
+namespace fn_dag {
+using namespace std;
+
+/** Lets a dag_manager run a static_dag like any of its other DAGs.
+ *
+ * The manager can start, pace, stop and drain it, but its topology is fixed
+ * at compile time: it has no nodes to look up and nothing can be attached to
+ * it.
+ */
+template <typename Pipeline, typename IDType>
+class _static_dag : public _dag_base<IDType> {
+ private:
+  const IDType m_id;  // The ID of the DAG itself
+  const _dag_context
+      &g_context;     // The shared state across all of the DAGs.
+  const stop_token m_stop;  // Set when the dags are asked to stop
+  _node_meter<> m_meter;    // What the DAG did, see get_source_metrics
+  const uint32_t m_track;   // What the DAG's spans refer to it by
+  atomic<uint64_t> m_ticks;  // Calls to the source so far, which number
+                             // the frames in the trace
+  _source_loop m_loop;      // Thread to run on if the DAG runs on its own
+
+  /** Calls the source once and runs the stages on its output.
+   * @return Whether the source had data
+   */
+  bool tick() {
+    _stop_scope scope(m_stop);
+    const auto started = m_meter.start();
+    _tracer::_span traced(g_context.tracer, "update", m_track, m_ticks++);
+    const bool had_data = Pipeline::push_once();
+    if (!had_data) traced.discard();
+    m_meter.finish(started, 1, had_data);
+    return had_data;
+  }
+
+ public:
+  /** Constructor of the DAG.
+   *
+   * @param _id The ID of the DAG itself
+   * @param _context The context shared across the DAGs
+   * @param _startThread Whether or not to autostart calling the source
+   * @param _pacing How to pace calls to the source
+   */
+  _static_dag(const IDType &_id, const _dag_context &_context,
+              const bool _startThread, const source_pacing _pacing)
+      : m_id(_id),
+        g_context(_context),
+        m_stop(_context.stopper.get_token()),
+        m_meter(),
+        m_track(_context.tracer.track(_id)),
+        m_ticks(0),
+        m_loop() {
+    if (_startThread)
+      m_loop.start(
+          m_stop, _pacing, [this]() { return tick(); },
+          [](const chrono::nanoseconds) { return true; });
+  }
+
+  /** Default deconstructor. Stops the source thread and waits for it. */
+  ~_static_dag() { m_loop.join(); }
+
+  /** A static DAG has no nodes with IDs.
+   * @return Always false
+   */
+  bool dag_contains(const IDType &) { return false; }
+
+  /** Simple print function to print the ID of this DAG. */
+  void print() { *g_context.log << "->" << m_id << " (static)" << endl; }
+
+  /** Simple getter for the ID of the DAG itself
+   * @return ID of the DAG
+   */
+  const IDType &get_id() { return m_id; }
+
+  /** Calls the source once and runs the stages on its output. */
+  void push_once() { m_loop.count(tick()); }
+
+  /** A static DAG has no nodes with IDs.
+   * @return Always nullptr
+   */
+  _dag_node_base<IDType> *find_node(const IDType &) { return nullptr; }
+
+  /** Reads how well the source kept its pace
+   * @return A snapshot of the pacing counters
+   */
+  pacing_stats get_pacing_stats() { return m_loop.stats(); }
+
+  /** Reads what the DAG did so far. Its stages are not nodes of their own,
+   * so the latency covers the source and every stage.
+   *
+   * @return A snapshot of the DAG's metrics
+   */
+  node_metrics get_source_metrics() { return m_meter.snapshot(); }
+
+  /** Changes where the source thread, and with it every stage, runs.
+   * @param _placement Where the thread should run
+   */
+  void set_placement(const thread_placement &_placement) {
+    m_loop.set_placement(_placement);
+  }
+
+  /** A static DAG has no nodes to visit. */
+  void for_each_node(const function<void(_dag_node_base<IDType> &)> &) {}
+
+  /** A static DAG is compiled already, as a type, so there is no plan.
+   * @return An empty plan
+   */
+  plan_stats freeze() { return plan_stats{}; }
+
+  /** Stops calling the source and waits for the source thread to finish.
+   * Every stage runs on the source thread, so nothing is left in flight.
+   *
+   * @param _deadline When to give up waiting
+   * @return Whether the source thread finished in time
+   */
+  bool stop_generating(chrono::steady_clock::time_point _deadline) {
+    return m_loop.stop(_deadline);
+  }
+
+  /** Nothing can be attached to a static DAG.
+   * @return PARENT_NOT_FOUND, always
+   */
+  expected<void *, error_codes> attach_point(const IDType &,
+                                             const type_info &) {
+    return unexpected(error_codes::PARENT_NOT_FOUND);
+  }
+
+  /** Nothing can be attached to a static DAG, so there is nothing to record.
+   */
+  void register_node(const IDType &, _dag_node_base<IDType> *) {}
+
+  /** Getter for the state shared by the DAGs
+   * @return The shared context
+   */
+  const _dag_context &get_context() { return g_context; }
+};
+}  // namespace fn_dag
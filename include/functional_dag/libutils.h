@@ -151,16 +151,25 @@ class library {
    * functionality to a simple JSON specification. It will check if the node
    * specified in the JSON file is available.
    *
+   * Nodes are created parents first, whatever order the JSON lists them in.
+   * A wire that names neither a source nor a node fails with
+   * PARENT_NOT_FOUND, and wires that go around in a cycle with SPEC_CYCLE.
+   * Either way the nodes involved are named on the logger. Many threads can
+   * deserialize at once, each parses with a parser of its own.
+   *
    * @param _json_in The JSON specification to create the DAG structure.
    * @param run_single_threaded Whether or not to run the DAGs on the same
    * thread. This is useful for debugging but not recommended for production
    * code. (optional)
+   * @param _logger An output stream to explain what is wrong with the
+   * specification, if anything. Defaults to stdout.
    * @return A normal dag manager to start/stop/modify if successful and an
    * error if unsuccessful.
    */
   [[nodiscard]] expected<fn_dag::dag_manager<string> *, fn_dag::error_codes>
   fsys_deserialize(const string &_json_in,
-                   const bool run_single_threaded = false);
+                   const bool run_single_threaded = false,
+                   ostream &_logger = cout);
 };
 
 /** Similar to load_all_available_libs, this function will retreive compatible
@@ -183,7 +192,8 @@ get_all_available_libs(const fs::directory_entry &_library_path);
  * JSON. Since the schema is needed for serialization, it makes sense to have it
  * here. The beta functionality here is only due to the inconvienience of
  * dealing with pipe specs without helper functions. For an example, check out
- * the lib_test.cpp unit test example of constructing a pipe_spec.
+ * the lib_test.cpp unit test example of constructing a pipe_spec. It is safe to
+ * call from many threads at once.
  *
  * @param _buffer_in The byte buffer in to be serialized to JSON.
  * @return The contents of a JSON file to be written out if necessary.
@@ -0,0 +1,158 @@
+#pragma once
+/** ---------------------------------------------
+ *    ___                 .___
+ *   |_  \              __| _/____     ____
+ *    /   \    ______  / __ |\__  \   / ___\
+ *   / /\  \  /_____/ / /_/ | / __ \_/ /_/  >
+ *  /_/  \__\         \____ |(____  /\___  /
+ *                         \/     \//_____/
+ * ---------------------------------------------
+ * @author ndepalma@alum.mit.edu
+ */
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace fn_dag {
+using namespace std;
+
+/** A stage of a static dag: calls F on the output of the previous stage.
+ *
+ * F is a stateless callable, e.g. a captureless lambda or a function pointer,
+ * that takes the previous output by const reference. It returns its output by
+ * value, an optional that stops the branch when empty, or void to end the
+ * branch.
+ */
+template <auto F>
+struct then {};
+
+/** A chain of stages to use as a branch of a fanout, e.g.
+ * `fanout<g, pipeline<then<a>, then<b>>{}>`. */
+template <typename... Stages>
+struct pipeline {};
+
+/** The last stage of a static dag: hands the previous output to every branch
+ * in order. A branch is either a callable like the one of then<> or a
+ * pipeline<> value. */
+template <auto... Branches>
+struct fanout {};
+
+/** Whether a type is an optional (a stage that may stop the branch). */
+template <typename T>
+struct _is_optional : false_type {};
+template <typename T>
+struct _is_optional<optional<T>> : true_type {};
+
+/** The type a stage outputs when it has data. */
+template <typename T>
+struct _unwrap_optional {
+  using type = remove_cvref_t<T>;
+};
+template <typename T>
+struct _unwrap_optional<optional<T>> {
+  using type = T;
+};
+
+/** Runs a chain of stages on a value. Only then<> stages, optionally ended
+ * by one fanout<>, form a chain. */
+template <typename T, typename... Stages>
+struct _static_chain {
+  static_assert(sizeof...(Stages) == 0,
+                "A static dag is a chain of then<> stages that may end in one "
+                "fanout<>");
+  /** The end of a chain. Nothing left to do. */
+  static void run(const T &) {}
+};
+
+/** Runs a then<> stage and the rest of the chain on its output. */
+template <typename T, auto F, typename... Rest>
+struct _static_chain<T, then<F>, Rest...> {
+  /** Runs the stage on a value.
+   * @param _in The output of the previous stage
+   */
+  static void run(const T &_in) {
+    using result = decltype(F(_in));
+    if constexpr (is_void_v<result>) {
+      static_assert(sizeof...(Rest) == 0,
+                    "A stage that returns void must end its branch");
+      F(_in);
+    } else if constexpr (_is_optional<result>::value) {
+      if (const result out = F(_in); out.has_value())
+        _static_chain<typename _unwrap_optional<result>::type, Rest...>::run(
+            *out);
+    } else {
+      _static_chain<remove_cvref_t<result>, Rest...>::run(F(_in));
+    }
+  }
+};
+
+/** Runs one branch of a fanout: a callable or a pipeline. */
+template <typename T, auto Branch>
+struct _static_branch {
+  /** Runs the branch on a value.
+   * @param _in The output shared by the branches
+   */
+  static void run(const T &_in) { _static_chain<T, then<Branch>>::run(_in); }
+};
+
+/** Runs a pipeline<> branch of a fanout. */
+template <typename T, typename... Stages, pipeline<Stages...> Branch>
+struct _static_branch<T, Branch> {
+  /** Runs the branch on a value.
+   * @param _in The output shared by the branches
+   */
+  static void run(const T &_in) { _static_chain<T, Stages...>::run(_in); }
+};
+
+/** Hands a value to every branch of a fanout. */
+template <typename T, auto... Branches>
+struct _static_chain<T, fanout<Branches...>> {
+  /** Runs every branch on a value.
+   * @param _in The output of the previous stage
+   */
+  static void run(const T &_in) {
+    (_static_branch<T, Branches>::run(_in), ...);
+  }
+};
+
+/** A dag whose topology is a type, e.g.
+ * `static_dag<src, then<f>, fanout<g, h>>`.
+ *
+ * Every stage is known at compile time, so there is no virtual call, no
+ * std::function and no allocation between stages and the compiler can inline
+ * the whole chain. The stages run one after the other on the thread that
+ * calls the source. Use it for chains of cheap stages, e.g. unit conversions
+ * and filters, where the indirection of a dynamic dag costs more than the
+ * work. Add it to a dag_manager with add_static_dag.
+ *
+ * @tparam Source A stateless callable that returns the source's output by
+ * value, or an optional that is empty when there is no data.
+ * @tparam Stages then<> stages, optionally ended by one fanout<>.
+ */
+template <auto Source, typename... Stages>
+struct static_dag {
+  /** What the source outputs */
+  using origin_type = typename _unwrap_optional<decltype(Source())>::type;
+
+  /** Calls the source once and runs the stages on its output.
+   * @return Whether the source had data
+   */
+  static bool push_once() {
+    if constexpr (_is_optional<decltype(Source())>::value) {
+      const auto out = Source();
+      if (!out.has_value()) return false;
+      run(*out);
+    } else {
+      run(Source());
+    }
+    return true;
+  }
+
+  /** Runs the stages on a value, skipping the source.
+   * @param _in The value to start from
+   */
+  static void run(const origin_type &_in) {
+    _static_chain<origin_type, Stages...>::run(_in);
+  }
+};
+}  // namespace fn_dag
@@ -12,14 +12,18 @@
 #include <functional_dag/libutils.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <filesystem>
 #include <functional_dag/dag_interface.hpp>
-#include <list>
-#include <numeric>
-#include <set>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "flatbuffers/flatbuffer_builder.h"
@@ -30,26 +34,85 @@
 
 INCBIN(g, schema, STR(SCHEMA_FILE));
 
-static flatbuffers::Parser
-    g_parser;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
-static bool has_initialized = false;
-
-auto __get_parser()
-    -> std::expected<flatbuffers::Parser *, fn_dag::error_codes> {
-  if (has_initialized) return &g_parser;
-
-  std::string pipe_spec_data(
-      g_schema_start,
-      static_cast<size_t>((char *)&g_schema_end - (char *)&g_schema_start));
+namespace {
+/** Lends out parsers loaded with the spec schema, one per call, so calls on
+ * many threads at once never parse into the same builder.
+ *
+ * The schema is copied out of the library once. A parser is only loaded with
+ * it when no idle one is left, and goes back to the idle ones when the call is
+ * done with it, so there are about as many parsers as calls ever overlapped.
+ */
+class parser_pool {
+ public:
+  /** Hands a lent parser back to the pool. */
+  struct give_back {
+    void operator()(flatbuffers::Parser *_parser) const;
+  };
+  using lease = std::unique_ptr<flatbuffers::Parser, give_back>;
+
+ private:
+  std::once_flag m_read_schema;   // Copies the schema and checks it once
+  std::vector<uint8_t> m_schema;  // The schema, read only once copied
+  bool m_schema_read = false;     // Whether the schema could be loaded
+  std::mutex m_lock;              // Guards m_idle
+  std::vector<std::unique_ptr<flatbuffers::Parser>> m_idle;  // Free to lend
+
+  /** Loads a new parser with the schema.
+   * @return The parser or nullptr if the schema doesn't load
+   */
+  auto load() const -> std::unique_ptr<flatbuffers::Parser> {
+    auto parser = std::make_unique<flatbuffers::Parser>();
+    if (!parser->Deserialize(m_schema.data(), m_schema.size())) {
+      return nullptr;
+    }
+    return parser;
+  }
 
-  if (!g_parser.Deserialize(reinterpret_cast<uint8_t *>(pipe_spec_data.data()),
-                            pipe_spec_data.size())) {
+ public:
+  /** Lends out a parser until the lease goes out of scope.
+   * @return The parser. Otherwise an error code if the schema can't be read.
+   */
+  auto borrow() -> std::expected<lease, fn_dag::error_codes> {
+    std::call_once(m_read_schema, [this]() {
+      m_schema.assign(g_schema_start, g_schema_end);
+      if (auto parser = load(); parser) {
+        m_idle.push_back(std::move(parser));
+        m_schema_read = true;
+      }
+    });
+    if (!m_schema_read) {
+      return std::unexpected(fn_dag::error_codes::SCHEMA_READ_ERROR);
+    }
+    {
+      const std::lock_guard<std::mutex> lock(m_lock);
+      if (!m_idle.empty()) {
+        lease parser(m_idle.back().release());
+        m_idle.pop_back();
+        return parser;
+      }
+    }
+    if (auto parser = load(); parser) {
+      return lease(parser.release());
+    }
     return std::unexpected(fn_dag::error_codes::SCHEMA_READ_ERROR);
   }
 
-  has_initialized = true;
-  return &g_parser;
+  /** Takes back a parser that was lent out. */
+  void take_back(flatbuffers::Parser *_parser) {
+    const std::lock_guard<std::mutex> lock(m_lock);
+    m_idle.emplace_back(_parser);
+  }
+};
+
+auto pool() -> parser_pool & {
+  static parser_pool parsers;
+  return parsers;
+}
+
+void parser_pool::give_back::operator()(flatbuffers::Parser *_parser) const {
+  pool().take_back(_parser);
 }
+}  // namespace
 
 namespace fn_dag {
 #ifdef __APPLE__
@@ -178,9 +241,9 @@ span<const library_spec> library::get_spec_iter() {
 auto fsys_serialize(const uint8_t *const _buffer_in)
     -> expected<string, error_codes> {
   string json_storage;  // NOLINT(cppcoreguidelines-init-variables)
-  const auto parser = __get_parser();
+  const auto parser = pool().borrow();
   if (parser.has_value()) {
-    auto error_str = GenerateText(*parser.value(), _buffer_in, &json_storage);
+    auto error_str = GenerateText(**parser, _buffer_in, &json_storage);
     if (error_str) {
       return unexpected(error_codes::SERIALIZATION_ERROR);
     }
@@ -189,6 +252,89 @@ auto fsys_serialize(const uint8_t *const _buffer_in)
   return unexpected(parser.error());
 }
 
+/** Translates the overflow policy of a wire to the runtime's. */
+static auto to_overflow_policy(const OVERFLOW_POLICY _policy)
+    -> overflow_policy {
+  switch (_policy) {
+    case OVERFLOW_POLICY_DROP_NEWEST:
+      return overflow_policy::DROP_NEWEST;
+    case OVERFLOW_POLICY_DROP_OLDEST:
+      return overflow_policy::DROP_OLDEST;
+    case OVERFLOW_POLICY_KEEP_LATEST:
+      return overflow_policy::KEEP_LATEST;
+    default:
+      return overflow_policy::BLOCK;
+  }
+}
+
+/** Applies the options declared on the wires of a spec to the node that was
+ * just constructed from it. */
+static auto apply_wire_options(dag_manager<string> &_manager,
+                               const node_spec *_spec)
+    -> expected<bool, error_codes> {
+  for (const string_mapping *wire : *_spec->wires()) {
+    if (wire->overflow() == OVERFLOW_POLICY_BLOCK) continue;
+    if (auto res = _manager.set_overflow_policy(
+            _spec->name()->str(), to_overflow_policy(wire->overflow()));
+        !res) {
+      return res;
+    }
+  }
+  return true;
+}
+
+/** Pins the node that was just constructed from a spec to where the spec
+ * says it runs. */
+static auto apply_spec_placement(dag_manager<string> &_manager,
+                                 const node_spec *_spec)
+    -> expected<bool, error_codes> {
+  thread_placement placement;
+  if (_spec->cores() != nullptr) {
+    placement.cores.assign(_spec->cores()->cbegin(), _spec->cores()->cend());
+  }
+  placement.numa_node = _spec->numa_node();
+  placement.fifo_priority = _spec->fifo_priority();
+  if (placement.empty()) {
+    return true;
+  }
+  return _manager.set_placement(_spec->name()->str(), placement);
+}
+
+/** Translates the priority class of a spec to the runtime's. */
+static auto to_priority_class(const PRIORITY_CLASS _priority)
+    -> priority_class {
+  switch (_priority) {
+    case PRIORITY_CLASS_CRITICAL:
+      return priority_class::CRITICAL;
+    case PRIORITY_CLASS_BACKGROUND:
+      return priority_class::BACKGROUND;
+    default:
+      return priority_class::NORMAL;
+  }
+}
+
+/** Sets how urgent the node that was just constructed from a spec is. */
+static auto apply_spec_priority(dag_manager<string> &_manager,
+                                const node_spec *_spec)
+    -> expected<bool, error_codes> {
+  if (_spec->priority() == PRIORITY_CLASS_NORMAL && _spec->deadline_us() == 0) {
+    return true;
+  }
+  return _manager.set_priority(_spec->name()->str(),
+                               to_priority_class(_spec->priority()),
+                               chrono::microseconds(_spec->deadline_us()));
+}
+
+/** Replicates the node that was just constructed from a spec, if asked. */
+static auto apply_spec_replicas(dag_manager<string> &_manager,
+                                const node_spec *_spec)
+    -> expected<bool, error_codes> {
+  if (_spec->replicas() <= 1) {
+    return true;
+  }
+  return _manager.set_replicas(_spec->name()->str(), _spec->replicas());
+}
+
 auto library::_create_node(dag_manager<string> &_manager,
                            const node_spec *_spec)
     -> expected<bool, error_codes> {
@@ -200,6 +346,22 @@ auto library::_create_node(dag_manager<string> &_manager,
       if (!spec_creator(_manager, *_spec)) {
         return unexpected(error_codes::CONSTRUCTION_FAILED);
       }
+      if (auto res = apply_wire_options(_manager, _spec); !res) {
+        return res;
+      }
+      if (auto res = apply_spec_placement(_manager, _spec); !res) {
+        return res;
+      }
+      if (auto res = apply_spec_priority(_manager, _spec); !res) {
+        return res;
+      }
+      if (auto res = apply_spec_replicas(_manager, _spec); !res) {
+        return res;
+      }
+      if (_spec->residence() == PS_TYPE_FORK) {
+        return _manager.set_residence(_spec->name()->str(),
+                                      node_residence::FORK);
+      }
       return true;
     }
     return unexpected(error_codes::DAG_NOT_FOUND);
@@ -207,17 +369,115 @@ auto library::_create_node(dag_manager<string> &_manager,
   return unexpected(error_codes::GUID_CONSTRUCTION_FAILED);
 }
 
+/** Orders the nodes of a spec so each comes after the nodes it is wired to.
+ *
+ * This is Kahn's algorithm: a node is ready once every node it is wired to
+ * is, and the nodes that were ready first go first. Wires to anything other
+ * than a node of the spec must name something the manager has already, like
+ * a source.
+ *
+ * @param _manager The manager the sources were added to
+ * @param _nodes The nodes of the spec
+ * @param _logger Where to name the nodes of wires that lead nowhere or go
+ * around in a cycle
+ * @return The indices of the nodes in the order to create them. Otherwise an
+ * error code.
+ */
+static auto order_nodes(
+    dag_manager<string> &_manager,
+    const flatbuffers::Vector<flatbuffers::Offset<node_spec>> &_nodes,
+    ostream &_logger) -> expected<vector<uint32_t>, error_codes> {
+  const uint32_t count = _nodes.size();
+  unordered_map<string_view, uint32_t> index_of;
+  index_of.reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    index_of.emplace(_nodes.Get(i)->name()->string_view(), i);
+  }
+
+  // Which nodes are wired to each node, and how many wires of each node
+  // lead to nodes that are not created yet
+  vector<vector<uint32_t>> children(count);
+  vector<uint32_t> in_degree(count, 0);
+  bool resolved = true;
+  for (uint32_t i = 0; i < count; i++) {
+    const node_spec *spec = _nodes.Get(i);
+    for (const string_mapping *wire : *spec->wires()) {
+      const string_view parent = wire->value()->string_view();
+      if (const auto found = index_of.find(parent); found != index_of.end()) {
+        children[found->second].push_back(i);
+        in_degree[i]++;
+      } else if (!_manager.manager_contains_id(string(parent))) {
+        _logger << "Node \"" << spec->name()->string_view()
+                << "\" is wired to \"" << parent
+                << "\", which is neither a source nor a node" << endl;
+        resolved = false;
+      }
+    }
+  }
+  if (!resolved) {
+    return unexpected(error_codes::PARENT_NOT_FOUND);
+  }
+
+  vector<uint32_t> order;
+  order.reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    if (in_degree[i] == 0) {
+      order.push_back(i);
+    }
+  }
+  for (size_t next = 0; next < order.size(); next++) {
+    for (const uint32_t child : children[order[next]]) {
+      if (--in_degree[child] == 0) {
+        order.push_back(child);
+      }
+    }
+  }
+  if (order.size() == count) {
+    return order;
+  }
+
+  // Every node left is wired to another node left, so following those wires
+  // from any of them has to come around to a node it passed already
+  const uint32_t none = numeric_limits<uint32_t>::max();
+  vector<uint32_t> step_of(count, none);
+  vector<uint32_t> path;
+  uint32_t at = static_cast<uint32_t>(
+      find_if(in_degree.cbegin(), in_degree.cend(),
+              [](const uint32_t _degree) { return _degree > 0; }) -
+      in_degree.cbegin());
+  while (step_of[at] == none) {
+    step_of[at] = static_cast<uint32_t>(path.size());
+    path.push_back(at);
+    for (const string_mapping *wire : *_nodes.Get(at)->wires()) {
+      const auto found = index_of.find(wire->value()->string_view());
+      if (found != index_of.end() && in_degree[found->second] > 0) {
+        at = found->second;
+        break;
+      }
+    }
+  }
+  // The path went against the wires, so the cycle is printed backwards
+  _logger << "Nodes";
+  for (size_t i = path.size(); i-- > step_of[at];) {
+    _logger << " \"" << _nodes.Get(path[i])->name()->string_view() << "\" ->";
+  }
+  _logger << " \"" << _nodes.Get(path.back())->name()->string_view()
+          << "\" are wired in a cycle, so " << count - order.size()
+          << " nodes can't be created" << endl;
+  return unexpected(error_codes::SPEC_CYCLE);
+}
+
 [[nodiscard]] auto library::fsys_deserialize(const string &_json_in,
-                                             const bool run_single_threaded)
+                                             const bool run_single_threaded,
+                                             ostream &_logger)
     -> expected<dag_manager<string> *, error_codes> {
-  const auto parser = __get_parser();
+  const auto parser = pool().borrow();
   if (parser.has_value()) {
     if (!parser.value()->ParseJson(_json_in.c_str())) {
       return unexpected(error_codes::JSON_PARSER_ERROR);
     }
 
-    set<string_view> nodes_added({});
-    auto manager = new dag_manager<string>();
+    auto manager = make_unique<dag_manager<string>>();
     if (run_single_threaded) {
       manager->run_single_threaded(true);
     }
@@ -229,69 +489,33 @@ auto library::_create_node(dag_manager<string> &_manager,
 
       ////////////////////////////////////////////////
       /// Begin by instantiating all of the nodes
-      const auto vec = pipe_spec->sources();
-
-      for (uint32_t i = 0; i < vec->size(); i++) {
-        const auto *nodes_spec = vec->Get(i);
-        if (const auto parent = _create_node(*manager, nodes_spec); parent) {
-          nodes_added.emplace(nodes_spec->name()->string_view());
-        } else {
-          return unexpected(parent.error());
+      for (const node_spec *source_spec : *pipe_spec->sources()) {
+        if (auto res = _create_node(*manager, source_spec); !res) {
+          return unexpected(res.error());
         }
       }
 
       ////////////////////////////////////////////////
       /// Figure out the order to create the nodes of the tree.
-      vector<int> ordered_list({});
-      list<int> to_sort(pipe_spec->nodes()->size());
-      set<string> node_names({});
-      iota(to_sort.begin(), to_sort.end(), 0);
-
-      bool has_found_node = true;
-      while (!to_sort.empty() && has_found_node) {
-        has_found_node = false;
-        list<int> to_remove({});
-        for (uint32_t i : to_sort) {
-          const node_spec *nodes_spec = pipe_spec->nodes()->Get(i);
-
-          // Check if contains all
-          if (all_of(nodes_spec->wires()->cbegin(), nodes_spec->wires()->cend(),
-                     [&manager, &node_names](const string_mapping *x) -> bool {
-                       return manager->manager_contains_id(x->value()->str()) ||
-                              node_names.contains(x->value()->str());
-                     })) {
-            to_remove.push_back(i);
-            ordered_list.push_back(i);
-            has_found_node = true;
-            node_names.emplace(nodes_spec->name()->str());
-          }
-        }
-        for_each(to_remove.begin(), to_remove.end(),
-                 [&to_sort](int i) { to_sort.remove(i); });
+      const auto ordered_list = order_nodes(*manager, *pipe_spec->nodes(),
+                                            _logger);
+      if (!ordered_list) {
+        return unexpected(ordered_list.error());
       }
 
-      if (to_sort.size() > 0) {
-        // Something was left over that couldn't be constructed
-        return unexpected(error_codes::CONSTRUCTION_FAILED);
-      }
       ////////////////////////////////////////////////
       /// Finally create the nodes of the tree
-      error_codes some_val = error_codes::NO_DETAILS;
-      for_each(ordered_list.cbegin(), ordered_list.cend(),
-               [&manager, &pipe_spec, &some_val, this](const int i) {
-                 const node_spec *nodes_spec = pipe_spec->nodes()->Get(i);
-                 if (auto err = _create_node(*manager, nodes_spec); !err) {
-                   some_val = err.error();
-                 }
-               });
-      if (some_val != error_codes::NO_DETAILS) {
-        return unexpected(some_val);
+      for (const uint32_t i : *ordered_list) {
+        if (auto res = _create_node(*manager, pipe_spec->nodes()->Get(i));
+            !res) {
+          return unexpected(res.error());
+        }
       }
     } else {
       return unexpected(error_codes::PIPE_SPEC_ERROR);
     }
 
-    return manager;
+    return manager.release();
   }
   return unexpected(parser.error());
 }
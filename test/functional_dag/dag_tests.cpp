@@ -1,12 +1,35 @@
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <catch2/catch_test_macros.hpp>
 #include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
 #include <functional_dag/fn_dag_interface.hpp>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <set>
+#include <span>
+#include <stop_token>
 #include <sstream>
+#include <string>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 #include "functional_dag/dag_interface.hpp"
 #include "functional_dag/filter_sys.hpp"
+#include "functional_dag/static_dag.hpp"
 
 TEST_CASE("Fill an array in order", "[dag.single_thread]") {
   int array[] = {0, 0, 0, 0, 0};
@@ -210,4 +233,2147 @@ TEST_CASE("Check that errors are thrown for not found parents",
   auto result2 = manager.add_node(1, fn_dag::fn_call(fn_node), 6);
   REQUIRE_FALSE(result2);
   REQUIRE(result2.error() == fn_dag::error_codes::PARENT_NOT_FOUND);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Fanout reuses the pooled workers", "[dag.thread_pool]") {
+  for (auto scheduler : {fn_dag::executor_type::CENTRAL_QUEUE,
+                         fn_dag::executor_type::WORK_STEALING}) {
+    std::mutex ids_mutex;
+    std::set<std::thread::id> thread_ids;
+    std::atomic<int> ran_times = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(2);
+    manager.set_executor_type(scheduler);
+
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(1);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+    REQUIRE(manager.worker_count() == 2);
+
+    for (int i = 0; i < 8; i++) {
+      std::function<std::unique_ptr<int>(const int *const)> fn_c =
+          [&ids_mutex, &thread_ids, &ran_times](const int *const) {
+            std::lock_guard<std::mutex> lock(ids_mutex);
+            thread_ids.insert(std::this_thread::get_id());
+            ran_times++;
+            return nullptr;
+          };
+      REQUIRE(manager.add_node(i + 1, fn_dag::fn_call(fn_c), 0));
+    }
+
+    for (int i = 0; i < 50; i++)
+      for (auto dag : manager.m_all_dags) dag->push_once();
+    manager.stahp();
+
+    // 2 workers plus the thread helping while it waits on the children
+    REQUIRE(ran_times == 8 * 50);
+    REQUIRE(thread_ids.size() <= 3);
+  }
+}
+
+TEST_CASE("Nested fanouts finish on a single worker", "[dag.work_stealing]") {
+  std::atomic<int> leaves_ran = 0;
+  fn_dag::dag_manager<int> manager;
+  manager.set_worker_count(1);
+
+  std::function<std::unique_ptr<int>()> fn = []() {
+    return std::make_unique<int>(1);
+  };
+  REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+
+  // Three levels of fan-out, 4 wide. Waiting nodes must help or this hangs.
+  std::function<std::unique_ptr<int>(const int *const)> fn_inner =
+      [](const int *const int_in) { return std::make_unique<int>(*int_in); };
+  std::function<std::unique_ptr<int>(const int *const)> fn_leaf =
+      [&leaves_ran](const int *const) {
+        leaves_ran++;
+        return nullptr;
+      };
+  int next_id = 1;
+  for (int i = 0; i < 4; i++) {
+    const int level1 = next_id++;
+    REQUIRE(manager.add_node(level1, fn_dag::fn_call(fn_inner), 0));
+    for (int j = 0; j < 4; j++) {
+      const int level2 = next_id++;
+      REQUIRE(manager.add_node(level2, fn_dag::fn_call(fn_inner), level1));
+      for (int k = 0; k < 4; k++)
+        REQUIRE(manager.add_node(next_id++, fn_dag::fn_call(fn_leaf), level2));
+    }
+  }
+
+  for (int i = 0; i < 10; i++)
+    for (auto dag : manager.m_all_dags) dag->push_once();
+  manager.stahp();
+
+  REQUIRE(leaves_ran == 64 * 10);
+}
+
+TEST_CASE("Pipelined sources do not wait on the dag", "[dag.pipelined]") {
+  std::atomic<int> produced = 0;
+  std::mutex seen_mutex;
+  std::vector<int> seen;
+  fn_dag::dag_manager<int> manager;
+  manager.set_worker_count(2);
+  manager.run_pipelined(true);
+  manager.set_edge_capacity(8);
+
+  std::function<std::unique_ptr<int>()> fn = [&produced]() {
+    return std::make_unique<int>(produced++);
+  };
+  auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+  REQUIRE(dag);
+
+  std::function<std::unique_ptr<int>(const int *const)> fn_slow =
+      [](const int *const int_in) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        return std::make_unique<int>(*int_in);
+      };
+  std::function<std::unique_ptr<int>(const int *const)> fn_sink =
+      [&seen_mutex, &seen](const int *const int_in) {
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        seen.push_back(*int_in);
+        return nullptr;
+      };
+  REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_slow), 0));
+  REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+
+  // Five frames are in flight before the slow stage finished the first one
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 5; i++) dag.value()->push_once();
+  REQUIRE(std::chrono::steady_clock::now() - start <
+          std::chrono::milliseconds(20));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  manager.stahp();
+
+  std::lock_guard<std::mutex> lock(seen_mutex);
+  REQUIRE(seen == std::vector<int>({0, 1, 2, 3, 4}));
+}
+
+TEST_CASE("Blocked edges deeper than the pool do not deadlock",
+          "[dag.pipelined]") {
+  std::mutex seen_mutex;
+  std::vector<int> seen;
+  fn_dag::dag_manager<int> manager;
+  manager.set_worker_count(2);
+  manager.run_pipelined(true);
+  manager.fuse_chains(false);
+  manager.set_edge_capacity(2);
+
+  int produced = 0;
+  std::function<std::unique_ptr<int>()> fn = [&produced]() {
+    return std::make_unique<int>(produced++);
+  };
+  auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+  REQUIRE(dag);
+
+  // Every edge blocks and the chain is four times as deep as the pool
+  std::function<std::unique_ptr<int>(const int *const)> fn_link =
+      [](const int *const int_in) { return std::make_unique<int>(*int_in); };
+  std::function<std::unique_ptr<int>(const int *const)> fn_sink =
+      [&seen_mutex, &seen](const int *const int_in) {
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        seen.push_back(*int_in);
+        return nullptr;
+      };
+  for (int i = 1; i <= 8; i++)
+    REQUIRE(manager.add_node(i, fn_dag::fn_call(fn_link), i - 1));
+  REQUIRE(manager.add_node(9, fn_dag::fn_call(fn_sink), 8));
+
+  // The pushes themselves hang if the workers end up waiting on each other
+  for (int i = 0; i < 500; i++) dag.value()->push_once();
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  size_t count = 0;
+  while (count < 500 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::lock_guard<std::mutex> lock(seen_mutex);
+    count = seen.size();
+  }
+  manager.stahp();
+
+  std::vector<int> in_order(500);
+  for (int i = 0; i < 500; i++) in_order[i] = i;
+  std::lock_guard<std::mutex> lock(seen_mutex);
+  REQUIRE(seen == in_order);
+}
+
+TEST_CASE("Slow pipelined nodes shed by their overflow policy",
+          "[dag.overflow_policy]") {
+  for (auto policy : {fn_dag::overflow_policy::DROP_NEWEST,
+                      fn_dag::overflow_policy::KEEP_LATEST}) {
+    std::atomic<int> produced = 0;
+    std::atomic<bool> sink_started = false;
+    std::atomic<bool> sink_released = false;
+    std::mutex seen_mutex;
+    std::vector<int> seen;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(2);
+    manager.run_pipelined(true);
+
+    std::function<std::unique_ptr<int>()> fn = [&produced]() {
+      return std::make_unique<int>(produced++);
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+
+    std::function<std::unique_ptr<int>(const int *const)> fn_sink =
+        [&](const int *const int_in) {
+          sink_started = true;
+          while (!sink_released) std::this_thread::yield();
+          std::lock_guard<std::mutex> lock(seen_mutex);
+          seen.push_back(*int_in);
+          return nullptr;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_sink), 0,
+                             {.policy = policy, .capacity = 2}));
+
+    // The sink holds on to frame 0 while 9 more frames arrive
+    dag.value()->push_once();
+    while (!sink_started) std::this_thread::yield();
+    for (int i = 0; i < 9; i++) dag.value()->push_once();
+    sink_released = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    manager.stahp();
+
+    auto stats = manager.get_edge_stats(1);
+    REQUIRE(stats);
+    REQUIRE(stats->policy == policy);
+    std::lock_guard<std::mutex> lock(seen_mutex);
+    if (policy == fn_dag::overflow_policy::DROP_NEWEST) {
+      REQUIRE(stats->dropped == 7);
+      REQUIRE(seen == std::vector<int>({0, 1, 2}));
+    } else {
+      REQUIRE(stats->dropped == 8);
+      REQUIRE(seen == std::vector<int>({0, 9}));
+    }
+  }
+
+  fn_dag::dag_manager<int> manager;
+  auto missing =
+      manager.set_overflow_policy(42, fn_dag::overflow_policy::DROP_OLDEST);
+  REQUIRE_FALSE(missing);
+  REQUIRE(missing.error() == fn_dag::error_codes::NODE_NOT_FOUND);
+}
+
+
+namespace {
+/** Counts how many instances are alive to check who frees the payloads */
+struct tracked_payload {
+  static inline std::atomic<int> alive = 0;
+  int value;
+  explicit tracked_payload(int _value) : value(_value) { alive++; }
+  ~tracked_payload() { alive--; }
+};
+}  // namespace
+
+TEST_CASE("The last child to finish frees the shared payload",
+          "[dag.shared_payload]") {
+  std::atomic<int> children_ran = 0;
+  fn_dag::dag_manager<int> manager;
+  manager.set_worker_count(2);
+
+  std::function<std::unique_ptr<tracked_payload>()> fn = []() {
+    return std::make_unique<tracked_payload>(7);
+  };
+  auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+  REQUIRE(dag);
+
+  for (int i = 0; i < 3; i++) {
+    std::function<std::unique_ptr<tracked_payload>(
+        const tracked_payload *const)>
+        fn_c = [&children_ran, i](const tracked_payload *const _in) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(20 * i));
+          if (_in->value == 7) children_ran++;
+          return std::make_unique<tracked_payload>(_in->value);
+        };
+    REQUIRE(manager.add_node(i + 1, fn_dag::fn_call(fn_c), 0));
+  }
+
+  // push_once returns once the whole frame propagated and was freed
+  for (int i = 0; i < 5; i++) {
+    dag.value()->push_once();
+    REQUIRE(children_ran == 3 * (i + 1));
+    REQUIRE(tracked_payload::alive == 0);
+  }
+  dag.value()->manual_pump(std::make_unique<tracked_payload>(7));
+  REQUIRE(children_ran == 18);
+  REQUIRE(tracked_payload::alive == 0);
+  manager.stahp();
+}
+
+TEST_CASE("Paced sources keep their rate", "[dag.pacing]") {
+  fn_dag::dag_manager<int> manager;
+
+  std::atomic<int> produced = 0;
+  std::function<std::unique_ptr<int>()> fixed = [&produced]() {
+    return std::make_unique<int>(produced++);
+  };
+  REQUIRE(manager.add_dag(
+      0, fn_dag::fn_source(fixed, {.mode = fn_dag::pacing_mode::FIXED_RATE,
+                                   .period = std::chrono::milliseconds(10)}),
+      true));
+
+  // A source that never has data must back off instead of spinning
+  std::function<std::unique_ptr<int>()> idle = []() { return nullptr; };
+  REQUIRE(manager.add_dag(1, fn_dag::fn_source(idle), true));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(250));
+  manager.stahp();
+
+  auto fixed_stats = manager.get_pacing_stats(0);
+  REQUIRE(fixed_stats);
+  REQUIRE(fixed_stats->ticks >= 10);
+  REQUIRE(fixed_stats->ticks <= 30);
+  REQUIRE(fixed_stats->idle_ticks == 0);
+  REQUIRE(fixed_stats->max_jitter >= fixed_stats->mean_jitter);
+
+  auto idle_stats = manager.get_pacing_stats(1);
+  REQUIRE(idle_stats);
+  REQUIRE(idle_stats->ticks == idle_stats->idle_ticks);
+  REQUIRE(idle_stats->ticks < 200);
+
+  auto missing = manager.get_pacing_stats(42);
+  REQUIRE_FALSE(missing);
+  REQUIRE(missing.error() == fn_dag::error_codes::DAG_NOT_FOUND);
+}
+
+TEST_CASE("Draining flushes in-flight frames", "[dag.drain]") {
+  fn_dag::dag_manager<int> manager;
+  manager.set_worker_count(2);
+  manager.run_pipelined(true);
+  manager.set_edge_capacity(4);
+
+  // The source has no data until the dag is built
+  std::atomic<bool> built = false;
+  std::atomic<int> produced = 0;
+  std::atomic<int> processed = 0;
+  std::function<std::unique_ptr<int>()> fn =
+      [&built, &produced]() -> std::unique_ptr<int> {
+    if (!built) return nullptr;
+    return std::make_unique<int>(produced++);
+  };
+  REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), true));
+
+  std::function<std::unique_ptr<int>(const int *const)> slow =
+      [&processed](const int *const _in) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        processed++;
+        return std::make_unique<int>(*_in);
+      };
+  REQUIRE(manager.add_node(1, fn_dag::fn_call(slow), 0));
+  built = true;
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  auto report = manager.drain(std::chrono::seconds(5));
+  REQUIRE(report.flushed);
+  REQUIRE(report.abandoned_frames == 0);
+  REQUIRE(report.dropped == 0);
+  REQUIRE(report.dropped_by_node.empty());
+  REQUIRE(processed == produced);
+}
+
+TEST_CASE("Nodes abort long work when the dags stop", "[dag.drain]") {
+  std::atomic<int> aborted = 0;
+  {
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(2);
+    manager.run_pipelined(true);
+    manager.set_edge_capacity(4);
+
+    std::atomic<bool> built = false;
+    std::function<std::unique_ptr<int>()> fn =
+        [&built]() -> std::unique_ptr<int> {
+      if (!built) return nullptr;
+      return std::make_unique<int>(1);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), true));
+
+    // Never finishes unless it notices the stop request
+    std::function<std::unique_ptr<int>(const int *const)> stuck =
+        [&aborted](const int *const) -> std::unique_ptr<int> {
+      const std::stop_token stop = fn_dag::current_stop_token();
+      while (!stop.stop_requested())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      aborted++;
+      return nullptr;
+    };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(stuck), 0));
+    built = true;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto report = manager.drain(std::chrono::milliseconds(20));
+    REQUIRE_FALSE(report.flushed);
+    REQUIRE(report.abandoned_frames > 0);
+    REQUIRE(report.dropped > 0);
+    REQUIRE(report.dropped_by_node.size() == 1);
+    REQUIRE(report.dropped_by_node[0].first == 1);
+    REQUIRE(report.elapsed < std::chrono::seconds(1));
+  }
+  REQUIRE(aborted == 1);
+}
+
+TEST_CASE("Join nodes match the inputs of several parents", "[dag.join]") {
+  using joined_t = std::tuple<int, int>;
+  std::mutex seen_mutex;
+  std::vector<joined_t> seen;
+  fn_dag::dag_manager<int> manager;
+  manager.run_single_threaded(true);
+
+  int camera_count = 0;
+  std::function<std::unique_ptr<int>()> camera = [&camera_count]() {
+    return std::make_unique<int>(camera_count++);
+  };
+  int imu_count = 100;
+  std::function<std::unique_ptr<int>()> imu = [&imu_count]() {
+    return std::make_unique<int>(imu_count++);
+  };
+  auto camera_dag = manager.add_dag(0, fn_dag::fn_source(camera), false);
+  auto imu_dag = manager.add_dag(1, fn_dag::fn_source(imu), false);
+  REQUIRE(camera_dag);
+  REQUIRE(imu_dag);
+
+  std::function<std::unique_ptr<int>(const joined_t *const)> fuse =
+      [&seen, &seen_mutex](const joined_t *const _in) {
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        seen.push_back(*_in);
+        return std::make_unique<int>(std::get<0>(*_in) + std::get<1>(*_in));
+      };
+  std::function<std::unique_ptr<int>(const int *const)> sink =
+      [](const int *const _in) { return std::make_unique<int>(*_in); };
+
+  SECTION("Exact sequence match across dags") {
+    REQUIRE(manager.add_join(2, fn_dag::fn_call(fuse), {0, 1}));
+    REQUIRE(manager.add_node(3, fn_dag::fn_call(sink), 2));
+    REQUIRE(manager.manager_contains_id(3));
+
+    camera_dag.value()->push_once();  // 0
+    camera_dag.value()->push_once();  // 1
+    REQUIRE(seen.empty());
+    imu_dag.value()->push_once();  // 100
+    imu_dag.value()->push_once();  // 101
+    REQUIRE(seen == std::vector<joined_t>({{0, 100}, {1, 101}}));
+    REQUIRE(manager.get_edge_stats(2)->dropped == 0);
+  }
+
+  SECTION("Sample and hold fires on the first parent") {
+    REQUIRE(manager.add_join(
+        2, fn_dag::fn_call(fuse), {0, 1},
+        {.policy = fn_dag::join_policy::SAMPLE_AND_HOLD}));
+
+    camera_dag.value()->push_once();  // 0, nothing held from the imu yet
+    imu_dag.value()->push_once();     // 100
+    imu_dag.value()->push_once();     // 101
+    camera_dag.value()->push_once();  // 1
+    camera_dag.value()->push_once();  // 2
+    REQUIRE(seen == std::vector<joined_t>({{1, 101}, {2, 101}}));
+  }
+
+  SECTION("Unmatched inputs are dropped oldest first") {
+    REQUIRE(manager.add_join(2, fn_dag::fn_call(fuse), {0, 1},
+                             {.policy = fn_dag::join_policy::EXACT_SEQUENCE,
+                              .capacity = 2}));
+    for (int i = 0; i < 4; i++) camera_dag.value()->push_once();  // 0..3
+    imu_dag.value()->push_once();                                 // 100
+    imu_dag.value()->push_once();                                 // 101
+    imu_dag.value()->push_once();                                 // 102
+    REQUIRE(seen == std::vector<joined_t>({{2, 102}}));
+    // Camera 0 and 1 fell out of the buffer, imu 100 and 101 never matched
+    REQUIRE(manager.get_edge_stats(2)->dropped == 4);
+  }
+
+  SECTION("Parents must exist and output the joined types") {
+    std::function<std::unique_ptr<double>(const int *const)> to_double =
+        [](const int *const _in) { return std::make_unique<double>(*_in); };
+    REQUIRE(manager.add_node(4, fn_dag::fn_call(to_double), 0));
+
+    auto missing = manager.add_join(2, fn_dag::fn_call(fuse), {0, 42});
+    REQUIRE(missing.error() == fn_dag::error_codes::PARENT_NOT_FOUND);
+    auto mismatch = manager.add_join(2, fn_dag::fn_call(fuse), {0, 4});
+    REQUIRE(mismatch.error() == fn_dag::error_codes::INPUT_TYPE_MISMATCH);
+    REQUIRE_FALSE(manager.manager_contains_id(2));
+  }
+}
+
+TEST_CASE("Join nodes match approximately in time across threads",
+          "[dag.join]") {
+  using joined_t = std::tuple<int, int>;
+  std::atomic<int> joined = 0;
+  fn_dag::dag_manager<int> manager;
+  manager.set_worker_count(2);
+
+  std::function<std::unique_ptr<int>()> fn = []() {
+    return std::make_unique<int>(1);
+  };
+  auto left = manager.add_dag(0, fn_dag::fn_source(fn), false);
+  auto right = manager.add_dag(1, fn_dag::fn_source(fn), false);
+  REQUIRE(left);
+  REQUIRE(right);
+
+  std::function<std::unique_ptr<int>(const joined_t *const)> fuse =
+      [&joined](const joined_t *const _in) {
+        joined++;
+        return std::make_unique<int>(std::get<0>(*_in) + std::get<1>(*_in));
+      };
+  REQUIRE(manager.add_join(2, fn_dag::fn_call(fuse), {0, 1},
+                           {.policy = fn_dag::join_policy::APPROXIMATE_TIME,
+                            .window = std::chrono::milliseconds(20)}));
+
+  // Pushed close together: joined. Far apart: not joined.
+  left.value()->push_once();
+  right.value()->push_once();
+  REQUIRE(joined == 1);
+  left.value()->push_once();
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  right.value()->push_once();
+  REQUIRE(joined == 1);
+  manager.stahp();
+}
+
+namespace {
+std::atomic<int> g_static_next = 0;
+std::atomic<int> g_static_doubled = 0;
+std::atomic<int> g_static_odd = 0;
+
+constexpr auto static_src = []() -> std::optional<int> {
+  if (g_static_next >= 5) return std::nullopt;
+  return g_static_next++;
+};
+constexpr auto to_double = [](const int &_in) { return _in * 2.0; };
+constexpr auto sum_doubled = [](const double &_in) {
+  g_static_doubled += static_cast<int>(_in);
+};
+constexpr auto only_odd = [](const double &_in) -> std::optional<int> {
+  const int half = static_cast<int>(_in) / 2;
+  if (half % 2 == 0) return std::nullopt;
+  return half;
+};
+constexpr auto count_odd = [](const int &) { g_static_odd++; };
+
+using odd_branch =
+    fn_dag::pipeline<fn_dag::then<only_odd>, fn_dag::then<count_odd>>;
+using static_pipeline =
+    fn_dag::static_dag<static_src, fn_dag::then<to_double>,
+                       fn_dag::fanout<sum_doubled, odd_branch{}>>;
+}  // namespace
+
+TEST_CASE("Static dags run in the manager", "[dag.static]") {
+  static_assert(std::is_same_v<static_pipeline::origin_type, int>);
+  g_static_next = 0;
+  g_static_doubled = 0;
+  g_static_odd = 0;
+
+  SECTION("Pushing by hand") {
+    fn_dag::dag_manager<int> manager;
+    auto dag = manager.add_static_dag<static_pipeline>(0, false);
+    REQUIRE(dag);
+    for (int i = 0; i < 6; i++) dag.value()->push_once();
+    REQUIRE(g_static_doubled == 2 * (0 + 1 + 2 + 3 + 4));
+    REQUIRE(g_static_odd == 2);
+    auto stats = manager.get_pacing_stats(0);
+    REQUIRE(stats->ticks == 6);
+    REQUIRE(stats->idle_ticks == 1);
+
+    std::function<std::unique_ptr<int>(const int *const)> fn =
+        [](const int *const _in) { return std::make_unique<int>(*_in); };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn), 0).error() ==
+            fn_dag::error_codes::PARENT_NOT_FOUND);
+  }
+
+  SECTION("On its own thread until drained") {
+    fn_dag::dag_manager<int> manager;
+    REQUIRE(manager.add_static_dag<static_pipeline>(0, true));
+    while (g_static_next < 5) std::this_thread::yield();
+    auto report = manager.drain(std::chrono::seconds(1));
+    REQUIRE(report.flushed);
+    REQUIRE(g_static_doubled == 20);
+    REQUIRE(g_static_odd == 2);
+  }
+}
+
+TEST_CASE("Chains of single children run fused", "[dag.fusion]") {
+  for (const bool pipelined : {false, true}) {
+    std::mutex threads_mutex;
+    std::vector<std::set<std::thread::id>> threads_by_frame(20);
+    std::atomic<int> finished = 0;
+    std::atomic<int> next_frame = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(2);
+    manager.run_pipelined(pipelined);
+
+    std::function<std::unique_ptr<int>()> fn = [&next_frame]() {
+      return std::make_unique<int>(next_frame++);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+
+    // decode -> undistort -> resize -> normalize
+    std::function<std::unique_ptr<int>(const int *const)> fn_link =
+        [&threads_mutex, &threads_by_frame](const int *const int_in) {
+          std::lock_guard<std::mutex> lock(threads_mutex);
+          threads_by_frame[*int_in].insert(std::this_thread::get_id());
+          return std::make_unique<int>(*int_in);
+        };
+    std::function<std::unique_ptr<int>(const int *const)> fn_last =
+        [&finished](const int *const) {
+          finished++;
+          return nullptr;
+        };
+    for (int i = 1; i <= 4; i++)
+      REQUIRE(manager.add_node(i, fn_dag::fn_call(fn_link), i - 1));
+    REQUIRE(manager.add_node(5, fn_dag::fn_call(fn_last), 4));
+
+    std::stringstream output_stream;
+    manager.set_logging_stream(&output_stream);
+    manager.print_all_dags();
+    const std::string printed = output_stream.str();
+    // The head of the chain is scheduled, the other links are fused
+    REQUIRE(printed.find("->1") != std::string::npos);
+    for (const char *const link : {"=>2", "=>3", "=>4", "=>5"})
+      REQUIRE(printed.find(link) != std::string::npos);
+
+    for (int i = 0; i < 20; i++)
+      for (auto dag : manager.m_all_dags) dag->push_once();
+    REQUIRE(manager.drain(std::chrono::seconds(5)).flushed);
+
+    REQUIRE(finished == 20);
+    for (const auto &threads : threads_by_frame) REQUIRE(threads.size() == 1);
+    REQUIRE(manager.get_edge_stats(3).value().dropped == 0);
+  }
+
+  SECTION("Switched off") {
+    std::atomic<int> finished = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.fuse_chains(false);
+
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(1);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+    std::function<std::unique_ptr<int>(const int *const)> fn_link =
+        [](const int *const int_in) { return std::make_unique<int>(*int_in); };
+    std::function<std::unique_ptr<int>(const int *const)> fn_last =
+        [&finished](const int *const) {
+          finished++;
+          return nullptr;
+        };
+    for (int i = 1; i <= 4; i++)
+      REQUIRE(manager.add_node(i, fn_dag::fn_call(fn_link), i - 1));
+    REQUIRE(manager.add_node(5, fn_dag::fn_call(fn_last), 4));
+
+    std::stringstream output_stream;
+    manager.set_logging_stream(&output_stream);
+    manager.print_all_dags();
+    REQUIRE(output_stream.str().find("=>") == std::string::npos);
+
+    for (int i = 0; i < 20; i++)
+      for (auto dag : manager.m_all_dags) dag->push_once();
+    REQUIRE(manager.drain(std::chrono::seconds(5)).flushed);
+    REQUIRE(finished == 20);
+  }
+
+  SECTION("Long chains go on in new tasks instead of overflowing the stack") {
+    for (const bool pipelined : {false, true}) {
+      std::atomic<int> last = 0;
+      fn_dag::dag_manager<int> manager;
+      manager.run_pipelined(pipelined);
+
+      std::function<std::unique_ptr<int>()> fn = []() {
+        return std::make_unique<int>(0);
+      };
+      auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+      REQUIRE(dag);
+      std::function<std::unique_ptr<int>(const int *const)> fn_link =
+          [](const int *const int_in) {
+            return std::make_unique<int>(*int_in + 1);
+          };
+      std::function<std::unique_ptr<int>(const int *const)> fn_last =
+          [&last](const int *const int_in) {
+            last = *int_in;
+            return nullptr;
+          };
+      constexpr int links = 20000;
+      for (int i = 1; i < links; i++)
+        REQUIRE(manager.add_node(i, fn_dag::fn_call(fn_link), i - 1));
+      REQUIRE(manager.add_node(links, fn_dag::fn_call(fn_last), links - 1));
+
+      dag.value()->push_once();
+      REQUIRE(manager.drain(std::chrono::seconds(10)).flushed);
+      REQUIRE(last == links - 1);
+    }
+  }
+}
+
+TEST_CASE("Queued messages run in adaptive batches", "[dag.batch]") {
+  std::vector<size_t> batch_sizes;
+  std::vector<int> seen;
+  fn_dag::dag_manager<int> manager;
+  manager.set_worker_count(1);
+  manager.run_pipelined(true);
+  manager.set_edge_capacity(64);
+
+  int produced = 0;
+  std::function<std::unique_ptr<int>()> fn = [&produced]() {
+    return std::make_unique<int>(produced++);
+  };
+  auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+  REQUIRE(dag);
+
+  std::function<std::unique_ptr<int>(const int *const)> fn_sink =
+      [&seen](const int *const int_in) {
+        seen.push_back(*int_in);
+        return nullptr;
+      };
+  std::vector<int> in_order(40);
+  for (int i = 0; i < 40; i++) in_order[i] = i;
+
+  SECTION("Batches grow with the queue") {
+    // Setting up costs far more than each input
+    std::function<std::vector<std::unique_ptr<int>>(
+        std::span<const int *const>)>
+        fn_batch = [&batch_sizes](std::span<const int *const> _batch) {
+          batch_sizes.push_back(_batch.size());
+          std::this_thread::sleep_for(std::chrono::milliseconds(2));
+          std::vector<std::unique_ptr<int>> outputs;
+          for (const int *const in : _batch)
+            outputs.push_back(std::make_unique<int>(*in));
+          return outputs;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_batch_call(fn_batch), 0,
+                             {.max_batch = 8}));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+
+    for (int i = 0; i < 40; i++) dag.value()->push_once();
+    REQUIRE(manager.drain(std::chrono::seconds(5)).flushed);
+
+    REQUIRE(seen == in_order);
+    REQUIRE(*std::max_element(batch_sizes.begin(), batch_sizes.end()) > 1);
+    REQUIRE(*std::max_element(batch_sizes.begin(), batch_sizes.end()) <= 8);
+    REQUIRE(manager.get_edge_stats(1).value().batches == batch_sizes.size());
+  }
+
+  SECTION("Batches fit the latency budget") {
+    // Every input costs 2ms, so 5ms fit two of them
+    std::function<std::vector<std::unique_ptr<int>>(
+        std::span<const int *const>)>
+        fn_batch = [&batch_sizes](std::span<const int *const> _batch) {
+          batch_sizes.push_back(_batch.size());
+          std::this_thread::sleep_for(std::chrono::milliseconds(2) *
+                                      _batch.size());
+          std::vector<std::unique_ptr<int>> outputs;
+          for (const int *const in : _batch)
+            outputs.push_back(std::make_unique<int>(*in));
+          return outputs;
+        };
+    REQUIRE(manager.add_node(
+        1, fn_dag::fn_batch_call(fn_batch), 0,
+        {.max_batch = 16, .max_latency = std::chrono::milliseconds(5)}));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+
+    for (int i = 0; i < 40; i++) dag.value()->push_once();
+    REQUIRE(manager.drain(std::chrono::seconds(5)).flushed);
+
+    REQUIRE(seen == in_order);
+    // The first batch has nothing to go by yet
+    REQUIRE(batch_sizes.size() > 1);
+    for (size_t i = 1; i < batch_sizes.size(); i++)
+      REQUIRE(batch_sizes[i] <= 2);
+  }
+
+  SECTION("Nodes without a batched update run one input at a time") {
+    int calls = 0;
+    std::function<std::unique_ptr<int>(const int *const)> fn_one =
+        [&calls](const int *const int_in) {
+          calls++;
+          return std::make_unique<int>(*int_in);
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_one), 0, {.max_batch = 4}));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+
+    for (int i = 0; i < 40; i++) dag.value()->push_once();
+    REQUIRE(manager.drain(std::chrono::seconds(5)).flushed);
+
+    REQUIRE(seen == in_order);
+    REQUIRE(calls == 40);
+  }
+}
+
+namespace {
+struct pooled_image {
+  static inline std::atomic<int> constructed = 0;
+  std::vector<unsigned char> pixels;
+  pooled_image() { constructed++; }
+};
+}  // namespace
+
+TEST_CASE("Pools recycle outputs once the last child is done",
+          "[dag.pool]") {
+  pooled_image::constructed = 0;
+  std::atomic<int> sunk = 0;
+  fn_dag::dag_manager<int> manager;
+  manager.set_worker_count(2);
+
+  std::function<std::unique_ptr<int>(const pooled_image *const)> fn_sink =
+      [&sunk](const pooled_image *const _in) {
+        if (_in->pixels.size() == 1024) sunk++;
+        return nullptr;
+      };
+
+  SECTION("Sources and nodes acquire from the pool") {
+    auto &pool = manager.get_pool<pooled_image>(
+        {.preallocate = 2, .max_free = 4, .huge_pages = true});
+    REQUIRE(pooled_image::constructed == 2);
+
+    std::function<std::unique_ptr<pooled_image>()> fn = [&pool]() {
+      auto image = pool.acquire();
+      image->pixels.resize(1024);
+      return image;
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    std::function<std::unique_ptr<pooled_image>(const pooled_image *const)>
+        fn_copy = [&pool](const pooled_image *const _in) {
+          auto image = pool.acquire();
+          image->pixels = _in->pixels;
+          return image;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_copy), 0));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+    REQUIRE(manager.add_node(3, fn_dag::fn_call(fn_sink), 1));
+
+    // Each frame is back in the pool by the time push_once returns
+    for (int i = 0; i < 20; i++) dag.value()->push_once();
+    REQUIRE(sunk == 40);
+
+    const auto stats = pool.stats();
+    REQUIRE(stats.hits == 40);
+    REQUIRE(stats.misses == 0);
+    REQUIRE(stats.recycled == 40);
+    REQUIRE(stats.discarded == 0);
+    REQUIRE(stats.free == 2);
+    REQUIRE(pooled_image::constructed == 2);
+  }
+
+  SECTION("Outputs allocated elsewhere are adopted") {
+    auto &pool = manager.get_pool<pooled_image>({.max_free = 1});
+    std::function<std::unique_ptr<pooled_image>()> fn = []() {
+      auto image = std::make_unique<pooled_image>();
+      image->pixels.resize(1024);
+      return image;
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_sink), 0));
+
+    for (int i = 0; i < 3; i++) dag.value()->push_once();
+    REQUIRE(sunk == 3);
+
+    // The first one fills the pool, the others are deleted
+    auto stats = pool.stats();
+    REQUIRE(stats.recycled == 1);
+    REQUIRE(stats.discarded == 2);
+    REQUIRE(stats.free == 1);
+
+    auto reused = pool.acquire();
+    REQUIRE(reused->pixels.size() == 1024);
+    REQUIRE(pool.stats().hits == 1);
+  }
+
+  SECTION("Huge pages back the buffers of containers") {
+    using frame_t = std::vector<unsigned char>;
+    auto &pool = manager.get_pool<frame_t>(
+        {.preallocate = 1, .max_free = 1, .huge_pages = true});
+    // Nothing to advise yet, the buffer is empty
+    REQUIRE(pool.stats().huge_page_skipped == 1);
+
+    auto frame = pool.acquire();
+    frame->resize(3840 * 2160 * 3);
+    pool.release(std::move(frame));
+    const auto stats = pool.stats();
+    REQUIRE(stats.huge_page_objects + stats.huge_page_skipped == 2);
+    // Kernels without transparent huge pages refuse the advice
+    if (std::ifstream("/sys/kernel/mm/transparent_hugepage/enabled"))
+      REQUIRE(stats.huge_page_objects == 1);
+
+    // A struct that does not expose its buffer has nothing to advise
+    auto &images = manager.get_pool<pooled_image>({.huge_pages = true});
+    auto image = images.acquire();
+    image->pixels.resize(3840 * 2160 * 3);
+    images.release(std::move(image));
+    REQUIRE(images.stats().huge_page_objects == 0);
+    REQUIRE(images.stats().huge_page_skipped == 2);
+  }
+  manager.stahp();
+}
+
+TEST_CASE("Nodes allocate temporaries from the frame's arena",
+          "[dag.arena]") {
+  SECTION("Every node of a frame shares one arena") {
+    std::mutex seen_mutex;
+    std::set<std::pmr::memory_resource *> arenas;
+    std::atomic<int> checked = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(2);
+
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(1);
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    std::function<std::unique_ptr<int>(const int *const)> fn_scratch =
+        [&seen_mutex, &arenas, &checked](const int *const _in) {
+          std::pmr::vector<int> scratch(1000, *_in, fn_dag::frame_memory());
+          if (std::accumulate(scratch.begin(), scratch.end(), 0) == 1000)
+            checked++;
+          std::lock_guard<std::mutex> lock(seen_mutex);
+          arenas.insert(scratch.get_allocator().resource());
+          return std::make_unique<int>(*_in);
+        };
+    for (int i = 1; i <= 4; i++)
+      REQUIRE(manager.add_node(i, fn_dag::fn_call(fn_scratch), 0));
+    REQUIRE(manager.add_node(5, fn_dag::fn_call(fn_scratch), 1));
+
+    dag.value()->push_once();
+    REQUIRE(checked == 5);
+    REQUIRE(arenas.size() == 1);
+    REQUIRE(*arenas.begin() != std::pmr::get_default_resource());
+    REQUIRE(fn_dag::frame_memory() == std::pmr::get_default_resource());
+    manager.stahp();
+  }
+
+  SECTION("Threads bump the same arena without overlapping") {
+    fn_dag::_frame_arena arena;
+    std::vector<std::vector<std::pair<unsigned char *, size_t>>> blocks(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < blocks.size(); t++)
+      threads.emplace_back([&arena, &blocks, t]() {
+        for (size_t i = 0; i < 2000; i++) {
+          // Mostly small, some bigger than a whole chunk
+          const size_t bytes = i % 500 == 0 ? 8192 : 1 + i % 64;
+          auto memory = static_cast<unsigned char *>(
+              arena.allocate(bytes, i % 2 == 0 ? 8 : 16));
+          std::fill(memory, memory + bytes, static_cast<unsigned char>(t));
+          blocks[t].emplace_back(memory, bytes);
+        }
+      });
+    for (auto &thread : threads) thread.join();
+
+    bool intact = true;
+    for (size_t t = 0; t < blocks.size(); t++)
+      for (const auto &[memory, bytes] : blocks[t])
+        intact = intact && std::all_of(memory, memory + bytes,
+                                       [t](const unsigned char _byte) {
+                                         return _byte == t;
+                                       });
+    REQUIRE(intact);
+    REQUIRE(arena.reserved() >= 4 * 2000);
+  }
+
+  SECTION("Outputs allocated from the arena outlive their frame") {
+    using scratch_t = std::pmr::vector<int>;
+    using joined_t = std::tuple<scratch_t, int>;
+    fn_dag::dag_manager<int> manager;
+    manager.run_single_threaded(true);
+    auto &pool = manager.get_pool<scratch_t>();
+
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(1);
+    };
+    auto camera = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    auto imu = manager.add_dag(1, fn_dag::fn_source(fn), false);
+    auto other = manager.add_dag(5, fn_dag::fn_source(fn), false);
+    REQUIRE(camera);
+    REQUIRE(imu);
+    REQUIRE(other);
+    std::function<std::unique_ptr<scratch_t>(const int *const)> fn_fill =
+        [](const int *const _in) {
+          return std::make_unique<scratch_t>(1000, *_in,
+                                             fn_dag::frame_memory());
+        };
+    std::function<std::unique_ptr<int>(const int *const)> fn_scribble =
+        [](const int *const) {
+          scratch_t scribble(1000, 7, fn_dag::frame_memory());
+          return std::make_unique<int>(scribble.back());
+        };
+    int total = 0;
+    std::function<std::unique_ptr<int>(const joined_t *const)> fn_sum =
+        [&total](const joined_t *const _in) {
+          const auto &scratch = std::get<0>(*_in);
+          total = std::accumulate(scratch.begin(), scratch.end(), 0);
+          return nullptr;
+        };
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_fill), 0));
+    REQUIRE(manager.add_node(6, fn_dag::fn_call(fn_scribble), 5));
+    REQUIRE(manager.add_join(3, fn_dag::fn_call(fn_sum), {2, 1}));
+
+    // The join holds the first frame's output after that frame is done, while
+    // another frame allocates
+    camera.value()->push_once();
+    other.value()->push_once();
+    imu.value()->push_once();
+    REQUIRE(total == 1000);
+    // Nor did it go back to the pool, which outlives every frame
+    REQUIRE(pool.stats().recycled == 0);
+  }
+}
+
+struct forked_result {
+  int value;
+  pid_t pid;
+};
+
+// A payload of bytes whose first byte is a checksum of the others
+struct checked_bytes {
+  std::vector<std::byte> owned;
+  std::span<const std::byte> viewed;
+
+  static std::byte checksum(std::span<const std::byte> _text) {
+    std::byte sum{0x5a};
+    for (const std::byte b : _text) sum ^= b;
+    return sum;
+  }
+
+  static std::unique_ptr<checked_bytes> make(const std::string &_text,
+                                             const bool _corrupt = false) {
+    auto payload = std::make_unique<checked_bytes>();
+    payload->owned.resize(_text.size() + 1);
+    std::memcpy(payload->owned.data() + 1, _text.data(), _text.size());
+    payload->owned[0] = checksum(std::span(payload->owned).subspan(1));
+    if (_corrupt) payload->owned[0] ^= std::byte{1};
+    payload->viewed = payload->owned;
+    return payload;
+  }
+
+  std::span<const std::byte> bytes() const { return viewed; }
+
+  static bool verify(std::span<const std::byte> _bytes) {
+    return !_bytes.empty() && _bytes[0] == checksum(_bytes.subspan(1));
+  }
+
+  static checked_bytes view(std::span<const std::byte> _bytes) {
+    checked_bytes payload;
+    payload.viewed = _bytes;
+    return payload;
+  }
+
+  static std::unique_ptr<checked_bytes> copy(
+      std::span<const std::byte> _bytes) {
+    auto payload = std::make_unique<checked_bytes>();
+    payload->owned.assign(_bytes.begin(), _bytes.end());
+    payload->viewed = payload->owned;
+    return payload;
+  }
+
+  std::string text() const {
+    return std::string(reinterpret_cast<const char *>(viewed.data()) + 1,
+                       viewed.size() - 1);
+  }
+};
+
+TEST_CASE("Forked nodes run in a worker process", "[dag.fork]") {
+  SECTION("A crash drops one message and the worker restarts") {
+    int next = 0;
+    std::vector<forked_result> results;
+    fn_dag::dag_manager<int> manager;
+    manager.run_single_threaded(true);
+
+    std::function<std::unique_ptr<int>()> fn = [&next]() {
+      return std::make_unique<int>(next++);
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    std::function<std::unique_ptr<forked_result>(const int *const)> fn_work =
+        [](const int *const _in) {
+          if (*_in == 2) raise(SIGKILL);
+          return std::make_unique<forked_result>(
+              forked_result{*_in * 10, getpid()});
+        };
+    std::function<std::unique_ptr<int>(const forked_result *const)> fn_sink =
+        [&results](const forked_result *const _in) {
+          results.push_back(*_in);
+          return nullptr;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_work), 0));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+    REQUIRE(manager.set_residence(1, fn_dag::node_residence::FORK));
+
+    for (int i = 0; i < 5; i++) dag.value()->push_once();
+    REQUIRE(results.size() == 4);
+    REQUIRE(results[0].value == 0);
+    REQUIRE(results[1].value == 10);
+    REQUIRE(results[2].value == 30);
+    REQUIRE(results[3].value == 40);
+    REQUIRE(results[0].pid != getpid());
+    REQUIRE(results[0].pid == results[1].pid);
+    REQUIRE(results[2].pid != results[1].pid);
+    REQUIRE(results[2].pid == results[3].pid);
+
+    REQUIRE(manager.set_residence(1, fn_dag::node_residence::THREAD));
+    dag.value()->push_once();
+    REQUIRE(results.back().value == 50);
+    REQUIRE(results.back().pid == getpid());
+    manager.stahp();
+  }
+
+  SECTION("Only plain data can cross the process boundary") {
+    fn_dag::dag_manager<int> manager;
+    manager.run_single_threaded(true);
+    std::function<std::unique_ptr<std::string>()> fn = []() {
+      return std::make_unique<std::string>("text");
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+    std::function<std::unique_ptr<std::string>(const std::string *const)>
+        fn_copy = [](const std::string *const _in) {
+          return std::make_unique<std::string>(*_in);
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_copy), 0));
+
+    auto res = manager.set_residence(1, fn_dag::node_residence::FORK);
+    REQUIRE(!res);
+    REQUIRE(res.error() == fn_dag::error_codes::RESIDENCE_UNSUPPORTED);
+    res = manager.set_residence(0, fn_dag::node_residence::FORK);
+    REQUIRE(!res);
+    REQUIRE(res.error() == fn_dag::error_codes::RESIDENCE_UNSUPPORTED);
+    res = manager.set_residence(7, fn_dag::node_residence::FORK);
+    REQUIRE(!res);
+    REQUIRE(res.error() == fn_dag::error_codes::NODE_NOT_FOUND);
+    REQUIRE(manager.set_residence(1, fn_dag::node_residence::THREAD));
+    manager.stahp();
+  }
+
+  SECTION("Plain outputs are built in place by the worker") {
+    int next = 0;
+    std::vector<forked_result> results;
+    fn_dag::dag_manager<int> manager;
+    manager.run_single_threaded(true);
+
+    std::function<std::unique_ptr<int>()> fn = [&next]() {
+      return std::make_unique<int>(next++);
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    std::function<bool(const int *const, forked_result &)> fn_fill =
+        [](const int *const _in, forked_result &_out) {
+          if (*_in % 3 == 0) return false;
+          _out = {*_in * 10, getpid()};
+          return true;
+        };
+    std::function<std::unique_ptr<int>(const forked_result *const)> fn_sink =
+        [&results](const forked_result *const _in) {
+          results.push_back(*_in);
+          return nullptr;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call_into(fn_fill), 0));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+    REQUIRE(manager.set_residence(1, fn_dag::node_residence::FORK));
+
+    for (int i = 0; i < 100; i++) dag.value()->push_once();
+    REQUIRE(results.size() == 66);
+    bool intact = true;
+    for (size_t i = 0; i < results.size(); i++) {
+      const int in = static_cast<int>(i / 2 * 3 + i % 2 + 1);
+      intact = intact && results[i].value == in * 10 &&
+               results[i].pid == results[0].pid;
+    }
+    REQUIRE(intact);
+    REQUIRE(results[0].pid != getpid());
+    manager.stahp();
+  }
+
+  SECTION("Payloads of bytes cross as bytes and are verified") {
+    using forked_t = fn_dag::_forked_dag_node<checked_bytes, checked_bytes>;
+    static_assert(fn_dag::_forkable_v<checked_bytes, checked_bytes>);
+    constexpr int messages = 2500;
+    int next = 0;
+    std::vector<std::string> results;
+    fn_dag::dag_manager<int> manager;
+    manager.run_single_threaded(true);
+
+    // Long enough for the rings to wrap around, in records of every length
+    std::function<std::unique_ptr<checked_bytes>()> fn = [&next]() {
+      const int at = next++;
+      if (at == 9)
+        return checked_bytes::make(
+            std::string(forked_t::max_payload_bytes, 'x'));
+      const std::string text = std::to_string(at) + ":" +
+                               std::string(at * 37 % 9000, 'a' + at % 26);
+      return checked_bytes::make(text, at == 5);
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    std::function<std::unique_ptr<checked_bytes>(const checked_bytes *const)>
+        fn_work = [](const checked_bytes *const _in) {
+          const std::string text = _in->text();
+          const int at = std::atoi(text.c_str());
+          const bool intact =
+              text.size() == std::to_string(at).size() + 1 + at * 37 % 9000;
+          return checked_bytes::make(std::to_string(at) + ":" +
+                                         std::to_string(getpid()) + ":" +
+                                         std::to_string(intact),
+                                     at == 7);
+        };
+    std::function<std::unique_ptr<int>(const checked_bytes *const)> fn_sink =
+        [&results](const checked_bytes *const _in) {
+          results.push_back(_in->text());
+          return nullptr;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_work), 0));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+    REQUIRE(manager.set_residence(1, fn_dag::node_residence::FORK));
+
+    for (int i = 0; i < messages; i++) dag.value()->push_once();
+    // The worker rejects 5, this process rejects what the worker made of 7,
+    // and 9 is too long to cross
+    REQUIRE(results.size() == messages - 3);
+    const std::string worker = results[0].substr(results[0].find(':'));
+    REQUIRE(worker != ":" + std::to_string(getpid()) + ":1");
+    bool intact = true;
+    size_t at = 0;
+    for (int i = 0; i < messages; i++) {
+      if (i == 5 || i == 7 || i == 9) continue;
+      intact = intact && results[at++] == std::to_string(i) + worker;
+    }
+    REQUIRE(intact);
+    manager.stahp();
+  }
+}
+
+TEST_CASE("Nodes and sources run where they are placed", "[dag.placement]") {
+  // Pin to the last core this process may use, so the test runs anywhere
+  cpu_set_t allowed;
+  REQUIRE(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+  uint32_t core = 0;
+  for (uint32_t i = 0; i < CPU_SETSIZE; i++)
+    if (CPU_ISSET(i, &allowed)) core = i;
+
+  SECTION("A part that needs privileges does not stop the rest") {
+    fn_dag::placement_result result;
+    std::thread placed([&result, core]() {
+      result = fn_dag::apply_placement(
+          {.cores = {core}, .numa_node = -1, .fifo_priority = 99});
+    });
+    placed.join();
+    REQUIRE(result.pinned);
+  }
+
+  SECTION("Placed nodes and sources run on their cores") {
+    std::atomic<int> source_cpu = -1;
+    std::atomic<int> node_cpu = -1;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(2);
+
+    std::function<std::unique_ptr<int>()> fn = [&source_cpu]() {
+      source_cpu = sched_getcpu();
+      return std::make_unique<int>(1);
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    std::function<std::unique_ptr<int>(const int *const)> fn_where =
+        [&node_cpu](const int *const _in) {
+          node_cpu = sched_getcpu();
+          return std::make_unique<int>(*_in);
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_where), 0));
+    REQUIRE(manager.set_placement(1, {.cores = {core}}));
+    auto missing = manager.set_placement(7, {.cores = {core}});
+    REQUIRE(!missing);
+    REQUIRE(missing.error() == fn_dag::error_codes::NODE_NOT_FOUND);
+
+    dag.value()->push_once();
+    REQUIRE(node_cpu == static_cast<int>(core));
+
+    // The running source thread moves before it calls the source again
+    std::atomic<int> looping_cpu = -1;
+    std::function<std::unique_ptr<int>()> fn_looping = [&looping_cpu]() {
+      looping_cpu = sched_getcpu();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      return std::make_unique<int>(1);
+    };
+    REQUIRE(manager.add_dag(2, fn_dag::fn_source(fn_looping), true));
+    REQUIRE(manager.set_placement(2, {.cores = {core}}));
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    bool moved = false;
+    while (!moved && std::chrono::steady_clock::now() < deadline) {
+      // Any call after the first one that saw the placement runs on the core
+      looping_cpu = -1;
+      while (looping_cpu == -1) std::this_thread::yield();
+      moved = looping_cpu == static_cast<int>(core);
+    }
+    REQUIRE(moved);
+    manager.stahp();
+  }
+
+  SECTION("A blocked parent leaves a placed node to its pool") {
+    std::mutex mutex;
+    std::set<std::thread::id> producers;
+    std::vector<std::thread::id> threads;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(2);
+    manager.run_pipelined(true);
+
+    std::function<std::unique_ptr<int>()> fn = [&mutex, &producers]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      producers.insert(std::this_thread::get_id());
+      return std::make_unique<int>(1);
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    std::function<std::unique_ptr<int>(const int *const)> fn_where =
+        [&mutex, &threads](const int *const) {
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+          std::lock_guard<std::mutex> lock(mutex);
+          threads.push_back(std::this_thread::get_id());
+          return nullptr;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_where), 0,
+                             {.policy = fn_dag::overflow_policy::BLOCK,
+                              .capacity = 1}));
+    REQUIRE(manager.set_placement(1, {.cores = {core}}));
+
+    // The edge fills up at once, and the source waits rather than running
+    // the node on its own thread
+    for (int i = 0; i < 50; i++) dag.value()->push_once();
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    size_t ran = 0;
+    while (ran < 50 && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+      std::lock_guard<std::mutex> lock(mutex);
+      ran = threads.size();
+    }
+    REQUIRE(ran == 50);
+    for (const auto &thread : threads) REQUIRE(!producers.contains(thread));
+    manager.stahp();
+  }
+
+  SECTION("Nodes placed the same way share one pool") {
+    auto threads = []() {
+      std::ifstream status("/proc/self/status");
+      std::string line;
+      while (std::getline(status, line))
+        if (line.starts_with("Threads:")) return std::stoi(line.substr(8));
+      return 0;
+    };
+    std::atomic<int> ran = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(2);
+
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(1);
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    std::function<std::unique_ptr<int>(const int *const)> fn_count =
+        [&ran](const int *const) {
+          ran++;
+          return nullptr;
+        };
+    for (int id = 1; id <= 20; id++)
+      REQUIRE(manager.add_node(id, fn_dag::fn_call(fn_count), 0));
+
+    const int before = threads();
+    for (int id = 1; id <= 20; id++)
+      REQUIRE(manager.set_placement(id, {.cores = {core}}));
+    REQUIRE(threads() == before + 1);
+    // Moving a node around reuses the pools of the places it was before
+    for (int i = 0; i < 50; i++) {
+      REQUIRE(manager.set_placement(1, {.cores = {core}, .fifo_priority = 1}));
+      REQUIRE(manager.set_placement(1, {.cores = {core}}));
+      REQUIRE(manager.set_placement(1, {}));
+    }
+    REQUIRE(threads() == before + 2);
+
+    dag.value()->push_once();
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (ran < 20 && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::yield();
+    REQUIRE(ran == 20);
+    manager.stahp();
+  }
+}
+
+TEST_CASE("Urgent nodes go first and background nodes are shed",
+          "[dag.priority]") {
+  SECTION("Pools run tasks with deadlines first, earliest first") {
+    const auto now = std::chrono::steady_clock::now();
+    auto check = [now](fn_dag::_dag_executor &_pool) {
+      std::mutex order_mutex;
+      std::vector<int> order;
+      std::atomic<bool> release = false;
+      auto record = [&order_mutex, &order](const int _which) {
+        return [&order_mutex, &order, _which]() {
+          std::lock_guard<std::mutex> lock(order_mutex);
+          order.push_back(_which);
+        };
+      };
+      // Keep the only worker busy until everything is queued
+      _pool.submit([&release]() {
+        while (!release) std::this_thread::yield();
+      });
+      _pool.submit(record(1));
+      _pool.submit_by(record(4), now + std::chrono::milliseconds(3));
+      _pool.submit(record(2));
+      _pool.submit_by(record(3), now + std::chrono::milliseconds(1));
+      release = true;
+      while (true) {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        if (order.size() == 4) return order;
+      }
+    };
+    // Each pool is joined before the next check reuses the stack
+    std::vector<int> stolen;
+    {
+      fn_dag::work_stealing_pool stealing(1);
+      stolen = check(stealing);
+    }
+    // Workers run their own deque newest first, so only the head is fixed
+    REQUIRE(std::vector<int>(stolen.begin(), stolen.begin() + 2) ==
+            std::vector<int>{3, 4});
+    std::vector<int> central_order;
+    {
+      fn_dag::dag_thread_pool central(1);
+      central_order = check(central);
+    }
+    REQUIRE(central_order == std::vector<int>{3, 4, 1, 2});
+  }
+
+  SECTION("A missed deadline sheds the background subtrees") {
+    int logged = 0;
+    int planned = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.run_single_threaded(true);
+
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(1);
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    std::function<std::unique_ptr<int>(const int *const)> fn_plan =
+        [&planned](const int *const _in) {
+          planned++;
+          std::this_thread::sleep_for(std::chrono::milliseconds(2));
+          return std::make_unique<int>(*_in);
+        };
+    std::function<std::unique_ptr<int>(const int *const)> fn_log =
+        [&logged](const int *const _in) {
+          logged++;
+          return std::make_unique<int>(*_in);
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_plan), 0));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_log), 0));
+    REQUIRE(manager.add_node(3, fn_dag::fn_call(fn_log), 2));
+    REQUIRE(manager.set_priority(1, fn_dag::priority_class::CRITICAL,
+                                 std::chrono::milliseconds(1)));
+    REQUIRE(manager.set_priority(2, fn_dag::priority_class::BACKGROUND));
+    auto source = manager.set_priority(0, fn_dag::priority_class::CRITICAL);
+    REQUIRE(!source);
+    REQUIRE(source.error() == fn_dag::error_codes::SCHEDULING_UNSUPPORTED);
+
+    // Nothing is overloaded until a deadline is missed
+    REQUIRE(manager.set_priority(1, fn_dag::priority_class::CRITICAL));
+    dag.value()->push_once();
+    REQUIRE(logged == 2);
+
+    REQUIRE(manager.set_priority(1, fn_dag::priority_class::CRITICAL,
+                                 std::chrono::milliseconds(1)));
+    for (int i = 0; i < 3; i++) dag.value()->push_once();
+    REQUIRE(planned == 4);
+    REQUIRE(logged == 2);
+    REQUIRE(manager.get_edge_stats(1)->deadline_misses == 3);
+    REQUIRE(manager.get_edge_stats(2)->shed == 3);
+    REQUIRE(manager.get_edge_stats(3)->shed == 0);
+
+    // Without misses the overload wears off
+    manager.set_shedding({.max_frames_in_flight = 0,
+                          .after_miss = std::chrono::nanoseconds(0)});
+    dag.value()->push_once();
+    REQUIRE(logged == 4);
+    manager.stahp();
+  }
+}
+
+TEST_CASE("Coroutine nodes wait on I/O without holding a worker",
+          "[dag.async]") {
+  using async_fn =
+      std::function<fn_dag::task<std::unique_ptr<int>>(const int *const)>;
+
+  SECTION("Waiting siblings share one worker") {
+    std::atomic<int> waiting = 0;
+    std::atomic<int> most_waiting = 0;
+    std::atomic<int> passed_on = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(1);
+
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(1);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+    async_fn fn_wait = [&waiting, &most_waiting](const int *const _in)
+        -> fn_dag::task<std::unique_ptr<int>> {
+      const int now_waiting = ++waiting;
+      int most = most_waiting;
+      while (now_waiting > most &&
+             !most_waiting.compare_exchange_weak(most, now_waiting)) {
+      }
+      const bool slept =
+          co_await fn_dag::async_sleep(std::chrono::milliseconds(30));
+      waiting--;
+      co_return slept ? std::make_unique<int>(*_in + 1) : nullptr;
+    };
+    std::function<std::unique_ptr<int>(const int *const)> fn_sink =
+        [&passed_on](const int *const _in) {
+          passed_on += *_in;
+          return nullptr;
+        };
+    for (int i = 0; i < 4; i++) {
+      REQUIRE(manager.add_node(10 + i, fn_dag::fn_async_call(fn_wait), 0));
+      REQUIRE(manager.add_node(20 + i, fn_dag::fn_call(fn_sink), 10 + i));
+    }
+
+    for (int i = 0; i < 3; i++)
+      for (auto dag : manager.m_all_dags) dag->push_once();
+    manager.stahp();
+    // A blocking sleep would let at most the worker and the pushing thread
+    // wait at once
+    REQUIRE(most_waiting == 4);
+    REQUIRE(passed_on == 3 * 4 * 2);
+  }
+
+  SECTION("Nodes resume when their fd is ready") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    std::atomic<int> received = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(1);
+
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(0);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+    async_fn fn_read =
+        [&fds](const int *const) -> fn_dag::task<std::unique_ptr<int>> {
+      if (!co_await fn_dag::async_readable(fds[0])) co_return nullptr;
+      char byte = 0;
+      if (read(fds[0], &byte, 1) != 1) co_return nullptr;
+      co_return std::make_unique<int>(byte);
+    };
+    std::function<std::unique_ptr<int>(const int *const)> fn_sink =
+        [&received](const int *const _in) {
+          received = *_in;
+          return nullptr;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_async_call(fn_read), 0));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+
+    std::thread writer([&fds]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      const char byte = 42;
+      REQUIRE(write(fds[1], &byte, 1) == 1);
+    });
+    manager.m_all_dags.front()->push_once();
+    writer.join();
+    REQUIRE(received == 42);
+
+    // Single threaded dags run the coroutine to completion in place
+    manager.run_single_threaded(true);
+    const char byte = 7;
+    REQUIRE(write(fds[1], &byte, 1) == 1);
+    manager.m_all_dags.front()->push_once();
+    REQUIRE(received == 7);
+    manager.stahp();
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  SECTION("Waits end when the dags stop") {
+    std::atomic<int> cancelled = 0;
+    std::atomic<int> passed_on = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(1);
+
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(1);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+    async_fn fn_stuck =
+        [&cancelled](const int *const) -> fn_dag::task<std::unique_ptr<int>> {
+      if (!co_await fn_dag::async_sleep(std::chrono::hours(1))) cancelled++;
+      co_return std::make_unique<int>(1);
+    };
+    std::function<std::unique_ptr<int>(const int *const)> fn_sink =
+        [&passed_on](const int *const) {
+          passed_on++;
+          return nullptr;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_async_call(fn_stuck), 0));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+    // Coroutine nodes can't leave the process
+    auto res = manager.set_residence(1, fn_dag::node_residence::FORK);
+    REQUIRE(!res);
+    REQUIRE(res.error() == fn_dag::error_codes::RESIDENCE_UNSUPPORTED);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::thread pusher([&manager]() {
+      manager.m_all_dags.front()->push_once();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    manager.stahp();
+    pusher.join();
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    REQUIRE(cancelled == 1);
+    REQUIRE(passed_on == 0);
+  }
+}
+
+TEST_CASE("Replicated nodes run frames at once and keep their order",
+          "[dag.replicas]") {
+  SECTION("Outputs reach the children in the order they were queued") {
+    std::atomic<bool> built = false;
+    std::atomic<int> produced = 0;
+    std::atomic<int> running = 0;
+    std::atomic<int> most_running = 0;
+    std::vector<int> received;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(4);
+    manager.run_pipelined(true);
+    manager.set_edge_capacity(8);
+
+    std::function<std::unique_ptr<int>()> fn =
+        [&built, &produced]() -> std::unique_ptr<int> {
+      if (!built || produced >= 40) return nullptr;
+      return std::make_unique<int>(produced++);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), true));
+    // Later messages often finish first
+    std::function<std::unique_ptr<int>(const int *const)> fn_slow =
+        [&running, &most_running](const int *const _in) {
+          const int now_running = ++running;
+          int most = most_running;
+          while (now_running > most &&
+                 !most_running.compare_exchange_weak(most, now_running)) {
+          }
+          std::this_thread::sleep_for(
+              std::chrono::milliseconds(1 + 3 * (3 - *_in % 4)));
+          running--;
+          return std::make_unique<int>(*_in);
+        };
+    std::function<std::unique_ptr<int>(const int *const)> fn_sink =
+        [&received](const int *const _in) {
+          received.push_back(*_in);
+          return nullptr;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_slow), 0,
+                             {.replicas = 4}));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+    built = true;
+
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (produced < 40 && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    REQUIRE(manager.drain(std::chrono::seconds(5)).flushed);
+
+    std::vector<int> expected(40);
+    std::iota(expected.begin(), expected.end(), 0);
+    REQUIRE(received == expected);
+    REQUIRE(most_running > 1);
+    REQUIRE(most_running <= 4);
+    auto stats = manager.get_edge_stats(1);
+    REQUIRE(stats);
+    REQUIRE(stats->replicas == 4);
+    REQUIRE(stats->reordered > 0);
+  }
+
+  SECTION("Replicas park while an early message holds up the rest") {
+    std::atomic<int> ran = 0;
+    std::atomic<int> delivered = 0;
+    std::vector<int> received;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(2);
+    manager.run_pipelined(true);
+    manager.set_edge_capacity(64);
+
+    int next = 0;
+    std::function<std::unique_ptr<int>()> fn = [&next]() {
+      return std::make_unique<int>(next++);
+    };
+    auto dag = manager.add_dag(0, fn_dag::fn_source(fn), false);
+    REQUIRE(dag);
+    std::function<std::unique_ptr<int>(const int *const)> fn_slow =
+        [&ran](const int *const _in) {
+          if (*_in == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+          ran++;
+          return std::make_unique<int>(*_in);
+        };
+    std::function<std::unique_ptr<int>(const int *const)> fn_sink =
+        [&received, &delivered](const int *const _in) {
+          received.push_back(*_in);
+          delivered++;
+          return nullptr;
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_slow), 0,
+                             {.replicas = 2}));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_sink), 1));
+
+    // The other replica runs up to the reorder buffer's limit and parks, so
+    // the process hardly uses the CPU while the first message sleeps
+    const std::clock_t cpu_start = std::clock();
+    for (int i = 0; i < 20; i++) dag.value()->push_once();
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (delivered < 20 && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const double cpu_ms =
+        1000.0 * (std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+    std::vector<int> expected(20);
+    std::iota(expected.begin(), expected.end(), 0);
+    REQUIRE(received == expected);
+    REQUIRE(ran == 20);
+    REQUIRE(cpu_ms < 150);
+    manager.stahp();
+  }
+
+  SECTION("Only plain nodes can be replicated") {
+    fn_dag::dag_manager<int> manager;
+    manager.run_pipelined(true);
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(1);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+    std::function<std::unique_ptr<int>(const int *const)> fn_copy =
+        [](const int *const _in) { return std::make_unique<int>(*_in); };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_copy), 0));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_copy), 0,
+                             {.max_batch = 4, .replicas = 4}));
+
+    REQUIRE(manager.set_replicas(1, 3));
+    REQUIRE(manager.get_edge_stats(1)->replicas == 3);
+    // Batching edges run one batch at a time
+    REQUIRE(manager.get_edge_stats(2)->replicas == 1);
+    auto res = manager.set_replicas(2, 2);
+    REQUIRE(!res);
+    REQUIRE(res.error() == fn_dag::error_codes::SCHEDULING_UNSUPPORTED);
+    res = manager.set_replicas(0, 2);
+    REQUIRE(!res);
+    REQUIRE(res.error() == fn_dag::error_codes::SCHEDULING_UNSUPPORTED);
+    res = manager.set_replicas(7, 2);
+    REQUIRE(!res);
+    REQUIRE(res.error() == fn_dag::error_codes::NODE_NOT_FOUND);
+    REQUIRE(manager.set_replicas(1, 1));
+    manager.stahp();
+  }
+}
+
+TEST_CASE("Nodes keep metrics of their runs", "[dag.metrics]") {
+  SECTION("Counts, latency and CPU time of every node and source") {
+    int next = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.run_single_threaded(true);
+    std::function<std::unique_ptr<int>()> fn = [&next]() {
+      return std::make_unique<int>(next++);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+    // Only passes the even numbers on
+    std::function<std::unique_ptr<int>(const int *const)> fn_sleepy =
+        [](const int *const _in) -> std::unique_ptr<int> {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      if (*_in % 2 != 0) return nullptr;
+      return std::make_unique<int>(*_in);
+    };
+    std::function<std::unique_ptr<int>(const int *const)> fn_busy =
+        [](const int *const _in) {
+          const auto until =
+              std::chrono::steady_clock::now() + std::chrono::milliseconds(2);
+          while (std::chrono::steady_clock::now() < until) {
+          }
+          return std::make_unique<int>(*_in);
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_sleepy), 0));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_busy), 1));
+    for (int i = 0; i < 10; i++) manager.m_all_dags.front()->push_once();
+
+    const auto metrics = manager.get_metrics();
+    if constexpr (!fn_dag::metrics_enabled) {
+      REQUIRE(metrics.empty());
+      return;
+    }
+    REQUIRE(metrics.size() == 3);
+    const auto &source = metrics.at(0);
+    REQUIRE(source.invocations == 10);
+    REQUIRE(source.null_outputs == 0);
+
+    const auto &sleepy = metrics.at(1);
+    REQUIRE(sleepy.invocations == 10);
+    REQUIRE(sleepy.null_outputs == 5);
+    REQUIRE(sleepy.latency.count == 10);
+    REQUIRE(sleepy.latency.shortest >= std::chrono::milliseconds(1));
+    REQUIRE(sleepy.latency.percentile(50) >= sleepy.latency.shortest);
+    REQUIRE(sleepy.latency.percentile(100) == sleepy.latency.longest);
+    REQUIRE(sleepy.latency.mean() >= std::chrono::milliseconds(1));
+    // Single threaded, nothing waits in a queue
+    REQUIRE(sleepy.queue_wait.count == 10);
+    REQUIRE(sleepy.queue_wait.longest < std::chrono::milliseconds(100));
+
+    const auto &busy = metrics.at(2);
+    REQUIRE(busy.invocations == 5);
+    REQUIRE(busy.null_outputs == 0);
+    // Sleeping takes no CPU time, spinning does
+    REQUIRE(busy.cpu_time > sleepy.cpu_time);
+    REQUIRE(sleepy.cpu_time < sleepy.latency.total);
+  }
+
+  SECTION("Queued messages record how long they waited") {
+    std::atomic<bool> built = false;
+    std::atomic<int> produced = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(1);
+    manager.run_pipelined(true);
+    std::function<std::unique_ptr<int>()> fn =
+        [&built, &produced]() -> std::unique_ptr<int> {
+      if (!built || produced >= 20) return nullptr;
+      return std::make_unique<int>(produced++);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), true));
+    std::function<std::unique_ptr<int>(const int *const)> fn_slow =
+        [](const int *const _in) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(2));
+          return std::make_unique<int>(*_in);
+        };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_slow), 0));
+    built = true;
+
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (produced < 20 && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    REQUIRE(manager.drain(std::chrono::seconds(5)).flushed);
+
+    if constexpr (!fn_dag::metrics_enabled) return;
+    const auto slow = manager.get_metrics().at(1);
+    REQUIRE(slow.invocations == 20);
+    REQUIRE(slow.queue_wait.count == 20);
+    // The later messages queued up behind the slow ones
+    REQUIRE(slow.queue_wait.longest >= std::chrono::milliseconds(2));
+  }
+
+  SECTION("Percentiles land in the bucket of the duration") {
+    fn_dag::latency_histogram histogram{.count = 0,
+                                        .shortest = {},
+                                        .longest = {},
+                                        .total = {},
+                                        .buckets = {}};
+    REQUIRE(histogram.percentile(99) == std::chrono::nanoseconds(0));
+    histogram.buckets.assign(fn_dag::_latency_buckets::k_count, 0);
+    for (const int64_t ns : {5, 100, 1000, 10000, 1000000}) {
+      const size_t bucket = fn_dag::_latency_buckets::index(ns);
+      REQUIRE(fn_dag::_latency_buckets::floor(bucket) <= uint64_t(ns));
+      REQUIRE(fn_dag::_latency_buckets::ceiling(bucket) >= uint64_t(ns));
+      REQUIRE(fn_dag::_latency_buckets::ceiling(bucket) <=
+              uint64_t(ns + ns / 8));
+      histogram.buckets[bucket]++;
+      histogram.count++;
+    }
+    histogram.shortest = std::chrono::nanoseconds(5);
+    histogram.longest = std::chrono::nanoseconds(1000000);
+    REQUIRE(histogram.percentile(0) == std::chrono::nanoseconds(5));
+    REQUIRE(histogram.percentile(50) >= std::chrono::nanoseconds(1000));
+    REQUIRE(histogram.percentile(50) <= std::chrono::nanoseconds(1125));
+    REQUIRE(histogram.percentile(100) == std::chrono::nanoseconds(1000000));
+  }
+}
+
+TEST_CASE("Traces show which threads ran which nodes", "[dag.trace]") {
+  SECTION("Spans of every node end up in the trace") {
+    int next = 0;
+    fn_dag::dag_manager<int> manager;
+    manager.set_worker_count(2);
+    std::function<std::unique_ptr<int>()> fn = [&next]() {
+      return std::make_unique<int>(next++);
+    };
+    REQUIRE(manager.add_dag(0, fn_dag::fn_source(fn), false));
+    std::function<std::unique_ptr<int>(const int *const)> fn_copy =
+        [](const int *const _in) { return std::make_unique<int>(*_in); };
+    REQUIRE(manager.add_node(1, fn_dag::fn_call(fn_copy), 0));
+    REQUIRE(manager.add_node(2, fn_dag::fn_call(fn_copy), 1));
+    REQUIRE(manager.add_node(3, fn_dag::fn_call(fn_copy), 0));
+
+    // Nothing is recorded until the trace starts
+    manager.m_all_dags.front()->push_once();
+    std::ostringstream before;
+    REQUIRE(manager.write_trace(before) == 0);
+
+    manager.start_trace();
+    for (int i = 0; i < 3; i++) manager.m_all_dags.front()->push_once();
+    manager.stop_trace();
+    manager.m_all_dags.front()->push_once();
+
+    std::ostringstream trace;
+    // A run_filter, update and fan_out of every node and frame, plus an
+    // update and fan_out of the source
+    REQUIRE(manager.write_trace(trace) == 3 * (3 * 3 + 2));
+    const std::string json = trace.str();
+    REQUIRE(json.starts_with("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    REQUIRE(json.ends_with("]}\n"));
+    REQUIRE(json.find("\"thread_name\"") != std::string::npos);
+    for (const char *name : {"run_filter", "update", "fan_out"})
+      REQUIRE(json.find("{\"name\":\"" + std::string(name) +
+                        "\",\"cat\":\"fn_dag\",\"ph\":\"X\"") !=
+              std::string::npos);
+    REQUIRE(json.find("\"args\":{\"node\":\"2\",\"frame\":3}") !=
+            std::string::npos);
+    // The frame pushed after the trace stopped is not in it
+    REQUIRE(json.find("\"frame\":4}") == std::string::npos);
+  }
+
+  SECTION("Traces are written to files") {
+    fn_dag::dag_manager<std::string> manager;
+    manager.run_single_threaded(true);
+    std::function<std::unique_ptr<int>()> fn = []() {
+      return std::make_unique<int>(1);
+    };
+    REQUIRE(manager.add_dag("source \"a\"", fn_dag::fn_source(fn), false));
+    manager.start_trace(16);
+    for (int i = 0; i < 40; i++) manager.m_all_dags.front()->push_once();
+
+    const std::string path = "/tmp/fn_dag_trace_test.json";
+    auto written = manager.write_trace(path);
+    REQUIRE(written);
+    // The ring keeps the newest spans only
+    REQUIRE(*written >= 16);
+    REQUIRE(*written < 80);
+    std::ifstream in(path);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    REQUIRE(contents.str().find("\"node\":\"source \\\"a\\\"\"") !=
+            std::string::npos);
+    std::remove(path.c_str());
+
+    written = manager.write_trace("/no/such/dir/trace.json");
+    REQUIRE(!written);
+    REQUIRE(written.error() == fn_dag::error_codes::PATH_DOES_NOT_EXIST);
+  }
+}
+
+TEST_CASE("Nodes are found by ID across dags", "[dag.index]") {
+  fn_dag::dag_manager<int> manager;
+  manager.run_single_threaded(true);
+
+  std::function<std::unique_ptr<int>()> source = []() {
+    return std::make_unique<int>(1);
+  };
+  std::function<std::unique_ptr<int>(const int *const)> add_one =
+      [](const int *const _in) { return std::make_unique<int>(*_in + 1); };
+  std::function<std::unique_ptr<double>(const int *const)> to_double =
+      [](const int *const _in) { return std::make_unique<double>(*_in); };
+  REQUIRE(manager.add_dag(0, fn_dag::fn_source(source), false));
+  REQUIRE(manager.add_dag(1, fn_dag::fn_source(source), false));
+
+  // A long chain, each node attached to the one added last
+  int parent = 0;
+  for (int id = 2; id < 5002; id++) {
+    REQUIRE(manager.add_node(id, fn_dag::fn_call(add_one), parent));
+    parent = id;
+  }
+  for (int id : {0, 1, 2, 2500, 5001}) REQUIRE(manager.manager_contains_id(id));
+  REQUIRE(manager.find_node(5001) != nullptr);
+  REQUIRE(manager.find_node(5001)->get_id() == 5001);
+  REQUIRE(manager.find_node(0) == nullptr);
+  REQUIRE(manager.find_node(5002) == nullptr);
+
+  SECTION("A node that fails to attach does not take its ID") {
+    REQUIRE(manager.add_node(6000, fn_dag::fn_call(to_double), 1));
+    auto mismatch = manager.add_node(6001, fn_dag::fn_call(add_one), 6000);
+    REQUIRE(mismatch.error() == fn_dag::error_codes::INPUT_TYPE_MISMATCH);
+    REQUIRE_FALSE(manager.manager_contains_id(6001));
+    REQUIRE(manager.set_overflow_policy(6001, fn_dag::overflow_policy::BLOCK)
+                .error() == fn_dag::error_codes::NODE_NOT_FOUND);
+
+    // The ID is still free for a node that does attach
+    REQUIRE(manager.add_node(6001, fn_dag::fn_call(add_one), 1));
+    REQUIRE(manager.find_node(6001)->get_id() == 6001);
+  }
+
+  SECTION("Joins and their children are found under the first parent") {
+    using joined_t = std::tuple<int, int>;
+    std::function<std::unique_ptr<int>(const joined_t *const)> sum =
+        [](const joined_t *const _in) {
+          return std::make_unique<int>(std::get<0>(*_in) + std::get<1>(*_in));
+        };
+    REQUIRE(manager.add_join(7000, fn_dag::fn_call(sum), {5001, 1}));
+    REQUIRE(manager.add_node(7001, fn_dag::fn_call(add_one), 7000));
+    REQUIRE(manager.find_node(7000)->get_id() == 7000);
+    REQUIRE(manager.find_node(7001)->get_id() == 7001);
+  }
+
+  SECTION("An ID is only taken once") {
+    using joined_t = std::tuple<int, int>;
+    std::function<std::unique_ptr<int>(const joined_t *const)> sum =
+        [](const joined_t *const _in) {
+          return std::make_unique<int>(std::get<0>(*_in) + std::get<1>(*_in));
+        };
+    auto node = manager.add_node(2500, fn_dag::fn_call(add_one), 1);
+    REQUIRE(node.error() == fn_dag::error_codes::GUID_COLLISION);
+    auto join = manager.add_join(2500, fn_dag::fn_call(sum), {5001, 1});
+    REQUIRE(join.error() == fn_dag::error_codes::GUID_COLLISION);
+    REQUIRE(manager.add_join(7000, fn_dag::fn_call(sum), {5001, 1}));
+    join = manager.add_join(7000, fn_dag::fn_call(sum), {5001, 1});
+    REQUIRE(join.error() == fn_dag::error_codes::GUID_COLLISION);
+    // The first node with the ID is still the one found
+    REQUIRE(manager.find_node(2500)->get_id() == 2500);
+    REQUIRE(manager.find_node(7000)->get_id() == 7000);
+
+    // DAGs share the IDs with the nodes
+    auto dag = manager.add_dag(0, fn_dag::fn_source(source), false);
+    REQUIRE(dag.error() == fn_dag::error_codes::GUID_COLLISION);
+    REQUIRE(manager.add_node(7001, fn_dag::fn_call(add_one), 1));
+    dag = manager.add_dag(7001, fn_dag::fn_source(source), false);
+    REQUIRE(dag.error() == fn_dag::error_codes::GUID_COLLISION);
+    auto static_dag = manager.add_static_dag<static_pipeline>(1, false);
+    REQUIRE(static_dag.error() == fn_dag::error_codes::GUID_COLLISION);
+    static_dag = manager.add_static_dag<static_pipeline>(7001, false);
+    REQUIRE(static_dag.error() == fn_dag::error_codes::GUID_COLLISION);
+    REQUIRE(manager.m_all_dags.size() == 2);
+    REQUIRE(manager.find_node(7001)->get_id() == 7001);
+    REQUIRE(manager.get_pacing_stats(0));
+  }
+
+  SECTION("DAGs are found by ID too") {
+    REQUIRE(manager.get_pacing_stats(1));
+    REQUIRE(manager.get_pacing_stats(2500).error() ==
+            fn_dag::error_codes::DAG_NOT_FOUND);
+    REQUIRE(manager.set_placement(1, {}));
+    REQUIRE(manager.set_placement(9000, {}).error() ==
+            fn_dag::error_codes::NODE_NOT_FOUND);
+  }
+
+  SECTION("Clearing the manager forgets every ID") {
+    manager.clear();
+    REQUIRE_FALSE(manager.manager_contains_id(0));
+    REQUIRE_FALSE(manager.manager_contains_id(2500));
+    REQUIRE(manager.find_node(2500) == nullptr);
+  }
+}
+
+TEST_CASE("Frozen dags run their nodes from a flat plan", "[dag.plan]") {
+  fn_dag::dag_manager<int> manager;
+  manager.run_single_threaded(true);
+
+  std::vector<int> ran;
+  int last = 0;
+  std::function<std::unique_ptr<int>()> source = []() {
+    return std::make_unique<int>(1);
+  };
+  auto step = [&ran, &last](const int _id, const bool _passes) {
+    std::function<std::unique_ptr<int>(const int *const)> fn =
+        [&ran, &last, _id, _passes](const int *const _in) {
+          ran.push_back(_id);
+          last = *_in + 1;
+          return _passes ? std::make_unique<int>(*_in + 1) : nullptr;
+        };
+    return fn_dag::fn_call(fn);
+  };
+  auto dag = manager.add_dag(0, fn_dag::fn_source(source), false);
+  REQUIRE(dag);
+
+  SECTION("Nodes run level by level and skip what has no input") {
+    // 0 -> 1 -> 3 -> 6
+    //        -> 4
+    //   -> 2 -> 5, but 2 has no output
+    REQUIRE(manager.add_node(1, step(1, true), 0));
+    REQUIRE(manager.add_node(2, step(2, false), 0));
+    REQUIRE(manager.add_node(3, step(3, true), 1));
+    REQUIRE(manager.add_node(4, step(4, true), 1));
+    REQUIRE(manager.add_node(5, step(5, true), 2));
+    REQUIRE(manager.add_node(6, step(6, true), 3));
+
+    auto plan = manager.freeze(0);
+    REQUIRE(plan);
+    REQUIRE(plan->nodes == 6);
+    REQUIRE(plan->levels == 3);
+    REQUIRE(plan->widest == 3);
+    REQUIRE(plan->opaque == 0);
+    REQUIRE(manager.freeze(0)->nodes == 6);
+    REQUIRE(manager.freeze(42).error() == fn_dag::error_codes::DAG_NOT_FOUND);
+
+    dag.value()->push_once();
+    REQUIRE(ran == std::vector<int>({1, 2, 3, 4, 6}));
+    REQUIRE(last == 4);
+    if constexpr (fn_dag::metrics_enabled)
+      REQUIRE(manager.get_metrics()[6].invocations == 1);
+
+    // The topology is fixed now
+    auto onto_node = manager.add_node(7, step(7, true), 6);
+    REQUIRE(onto_node.error() == fn_dag::error_codes::DAG_FROZEN);
+    auto onto_dag = manager.add_node(7, step(7, true), 0);
+    REQUIRE(onto_dag.error() == fn_dag::error_codes::DAG_FROZEN);
+    REQUIRE_FALSE(manager.manager_contains_id(7));
+  }
+
+  SECTION("Deep chains run without recursing") {
+    int parent = 0;
+    for (int id = 1; id <= 10000; id++) {
+      REQUIRE(manager.add_node(id, step(id, true), parent));
+      parent = id;
+    }
+    auto plan = manager.freeze(0);
+    REQUIRE(plan->levels == 10000);
+    REQUIRE(plan->widest == 1);
+
+    dag.value()->push_once();
+    REQUIRE(ran.size() == 10000);
+    REQUIRE(last == 10001);
+  }
+
+  SECTION("Joins run their own subtree") {
+    using joined_t = std::tuple<int, int>;
+    std::function<std::unique_ptr<int>(const joined_t *const)> sum =
+        [](const joined_t *const _in) {
+          return std::make_unique<int>(std::get<0>(*_in) + std::get<1>(*_in));
+        };
+    REQUIRE(manager.add_node(1, step(1, true), 0));
+    REQUIRE(manager.add_node(2, step(2, true), 0));
+    REQUIRE(manager.add_join(3, fn_dag::fn_call(sum), {1, 2}));
+    REQUIRE(manager.add_node(4, step(4, true), 3));
+
+    // The join counts once per parent
+    auto plan = manager.freeze(0);
+    REQUIRE(plan->nodes == 4);
+    REQUIRE(plan->opaque == 2);
+
+    dag.value()->push_once();
+    REQUIRE(ran == std::vector<int>({1, 2, 4}));
+    REQUIRE(last == 5);
+  }
+
+  SECTION("Multi-threaded dags still fan out on the pool") {
+    std::atomic<int> calls = 0;
+    std::atomic<int> total = 0;
+    fn_dag::dag_manager<int> threaded;
+    threaded.set_worker_count(2);
+    std::function<std::unique_ptr<int>(const int *const)> add_one =
+        [&calls, &total](const int *const _in) {
+          calls++;
+          total += *_in;
+          return std::make_unique<int>(*_in + 1);
+        };
+    auto threaded_dag = threaded.add_dag(0, fn_dag::fn_source(source), false);
+    REQUIRE(threaded_dag);
+    // 0 -> 1 -> 3
+    //   -> 2
+    REQUIRE(threaded.add_node(1, fn_dag::fn_call(add_one), 0));
+    REQUIRE(threaded.add_node(2, fn_dag::fn_call(add_one), 0));
+    REQUIRE(threaded.add_node(3, fn_dag::fn_call(add_one), 1));
+    REQUIRE(threaded.freeze(0)->nodes == 3);
+
+    for (int i = 0; i < 10; i++) threaded_dag.value()->push_once();
+    REQUIRE(calls == 30);
+    REQUIRE(total == 10 * (1 + 1 + 2));
+    auto onto_node = threaded.add_node(4, fn_dag::fn_call(add_one), 3);
+    REQUIRE(onto_node.error() == fn_dag::error_codes::DAG_FROZEN);
+    threaded.stahp();
+  }
+}
@@ -1,10 +1,19 @@
+#include <sched.h>
+#include <unistd.h>
+
+#include <atomic>
 #include <cassert>
 #include <catch2/catch_test_macros.hpp>
+#include <chrono>
 #include <functional>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 #include "functional_dag/dag_interface.hpp"
 #include "functional_dag/error_codes.h"
 #include "functional_dag/filter_sys.hpp"
+#include "functional_dag/fn_dag_interface.hpp"
 #include "functional_dag/guid_impl.hpp"
 #include "functional_dag/lib_spec_generated.h"
 #include "functional_dag/libutils.h"
@@ -108,6 +117,101 @@ class library_example : public library {
   }
 };
 
+class test_relay : public dag_node<int, int> {
+ public:
+  unique_ptr<int> update(const int *const y) {
+    return std::make_unique<int>(*y);
+  }
+};
+
+bool construct_relay(dag_manager<string> &manager, const node_spec &spec) {
+  return manager.add_node(spec.name()->str(), new test_relay(),
+                          spec.wires()->Get(0)->value()->str())
+      .has_value();
+}
+
+// Unlike construct_node this does not assert, so it can run on any thread
+bool construct_relay_source(dag_manager<string> &manager,
+                            const node_spec &spec) {
+  return manager.add_dag(spec.name()->str(), new test_src(), false)
+      .has_value();
+}
+
+// Also builds relays, int to int nodes that can be wired to each other, and
+// sources for them
+class library_relay : public library_example {
+ public:
+  library_relay() : library_example() {
+    m_constructors[GUID<node_spec>(GUID_vals(1, 1))] =
+        function<construction_signature>(&construct_relay_source);
+    m_constructors[GUID<node_spec>(GUID_vals(1, 2))] =
+        function<construction_signature>(&construct_relay);
+  }
+};
+
+// Tells which process it ran in
+class pid_relay : public dag_node<int, int> {
+ public:
+  unique_ptr<int> update(const int *const) {
+    return std::make_unique<int>(getpid());
+  }
+};
+
+// Tells which core it ran on
+class core_relay : public dag_node<int, int> {
+ public:
+  unique_ptr<int> update(const int *const) {
+    return std::make_unique<int>(sched_getcpu());
+  }
+};
+
+// Takes longer than a millisecond
+class slow_relay : public dag_node<int, int> {
+ public:
+  unique_ptr<int> update(const int *const y) {
+    this_thread::sleep_for(chrono::milliseconds(2));
+    return std::make_unique<int>(*y);
+  }
+};
+
+// Also builds pid, core and slow relays, and keeps the sources it builds so
+// tests can push them
+class library_probe : public library_relay {
+ public:
+  vector<dag<int, string> *> sources;
+
+  library_probe() : library_relay() {
+    m_constructors[GUID<node_spec>(GUID_vals(1, 1))] =
+        [this](dag_manager<string> &manager, const node_spec &spec) {
+          auto source =
+              manager.add_dag(spec.name()->str(), new test_src(), false);
+          if (source) sources.push_back(source.value());
+          return source.has_value();
+        };
+    m_constructors[GUID<node_spec>(GUID_vals(1, 3))] =
+        [](dag_manager<string> &manager, const node_spec &spec) {
+          return manager
+              .add_node(spec.name()->str(), new pid_relay(),
+                        spec.wires()->Get(0)->value()->str())
+              .has_value();
+        };
+    m_constructors[GUID<node_spec>(GUID_vals(1, 4))] =
+        [](dag_manager<string> &manager, const node_spec &spec) {
+          return manager
+              .add_node(spec.name()->str(), new core_relay(),
+                        spec.wires()->Get(0)->value()->str())
+              .has_value();
+        };
+    m_constructors[GUID<node_spec>(GUID_vals(1, 5))] =
+        [](dag_manager<string> &manager, const node_spec &spec) {
+          return manager
+              .add_node(spec.name()->str(), new slow_relay(),
+                        spec.wires()->Get(0)->value()->str())
+              .has_value();
+        };
+  }
+};
+
 TEST_CASE("Deserializes JSON", "[libs.json_deserialize_success]") {
   string json_str =
       "{\
@@ -142,6 +246,226 @@ TEST_CASE("Deserializes JSON", "[libs.json_deserialize_success]") {
   }
 }
 
+TEST_CASE("Deserializes wire overflow policies", "[libs.json_wire_policy]") {
+  string json_str =
+      "{\
+    nodes:\
+    [\
+        {\
+            name: \"ex_node\",\
+            target_id: {bits1: 16570122415097137046, bits2: 12761028291507926795},\
+            wires: [{key: \"y\", value:\"ex_source\", overflow: KEEP_LATEST}],\
+            options: [{name: \"test_string\", value: {type: INT, int_value: 5}}]\
+        },\
+    ],\
+    sources:\
+    [\
+        {\
+            name : \"ex_source\",\
+            target_id: {bits1 : 2473537575747866612, bits2 : 10560267256759610388},\
+            wires : [],\
+            options: [{name: \"cons_in\", value: {type: INT, int_value: 10}}]\
+        }\
+    ]\
+    }";
+  library_example library_ex;
+
+  if (auto manager = library_ex.fsys_deserialize(json_str); manager) {
+    auto real_manager = manager.value();
+    auto stats = real_manager->get_edge_stats("ex_node");
+    REQUIRE(stats.has_value());
+    REQUIRE(stats->policy == fn_dag::overflow_policy::KEEP_LATEST);
+    delete real_manager;
+  } else {
+    REQUIRE(manager.has_value());
+  }
+}
+
+TEST_CASE("Deserializes thread placements", "[libs.json_placement]") {
+  // Place on the last core this process may use, so the test runs anywhere
+  cpu_set_t allowed;
+  REQUIRE(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+  int core = 0;
+  for (int i = 0; i < CPU_SETSIZE; i++)
+    if (CPU_ISSET(i, &allowed)) core = i;
+  string json_str =
+      "{\
+    nodes:\
+    [\
+        {\
+            name: \"ex_node\",\
+            target_id: {bits1: 1, bits2: 4},\
+            wires: [{key: \"y\", value:\"ex_source\"}],\
+            options: [],\
+            cores: [" +
+      to_string(core) +
+      "],\
+            numa_node: 0\
+        },\
+    ],\
+    sources:\
+    [\
+        {\
+            name : \"ex_source\",\
+            target_id: {bits1 : 1, bits2 : 1},\
+            wires : [],\
+            options: [],\
+            cores: [" +
+      to_string(core) +
+      "],\
+            fifo_priority: 10\
+        }\
+    ]\
+    }";
+  library_probe library_ex;
+
+  // Placements the process has no privileges for are skipped, not fatal
+  auto manager = library_ex.fsys_deserialize(json_str);
+  REQUIRE(manager.has_value());
+  auto real_manager = manager.value();
+  atomic<int> node_cpu = -1;
+  function<unique_ptr<int>(const int *const)> fn_sink =
+      [&node_cpu](const int *const _in) {
+        node_cpu = *_in;
+        return nullptr;
+      };
+  REQUIRE(real_manager->add_node("sink", fn_call(fn_sink), "ex_node"));
+  REQUIRE(library_ex.sources.size() == 1);
+
+  library_ex.sources[0]->push_once();
+  REQUIRE(node_cpu == core);
+  real_manager->stahp();
+  delete real_manager;
+}
+
+TEST_CASE("Deserializes priorities and deadlines", "[libs.json_priority]") {
+  string json_str =
+      "{\
+    nodes:\
+    [\
+        {\
+            name: \"plan\",\
+            target_id: {bits1: 1, bits2: 5},\
+            wires: [{key: \"y\", value:\"ex_source\"}],\
+            options: [],\
+            priority: CRITICAL,\
+            deadline_us: 1000\
+        },\
+        {\
+            name: \"log\",\
+            target_id: {bits1: 1, bits2: 2},\
+            wires: [{key: \"y\", value:\"ex_source\"}],\
+            options: [],\
+            priority: BACKGROUND\
+        },\
+    ],\
+    sources:\
+    [\
+        {\
+            name : \"ex_source\",\
+            target_id: {bits1 : 1, bits2 : 1},\
+            wires : [],\
+            options: []\
+        }\
+    ]\
+    }";
+  library_probe library_ex;
+
+  auto manager = library_ex.fsys_deserialize(json_str, true);
+  REQUIRE(manager.has_value());
+  auto real_manager = manager.value();
+  REQUIRE(library_ex.sources.size() == 1);
+
+  // Every frame misses the deadline of "plan", which runs first, so "log" is
+  // shed from the first frame on
+  for (int i = 0; i < 3; i++) library_ex.sources[0]->push_once();
+  REQUIRE(real_manager->get_edge_stats("plan")->deadline_misses == 3);
+  REQUIRE(real_manager->get_edge_stats("log")->shed == 3);
+  real_manager->stahp();
+  delete real_manager;
+}
+
+TEST_CASE("Deserializes replicated nodes", "[libs.json_replicas]") {
+  string json_str =
+      "{\
+    nodes:\
+    [\
+        {\
+            name: \"ex_node\",\
+            target_id: {bits1: 16570122415097137046, bits2: 12761028291507926795},\
+            wires: [{key: \"y\", value:\"ex_source\"}],\
+            options: [{name: \"test_string\", value: {type: INT, int_value: 5}}],\
+            replicas: 4\
+        },\
+    ],\
+    sources:\
+    [\
+        {\
+            name : \"ex_source\",\
+            target_id: {bits1 : 2473537575747866612, bits2 : 10560267256759610388},\
+            wires : [],\
+            options: [{name: \"cons_in\", value: {type: INT, int_value: 10}}]\
+        }\
+    ]\
+    }";
+  library_example library_ex;
+
+  if (auto manager = library_ex.fsys_deserialize(json_str); manager) {
+    auto real_manager = manager.value();
+    auto stats = real_manager->get_edge_stats("ex_node");
+    REQUIRE(stats.has_value());
+    REQUIRE(stats->replicas == 4);
+    delete real_manager;
+  } else {
+    REQUIRE(manager.has_value());
+  }
+}
+
+TEST_CASE("Deserializes forked nodes", "[libs.json_fork]") {
+  string json_str =
+      "{\
+    nodes:\
+    [\
+        {\
+            name: \"ex_node\",\
+            target_id: {bits1: 1, bits2: 3},\
+            wires: [{key: \"y\", value:\"ex_source\"}],\
+            options: [],\
+            residence: FORK\
+        },\
+    ],\
+    sources:\
+    [\
+        {\
+            name : \"ex_source\",\
+            target_id: {bits1 : 1, bits2 : 1},\
+            wires : [],\
+            options: []\
+        }\
+    ]\
+    }";
+  library_probe library_ex;
+
+  auto manager = library_ex.fsys_deserialize(json_str, true);
+  REQUIRE(manager.has_value());
+  auto real_manager = manager.value();
+  vector<int> pids;
+  function<unique_ptr<int>(const int *const)> fn_sink =
+      [&pids](const int *const _in) {
+        pids.push_back(*_in);
+        return nullptr;
+      };
+  REQUIRE(real_manager->add_node("sink", fn_call(fn_sink), "ex_node"));
+  REQUIRE(library_ex.sources.size() == 1);
+
+  for (int i = 0; i < 3; i++) library_ex.sources[0]->push_once();
+  REQUIRE(pids.size() == 3);
+  REQUIRE(pids[0] != getpid());
+  REQUIRE(pids[0] == pids[2]);
+  real_manager->stahp();
+  delete real_manager;
+}
+
 TEST_CASE("Serializes JSON", "[libs.json_serialize_success]") {
   flatbuffers::FlatBufferBuilder builder(1024);
   GUID_vals vals(11, 44);
@@ -213,3 +537,175 @@ TEST_CASE("Bad JSON", "[libs.json_bad_data]") {
   REQUIRE(manager_badkey.error() == fn_dag::JSON_PARSER_ERROR);
   REQUIRE(manager_badtype.error() == fn_dag::JSON_PARSER_ERROR);
 }
+
+TEST_CASE("Deserializes nodes listed before their parents",
+          "[libs.json_order]") {
+  string json_str =
+      "{\
+    nodes:\
+    [\
+        {\
+            name: \"c\",\
+            target_id: {bits1: 1, bits2: 2},\
+            wires: [{key: \"y\", value:\"b\"}],\
+            options: []\
+        },\
+        {\
+            name: \"b\",\
+            target_id: {bits1: 1, bits2: 2},\
+            wires: [{key: \"y\", value:\"a\"}],\
+            options: []\
+        },\
+        {\
+            name: \"a\",\
+            target_id: {bits1: 1, bits2: 2},\
+            wires: [{key: \"y\", value:\"ex_source\"}],\
+            options: []\
+        },\
+    ],\
+    sources:\
+    [\
+        {\
+            name : \"ex_source\",\
+            target_id: {bits1 : 2473537575747866612, bits2 : 10560267256759610388},\
+            wires : [],\
+            options: []\
+        }\
+    ]\
+    }";
+  library_relay library_ex;
+
+  auto manager = library_ex.fsys_deserialize(json_str);
+  REQUIRE(manager.has_value());
+  for (const string id : {"a", "b", "c"})
+    REQUIRE(manager.value()->manager_contains_id(id));
+  delete manager.value();
+}
+
+TEST_CASE("Names the nodes of bad wires", "[libs.json_bad_wires]") {
+  library_relay library_ex;
+  ostringstream log;
+
+  SECTION("A wire to nothing") {
+    string json_str =
+        "{\
+      nodes:\
+      [\
+          {\
+              name: \"a\",\
+              target_id: {bits1: 1, bits2: 2},\
+              wires: [{key: \"y\", value:\"nowhere\"}],\
+              options: []\
+          },\
+      ],\
+      sources:\
+      [\
+          {\
+              name : \"ex_source\",\
+              target_id: {bits1 : 2473537575747866612, bits2 : 10560267256759610388},\
+              wires : [],\
+              options: []\
+          }\
+      ]\
+      }";
+    auto manager = library_ex.fsys_deserialize(json_str, false, log);
+    REQUIRE(manager.error() == fn_dag::PARENT_NOT_FOUND);
+    REQUIRE(log.str().find("\"a\"") != string::npos);
+    REQUIRE(log.str().find("\"nowhere\"") != string::npos);
+  }
+
+  SECTION("Wires in a cycle") {
+    string json_str =
+        "{\
+      nodes:\
+      [\
+          {\
+              name: \"a\",\
+              target_id: {bits1: 1, bits2: 2},\
+              wires: [{key: \"y\", value:\"c\"}],\
+              options: []\
+          },\
+          {\
+              name: \"b\",\
+              target_id: {bits1: 1, bits2: 2},\
+              wires: [{key: \"y\", value:\"a\"}],\
+              options: []\
+          },\
+          {\
+              name: \"c\",\
+              target_id: {bits1: 1, bits2: 2},\
+              wires: [{key: \"y\", value:\"b\"}],\
+              options: []\
+          },\
+          {\
+              name: \"d\",\
+              target_id: {bits1: 1, bits2: 2},\
+              wires: [{key: \"y\", value:\"ex_source\"}],\
+              options: []\
+          },\
+      ],\
+      sources:\
+      [\
+          {\
+              name : \"ex_source\",\
+              target_id: {bits1 : 2473537575747866612, bits2 : 10560267256759610388},\
+              wires : [],\
+              options: []\
+          }\
+      ]\
+      }";
+    auto manager = library_ex.fsys_deserialize(json_str, false, log);
+    REQUIRE(manager.error() == fn_dag::SPEC_CYCLE);
+    for (const string name : {"\"a\"", "\"b\"", "\"c\""})
+      REQUIRE(log.str().find(name) != string::npos);
+    REQUIRE(log.str().find("\"d\"") == string::npos);
+  }
+}
+
+TEST_CASE("Deserializes on many threads at once", "[libs.json_threads]") {
+  string json_str =
+      "{\
+    nodes:\
+    [\
+        {\
+            name: \"b\",\
+            target_id: {bits1: 1, bits2: 2},\
+            wires: [{key: \"y\", value:\"a\"}],\
+            options: []\
+        },\
+        {\
+            name: \"a\",\
+            target_id: {bits1: 1, bits2: 2},\
+            wires: [{key: \"y\", value:\"src\"}],\
+            options: []\
+        },\
+    ],\
+    sources:\
+    [\
+        {\
+            name : \"src\",\
+            target_id: {bits1 : 1, bits2 : 1},\
+            wires : [],\
+            options: []\
+        }\
+    ]\
+    }";
+  library_relay library_ex;
+  constexpr int threads = 8;
+  constexpr int loads = 50;
+
+  // Catch2 assertions are not thread safe, so the threads only count
+  vector<int> loaded(threads, 0);
+  vector<thread> loaders;
+  for (int t = 0; t < threads; t++) {
+    loaders.emplace_back([&library_ex, &json_str, &loaded, t]() {
+      for (int i = 0; i < loads; i++) {
+        auto manager = library_ex.fsys_deserialize(json_str, true);
+        if (manager && manager.value()->manager_contains_id("b")) loaded[t]++;
+        if (manager) delete manager.value();
+      }
+    });
+  }
+  for (auto &loader : loaders) loader.join();
+  for (const int count : loaded) REQUIRE(count == loads);
+}